@@ -0,0 +1,30 @@
+-- Closure-heavy callbacks: higher-order functions taking fresh closures.
+
+function map(list, fn)
+    local result = {}
+    for i = 1, #list do
+        result[i] = fn(list[i])
+    end
+    return result
+end
+
+function reduce(list, fn, initial)
+    local accumulator = initial
+    for i = 1, #list do
+        accumulator = fn(accumulator, list[i])
+    end
+    return accumulator
+end
+
+function bench_closures()
+    local list = {}
+    for i = 1, 2000 do
+        list[i] = i
+    end
+    local total = 0
+    for offset = 1, 10 do
+        local mapped = map(list, function(x) return x + offset end)
+        total = total + reduce(mapped, function(a, b) return a + b end, 0)
+    end
+    return total
+end
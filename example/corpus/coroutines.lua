@@ -0,0 +1,37 @@
+-- Coroutine ping-pong: control passed back and forth between coroutines.
+
+function ping_pong(n)
+    local pong = coroutine.wrap(function(value)
+        while true do
+            value = coroutine.yield(value + 1)
+        end
+    end)
+    local value = 0
+    for _ = 1, n do
+        value = pong(value)
+    end
+    return value
+end
+
+function producer_consumer(n)
+    local producer = coroutine.create(function()
+        for i = 1, n do
+            coroutine.yield(i)
+        end
+    end)
+    local sum = 0
+    while true do
+        local _, value = coroutine.resume(producer)
+        if value == nil then break end
+        sum = sum + value
+    end
+    return sum
+end
+
+function bench_coroutine_ping_pong()
+    return ping_pong(10000)
+end
+
+function bench_coroutine_producer_consumer()
+    return producer_consumer(10000)
+end
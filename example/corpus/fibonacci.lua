@@ -0,0 +1,10 @@
+-- Recursive function calls: many short calls to a single Lua function.
+
+function fibonacci(x)
+    if x < 2 then return x end
+    return fibonacci(x - 2) + fibonacci(x - 1)
+end
+
+function bench_fibonacci()
+    return fibonacci(20)
+end
@@ -0,0 +1,35 @@
+-- Metamethod-heavy math: arithmetic on vectors through metatables.
+
+Vector = {}
+Vector.__index = Vector
+
+function Vector.new(x, y, z)
+    return setmetatable({x = x, y = y, z = z}, Vector)
+end
+
+function Vector.__add(a, b)
+    return Vector.new(a.x + b.x, a.y + b.y, a.z + b.z)
+end
+
+function Vector.__mul(a, s)
+    return Vector.new(a.x * s, a.y * s, a.z * s)
+end
+
+function Vector.__eq(a, b)
+    return a.x == b.x and a.y == b.y and a.z == b.z
+end
+
+function Vector:dot(other)
+    return self.x * other.x + self.y * other.y + self.z * other.z
+end
+
+function bench_vector_math()
+    local position = Vector.new(0, 0, 0)
+    local velocity = Vector.new(1, 2, 3)
+    local total = 0
+    for _ = 1, 5000 do
+        position = position + velocity * 0.5
+        total = total + position:dot(velocity)
+    end
+    return total
+end
@@ -0,0 +1,38 @@
+-- Deep module trees: calls passing through a chain of nested modules,
+-- and requiring the whole chain.
+
+local DEPTH = 8
+
+for level = 1, DEPTH do
+    package.preload["tree" .. level] = function()
+        local module = {}
+        if level < DEPTH then
+            module.child = require("tree" .. (level + 1))
+            function module.descend(x)
+                return module.child.descend(x + 1)
+            end
+        else
+            function module.descend(x)
+                return x
+            end
+        end
+        return module
+    end
+end
+
+tree = require("tree1")
+
+function bench_module_calls()
+    local total = 0
+    for i = 1, 2000 do
+        total = total + tree.descend(i)
+    end
+    return total
+end
+
+function bench_module_require()
+    for level = 1, DEPTH do
+        package.loaded["tree" .. level] = nil
+    end
+    return require("tree1")
+end
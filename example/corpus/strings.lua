@@ -0,0 +1,25 @@
+-- String building: concatenation, formatting, and buffers.
+
+function concatenate(n)
+    local s = ""
+    for i = 1, n do
+        s = s .. tostring(i) .. ","
+    end
+    return s
+end
+
+function format_lines(n)
+    local lines = {}
+    for i = 1, n do
+        lines[#lines + 1] = string.format("%05d: %s", i, string.rep("x", i % 16))
+    end
+    return table.concat(lines, "\n")
+end
+
+function bench_string_concatenation()
+    return concatenate(2000)
+end
+
+function bench_string_format()
+    return format_lines(2000)
+end
@@ -0,0 +1,33 @@
+-- Table churn: creating, filling, and discarding many small tables.
+
+function make_record(i)
+    return {id = i, name = "record" .. i, tags = {i, i + 1, i + 2}}
+end
+
+function churn(n)
+    local records = {}
+    for i = 1, n do
+        records[i] = make_record(i)
+    end
+    for i = 1, n, 2 do
+        records[i] = nil
+    end
+    local count = 0
+    for _, record in pairs(records) do
+        count = count + #record.tags
+    end
+    return count
+end
+
+function bench_table_churn()
+    return churn(5000)
+end
+
+function bench_table_sort()
+    local values = {}
+    for i = 1, 5000 do
+        values[i] = (i * 7919) % 5003
+    end
+    table.sort(values)
+    return values
+end
@@ -0,0 +1,315 @@
+/**
+ * @file BytecodeCache.cpp
+ *
+ * This module contains the implementation of the BytecodeCache class.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include "BytecodeCache.hpp"
+#include "MappedFile.hpp"
+
+#include <functional>
+#include <stdint.h>
+#include <stdio.h>
+#include <StringExtensions/StringExtensions.hpp>
+#include <SystemAbstractions/File.hpp>
+#include <thread>
+
+#ifdef _WIN32
+#include <process.h>
+#else /* not _WIN32 */
+#include <unistd.h>
+#endif /* _WIN32 or not _WIN32 */
+
+extern "C" {
+#include <lua.h>
+#include <lualib.h>
+#include <lauxlib.h>
+}
+
+namespace {
+
+    /**
+     * This is the initial value of the 64-bit FNV-1a hash.
+     */
+    constexpr uint64_t FNV_OFFSET_BASIS = 0xcbf29ce484222325ULL;
+
+    /**
+     * This is the multiplier used by the 64-bit FNV-1a hash.
+     */
+    constexpr uint64_t FNV_PRIME = 0x100000001b3ULL;
+
+    /**
+     * Continue computing a 64-bit FNV-1a hash over the given data.
+     *
+     * @param[in] hash
+     *     This is the hash of the data hashed so far.
+     *
+     * @param[in] data
+     *     This points to the data to hash.
+     *
+     * @param[in] size
+     *     This is the number of bytes of data to hash.
+     *
+     * @return
+     *     The hash of the data hashed so far, followed by the
+     *     given data, is returned.
+     */
+    uint64_t Fnv1a(uint64_t hash, const void* data, size_t size) {
+        const auto bytes = (const uint8_t*)data;
+        for (size_t i = 0; i < size; ++i) {
+            hash ^= bytes[i];
+            hash *= FNV_PRIME;
+        }
+        return hash;
+    }
+
+    /**
+     * This function is provided to lua_dump in order to collect
+     * the precompiled form of a chunk into a string.
+     *
+     * @param[in] lua
+     *     This points to the state of the Lua interpreter.
+     *
+     * @param[in] p
+     *     This points to the next piece of the precompiled chunk.
+     *
+     * @param[in] sz
+     *     This is the size of the next piece of the precompiled chunk.
+     *
+     * @param[in] ud
+     *     This points to the string in which to collect
+     *     the precompiled chunk.
+     *
+     * @return
+     *     Zero is returned to indicate success.
+     */
+    int LuaWriter(lua_State* lua, const void* p, size_t sz, void* ud) {
+        auto& bytecode = *(std::string*)ud;
+        (void)bytecode.append((const char*)p, sz);
+        return 0;
+    }
+
+}
+
+/**
+ * This contains the private properties of a BytecodeCache instance.
+ */
+struct BytecodeCache::Impl {
+    // Properties
+
+    /**
+     * This is the path to the directory in which to store
+     * precompiled chunks.
+     */
+    std::string directory;
+
+    // Methods
+
+    /**
+     * Compile the given chunk of Lua source code, and return its
+     * precompiled form, storing it in the cache.
+     *
+     * @param[in,out] lua
+     *     This is the state of the Lua interpreter to use.
+     *
+     * @param[in] name
+     *     This is the name of the chunk, used in Lua error messages.
+     *
+     * @param[in] source
+     *     This points to the Lua source code.
+     *
+     * @param[in] size
+     *     This is the size of the Lua source code, in bytes.
+     *
+     * @param[in] cachePath
+     *     This is the path of the file in which to store
+     *     the precompiled chunk.
+     *
+     * @param[out] bytecode
+     *     This is where to store the precompiled chunk.
+     *
+     * @return
+     *     The status code returned by lua_load is returned.  The compiled
+     *     function, or an error message, is left on the Lua stack.
+     */
+    int Compile(
+        lua_State* lua,
+        const std::string& name,
+        const char* source,
+        size_t size,
+        const std::string& cachePath,
+        std::string& bytecode
+    ) {
+        const auto status = luaL_loadbufferx(lua, source, size, ("=" + name).c_str(), "t");
+        if (status != LUA_OK) {
+            return status;
+        }
+        bytecode.clear();
+        (void)lua_dump(lua, LuaWriter, &bytecode, 0);
+        Store(cachePath, bytecode);
+        return LUA_OK;
+    }
+
+    /**
+     * Store the given precompiled chunk in the given file.  The file is
+     * written under a temporary name, unique to the calling process and
+     * thread, first and then renamed, so that other threads and programs
+     * using the cache never see a partially written file.
+     *
+     * @param[in] cachePath
+     *     This is the path of the file in which to store
+     *     the precompiled chunk.
+     *
+     * @param[in] bytecode
+     *     This is the precompiled chunk to store.
+     */
+    void Store(
+        const std::string& cachePath,
+        const std::string& bytecode
+    ) {
+        const auto temporaryPath = StringExtensions::sprintf(
+            "%s.%u.%zu.tmp",
+            cachePath.c_str(),
+#ifdef _WIN32
+            (unsigned int)_getpid(),
+#else /* not _WIN32 */
+            (unsigned int)getpid(),
+#endif /* _WIN32 or not _WIN32 */
+            std::hash< std::thread::id >()(std::this_thread::get_id())
+        );
+        const auto file = fopen(temporaryPath.c_str(), "wb");
+        if (file == NULL) {
+            return;
+        }
+        const auto written = fwrite(bytecode.data(), 1, bytecode.length(), file);
+        if (
+            (fclose(file) != 0)
+            || (written != bytecode.length())
+            || (rename(temporaryPath.c_str(), cachePath.c_str()) != 0)
+        ) {
+            (void)remove(temporaryPath.c_str());
+        }
+    }
+};
+
+BytecodeCache::~BytecodeCache() noexcept = default;
+
+BytecodeCache::BytecodeCache(BytecodeCache&& other) noexcept
+    : impl_(std::move(other.impl_))
+{
+}
+
+BytecodeCache& BytecodeCache::operator=(BytecodeCache&& other) noexcept {
+    if (this != &other) {
+        impl_ = std::move(other.impl_);
+    }
+    return *this;
+}
+
+BytecodeCache::BytecodeCache(const std::string& directory)
+    : impl_(new Impl())
+{
+    impl_->directory = directory;
+    (void)SystemAbstractions::File::CreateDirectory(directory);
+}
+
+std::string BytecodeCache::GetCachePath(
+    const std::string& name,
+    const char* source,
+    size_t size
+) const {
+    // Hash the name along with the source code, since the name is
+    // stored in the debug information of the precompiled chunk.
+    auto hash = Fnv1a(FNV_OFFSET_BASIS, name.data(), name.length() + 1);
+    hash = Fnv1a(hash, source, size);
+
+    // Precompiled chunks can only be loaded by interpreters with the same
+    // version and number format as the one which produced them.
+    return StringExtensions::sprintf(
+        "%s/%016llx-%d-%u%u%u.luac",
+        impl_->directory.c_str(),
+        (unsigned long long)hash,
+        (int)LUA_VERSION_NUM,
+        (unsigned int)sizeof(lua_Integer),
+        (unsigned int)sizeof(lua_Number),
+        (unsigned int)sizeof(size_t)
+    );
+}
+
+int BytecodeCache::Load(
+    lua_State* lua,
+    const std::string& name,
+    const char* source,
+    size_t size
+) {
+    const auto cachePath = GetCachePath(name, source, size);
+    MappedFile cached;
+    if (
+        cached.Open(cachePath)
+        && (cached.GetSize() > 0)
+    ) {
+        if (
+            luaL_loadbufferx(
+                lua,
+                cached.GetData(),
+                cached.GetSize(),
+                ("=" + name).c_str(),
+                "b"
+            ) == LUA_OK
+        ) {
+            return LUA_OK;
+        }
+
+        // The cached chunk is unusable (for example, it was truncated),
+        // so discard the error and compile the source code again.
+        lua_pop(lua, 1);
+    }
+    std::string bytecode;
+    return impl_->Compile(lua, name, source, size, cachePath, bytecode);
+}
+
+bool BytecodeCache::GetBytecode(
+    lua_State* lua,
+    const std::string& name,
+    const char* source,
+    size_t size,
+    std::string& bytecode,
+    std::string& errorMessage
+) {
+    const auto cachePath = GetCachePath(name, source, size);
+    MappedFile cached;
+    if (
+        cached.Open(cachePath)
+        && (cached.GetSize() > 0)
+    ) {
+        // Make sure the cached chunk can be loaded, as Load does,
+        // before handing it out.
+        const auto status = luaL_loadbufferx(
+            lua,
+            cached.GetData(),
+            cached.GetSize(),
+            ("=" + name).c_str(),
+            "b"
+        );
+        lua_pop(lua, 1);
+        if (status == LUA_OK) {
+            bytecode.assign(cached.GetData(), cached.GetSize());
+            return true;
+        }
+
+        // The cached chunk is unusable (for example, it was truncated),
+        // so compile the source code again.
+    }
+    const auto status = impl_->Compile(lua, name, source, size, cachePath, bytecode);
+    if (status != LUA_OK) {
+        if (lua_isstring(lua, -1)) {
+            errorMessage = lua_tostring(lua, -1);
+        } else {
+            errorMessage = StringExtensions::sprintf("(unexpected lua_load result: %d)", status);
+        }
+    }
+    lua_pop(lua, 1);
+    return (status == LUA_OK);
+}
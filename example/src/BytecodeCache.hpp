@@ -0,0 +1,149 @@
+#pragma once
+
+/**
+ * @file BytecodeCache.hpp
+ *
+ * This module declares the BytecodeCache class.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include <memory>
+#include <stddef.h>
+#include <string>
+
+struct lua_State;
+
+/**
+ * This stores precompiled Lua chunks (the output of lua_dump) in files
+ * in a directory, keyed by a hash of the chunk name and source code and by
+ * the version and number format of the Lua interpreter, so that loading
+ * the same source again can skip parsing and compiling it.
+ */
+class BytecodeCache {
+    // Lifecycle management
+public:
+    ~BytecodeCache() noexcept;
+    BytecodeCache(const BytecodeCache&) = delete;
+    BytecodeCache(BytecodeCache&&) noexcept;
+    BytecodeCache& operator=(const BytecodeCache&) = delete;
+    BytecodeCache& operator=(BytecodeCache&&) noexcept;
+
+    // Public methods
+public:
+    /**
+     * This constructs the cache, storing files in the given directory,
+     * which is created if it doesn't exist.
+     *
+     * @param[in] directory
+     *     This is the path to the directory in which to store
+     *     precompiled chunks.
+     */
+    explicit BytecodeCache(const std::string& directory);
+
+    /**
+     * Return the path of the file in which the precompiled form of
+     * the given chunk of Lua source code is stored.
+     *
+     * @param[in] name
+     *     This is the name of the chunk, used in Lua error messages.
+     *
+     * @param[in] source
+     *     This points to the Lua source code.
+     *
+     * @param[in] size
+     *     This is the size of the Lua source code, in bytes.
+     *
+     * @return
+     *     The path of the file in which the precompiled chunk
+     *     is stored is returned.
+     */
+    std::string GetCachePath(
+        const std::string& name,
+        const char* source,
+        size_t size
+    ) const;
+
+    /**
+     * Push onto the Lua stack the given chunk of Lua source code,
+     * compiled as a Lua function, in the same way as lua_load.
+     * The precompiled form of the chunk is loaded from the cache if
+     * it's there.  Otherwise the source code is compiled and the
+     * result is stored in the cache.
+     *
+     * @param[in,out] lua
+     *     This is the state of the Lua interpreter to use.
+     *
+     * @param[in] name
+     *     This is the name of the chunk, used in Lua error messages.
+     *
+     * @param[in] source
+     *     This points to the Lua source code.
+     *
+     * @param[in] size
+     *     This is the size of the Lua source code, in bytes.
+     *
+     * @return
+     *     The status code returned by lua_load is returned.  If it's
+     *     not LUA_OK, an error message was pushed onto the Lua stack
+     *     instead of the function.
+     */
+    int Load(
+        lua_State* lua,
+        const std::string& name,
+        const char* source,
+        size_t size
+    );
+
+    /**
+     * Return the precompiled form of the given chunk of Lua source code,
+     * compiling it and storing the result in the cache if it isn't in
+     * the cache already, or if the cached form can't be loaded.
+     *
+     * @param[in,out] lua
+     *     This is the state of the Lua interpreter to use
+     *     to compile the chunk.
+     *
+     * @param[in] name
+     *     This is the name of the chunk, used in Lua error messages.
+     *
+     * @param[in] source
+     *     This points to the Lua source code.
+     *
+     * @param[in] size
+     *     This is the size of the Lua source code, in bytes.
+     *
+     * @param[out] bytecode
+     *     This is where to store the precompiled chunk.
+     *
+     * @param[out] errorMessage
+     *     This is where to store the error message from Lua,
+     *     if the chunk couldn't be compiled.
+     *
+     * @return
+     *     An indication of whether or not the precompiled form
+     *     of the chunk was obtained is returned.
+     */
+    bool GetBytecode(
+        lua_State* lua,
+        const std::string& name,
+        const char* source,
+        size_t size,
+        std::string& bytecode,
+        std::string& errorMessage
+    );
+
+    // Private properties
+private:
+    /**
+     * This is the type of structure that contains the private
+     * properties of the instance.  It is defined in the implementation
+     * and declared here to ensure that it is scoped inside the class.
+     */
+    struct Impl;
+
+    /**
+     * This contains the private properties of the instance.
+     */
+    std::unique_ptr< Impl > impl_;
+};
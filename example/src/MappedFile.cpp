@@ -0,0 +1,184 @@
+/**
+ * @file MappedFile.cpp
+ *
+ * This module contains the implementation of the MappedFile class.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include "MappedFile.hpp"
+
+#include <stdint.h>
+#include <SystemAbstractions/File.hpp>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif /* not _WIN32 */
+
+/**
+ * This contains the private properties of a MappedFile instance.
+ */
+struct MappedFile::Impl {
+    // Properties
+
+    /**
+     * This points to the contents of the file.
+     */
+    const char* data = nullptr;
+
+    /**
+     * This is the size of the file, in bytes.
+     */
+    size_t size = 0;
+
+    /**
+     * This indicates whether or not the contents of the file are
+     * mapped into memory, rather than read into the buffer.
+     */
+    bool mapped = false;
+
+    /**
+     * If the contents of the file couldn't be mapped into memory,
+     * this holds a copy of them instead.
+     */
+    std::vector< uint8_t > buffer;
+
+    // Lifecycle management
+
+    ~Impl() noexcept {
+        Close();
+    }
+    Impl(const Impl&) = delete;
+    Impl(Impl&&) noexcept = delete;
+    Impl& operator=(const Impl&) = delete;
+    Impl& operator=(Impl&&) noexcept = delete;
+
+    // Methods
+
+    /**
+     * This is the default constructor for the structure.
+     */
+    Impl() = default;
+
+    /**
+     * Release the contents of any file opened.
+     */
+    void Close() {
+#ifndef _WIN32
+        if (mapped) {
+            (void)munmap((void*)data, size);
+        }
+#endif /* not _WIN32 */
+        mapped = false;
+        data = nullptr;
+        size = 0;
+        buffer.clear();
+        buffer.shrink_to_fit();
+    }
+
+    /**
+     * Map the contents of the file with the given path into memory.
+     *
+     * @param[in] path
+     *     This is the path of the file to map.
+     *
+     * @return
+     *     An indication of whether or not the file was mapped
+     *     is returned.
+     */
+    bool Map(const std::string& path) {
+#ifdef _WIN32
+        return false;
+#else /* not _WIN32 */
+        const auto fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat status;
+        if (fstat(fd, &status) != 0) {
+            (void)close(fd);
+            return false;
+        }
+        size = (size_t)status.st_size;
+        if (size == 0) {
+            // Empty files can't be mapped, but there's nothing
+            // to map anyway.
+            (void)close(fd);
+            return true;
+        }
+        const auto address = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        (void)close(fd);
+        if (address == MAP_FAILED) {
+            size = 0;
+            return false;
+        }
+        data = (const char*)address;
+        mapped = true;
+        return true;
+#endif /* _WIN32 */
+    }
+
+    /**
+     * Read the contents of the file with the given path into memory.
+     *
+     * @param[in] path
+     *     This is the path of the file to read.
+     *
+     * @return
+     *     An indication of whether or not the file was read
+     *     is returned.
+     */
+    bool Read(const std::string& path) {
+        SystemAbstractions::File file(path);
+        if (!file.OpenReadOnly()) {
+            return false;
+        }
+        buffer.resize((size_t)file.GetSize());
+        if (file.Read(buffer) != buffer.size()) {
+            buffer.clear();
+            return false;
+        }
+        data = (const char*)buffer.data();
+        size = buffer.size();
+        return true;
+    }
+};
+
+MappedFile::~MappedFile() noexcept = default;
+
+MappedFile::MappedFile(MappedFile&& other) noexcept
+    : impl_(std::move(other.impl_))
+{
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept {
+    if (this != &other) {
+        impl_ = std::move(other.impl_);
+    }
+    return *this;
+}
+
+MappedFile::MappedFile()
+    : impl_(new Impl())
+{
+}
+
+bool MappedFile::Open(const std::string& path) {
+    impl_->Close();
+    return (
+        impl_->Map(path)
+        || impl_->Read(path)
+    );
+}
+
+const char* MappedFile::GetData() const {
+    return impl_->data;
+}
+
+size_t MappedFile::GetSize() const {
+    return impl_->size;
+}
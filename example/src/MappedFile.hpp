@@ -0,0 +1,80 @@
+#pragma once
+
+/**
+ * @file MappedFile.hpp
+ *
+ * This module declares the MappedFile class.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include <memory>
+#include <stddef.h>
+#include <string>
+
+/**
+ * This provides read-only access to the contents of a file, mapped into
+ * memory where the operating system supports it, so that the contents
+ * don't need to be copied before they are used.  Where mapping isn't
+ * supported or fails, the contents are read into memory instead.
+ */
+class MappedFile {
+    // Lifecycle management
+public:
+    ~MappedFile() noexcept;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile(MappedFile&&) noexcept;
+    MappedFile& operator=(const MappedFile&) = delete;
+    MappedFile& operator=(MappedFile&&) noexcept;
+
+    // Public methods
+public:
+    /**
+     * This is the default constructor for the class.
+     */
+    MappedFile();
+
+    /**
+     * Open the file with the given path and make its contents available,
+     * releasing the contents of any file opened before.
+     *
+     * @param[in] path
+     *     This is the path of the file to open.
+     *
+     * @return
+     *     An indication of whether or not the file was opened
+     *     is returned.
+     */
+    bool Open(const std::string& path);
+
+    /**
+     * Return a pointer to the contents of the file.
+     *
+     * @return
+     *     A pointer to the contents of the file is returned.  This is
+     *     nullptr if no file is open or the file is empty.
+     */
+    const char* GetData() const;
+
+    /**
+     * Return the size of the file.
+     *
+     * @return
+     *     The size of the file, in bytes, is returned.
+     */
+    size_t GetSize() const;
+
+    // Private properties
+private:
+    /**
+     * This is the type of structure that contains the private
+     * properties of the instance.  It is defined in the implementation
+     * and declared here to ensure that it is scoped inside the class.
+     */
+    struct Impl;
+
+    /**
+     * This contains the private properties of the instance.
+     */
+    std::unique_ptr< Impl > impl_;
+};
@@ -0,0 +1,139 @@
+/**
+ * @file Stability.cpp
+ *
+ * This module contains the implementation of the functions which prepare
+ * the process for stable benchmark measurements and check for sources
+ * of measurement noise.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include "Stability.hpp"
+
+#include <fstream>
+#include <StringExtensions/StringExtensions.hpp>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#endif /* __linux__ */
+
+#ifdef __linux__
+namespace {
+
+    /**
+     * This is the niceness the process asks for when raising its
+     * scheduling priority.
+     */
+    constexpr int STABLE_NICENESS = -10;
+
+    /**
+     * Read the first line of the given file, with surrounding
+     * whitespace removed.
+     *
+     * @param[in] path
+     *     This is the path of the file to read.
+     *
+     * @param[out] value
+     *     This is where to store the line read.
+     *
+     * @return
+     *     An indication of whether or not the file could be read
+     *     is returned.
+     */
+    bool ReadFirstLine(const std::string& path, std::string& value) {
+        std::ifstream file(path);
+        if (!file) {
+            return false;
+        }
+        std::string line;
+        if (!std::getline(file, line)) {
+            return false;
+        }
+        value = StringExtensions::Trim(line);
+        return true;
+    }
+
+    /**
+     * Check the CPU frequency scaling settings exposed through sysfs,
+     * adding a warning for each one likely to add noise to measurements.
+     *
+     * @param[in] cpu
+     *     This is the index of the CPU whose frequency governor to check,
+     *     or -1 to check the first CPU.
+     *
+     * @param[in,out] warnings
+     *     This is where to add warnings.
+     */
+    void CheckCpuFrequencyScaling(int cpu, std::vector< std::string >& warnings) {
+        const auto cpuPath = StringExtensions::sprintf(
+            "/sys/devices/system/cpu/cpu%d/cpufreq/scaling_governor",
+            ((cpu < 0) ? 0 : cpu)
+        );
+        std::string value;
+        if (ReadFirstLine(cpuPath, value)) {
+            if (value != "performance") {
+                warnings.push_back(
+                    StringExtensions::sprintf(
+                        "CPU frequency governor is \"%s\" rather than \"performance\" (%s)",
+                        value.c_str(),
+                        cpuPath.c_str()
+                    )
+                );
+            }
+        }
+        if (
+            ReadFirstLine("/sys/devices/system/cpu/intel_pstate/no_turbo", value)
+            && (value == "0")
+        ) {
+            warnings.push_back("Turbo boost is enabled (/sys/devices/system/cpu/intel_pstate/no_turbo is 0)");
+        }
+        if (
+            ReadFirstLine("/sys/devices/system/cpu/cpufreq/boost", value)
+            && (value == "1")
+        ) {
+            warnings.push_back("CPU boost is enabled (/sys/devices/system/cpu/cpufreq/boost is 1)");
+        }
+    }
+
+}
+#endif /* __linux__ */
+
+StabilityInformation PrepareForStableMeasurements() {
+    StabilityInformation information;
+#ifdef __linux__
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (pthread_getaffinity_np(pthread_self(), sizeof(allowed), &allowed) == 0) {
+        for (int cpu = CPU_SETSIZE - 1; cpu >= 0; --cpu) {
+            if (CPU_ISSET(cpu, &allowed)) {
+                information.cpu = cpu;
+                break;
+            }
+        }
+    }
+    if (information.cpu >= 0) {
+        cpu_set_t pinned;
+        CPU_ZERO(&pinned);
+        CPU_SET(information.cpu, &pinned);
+        information.pinned = (pthread_setaffinity_np(pthread_self(), sizeof(pinned), &pinned) == 0);
+    }
+    if (!information.pinned) {
+        information.cpu = -1;
+        information.warnings.push_back("Unable to pin the benchmark thread to a CPU");
+    }
+    information.priorityRaised = (setpriority(PRIO_PROCESS, 0, STABLE_NICENESS) == 0);
+    if (!information.priorityRaised) {
+        information.warnings.push_back(
+            "Unable to raise scheduling priority (insufficient permissions?)"
+        );
+    }
+    CheckCpuFrequencyScaling(information.cpu, information.warnings);
+#else /* not __linux__ */
+    information.warnings.push_back(
+        "CPU pinning, priority and frequency scaling checks are not supported on this platform"
+    );
+#endif /* __linux__ or not __linux__ */
+    return information;
+}
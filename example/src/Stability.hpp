@@ -0,0 +1,58 @@
+#pragma once
+
+/**
+ * @file Stability.hpp
+ *
+ * This module declares functions which prepare the process for stable
+ * benchmark measurements and check for sources of measurement noise.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include <string>
+#include <vector>
+
+/**
+ * This holds the outcome of preparing the process for stable
+ * benchmark measurements.
+ */
+struct StabilityInformation {
+    /**
+     * This indicates whether or not the calling thread
+     * was pinned to a single CPU.
+     */
+    bool pinned = false;
+
+    /**
+     * If the calling thread was pinned to a single CPU,
+     * this is the index of that CPU.
+     */
+    int cpu = -1;
+
+    /**
+     * This indicates whether or not the scheduling priority
+     * of the process was raised.
+     */
+    bool priorityRaised = false;
+
+    /**
+     * These are warnings about conditions found which are likely
+     * to add noise to measurements, such as CPU frequency scaling.
+     */
+    std::vector< std::string > warnings;
+};
+
+/**
+ * Prepare the process for stable benchmark measurements, as far as the
+ * operating system and the permissions of the process allow.
+ *
+ * - Pin the calling thread to the last CPU it's allowed to run on
+ *   (the first CPU tends to handle more of the system's interrupts).
+ * - Raise the scheduling priority of the process.
+ * - Check whether CPU frequency scaling or turbo boost
+ *   appear to be active, and warn about it if so.
+ *
+ * @return
+ *     The outcome of preparing the process is returned.
+ */
+StabilityInformation PrepareForStableMeasurements();
@@ -9,3 +9,7 @@ function main()
         print("fibonacci(" .. x .. ") = " .. fibonacci(x))
     end
 end
+
+function bench_fibonacci()
+    fibonacci(15)
+end
@@ -7,14 +7,30 @@
  * © 2019 by Richard Walters
  */
 
+#include "BytecodeCache.hpp"
+#include "MappedFile.hpp"
+#include "Stability.hpp"
+
+#include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <math.h>
 #include <memory>
+#include <MoonClock/Callgrind.hpp>
+#include <MoonClock/Dot.hpp>
+#include <MoonClock/Html.hpp>
 #include <MoonClock/MoonClock.hpp>
+#include <MoonClock/PoolAllocator.hpp>
+#include <MoonClock/Pprof.hpp>
+#include <mutex>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <StringExtensions/StringExtensions.hpp>
-#include <SystemAbstractions/File.hpp>
 #include <SystemAbstractions/Time.hpp>
+#include <thread>
+#include <vector>
 
 extern "C" {
 #include <lua.h>
@@ -32,15 +48,97 @@ namespace {
         fprintf(
             stderr,
             (
-                "Usage: MoonClockTest SCRIPT FUNCTION\n"
+                "Usage: MoonClockTest [--startup] [--bytecode-cache DIR] [--allocator A]\n"
+                "                     [--jobs N] [--iterations N] [--gc-sweep]\n"
+                "                     [--pprof FILE] [--callgrind FILE] [--dot FILE]\n"
+                "                     [--html FILE] [--publish NAME]\n"
+                "                     SCRIPT [FUNCTION]\n"
+                "       MoonClockTest --bench [--bench-prefix PREFIX] [--warmup N]\n"
+                "                     [--repetitions N] [--overhead] [--stable]\n"
+                "                     [--bytecode-cache DIR] [--allocator A]\n"
+                "                     SCRIPT...\n"
                 "\n"
                 "Load a given Lua SCRIPT, instrument its functions, call\n"
                 "the given FUNCTION, and print out a report on performance\n"
                 "metrics associated with all Lua functions found.\n"
                 "\n"
-                "SCRIPT    Path to file containing Lua functions to execute.\n"
+                "SCRIPT     Path to file containing Lua functions to execute.\n"
+                "\n"
+                "FUNCTION   Name of the Lua function to call.  This is\n"
+                "           optional if --startup is given.\n"
+                "\n"
+                "--startup  Start instrumentation before loading SCRIPT,\n"
+                "           and report the time taken to compile it and\n"
+                "           execute its top level, along with the functions\n"
+                "           it called while doing so.\n"
+                "\n"
+                "--bytecode-cache DIR\n"
+                "           Store SCRIPT in precompiled form in the directory\n"
+                "           DIR, and load it from there on later runs,\n"
+                "           rather than compiling it every time.\n"
+                "\n"
+                "--jobs N   Run N independent Lua interpreters, each on its\n"
+                "           own thread, loading SCRIPT and calling FUNCTION\n"
+                "           concurrently.  Report the throughput of each\n"
+                "           and in aggregate, and combine their reports.\n"
+                "\n"
+                "--iterations N\n"
+                "           Call FUNCTION N times (in each interpreter)\n"
+                "           rather than once.\n"
+                "\n"
+                "--bench    Load each SCRIPT, find every global function\n"
+                "           whose name starts with PREFIX (\"bench_\" by\n"
+                "           default), and call each one N times (10 by\n"
+                "           default, set by --repetitions) after calling it\n"
+                "           N times (1 by default, set by --warmup) without\n"
+                "           instrumentation.  Report statistics of the time\n"
+                "           taken by each benchmark call, and a breakdown of\n"
+                "           the functions each benchmark called.\n"
+                "\n"
+                "--overhead In benchmark mode, also call each benchmark N\n"
+                "           times without instrumentation, and report how\n"
+                "           much slower the instrumented calls were.\n"
                 "\n"
-                "FUNCTION  Name of the Lua function to call.\n"
+                "--stable   In benchmark mode, pin the benchmark thread to\n"
+                "           one CPU, raise the scheduling priority if\n"
+                "           permitted, warn if CPU frequency scaling or turbo\n"
+                "           boost appear active, and measure the noise floor\n"
+                "           of the machine with a fixed calibration workload,\n"
+                "           reporting it alongside the results.\n"
+                "\n"
+                "--allocator pool|system\n"
+                "           Select the memory allocator used by the Lua\n"
+                "           interpreters: \"pool\" for size-class pools\n"
+                "           (MoonClock::PoolAllocator), or \"system\" for\n"
+                "           the C library's allocator (the default).\n"
+                "\n"
+                "--pprof FILE\n"
+                "           Collect the call tree, and write the report to\n"
+                "           FILE as a profile for the pprof tools.\n"
+                "\n"
+                "--callgrind FILE\n"
+                "           Write the report to FILE as a profile in the\n"
+                "           Callgrind format, for KCachegrind or QCachegrind.\n"
+                "\n"
+                "--dot FILE\n"
+                "           Write the call graph of the report to FILE in the\n"
+                "           DOT language, for rendering with Graphviz.\n"
+                "\n"
+                "--html FILE\n"
+                "           Collect the call tree and latency histograms, and\n"
+                "           write the report to FILE as an interactive web page.\n"
+                "\n"
+                "--publish NAME\n"
+                "           Publish live statistics in the POSIX shared memory\n"
+                "           segment NAME while FUNCTION runs, for watching\n"
+                "           with moonclock-top.\n"
+                "\n"
+                "--gc-sweep Call FUNCTION N times (set by --iterations) in\n"
+                "           a fresh interpreter for each of a grid of garbage\n"
+                "           collector settings, and report the wall time,\n"
+                "           estimated garbage collection time, and peak memory\n"
+                "           for each, marking the Pareto-optimal settings.\n"
+                "           FUNCTION isn't instrumented during the sweep.\n"
             )
         );
     }
@@ -59,8 +157,145 @@ namespace {
          * This is the name of the Lua function to call.
          */
         std::string functionName;
+
+        /**
+         * This indicates whether or not to profile the loading
+         * of the script, as well as the call of the function.
+         */
+        bool startup = false;
+
+        /**
+         * If not empty, this is the path to the directory in which
+         * to cache the script in precompiled form.
+         */
+        std::string bytecodeCacheDirectory;
+
+        /**
+         * If not zero, this is the number of Lua interpreters to run
+         * concurrently, each on its own thread.
+         */
+        size_t jobs = 0;
+
+        /**
+         * This is the number of times to call the Lua function
+         * in each Lua interpreter.
+         */
+        size_t iterations = 1;
+
+        /**
+         * This indicates whether or not to discover and run benchmarks
+         * in the scripts, rather than calling a single function.
+         */
+        bool bench = false;
+
+        /**
+         * In benchmark mode, these are the paths to the files containing
+         * the benchmarks to run.
+         */
+        std::vector< std::string > scriptPaths;
+
+        /**
+         * In benchmark mode, this is the prefix of the names of
+         * the global functions which are benchmarks.
+         */
+        std::string benchPrefix = "bench_";
+
+        /**
+         * In benchmark mode, this is the number of times to call each
+         * benchmark, without instrumentation, before measuring it.
+         */
+        size_t warmup = 1;
+
+        /**
+         * In benchmark mode, this is the number of times to call
+         * each benchmark while measuring it.
+         */
+        size_t repetitions = 10;
+
+        /**
+         * In benchmark mode, this indicates whether or not to also measure
+         * each benchmark without instrumentation, in order to report the
+         * overhead of the instrumentation.
+         */
+        bool overhead = false;
+
+        /**
+         * In benchmark mode, this indicates whether or not to prepare the
+         * process for stable measurements and measure the noise floor.
+         */
+        bool stable = false;
+
+        /**
+         * This indicates whether or not the Lua interpreters should use
+         * MoonClock::PoolAllocator, rather than the C library's allocator.
+         */
+        bool poolAllocator = false;
+
+        /**
+         * This indicates whether or not to call the Lua function under
+         * a range of garbage collector settings, rather than once.
+         */
+        bool gcSweep = false;
+
+        /**
+         * If not empty, this is the path to the file to which to write
+         * the report as a profile for the pprof tools.
+         */
+        std::string pprofPath;
+
+        /**
+         * If not empty, this is the path to the file to which to write
+         * the report as a profile in the Callgrind format.
+         */
+        std::string callgrindPath;
+
+        /**
+         * If not empty, this is the path to the file to which to write
+         * the call graph of the report in the DOT language.
+         */
+        std::string dotPath;
+
+        /**
+         * If not empty, this is the path to the file to which to write
+         * the report as an interactive web page.
+         */
+        std::string htmlPath;
+
+        /**
+         * If not empty, this is the name of the shared memory segment
+         * in which to publish live statistics.
+         */
+        std::string publishName;
     };
 
+    /**
+     * This function parses the given command-line argument
+     * as a non-negative integer.
+     *
+     * @param[in] arg
+     *     This is the command-line argument to parse.
+     *
+     * @param[in] minimum
+     *     This is the smallest value allowed.
+     *
+     * @param[out] value
+     *     This is where to store the value parsed.
+     *
+     * @return
+     *     An indication of whether or not the argument is an
+     *     integer no smaller than the minimum is returned.
+     */
+    bool ParseInteger(const std::string& arg, size_t minimum, size_t& value) {
+        if (
+            arg.empty()
+            || (arg.find_first_not_of("0123456789") != std::string::npos)
+        ) {
+            return false;
+        }
+        value = (size_t)strtoull(arg.c_str(), NULL, 10);
+        return (value >= minimum);
+    }
+
     /**
      * This function updates the program environment to incorporate
      * any applicable command-line arguments.
@@ -82,43 +317,247 @@ namespace {
         char* argv[],
         Environment& environment
     ) {
-        size_t state = 0;
+        const std::map< std::string, std::pair< size_t*, size_t > > integerOptions{
+            {"--jobs", {&environment.jobs, 1}},
+            {"--iterations", {&environment.iterations, 1}},
+            {"--warmup", {&environment.warmup, 0}},
+            {"--repetitions", {&environment.repetitions, 1}},
+        };
+        std::vector< std::string > positionalArgs;
         for (int i = 1; i < argc; ++i) {
             const std::string arg(argv[i]);
-            switch (state) {
-                case 0: { // SCRIPT
-                    environment.scriptPath = arg;
-                    state = 1;
-                } break;
-
-                case 1: { // FUNCTION
-                    environment.functionName = arg;
-                    state = 2;
-                } break;
-
-                case 2: { // extra argument
+            if (arg == "--startup") {
+                environment.startup = true;
+                continue;
+            }
+            if (arg == "--bench") {
+                environment.bench = true;
+                continue;
+            }
+            if (arg == "--overhead") {
+                environment.overhead = true;
+                continue;
+            }
+            if (arg == "--stable") {
+                environment.stable = true;
+                continue;
+            }
+            if (arg == "--gc-sweep") {
+                environment.gcSweep = true;
+                continue;
+            }
+            if (
+                (arg == "--bytecode-cache")
+                || (arg == "--bench-prefix")
+                || (arg == "--allocator")
+                || (arg == "--pprof")
+                || (arg == "--callgrind")
+                || (arg == "--dot")
+                || (arg == "--html")
+                || (arg == "--publish")
+            ) {
+                if (++i >= argc) {
+                    fprintf(
+                        stderr,
+                        "no value given for %s\n",
+                        arg.c_str()
+                    );
+                    return false;
+                }
+                if (arg == "--bytecode-cache") {
+                    environment.bytecodeCacheDirectory = argv[i];
+                } else if (arg == "--bench-prefix") {
+                    environment.benchPrefix = argv[i];
+                } else if (arg == "--pprof") {
+                    environment.pprofPath = argv[i];
+                } else if (arg == "--callgrind") {
+                    environment.callgrindPath = argv[i];
+                } else if (arg == "--dot") {
+                    environment.dotPath = argv[i];
+                } else if (arg == "--html") {
+                    environment.htmlPath = argv[i];
+                } else if (arg == "--publish") {
+                    environment.publishName = argv[i];
+                } else {
+                    const std::string allocator(argv[i]);
+                    if (allocator == "pool") {
+                        environment.poolAllocator = true;
+                    } else if (allocator == "system") {
+                        environment.poolAllocator = false;
+                    } else {
+                        fprintf(
+                            stderr,
+                            "unknown allocator '%s' given for --allocator\n",
+                            allocator.c_str()
+                        );
+                        return false;
+                    }
+                }
+                continue;
+            }
+            const auto integerOption = integerOptions.find(arg);
+            if (integerOption != integerOptions.end()) {
+                if (
+                    (++i >= argc)
+                    || !ParseInteger(
+                        argv[i],
+                        integerOption->second.second,
+                        *integerOption->second.first
+                    )
+                ) {
                     fprintf(
                         stderr,
-                        "extra arguments given\n"
+                        "no integer N >= %zu given for %s\n",
+                        integerOption->second.second,
+                        arg.c_str()
                     );
                     return false;
-                } break;
+                }
+                continue;
             }
+            positionalArgs.push_back(arg);
         }
-        if (state < 1) {
+        if (positionalArgs.empty()) {
             fprintf(
                 stderr,
                 "no SCRIPT given\n"
             );
             return false;
         }
-        if (state < 2) {
+        if (environment.bench) {
+            if (
+                environment.startup
+                || (environment.jobs > 0)
+                || environment.gcSweep
+            ) {
+                fprintf(
+                    stderr,
+                    "--bench can't be combined with --startup, --jobs, or --gc-sweep\n"
+                );
+                return false;
+            }
+            if (
+                !environment.pprofPath.empty()
+                || !environment.callgrindPath.empty()
+                || !environment.dotPath.empty()
+                || !environment.htmlPath.empty()
+                || !environment.publishName.empty()
+            ) {
+                fprintf(
+                    stderr,
+                    "--pprof, --callgrind, --dot, --html, and --publish can't be combined with --bench\n"
+                );
+                return false;
+            }
+            environment.scriptPaths = positionalArgs;
+            return true;
+        }
+        if (environment.stable) {
+            fprintf(
+                stderr,
+                "--stable can only be used with --bench\n"
+            );
+            return false;
+        }
+        if (
+            (
+                !environment.pprofPath.empty()
+                || !environment.callgrindPath.empty()
+                || !environment.dotPath.empty()
+                || !environment.htmlPath.empty()
+                || !environment.publishName.empty()
+            )
+            && (
+                (environment.jobs > 0)
+                || environment.gcSweep
+            )
+        ) {
+            fprintf(
+                stderr,
+                "--pprof, --callgrind, --dot, --html, and --publish can't be combined with --jobs or --gc-sweep\n"
+            );
+            return false;
+        }
+        if (positionalArgs.size() > 2) {
+            fprintf(
+                stderr,
+                "extra arguments given\n"
+            );
+            return false;
+        }
+        environment.scriptPath = positionalArgs[0];
+        if (positionalArgs.size() > 1) {
+            environment.functionName = positionalArgs[1];
+        }
+        if (
+            environment.functionName.empty()
+            && (
+                !environment.startup
+                || (environment.jobs > 0)
+                || environment.gcSweep
+            )
+        ) {
             fprintf(
                 stderr,
                 "no FUNCTION given\n"
             );
             return false;
         }
+        if (
+            environment.startup
+            && (environment.jobs > 0)
+        ) {
+            fprintf(
+                stderr,
+                "--startup can't be combined with --jobs\n"
+            );
+            return false;
+        }
+        if (
+            environment.gcSweep
+            && (
+                environment.startup
+                || (environment.jobs > 0)
+            )
+        ) {
+            fprintf(
+                stderr,
+                "--gc-sweep can't be combined with --startup or --jobs\n"
+            );
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * This function writes the given contents to the file at the given path,
+     * replacing anything already in the file.
+     *
+     * @param[in] path
+     *     This is the path of the file to write.
+     *
+     * @param[in] contents
+     *     This is what to write to the file.
+     *
+     * @return
+     *     An indication of whether or not the file was written
+     *     is returned.
+     */
+    bool WriteFile(const std::string& path, const std::string& contents) {
+        const auto file = fopen(path.c_str(), "wb");
+        if (file == NULL) {
+            fprintf(stderr, "Unable to open file '%s' for writing\n", path.c_str());
+            return false;
+        }
+        const auto written = fwrite(contents.data(), 1, contents.length(), file);
+        const auto closed = (fclose(file) == 0);
+        if (
+            (written != contents.length())
+            || !closed
+        ) {
+            fprintf(stderr, "Unable to write file '%s'\n", path.c_str());
+            return false;
+        }
         return true;
     }
 
@@ -160,9 +599,14 @@ namespace {
      */
     struct LuaReaderState {
         /**
-         * This is the code chunk to be read by the Lua interpreter.
+         * This points to the code chunk to be read by the Lua interpreter.
+         */
+        const char* chunk = nullptr;
+
+        /**
+         * This is the size of the code chunk, in bytes.
          */
-        const std::string* chunk = nullptr;
+        size_t size = 0;
 
         /**
          * This flag indicates whether or not the Lua interpreter
@@ -199,8 +643,8 @@ namespace {
             return NULL;
         } else {
             state->read = true;
-            *size = state->chunk->length();
-            return state->chunk->c_str();
+            *size = state->size;
+            return state->chunk;
         }
     }
 
@@ -231,44 +675,24 @@ namespace {
         return 1;
     }
 
-    /**
-     * This function loads the contents of the file with the given path.
-     *
-     * @param[in] filePath
-     *     This is the path of the file to load.
-     *
-     * @return
-     *     This file's contents are returned.  If the file could not be
-     *     read, an empty string is returned.
-     */
-    std::string LoadFile(const std::string& filePath) {
-        SystemAbstractions::File file(filePath);
-        if (!file.OpenReadOnly()) {
-            fprintf(stderr, "Unable to open file '%s'\n", filePath.c_str());
-            return "";
-        }
-        std::vector< uint8_t > fileContentsAsVector(file.GetSize());
-        if (file.Read(fileContentsAsVector) != fileContentsAsVector.size()) {
-            fprintf(stderr,"Unable to read file '%s'\n", filePath.c_str());
-            return "";
-        }
-        return std::string(
-            (const char*)fileContentsAsVector.data(),
-            fileContentsAsVector.size()
-        );
-    }
-
     bool LoadScript(
         lua_State* lua,
         const std::string& name,
-        const std::string& script
+        const MappedFile& script,
+        BytecodeCache* bytecodeCache
     ) {
         lua_settop(lua, 0);
         lua_pushcfunction(lua, LuaTraceback);
         LuaReaderState luaReaderState;
-        luaReaderState.chunk = &script;
+        luaReaderState.chunk = script.GetData();
+        luaReaderState.size = script.GetSize();
         std::string errorMessage;
-        switch (const int luaLoadResult = lua_load(lua, LuaReader, &luaReaderState, ("=" + name).c_str(), "t")) {
+        const int luaLoadResult = (
+            (bytecodeCache == nullptr)
+            ? lua_load(lua, LuaReader, &luaReaderState, ("=" + name).c_str(), "t")
+            : bytecodeCache->Load(lua, name, script.GetData(), script.GetSize())
+        );
+        switch (luaLoadResult) {
             case LUA_OK: {
                 const int luaPCallResult = lua_pcall(lua, 0, 0, 1);
                 if (luaPCallResult != LUA_OK) {
@@ -338,84 +762,1280 @@ namespace {
         }
     };
 
-}
-
-/**
- * This function is the entrypoint of the program.
- * It loads a Lua script, instruments it, calls a Lua function,
- * and finally prints out a report generated by the instrumentation.
- *
- * @param[in] argc
- *     This is the number of command-line arguments given to the program.
- *
- * @param[in] argv
- *     This is the array of command-line arguments given to the program.
- */
-int main(int argc, char* argv[]) {
-#ifdef _WIN32
-    //_crtBreakAlloc = 18;
-    _CrtSetDbgFlag(_CRTDBG_ALLOC_MEM_DF | _CRTDBG_LEAK_CHECK_DF);
-#endif /* _WIN32 */
-    Environment environment;
-    (void)setbuf(stdout, NULL);
-    if (!ProcessCommandLineArguments(argc, argv, environment)) {
-        PrintUsageInformation();
-        return EXIT_FAILURE;
-    }
-    std::shared_ptr< lua_State > lua(
-        lua_newstate(LuaAllocator, NULL),
-        [](lua_State* lua) {
-            lua_close(lua);
+    /**
+     * This function creates a new Lua interpreter with the standard
+     * Lua libraries opened.
+     *
+     * @param[in] poolAllocator
+     *     This indicates whether or not the interpreter should use
+     *     its own MoonClock::PoolAllocator, rather than the C library's
+     *     allocator.
+     *
+     * @return
+     *     The new Lua interpreter is returned.
+     */
+    std::shared_ptr< lua_State > NewLuaState(bool poolAllocator) {
+        std::shared_ptr< lua_State > lua;
+        if (poolAllocator) {
+            // The deleter holds onto the allocator, so that the allocator
+            // outlives the interpreter.
+            const auto allocator = std::make_shared< MoonClock::PoolAllocator >();
+            lua.reset(
+                allocator->NewState(),
+                [allocator](lua_State* lua) {
+                    lua_close(lua);
+                }
+            );
+        } else {
+            lua.reset(
+                lua_newstate(LuaAllocator, NULL),
+                [](lua_State* lua) {
+                    lua_close(lua);
+                }
+            );
         }
-    );
-    MoonClock::MoonClock moonClock;
-    const auto clock = std::make_shared< Clock >();
-    moonClock.SetClock(clock);
-    lua_gc(lua.get(), LUA_GCSTOP, 0);
-    luaL_openlibs(lua.get());
-    lua_gc(lua.get(), LUA_GCRESTART, 0);
-    const auto script = LoadFile(environment.scriptPath);
-    if (script.empty()) {
-        return EXIT_FAILURE;
-    }
-    if (!LoadScript(lua.get(), environment.scriptPath, script)) {
-        return EXIT_FAILURE;
+        lua_gc(lua.get(), LUA_GCSTOP, 0);
+        luaL_openlibs(lua.get());
+        lua_gc(lua.get(), LUA_GCRESTART, 0);
+        return lua;
     }
-    moonClock.StartInstrumentation(lua);
-    if (!Call(lua.get(), environment.functionName)) {
-        return EXIT_FAILURE;
+
+    /**
+     * This is used to hold back the threads running Lua interpreters
+     * concurrently until all of them are ready, so that they start
+     * calling the Lua function at the same time.
+     */
+    struct StartingGate {
+        /**
+         * This is used to synchronize access to the gate.
+         */
+        std::mutex mutex;
+
+        /**
+         * This is used to signal when the state of the gate changes.
+         */
+        std::condition_variable condition;
+
+        /**
+         * This is the number of threads which are ready to start.
+         */
+        size_t numReady = 0;
+
+        /**
+         * This indicates whether or not the gate is open.
+         */
+        bool open = false;
+    };
+
+    /**
+     * This holds the results from one of the Lua interpreters
+     * run concurrently.
+     */
+    struct JobResult {
+        /**
+         * This indicates whether or not the script was loaded and
+         * every call to the Lua function succeeded.
+         */
+        bool succeeded = false;
+
+        /**
+         * This is the number of times the Lua function was called.
+         */
+        size_t numCalls = 0;
+
+        /**
+         * This is the amount of time elapsed, in seconds,
+         * calling the Lua function.
+         */
+        double elapsed = 0.0;
+
+        /**
+         * This is the report generated by instrumenting the Lua function.
+         */
+        MoonClock::Report report;
+    };
+
+    /**
+     * This function runs a Lua interpreter of its own, loading the script
+     * and calling the Lua function, once all the other interpreters run
+     * concurrently have loaded the script as well.
+     *
+     * @param[in] environment
+     *     This holds the settings given on the command line.
+     *
+     * @param[in] script
+     *     This holds the script to load.
+     *
+     * @param[in] bytecodeCache
+     *     If not nullptr, this is the cache from which to load
+     *     the script in precompiled form.
+     *
+     * @param[in,out] gate
+     *     This is used to start calling the Lua function at the same
+     *     time as the other interpreters.
+     *
+     * @param[out] result
+     *     This is where to store the results.
+     */
+    void RunJob(
+        const Environment& environment,
+        const MappedFile& script,
+        BytecodeCache* bytecodeCache,
+        StartingGate& gate,
+        JobResult& result
+    ) {
+        const auto lua = NewLuaState(environment.poolAllocator);
+        MoonClock::MoonClock moonClock;
+        const auto clock = std::make_shared< Clock >();
+        moonClock.SetClock(clock);
+        const auto loaded = LoadScript(lua.get(), environment.scriptPath, script, bytecodeCache);
+        {
+            std::unique_lock< decltype(gate.mutex) > lock(gate.mutex);
+            ++gate.numReady;
+            gate.condition.notify_all();
+            gate.condition.wait(lock, [&gate]{ return gate.open; });
+        }
+        if (!loaded) {
+            return;
+        }
+        moonClock.StartInstrumentation(lua);
+        const auto start = clock->GetCurrentTime();
+        result.succeeded = true;
+        for (size_t i = 0; i < environment.iterations; ++i) {
+            if (!Call(lua.get(), environment.functionName)) {
+                result.succeeded = false;
+                break;
+            }
+            ++result.numCalls;
+        }
+        result.elapsed = clock->GetCurrentTime() - start;
+        moonClock.StopInstrumentation();
+        result.report = moonClock.GenerateReport();
     }
-    moonClock.StopInstrumentation();
-    const auto report = moonClock.GenerateReport();
-    printf("-----------------------------------------------------------------------------------------\n");
-    printf("Report:\n");
-    printf("-----------------------------------------------------------------------------------------\n");
-    printf(
-        "%-20s %7s  %14s %14s %14s %14s\n",
-        "FUNC", "#", "MIN", "MAX", "TOTAL", "AVG"
-    );
-    for (const auto& fn: report.functionInfo) {
+
+    /**
+     * This function prints out the given report.
+     *
+     * @param[in] report
+     *     This is the report to print.
+     */
+    void PrintReport(const MoonClock::Report& report) {
+        printf("-----------------------------------------------------------------------------------------\n");
+        printf("Report:\n");
+        printf("-----------------------------------------------------------------------------------------\n");
         printf(
-            "%-20s %7zu  %14.9lf %14.9lf %14.9lf %14.9lf\n",
-            StringExtensions::Join(fn.first, ".").c_str(),
-            fn.second.numCalls,
-            fn.second.minTime,
-            fn.second.maxTime,
-            fn.second.totalTime,
-            (fn.second.totalTime / fn.second.numCalls)
+            "%-20s %7s  %14s %14s %14s %14s\n",
+            "FUNC", "#", "MIN", "MAX", "TOTAL", "AVG"
         );
-        for (const auto& subfn: fn.second.calls) {
+        for (const auto& fn: report.functionInfo) {
+            printf(
+                "%-20s %7zu  %14.9lf %14.9lf %14.9lf %14.9lf\n",
+                StringExtensions::Join(fn.first, ".").c_str(),
+                fn.second.numCalls,
+                fn.second.minTime,
+                fn.second.maxTime,
+                fn.second.totalTime,
+                (fn.second.totalTime / fn.second.numCalls)
+            );
+            for (const auto& subfn: fn.second.calls) {
+                printf(
+                    "  %-18s %7zu  %14s %14s %14.9lf %14s\n",
+                    StringExtensions::Join(subfn.first, ".").c_str(),
+                    subfn.second.numCalls,
+                    "",
+                    "",
+                    subfn.second.totalTime,
+                    ""
+                );
+            }
+        }
+        printf("-----------------------------------------------------------------------------------------\n");
+        if (!report.chunkLoads.empty()) {
+            printf("Startup:\n");
+            printf("-----------------------------------------------------------------------------------------\n");
             printf(
-                "  %-18s %7zu  %14s %14s %14.9lf %14s\n",
-                StringExtensions::Join(subfn.first, ".").c_str(),
-                subfn.second.numCalls,
-                "",
-                "",
-                subfn.second.totalTime,
-                ""
+                "%-44s %14s %14s\n",
+                "SCRIPT", "COMPILE", "EXECUTE"
             );
+            for (const auto& chunkLoad: report.chunkLoads) {
+                printf(
+                    "%-44s %14.9lf %14.9lf\n",
+                    chunkLoad.name.c_str(),
+                    chunkLoad.compileTime,
+                    chunkLoad.executionTime
+                );
+            }
+            printf("-----------------------------------------------------------------------------------------\n");
         }
     }
-    printf("-----------------------------------------------------------------------------------------\n");
+
+    /**
+     * This function runs the given number of Lua interpreters concurrently,
+     * each on its own thread, and prints out the throughput of each,
+     * the aggregate throughput, and the combination of their reports.
+     *
+     * @param[in] environment
+     *     This holds the settings given on the command line.
+     *
+     * @param[in] script
+     *     This holds the script to load.
+     *
+     * @param[in] bytecodeCache
+     *     If not nullptr, this is the cache from which to load
+     *     the script in precompiled form.
+     *
+     * @return
+     *     An indication of whether or not every interpreter succeeded
+     *     is returned.
+     */
+    bool RunJobs(
+        const Environment& environment,
+        const MappedFile& script,
+        BytecodeCache* bytecodeCache
+    ) {
+        StartingGate gate;
+        std::vector< JobResult > results(environment.jobs);
+        std::vector< std::thread > threads;
+        threads.reserve(environment.jobs);
+        for (size_t i = 0; i < environment.jobs; ++i) {
+            threads.emplace_back(
+                RunJob,
+                std::cref(environment),
+                std::cref(script),
+                bytecodeCache,
+                std::ref(gate),
+                std::ref(results[i])
+            );
+        }
+        Clock clock;
+        double start;
+        {
+            std::unique_lock< decltype(gate.mutex) > lock(gate.mutex);
+            gate.condition.wait(lock, [&gate, &environment]{ return gate.numReady == environment.jobs; });
+            gate.open = true;
+            start = clock.GetCurrentTime();
+            gate.condition.notify_all();
+        }
+        for (auto& thread: threads) {
+            thread.join();
+        }
+        const auto elapsed = clock.GetCurrentTime() - start;
+        printf("-----------------------------------------------------------------------------------------\n");
+        printf("Throughput:\n");
+        printf("-----------------------------------------------------------------------------------------\n");
+        printf(
+            "%-20s %7s  %14s %14s\n",
+            "JOB", "#", "ELAPSED", "CALLS/SEC"
+        );
+        bool succeeded = true;
+        size_t numCalls = 0;
+        std::vector< MoonClock::Report > reports;
+        reports.reserve(results.size());
+        for (size_t i = 0; i < results.size(); ++i) {
+            const auto& result = results[i];
+            printf(
+                "%-20zu %7zu  %14.9lf %14.3lf%s\n",
+                i + 1,
+                result.numCalls,
+                result.elapsed,
+                ((result.elapsed > 0.0) ? (result.numCalls / result.elapsed) : 0.0),
+                (result.succeeded ? "" : "  (failed)")
+            );
+            succeeded = succeeded && result.succeeded;
+            numCalls += result.numCalls;
+            reports.push_back(result.report);
+        }
+        printf(
+            "%-20s %7zu  %14.9lf %14.3lf\n",
+            "(all)",
+            numCalls,
+            elapsed,
+            ((elapsed > 0.0) ? (numCalls / elapsed) : 0.0)
+        );
+        PrintReport(MoonClock::MergeReports(reports));
+        return succeeded;
+    }
+
+    /**
+     * This function returns the names of the global functions whose
+     * names start with the given prefix, in alphabetical order.
+     *
+     * @param[in] lua
+     *     This points to the state of the Lua interpreter.
+     *
+     * @param[in] prefix
+     *     This is the prefix of the names of the functions to find.
+     *
+     * @return
+     *     The names of the functions found are returned.
+     */
+    std::vector< std::string > FindBenchmarks(
+        lua_State* lua,
+        const std::string& prefix
+    ) {
+        std::vector< std::string > names;
+        lua_pushglobaltable(lua); // -1 = _G
+        lua_pushnil(lua); // -1 = nil, -2 = _G
+        while (lua_next(lua, -2) != 0) { // -1 = value, -2 = key, -3 = _G
+            if (
+                (lua_type(lua, -2) == LUA_TSTRING)
+                && lua_isfunction(lua, -1)
+            ) {
+                const std::string name(lua_tostring(lua, -2));
+                if (name.compare(0, prefix.length(), prefix) == 0) {
+                    names.push_back(name);
+                }
+            }
+            lua_pop(lua, 1); // -1 = key, -2 = _G
+        } // -1 = _G
+        lua_pop(lua, 1); // (stack empty)
+        std::sort(names.begin(), names.end());
+        return names;
+    }
+
+    /**
+     * This holds statistics about a set of measurements.
+     */
+    struct Statistics {
+        /**
+         * This is the smallest measurement.
+         */
+        double min = 0.0;
+
+        /**
+         * This is the median of the measurements.
+         */
+        double median = 0.0;
+
+        /**
+         * This is the mean of the measurements.
+         */
+        double mean = 0.0;
+
+        /**
+         * This is the largest measurement.
+         */
+        double max = 0.0;
+
+        /**
+         * This is the sample standard deviation of the measurements.
+         */
+        double stddev = 0.0;
+    };
+
+    /**
+     * This function computes statistics about the given measurements.
+     *
+     * @param[in] measurements
+     *     These are the measurements to summarize.
+     *
+     * @return
+     *     Statistics about the given measurements are returned.
+     */
+    Statistics ComputeStatistics(std::vector< double > measurements) {
+        Statistics statistics;
+        const auto n = measurements.size();
+        if (n == 0) {
+            return statistics;
+        }
+        std::sort(measurements.begin(), measurements.end());
+        statistics.min = measurements.front();
+        statistics.max = measurements.back();
+        statistics.median = (
+            ((n % 2) == 0)
+            ? ((measurements[n / 2 - 1] + measurements[n / 2]) / 2.0)
+            : measurements[n / 2]
+        );
+        double sum = 0.0;
+        for (const auto measurement: measurements) {
+            sum += measurement;
+        }
+        statistics.mean = sum / n;
+        if (n > 1) {
+            double sumOfSquares = 0.0;
+            for (const auto measurement: measurements) {
+                const auto deviation = measurement - statistics.mean;
+                sumOfSquares += deviation * deviation;
+            }
+            statistics.stddev = sqrt(sumOfSquares / (n - 1));
+        }
+        return statistics;
+    }
+
+    /**
+     * This holds the results of running one benchmark.
+     */
+    struct BenchmarkResult {
+        /**
+         * This is the path to the file containing the benchmark.
+         */
+        std::string scriptPath;
+
+        /**
+         * This is the name of the benchmark function.
+         */
+        std::string name;
+
+        /**
+         * This indicates whether or not every call to the benchmark
+         * function succeeded.
+         */
+        bool succeeded = false;
+
+        /**
+         * This holds the time taken, in seconds, by each measured call
+         * to the benchmark function.
+         */
+        std::vector< double > times;
+
+        /**
+         * If the overhead of instrumentation is measured, this holds
+         * the time taken, in seconds, by each call to the benchmark
+         * function made without instrumentation.
+         */
+        std::vector< double > uninstrumentedTimes;
+
+        /**
+         * This is the report generated by instrumenting the
+         * measured calls to the benchmark function.
+         */
+        MoonClock::Report report;
+    };
+
+    /**
+     * This function runs the given benchmark function.
+     *
+     * @param[in] environment
+     *     This holds the settings given on the command line.
+     *
+     * @param[in] lua
+     *     This is the Lua interpreter in which the benchmark was loaded.
+     *
+     * @param[in,out] result
+     *     This holds the script path and name of the benchmark on entry,
+     *     and is where to store the results.
+     */
+    void RunBenchmark(
+        const Environment& environment,
+        const std::shared_ptr< lua_State >& lua,
+        BenchmarkResult& result
+    ) {
+        for (size_t i = 0; i < environment.warmup; ++i) {
+            if (!Call(lua.get(), result.name)) {
+                return;
+            }
+        }
+        MoonClock::MoonClock moonClock;
+        const auto clock = std::make_shared< Clock >();
+        if (environment.overhead) {
+            for (size_t i = 0; i < environment.repetitions; ++i) {
+                const auto start = clock->GetCurrentTime();
+                if (!Call(lua.get(), result.name)) {
+                    return;
+                }
+                result.uninstrumentedTimes.push_back(clock->GetCurrentTime() - start);
+            }
+        }
+        moonClock.SetClock(clock);
+        moonClock.StartInstrumentation(lua);
+        result.succeeded = true;
+        for (size_t i = 0; i < environment.repetitions; ++i) {
+            const auto start = clock->GetCurrentTime();
+            if (!Call(lua.get(), result.name)) {
+                result.succeeded = false;
+                break;
+            }
+            result.times.push_back(clock->GetCurrentTime() - start);
+        }
+        moonClock.StopInstrumentation();
+        result.report = moonClock.GenerateReport();
+    }
+
+    /**
+     * This function prints out the breakdown of the time taken by the
+     * given benchmark among the functions it called, listing those
+     * taking the most time first.
+     *
+     * @param[in] result
+     *     These are the results of running the benchmark.
+     */
+    void PrintBenchmarkBreakdown(const BenchmarkResult& result) {
+        const auto benchmarkInfo = result.report.functionInfo.find({result.name});
+        if (benchmarkInfo == result.report.functionInfo.end()) {
+            return;
+        }
+        std::vector< std::pair< std::string, const MoonClock::FunctionInformation* > > functions;
+        for (const auto& fn: result.report.functionInfo) {
+            if (fn.first == benchmarkInfo->first) {
+                continue;
+            }
+            functions.emplace_back(StringExtensions::Join(fn.first, "."), &fn.second);
+        }
+        std::sort(
+            functions.begin(),
+            functions.end(),
+            [](
+                const std::pair< std::string, const MoonClock::FunctionInformation* >& lhs,
+                const std::pair< std::string, const MoonClock::FunctionInformation* >& rhs
+            ){
+                return lhs.second->totalTime > rhs.second->totalTime;
+            }
+        );
+        printf("%s (%s):\n", result.name.c_str(), result.scriptPath.c_str());
+        printf(
+            "  %-30s %9s  %14s %14s %7s\n",
+            "FUNC", "#", "TOTAL", "AVG", "%"
+        );
+        const auto benchmarkTime = benchmarkInfo->second.totalTime;
+        for (const auto& fn: functions) {
+            printf(
+                "  %-30s %9zu  %14.9lf %14.9lf %6.1lf%%\n",
+                fn.first.c_str(),
+                fn.second->numCalls,
+                fn.second->totalTime,
+                (fn.second->totalTime / fn.second->numCalls),
+                ((benchmarkTime > 0.0) ? (fn.second->totalTime / benchmarkTime * 100.0) : 0.0)
+            );
+        }
+    }
+
+    /**
+     * This is the Lua code of the fixed workload used to measure
+     * the noise floor of the machine.
+     */
+    constexpr const char* CALIBRATION_WORKLOAD = (
+        "function calibrate()\n"
+        "    local t = {}\n"
+        "    for i = 1, 100000 do\n"
+        "        t[i % 64 + 1] = i * 2\n"
+        "    end\n"
+        "end\n"
+    );
+
+    /**
+     * This is the smallest number of calls of the calibration workload
+     * made to measure the noise floor.
+     */
+    constexpr size_t MINIMUM_CALIBRATION_CALLS = 30;
+
+    /**
+     * This function measures the noise floor of the machine by timing
+     * repeated calls of a fixed calibration workload, without
+     * instrumentation.
+     *
+     * @param[in] environment
+     *     This holds the settings given on the command line.
+     *
+     * @return
+     *     The time taken, in seconds, by each measured call of the
+     *     calibration workload is returned.  This is empty if the
+     *     calibration workload failed.
+     */
+    std::vector< double > MeasureNoiseFloor(const Environment& environment) {
+        std::vector< double > times;
+        const auto lua = NewLuaState(environment.poolAllocator);
+        if (luaL_dostring(lua.get(), CALIBRATION_WORKLOAD) != LUA_OK) {
+            fprintf(stderr, "Unable to load calibration workload: %s\n", lua_tostring(lua.get(), -1));
+            return times;
+        }
+        for (size_t i = 0; i < environment.warmup; ++i) {
+            if (!Call(lua.get(), "calibrate")) {
+                return times;
+            }
+        }
+        Clock clock;
+        const auto numCalls = std::max(environment.repetitions, MINIMUM_CALIBRATION_CALLS);
+        for (size_t i = 0; i < numCalls; ++i) {
+            const auto start = clock.GetCurrentTime();
+            if (!Call(lua.get(), "calibrate")) {
+                times.clear();
+                return times;
+            }
+            times.push_back(clock.GetCurrentTime() - start);
+        }
+        return times;
+    }
+
+    /**
+     * This function returns the sample standard deviation of the given
+     * statistics as a percentage of their median.
+     *
+     * @param[in] statistics
+     *     These are the statistics to use.
+     *
+     * @return
+     *     The relative standard deviation, in percent, is returned.
+     */
+    double RelativeStandardDeviation(const Statistics& statistics) {
+        return (
+            (statistics.median > 0.0)
+            ? (statistics.stddev / statistics.median * 100.0)
+            : 0.0
+        );
+    }
+
+    /**
+     * This function loads each script given on the command line, runs
+     * the benchmarks found in them, and prints out the results.
+     *
+     * @param[in] environment
+     *     This holds the settings given on the command line.
+     *
+     * @param[in] bytecodeCache
+     *     If not nullptr, this is the cache from which to load
+     *     the scripts in precompiled form.
+     *
+     * @return
+     *     An indication of whether or not every script was loaded,
+     *     and every benchmark succeeded, is returned.
+     */
+    bool RunBenchmarks(
+        const Environment& environment,
+        BytecodeCache* bytecodeCache
+    ) {
+        bool succeeded = true;
+        StabilityInformation stability;
+        std::vector< double > calibrationTimes;
+        if (environment.stable) {
+            stability = PrepareForStableMeasurements();
+            calibrationTimes = MeasureNoiseFloor(environment);
+        }
+        std::vector< BenchmarkResult > results;
+        for (const auto& scriptPath: environment.scriptPaths) {
+            MappedFile script;
+            if (!script.Open(scriptPath)) {
+                fprintf(stderr, "Unable to read file '%s'\n", scriptPath.c_str());
+                succeeded = false;
+                continue;
+            }
+            const auto lua = NewLuaState(environment.poolAllocator);
+            if (!LoadScript(lua.get(), scriptPath, script, bytecodeCache)) {
+                succeeded = false;
+                continue;
+            }
+            for (const auto& name: FindBenchmarks(lua.get(), environment.benchPrefix)) {
+                BenchmarkResult result;
+                result.scriptPath = scriptPath;
+                result.name = name;
+                RunBenchmark(environment, lua, result);
+                succeeded = succeeded && result.succeeded;
+                results.push_back(std::move(result));
+            }
+        }
+        printf("-----------------------------------------------------------------------------------------\n");
+        printf("Benchmarks:\n");
+        printf("-----------------------------------------------------------------------------------------\n");
+        printf(
+            "%-24s %5s  %11s %11s %11s %11s %11s\n",
+            "BENCH", "#", "MIN", "MEDIAN", "MEAN", "MAX", "STDDEV"
+        );
+        for (const auto& result: results) {
+            const auto statistics = ComputeStatistics(result.times);
+            printf(
+                "%-24s %5zu  %11.9lf %11.9lf %11.9lf %11.9lf %11.9lf%s\n",
+                result.name.c_str(),
+                result.times.size(),
+                statistics.min,
+                statistics.median,
+                statistics.mean,
+                statistics.max,
+                statistics.stddev,
+                (result.succeeded ? "" : "  (failed)")
+            );
+        }
+        if (environment.stable) {
+            printf("-----------------------------------------------------------------------------------------\n");
+            printf("Stability:\n");
+            printf("-----------------------------------------------------------------------------------------\n");
+            if (stability.pinned) {
+                printf("Pinned to CPU:    %d\n", stability.cpu);
+            } else {
+                printf("Pinned to CPU:    no\n");
+            }
+            printf("Priority raised:  %s\n", (stability.priorityRaised ? "yes" : "no"));
+            for (const auto& warning: stability.warnings) {
+                printf("Warning:          %s\n", warning.c_str());
+            }
+            if (calibrationTimes.empty()) {
+                printf("Noise floor:      unknown (calibration failed)\n");
+            } else {
+                const auto calibration = ComputeStatistics(calibrationTimes);
+                printf(
+                    "Noise floor:      %.2lf%% (relative standard deviation of %zu calibration calls)\n",
+                    RelativeStandardDeviation(calibration),
+                    calibrationTimes.size()
+                );
+                printf(
+                    "                  %.2lf%% (spread from minimum to median)\n",
+                    ((calibration.min > 0.0) ? ((calibration.median - calibration.min) / calibration.min * 100.0) : 0.0)
+                );
+            }
+            printf(
+                "%-24s %5s  %11s\n",
+                "BENCH", "#", "RSD"
+            );
+            for (const auto& result: results) {
+                printf(
+                    "%-24s %5zu  %10.2lf%%\n",
+                    result.name.c_str(),
+                    result.times.size(),
+                    RelativeStandardDeviation(ComputeStatistics(result.times))
+                );
+            }
+        }
+        if (environment.overhead) {
+            printf("-----------------------------------------------------------------------------------------\n");
+            printf("Overhead:\n");
+            printf("-----------------------------------------------------------------------------------------\n");
+            printf(
+                "%-24s %5s  %17s %17s %11s\n",
+                "BENCH", "#", "UNINSTR. MEDIAN", "INSTR. MEDIAN", "SLOWDOWN"
+            );
+            for (const auto& result: results) {
+                const auto uninstrumented = ComputeStatistics(result.uninstrumentedTimes);
+                const auto instrumented = ComputeStatistics(result.times);
+                printf(
+                    "%-24s %5zu  %17.9lf %17.9lf %10.2lfx\n",
+                    result.name.c_str(),
+                    result.uninstrumentedTimes.size(),
+                    uninstrumented.median,
+                    instrumented.median,
+                    ((uninstrumented.median > 0.0) ? (instrumented.median / uninstrumented.median) : 0.0)
+                );
+            }
+        }
+        printf("-----------------------------------------------------------------------------------------\n");
+        printf("Breakdowns:\n");
+        printf("-----------------------------------------------------------------------------------------\n");
+        for (const auto& result: results) {
+            PrintBenchmarkBreakdown(result);
+        }
+        printf("-----------------------------------------------------------------------------------------\n");
+        return succeeded;
+    }
+
+    /**
+     * This holds one combination of garbage collector settings.
+     */
+    struct GcSetting {
+        /**
+         * This is the name of the garbage collector mode.
+         */
+        std::string mode;
+
+        /**
+         * This is the first parameter of the mode: the pause for
+         * incremental mode, or the minor multiplier for generational mode.
+         */
+        int first = 0;
+
+        /**
+         * This is the second parameter of the mode: the step multiplier
+         * for incremental mode, or the major multiplier for
+         * generational mode.
+         */
+        int second = 0;
+    };
+
+    /**
+     * This function returns the grid of garbage collector settings
+     * to try, covering the modes supported by the Lua interpreter.
+     *
+     * @return
+     *     The garbage collector settings to try are returned.
+     */
+    std::vector< GcSetting > GetGcSettings() {
+        std::vector< GcSetting > settings;
+        for (const auto pause: {100, 150, 200, 300, 400}) {
+            for (const auto stepmul: {100, 200, 400, 800}) {
+                GcSetting setting;
+                setting.mode = "incremental";
+                setting.first = pause;
+                setting.second = stepmul;
+                settings.push_back(setting);
+            }
+        }
+#ifdef LUA_GCGEN
+        for (const auto minormul: {10, 20, 40}) {
+            for (const auto majormul: {50, 100, 200}) {
+                GcSetting setting;
+                setting.mode = "generational";
+                setting.first = minormul;
+                setting.second = majormul;
+                settings.push_back(setting);
+            }
+        }
+#endif /* LUA_GCGEN */
+        return settings;
+    }
+
+    /**
+     * This function applies the given garbage collector settings
+     * to the given Lua interpreter.
+     *
+     * @param[in] lua
+     *     This points to the state of the Lua interpreter.
+     *
+     * @param[in] setting
+     *     These are the garbage collector settings to apply.
+     */
+    void ApplyGcSetting(lua_State* lua, const GcSetting& setting) {
+#ifdef LUA_GCGEN
+        if (setting.mode == "generational") {
+            (void)lua_gc(lua, LUA_GCGEN, setting.first, setting.second);
+        } else {
+            (void)lua_gc(lua, LUA_GCINC, setting.first, setting.second, 0);
+        }
+#else /* not LUA_GCGEN */
+        (void)lua_gc(lua, LUA_GCSETPAUSE, setting.first);
+        (void)lua_gc(lua, LUA_GCSETSTEPMUL, setting.second);
+#endif /* LUA_GCGEN */
+    }
+
+    /**
+     * This holds the results of calling the Lua function under
+     * one combination of garbage collector settings.
+     */
+    struct GcTrialResult {
+        /**
+         * This indicates whether or not the script was loaded and
+         * every call to the Lua function succeeded.
+         */
+        bool succeeded = false;
+
+        /**
+         * This is the amount of time elapsed, in seconds,
+         * calling the Lua function.
+         */
+        double wallTime = 0.0;
+
+        /**
+         * This is the largest number of bytes in use by the Lua
+         * interpreter while calling the Lua function.
+         */
+        size_t peakBytes = 0;
+    };
+
+    /**
+     * This holds the state of the allocator function installed by
+     * RunGcTrial to measure the peak memory used by a Lua interpreter.
+     */
+    struct PeakMemoryCounter {
+        /**
+         * This is the allocator function the interpreter had before
+         * the counting allocator was installed.
+         */
+        lua_Alloc originalAllocator = nullptr;
+
+        /**
+         * This is the opaque pointer to pass to the original
+         * allocator function.
+         */
+        void* originalAllocatorUd = nullptr;
+
+        /**
+         * This is the number of bytes currently in use by
+         * the Lua interpreter.
+         */
+        size_t bytesInUse = 0;
+
+        /**
+         * This is the largest number of bytes in use by the Lua
+         * interpreter since the counting allocator was installed.
+         */
+        size_t peakBytes = 0;
+    };
+
+    /**
+     * This is the allocator function installed by RunGcTrial.  It only
+     * keeps count of the memory in use, and its peak, so that measuring
+     * memory doesn't add the overhead of full instrumentation to the
+     * trial's wall time.
+     *
+     * @param[in] ud
+     *     This points to the PeakMemoryCounter.
+     *
+     * @param[in] ptr
+     *     If not NULL, this points to the memory block to be
+     *     freed or reallocated.
+     *
+     * @param[in] osize
+     *     This is the size of the memory block pointed to by "ptr".
+     *
+     * @param[in] nsize
+     *     This is the number of bytes of memory to allocate or
+     *     reallocate, or zero if the given block should be freed instead.
+     *
+     * @return
+     *     The value returned by the original allocator function
+     *     is returned.
+     */
+    void* PeakCountingAllocator(void* ud, void* ptr, size_t osize, size_t nsize) {
+        const auto counter = (PeakMemoryCounter*)ud;
+        const auto result = counter->originalAllocator(counter->originalAllocatorUd, ptr, osize, nsize);
+        const size_t oldSize = ((ptr == NULL) ? 0 : osize);
+        if (nsize == 0) {
+            counter->bytesInUse -= oldSize;
+        } else if (result != NULL) {
+            counter->bytesInUse -= oldSize;
+            counter->bytesInUse += nsize;
+            counter->peakBytes = std::max(counter->peakBytes, counter->bytesInUse);
+        }
+        return result;
+    }
+
+    /**
+     * This function loads the script in a fresh Lua interpreter,
+     * configures the garbage collector, and then calls the Lua function
+     * the number of times given on the command line, measuring the time
+     * taken and the memory used.
+     *
+     * The Lua function isn't instrumented, since the overhead of
+     * the instrumentation grows with the number of calls and allocations
+     * made and would skew the comparison between settings.  Only the
+     * memory in use is counted, by a minimal allocator function.
+     *
+     * @param[in] environment
+     *     This holds the settings given on the command line.
+     *
+     * @param[in] script
+     *     This holds the script to load.
+     *
+     * @param[in] bytecodeCache
+     *     If not nullptr, this is the cache from which to load
+     *     the script in precompiled form.
+     *
+     * @param[in] configure
+     *     This is the function to call to configure the garbage collector.
+     *
+     * @return
+     *     The results of the trial are returned.
+     */
+    GcTrialResult RunGcTrial(
+        const Environment& environment,
+        const MappedFile& script,
+        BytecodeCache* bytecodeCache,
+        const std::function< void(lua_State* lua) >& configure
+    ) {
+        GcTrialResult result;
+        const auto lua = NewLuaState(environment.poolAllocator);
+        if (!LoadScript(lua.get(), environment.scriptPath, script, bytecodeCache)) {
+            return result;
+        }
+        (void)lua_gc(lua.get(), LUA_GCCOLLECT, 0);
+        configure(lua.get());
+        PeakMemoryCounter counter;
+        counter.originalAllocator = lua_getallocf(lua.get(), &counter.originalAllocatorUd);
+        counter.bytesInUse = (
+            (size_t)lua_gc(lua.get(), LUA_GCCOUNT, 0) * 1024
+            + (size_t)lua_gc(lua.get(), LUA_GCCOUNTB, 0)
+        );
+        counter.peakBytes = counter.bytesInUse;
+        lua_setallocf(lua.get(), PeakCountingAllocator, &counter);
+        Clock clock;
+        const auto start = clock.GetCurrentTime();
+        result.succeeded = true;
+        for (size_t i = 0; i < environment.iterations; ++i) {
+            if (!Call(lua.get(), environment.functionName)) {
+                result.succeeded = false;
+                break;
+            }
+        }
+        result.wallTime = clock.GetCurrentTime() - start;
+        lua_setallocf(lua.get(), counter.originalAllocator, counter.originalAllocatorUd);
+        result.peakBytes = counter.peakBytes;
+        return result;
+    }
+
+    /**
+     * This function calls the Lua function under each of a grid of garbage
+     * collector settings, and prints out the wall time, estimated garbage
+     * collection time, and peak memory for each, marking the settings
+     * for which no other settings were both faster and used less memory.
+     *
+     * The time spent collecting garbage is estimated as the difference
+     * between the wall time and that of a run with the garbage collector
+     * stopped, since Lua doesn't measure it directly.
+     *
+     * @param[in] environment
+     *     This holds the settings given on the command line.
+     *
+     * @param[in] script
+     *     This holds the script to load.
+     *
+     * @param[in] bytecodeCache
+     *     If not nullptr, this is the cache from which to load
+     *     the script in precompiled form.
+     *
+     * @return
+     *     An indication of whether or not every trial succeeded
+     *     is returned.
+     */
+    bool RunGcSweep(
+        const Environment& environment,
+        const MappedFile& script,
+        BytecodeCache* bytecodeCache
+    ) {
+        const auto baseline = RunGcTrial(
+            environment,
+            script,
+            bytecodeCache,
+            [](lua_State* lua){
+                (void)lua_gc(lua, LUA_GCSTOP, 0);
+            }
+        );
+        if (!baseline.succeeded) {
+            return false;
+        }
+        const auto settings = GetGcSettings();
+        std::vector< GcTrialResult > results;
+        results.reserve(settings.size());
+        bool succeeded = true;
+        for (const auto& setting: settings) {
+            results.push_back(
+                RunGcTrial(
+                    environment,
+                    script,
+                    bytecodeCache,
+                    [&setting](lua_State* lua){
+                        ApplyGcSetting(lua, setting);
+                    }
+                )
+            );
+            succeeded = succeeded && results.back().succeeded;
+        }
+        std::vector< bool > paretoOptimal(results.size(), false);
+        for (size_t i = 0; i < results.size(); ++i) {
+            if (!results[i].succeeded) {
+                continue;
+            }
+            paretoOptimal[i] = true;
+            for (size_t j = 0; j < results.size(); ++j) {
+                if (
+                    results[j].succeeded
+                    && (results[j].wallTime <= results[i].wallTime)
+                    && (results[j].peakBytes <= results[i].peakBytes)
+                    && (
+                        (results[j].wallTime < results[i].wallTime)
+                        || (results[j].peakBytes < results[i].peakBytes)
+                    )
+                ) {
+                    paretoOptimal[i] = false;
+                    break;
+                }
+            }
+        }
+        printf("-----------------------------------------------------------------------------------------\n");
+        printf("Garbage collector settings:\n");
+        printf("-----------------------------------------------------------------------------------------\n");
+        printf(
+            "%-14s %6s %6s  %14s %14s %14s\n",
+            "MODE", "P1", "P2", "WALL", "GC (EST.)", "PEAK BYTES"
+        );
+        printf(
+            "%-14s %6s %6s  %14.9lf %14s %14zu\n",
+            "(stopped)", "", "",
+            baseline.wallTime,
+            "",
+            baseline.peakBytes
+        );
+        for (size_t i = 0; i < results.size(); ++i) {
+            const auto& result = results[i];
+            if (!result.succeeded) {
+                printf(
+                    "%-14s %6d %6d  (failed)\n",
+                    settings[i].mode.c_str(),
+                    settings[i].first,
+                    settings[i].second
+                );
+                continue;
+            }
+            printf(
+                "%-14s %6d %6d  %14.9lf %14.9lf %14zu%s\n",
+                settings[i].mode.c_str(),
+                settings[i].first,
+                settings[i].second,
+                result.wallTime,
+                std::max(0.0, result.wallTime - baseline.wallTime),
+                result.peakBytes,
+                (paretoOptimal[i] ? "  *" : "")
+            );
+        }
+        printf("-----------------------------------------------------------------------------------------\n");
+        printf("Pareto-optimal settings (fastest first):\n");
+        printf("-----------------------------------------------------------------------------------------\n");
+        std::vector< size_t > paretoSet;
+        for (size_t i = 0; i < results.size(); ++i) {
+            if (paretoOptimal[i]) {
+                paretoSet.push_back(i);
+            }
+        }
+        std::sort(
+            paretoSet.begin(),
+            paretoSet.end(),
+            [&results](size_t lhs, size_t rhs){
+                return results[lhs].wallTime < results[rhs].wallTime;
+            }
+        );
+        for (const auto i: paretoSet) {
+            printf(
+                "%-14s %6d %6d  %14.9lf %14.9lf %14zu\n",
+                settings[i].mode.c_str(),
+                settings[i].first,
+                settings[i].second,
+                results[i].wallTime,
+                std::max(0.0, results[i].wallTime - baseline.wallTime),
+                results[i].peakBytes
+            );
+        }
+        printf("-----------------------------------------------------------------------------------------\n");
+        return succeeded;
+    }
+
+}
+
+/**
+ * This function is the entrypoint of the program.
+ * It loads a Lua script, instruments it, calls a Lua function,
+ * and finally prints out a report generated by the instrumentation.
+ *
+ * @param[in] argc
+ *     This is the number of command-line arguments given to the program.
+ *
+ * @param[in] argv
+ *     This is the array of command-line arguments given to the program.
+ */
+int main(int argc, char* argv[]) {
+#ifdef _WIN32
+    //_crtBreakAlloc = 18;
+    _CrtSetDbgFlag(_CRTDBG_ALLOC_MEM_DF | _CRTDBG_LEAK_CHECK_DF);
+#endif /* _WIN32 */
+    Environment environment;
+    (void)setbuf(stdout, NULL);
+    if (!ProcessCommandLineArguments(argc, argv, environment)) {
+        PrintUsageInformation();
+        return EXIT_FAILURE;
+    }
+    std::unique_ptr< BytecodeCache > bytecodeCache;
+    if (!environment.bytecodeCacheDirectory.empty()) {
+        bytecodeCache.reset(new BytecodeCache(environment.bytecodeCacheDirectory));
+    }
+    if (environment.bench) {
+        return (
+            RunBenchmarks(environment, bytecodeCache.get())
+            ? EXIT_SUCCESS
+            : EXIT_FAILURE
+        );
+    }
+    MappedFile script;
+    if (!script.Open(environment.scriptPath)) {
+        fprintf(stderr, "Unable to read file '%s'\n", environment.scriptPath.c_str());
+        return EXIT_FAILURE;
+    }
+    if (environment.gcSweep) {
+        return (
+            RunGcSweep(environment, script, bytecodeCache.get())
+            ? EXIT_SUCCESS
+            : EXIT_FAILURE
+        );
+    }
+    if (environment.jobs > 0) {
+        return (
+            RunJobs(environment, script, bytecodeCache.get())
+            ? EXIT_SUCCESS
+            : EXIT_FAILURE
+        );
+    }
+    const auto lua = NewLuaState(environment.poolAllocator);
+    MoonClock::MoonClock moonClock;
+    const auto clock = std::make_shared< Clock >();
+    moonClock.SetClock(clock);
+    moonClock.SetCallTreeTracking(
+        !environment.pprofPath.empty()
+        || !environment.htmlPath.empty()
+    );
+    moonClock.SetLatencyHistograms(!environment.htmlPath.empty());
+    if (
+        !environment.publishName.empty()
+        && !moonClock.SetSharedStatistics(environment.publishName)
+    ) {
+        fprintf(
+            stderr,
+            "unable to publish statistics in shared memory segment '%s' (is it already in use?)\n",
+            environment.publishName.c_str()
+        );
+        return EXIT_FAILURE;
+    }
+    if (environment.startup) {
+        // With a bytecode cache, the time measured to compile the script
+        // is the time taken to load its precompiled form instead.
+        std::string chunk;
+        if (bytecodeCache == nullptr) {
+            chunk.assign(script.GetData(), script.GetSize());
+        } else {
+            std::string errorMessage;
+            if (
+                !bytecodeCache->GetBytecode(
+                    lua.get(),
+                    environment.scriptPath,
+                    script.GetData(),
+                    script.GetSize(),
+                    chunk,
+                    errorMessage
+                )
+            ) {
+                fprintf(stderr, "%s\n", errorMessage.c_str());
+                return EXIT_FAILURE;
+            }
+        }
+        moonClock.StartInstrumentation(lua);
+        const auto chunkLoad = moonClock.LoadChunk(environment.scriptPath, chunk);
+        if (!chunkLoad.succeeded) {
+            fprintf(stderr, "%s\n", chunkLoad.errorMessage.c_str());
+            return EXIT_FAILURE;
+        }
+    } else {
+        if (!LoadScript(lua.get(), environment.scriptPath, script, bytecodeCache.get())) {
+            return EXIT_FAILURE;
+        }
+        moonClock.StartInstrumentation(lua);
+    }
+    if (!environment.functionName.empty()) {
+        for (size_t i = 0; i < environment.iterations; ++i) {
+            if (!Call(lua.get(), environment.functionName)) {
+                return EXIT_FAILURE;
+            }
+        }
+    }
+    moonClock.StopInstrumentation();
+    const auto report = moonClock.GenerateReport();
+    PrintReport(report);
+    if (
+        !environment.pprofPath.empty()
+        && !WriteFile(environment.pprofPath, MoonClock::EncodePprofProfile(report))
+    ) {
+        return EXIT_FAILURE;
+    }
+    if (
+        !environment.callgrindPath.empty()
+        && !WriteFile(environment.callgrindPath, MoonClock::FormatCallgrindProfile(report))
+    ) {
+        return EXIT_FAILURE;
+    }
+    if (
+        !environment.dotPath.empty()
+        && !WriteFile(environment.dotPath, MoonClock::FormatDotGraph(report))
+    ) {
+        return EXIT_FAILURE;
+    }
+    if (
+        !environment.htmlPath.empty()
+        && !WriteFile(
+            environment.htmlPath,
+            MoonClock::FormatHtmlReport(report, "MoonClock Report: " + environment.scriptPath)
+        )
+    ) {
+        return EXIT_FAILURE;
+    }
     return EXIT_SUCCESS;
 }
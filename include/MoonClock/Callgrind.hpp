@@ -0,0 +1,47 @@
+#pragma once
+
+/**
+ * @file Callgrind.hpp
+ *
+ * This module declares the function which exports a MoonClock::Report
+ * as a profile in the Callgrind format, as read by KCachegrind
+ * and QCachegrind.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include <MoonClock/MoonClock.hpp>
+#include <string>
+
+namespace MoonClock {
+
+    /**
+     * Format the given report as a profile in the Callgrind format, so that
+     * the calls between Lua functions can be browsed with KCachegrind or
+     * QCachegrind.  These events are given for each function, exclusive
+     * of the instrumented functions it called, and for each call between
+     * functions, inclusive of everything the called function did:
+     * - Time: the time elapsed, in nanoseconds
+     * - Ir: the Lua virtual machine instructions executed
+     * - Allocs: the number of blocks of memory allocated
+     * - Bytes: the number of bytes allocated
+     *
+     * The number of calls between each pair of functions is given as well,
+     * from which the viewers derive the call counts of each function.
+     * Inclusive costs of functions are derived by the viewers from the
+     * exclusive costs and the costs of calls.
+     *
+     * Each function is placed in the source file where it was defined,
+     * when known, at the line where its definition starts.  Since the
+     * line of each call isn't known, calls are placed at the line where
+     * the definition of the calling function starts.
+     *
+     * @param[in] report
+     *     This is the report to format.
+     *
+     * @return
+     *     The formatted profile is returned.
+     */
+    std::string FormatCallgrindProfile(const Report& report);
+
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+/**
+ * @file Dot.hpp
+ *
+ * This module declares the function which exports the call graph of
+ * a MoonClock::Report in the DOT language, for rendering with Graphviz.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include <MoonClock/MoonClock.hpp>
+#include <string>
+
+namespace MoonClock {
+
+    /**
+     * This holds settings which control which parts of the call graph
+     * are drawn by FormatDotGraph.  Thresholds are fractions of the total
+     * time of the report; for example, 0.005 hides anything accounting
+     * for less than 0.5% of the total time.
+     */
+    struct DotOptions {
+        /**
+         * Functions whose total time, including the functions they
+         * called, is less than this fraction of the total time of the
+         * report aren't drawn.
+         */
+        double nodeThreshold = 0.005;
+
+        /**
+         * Calls between functions whose total time is less than this
+         * fraction of the total time of the report aren't drawn.
+         */
+        double edgeThreshold = 0.001;
+    };
+
+    /**
+     * Format the call graph of the given report in the DOT language.
+     *
+     * Each function called is drawn as a box labeled with its path, self
+     * time, total time, and number of calls.  The larger the self time of
+     * a function, the larger its label is drawn, and the closer to red it
+     * is filled.  Each pair of functions where one called the other is
+     * joined by an arrow labeled with the number of calls and the total
+     * time of those calls.  The larger that time, the thicker the arrow is
+     * drawn.  The layout tries harder to keep an arrow short and straight
+     * the larger that time and the more calls it stands for, weighing
+     * the two equally.
+     *
+     * Functions and calls below the thresholds in the given options are
+     * left out, along with calls to or from functions left out, and the
+     * number of each left out is noted in the label of the graph.
+     *
+     * @param[in] report
+     *     This is the report whose call graph to format.
+     *
+     * @param[in] options
+     *     These are the settings which control which parts of the
+     *     call graph are drawn.
+     *
+     * @return
+     *     The call graph, as a DOT "digraph", is returned.
+     */
+    std::string FormatDotGraph(
+        const Report& report,
+        const DotOptions& options = DotOptions()
+    );
+
+}
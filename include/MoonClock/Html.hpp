@@ -0,0 +1,47 @@
+#pragma once
+
+/**
+ * @file Html.hpp
+ *
+ * This module declares the function which formats a MoonClock::Report
+ * as a self-contained, interactive HTML page.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include <MoonClock/MoonClock.hpp>
+#include <string>
+
+namespace MoonClock {
+
+    /**
+     * Format the given report as a single HTML page, with the report's
+     * information and the scripts to browse it embedded in the page, so
+     * that it can be shared as one file and viewed without a network
+     * connection.  The page has these parts:
+     * - a summary of the report as a whole
+     * - a table of all the functions called, which can be sorted by
+     *   clicking the heading of any column
+     * - a flame graph of the call tree, if the report has one
+     *   (see MoonClock::SetCallTreeTracking), which can be zoomed into
+     *   by clicking any frame
+     * - the details of the selected function, including the functions
+     *   which called it and which it called, which can be selected in
+     *   turn, and its latency histogram, if the report has latency
+     *   histograms (see MoonClock::SetLatencyHistograms)
+     *
+     * @param[in] report
+     *     This is the report to format.
+     *
+     * @param[in] title
+     *     This is the title of the page.
+     *
+     * @return
+     *     The HTML page is returned.
+     */
+    std::string FormatHtmlReport(
+        const Report& report,
+        const std::string& title = "MoonClock Report"
+    );
+
+}
@@ -9,9 +9,12 @@
  */
 
 #include <algorithm>
+#include <deque>
 #include <functional>
+#include <limits>
 #include <map>
 #include <memory>
+#include <MoonClock/VirtualClock.hpp>
 #include <sstream>
 #include <string>
 #include <Timekeeping/Clock.hpp>
@@ -47,6 +50,19 @@ namespace MoonClock {
      */
     using Instrument = void (*)(lua_State* lua, void* context, const Path& path);
 
+    /**
+     * This is the number of buckets in each latency histogram
+     * (see FunctionInformation::latencyHistogram).
+     */
+    constexpr size_t NUM_LATENCY_HISTOGRAM_BUCKETS = 32;
+
+    /**
+     * This is the upper limit, in seconds, of the call times counted
+     * in the first bucket of each latency histogram.  The limit of each
+     * bucket after that is twice the limit of the bucket before it.
+     */
+    constexpr double LATENCY_HISTOGRAM_FIRST_LIMIT = 1e-6;
+
     /**
      * This collects information about other Lua functions called from a given
      * Lua function.
@@ -63,6 +79,27 @@ namespace MoonClock {
          */
         double totalTime = 0.0;
 
+        /**
+         * If memory tracking is enabled, this is the number of blocks of
+         * memory newly allocated during all calls to this function
+         * from the caller, including the functions it called.
+         */
+        size_t numAllocations = 0;
+
+        /**
+         * If memory tracking is enabled, this is the number of bytes
+         * newly allocated during all calls to this function from the
+         * caller, including the functions it called.
+         */
+        size_t bytesAllocated = 0;
+
+        /**
+         * If instruction counting is enabled, this is the number of
+         * Lua virtual machine instructions executed during all calls to
+         * this function from the caller, including the functions it called.
+         */
+        size_t numInstructions = 0;
+
         CallsInformation() = default;
 
         CallsInformation(size_t numCalls, double totalTime);
@@ -129,6 +166,37 @@ namespace MoonClock {
          */
         std::map< Path, CallsInformation > calls;
 
+        /**
+         * If memory tracking is enabled, this is the number of blocks of
+         * memory newly allocated during all calls to this function,
+         * including the functions it called.
+         */
+        size_t numAllocations = 0;
+
+        /**
+         * If memory tracking is enabled, this is the number of bytes
+         * newly allocated during all calls to this function,
+         * including the functions it called.
+         */
+        size_t bytesAllocated = 0;
+
+        /**
+         * If instruction counting is enabled, this is the number of
+         * Lua virtual machine instructions executed during all calls to
+         * this function, including the functions it called, to the
+         * granularity of the instruction counting.
+         */
+        size_t numInstructions = 0;
+
+        /**
+         * If latency histograms are enabled, this counts the calls to
+         * this function by how long they took.  There are
+         * NUM_LATENCY_HISTOGRAM_BUCKETS buckets; see
+         * GetLatencyHistogramBucket for which calls each one counts.
+         * Otherwise, this is empty.
+         */
+        std::vector< size_t > latencyHistogram;
+
         FunctionInformation() = default;
 
         FunctionInformation(
@@ -168,6 +236,592 @@ namespace MoonClock {
         std::ostream* os
     );
 
+    /**
+     * This holds information about where a Lua function was defined.
+     */
+    struct SourceInformation {
+        /**
+         * This identifies the chunk in which the function was defined,
+         * such as the path of a script file, in the short form Lua uses
+         * in error messages.
+         */
+        std::string source;
+
+        /**
+         * This is the line number where the definition of the function
+         * starts, or zero if the function isn't a Lua function.
+         */
+        int lineDefined = 0;
+
+        /**
+         * This is the line number where the definition of the function
+         * ends, or zero if the function isn't a Lua function.
+         */
+        int lastLineDefined = 0;
+    };
+
+    /**
+     * This holds information about all the calls to a Lua function made
+     * through one particular chain of calls from the top level, which is
+     * a node of the call tree collected if call tree tracking is enabled.
+     */
+    struct CallTreeNode {
+        /**
+         * This represents the path to the function called, or is
+         * empty for the root of the call tree.
+         */
+        Path path;
+
+        /**
+         * This is the index in the call tree of the node of the caller.
+         * The root of the call tree is its own parent.
+         */
+        size_t parent = 0;
+
+        /**
+         * This holds the index in the call tree of the node of each
+         * function called from this node, keyed by the path to the
+         * function called.
+         */
+        std::map< Path, size_t > children;
+
+        /**
+         * This is the number of calls made through this node.
+         */
+        size_t numCalls = 0;
+
+        /**
+         * This is the total amount of time elapsed, in seconds, during
+         * all calls made through this node, including the calls
+         * they made.
+         */
+        double totalTime = 0.0;
+
+        /**
+         * If memory tracking is enabled, this is the number of blocks of
+         * memory newly allocated during all calls made through this node,
+         * including the calls they made.
+         */
+        size_t numAllocations = 0;
+
+        /**
+         * If memory tracking is enabled, this is the number of bytes newly
+         * allocated during all calls made through this node, including
+         * the calls they made.
+         */
+        size_t bytesAllocated = 0;
+
+        /**
+         * If instruction counting is enabled, this is the number of
+         * Lua virtual machine instructions executed during all calls made
+         * through this node, including the calls they made.
+         */
+        size_t numInstructions = 0;
+    };
+
+    /**
+     * This holds information about a single call to a Lua function
+     * which took longer than the slow-call threshold configured for it.
+     */
+    struct SlowCallInformation {
+        /**
+         * This represents the path to the function which was slow.
+         */
+        Path path;
+
+        /**
+         * This holds the paths to all the functions on the call stack
+         * when the slow call returned, starting with the outermost call
+         * and ending with the slow function itself.
+         */
+        std::vector< Path > callStack;
+
+        /**
+         * This is the value sampled from the real-time clock
+         * when the slow call returned.
+         */
+        double timestamp = 0.0;
+
+        /**
+         * This is the amount of time elapsed, in seconds, during the call.
+         */
+        double totalTime = 0.0;
+
+        /**
+         * If enabled, this is the Lua traceback captured when the slow call
+         * returned.
+         */
+        std::string traceback;
+
+        /**
+         * If enabled, this holds a short summary of each argument
+         * passed to the slow call.
+         */
+        std::vector< std::string > arguments;
+    };
+
+    /**
+     * This holds information about one call on a critical path.
+     */
+    struct CriticalPathStep {
+        /**
+         * This represents the path to the function called.
+         */
+        Path path;
+
+        /**
+         * This is the amount of time elapsed, in seconds, during the call.
+         */
+        double totalTime = 0.0;
+    };
+
+    /**
+     * This holds the critical path through a single top-level call to
+     * an instrumented Lua function: the chain of calls, starting with the
+     * top-level call, in which each call is the one which took the most
+     * time among the calls made by the call before it.
+     */
+    struct CriticalPathInformation {
+        /**
+         * This is the value sampled from the real-time clock
+         * when the top-level call was made.
+         */
+        double start = 0.0;
+
+        /**
+         * This holds the calls on the critical path, starting with
+         * the top-level call and ending with a call which made no
+         * calls to instrumented functions.
+         */
+        std::vector< CriticalPathStep > steps;
+    };
+
+    /**
+     * This holds how much a Lua function appeared on the critical paths
+     * through all the top-level calls made while instrumented.
+     */
+    struct CriticalPathFunctionInformation {
+        /**
+         * This is the number of top-level calls whose critical path
+         * went through the function.
+         */
+        size_t numOccurrences = 0;
+
+        /**
+         * This is the total amount of time elapsed, in seconds, during
+         * the calls to the function on critical paths.  For recursive
+         * functions, only the outermost call on each critical path
+         * is counted.
+         */
+        double totalTime = 0.0;
+
+        /**
+         * This is the total amount of time elapsed, in seconds, during
+         * the calls to the function on critical paths, not including
+         * the time of the next call on the critical path.  This is the
+         * time for which the function itself held up the top-level call.
+         */
+        double selfTime = 0.0;
+    };
+
+    /**
+     * This holds the settings which control how the default instruments
+     * capture calls which take longer than expected.
+     */
+    struct SlowCallOptions {
+        /**
+         * This is the amount of time, in seconds, which a call to any
+         * function not listed in thresholds must exceed in order
+         * to be captured.
+         */
+        double threshold = std::numeric_limits< decltype(threshold) >::infinity();
+
+        /**
+         * This holds the amount of time, in seconds, which a call to
+         * specific functions must exceed in order to be captured,
+         * overriding the general threshold.
+         */
+        std::map< Path, double > thresholds;
+
+        /**
+         * This is the maximum number of slow calls kept in the report.
+         * Once reached, the oldest slow call is discarded whenever a new
+         * one is captured.
+         */
+        size_t capacity = 100;
+
+        /**
+         * This indicates whether or not to capture the Lua traceback
+         * for each slow call.
+         */
+        bool captureTraceback = false;
+
+        /**
+         * This indicates whether or not to capture a summary of the
+         * arguments passed to each slow call.  Note that this requires
+         * summarizing the arguments of every call, since it isn't known
+         * in advance which calls will be slow.
+         */
+        bool captureArguments = false;
+    };
+
+    /**
+     * This is the type of function called by the default instruments
+     * whenever a call exceeds a latency budget.
+     *
+     * @param[in] path
+     *     This represents the path to the function whose call
+     *     exceeded the budget.
+     *
+     * @param[in] totalTime
+     *     This is the amount of time elapsed, in seconds, during the call.
+     *
+     * @param[in] pattern
+     *     This is the pattern of the latency budget which was exceeded.
+     *
+     * @param[in] budget
+     *     This is the amount of time, in seconds, which was exceeded.
+     */
+    using LatencyBudgetViolationCallback = std::function<
+        void(
+            const Path& path,
+            double totalTime,
+            const std::string& pattern,
+            double budget
+        )
+    >;
+
+    /**
+     * This describes the amount of time calls to a group of Lua functions
+     * are expected to take.
+     */
+    struct LatencyBudget {
+        /**
+         * This selects the functions to which the budget applies.
+         * See PathMatchesPattern for the syntax.
+         */
+        std::string pattern;
+
+        /**
+         * This is the amount of time, in seconds, which a call must
+         * exceed in order to count as a violation of the budget.
+         */
+        double budget = 0.0;
+
+        /**
+         * This is the fraction of calls which are expected to stay
+         * within the budget.  The burn rate of the budget is the fraction
+         * of calls violating the budget, divided by the fraction allowed
+         * to violate it.
+         */
+        double objective = 0.99;
+
+        /**
+         * This is the length, in seconds, of each time window over which
+         * the burn rate is tracked.
+         */
+        double window = 60.0;
+
+        /**
+         * This is the maximum number of time windows kept in the report.
+         */
+        size_t windowHistory = 60;
+
+        /**
+         * If not null, this is called whenever a call violates the budget.
+         */
+        LatencyBudgetViolationCallback onViolation;
+    };
+
+    /**
+     * This holds the number of calls and violations of a latency budget
+     * which occurred during a single time window.
+     */
+    struct LatencyBudgetWindow {
+        /**
+         * This is the value sampled from the real-time clock
+         * when the window started.
+         */
+        double start = 0.0;
+
+        /**
+         * This is the number of calls subject to the budget during the window.
+         */
+        size_t numCalls = 0;
+
+        /**
+         * This is the number of calls which violated the budget
+         * during the window.
+         */
+        size_t numViolations = 0;
+
+        /**
+         * This is the fraction of calls which violated the budget during the
+         * window, divided by the fraction allowed to violate it.
+         */
+        double burnRate = 0.0;
+    };
+
+    /**
+     * This holds information collected about a latency budget.
+     */
+    struct LatencyBudgetInformation {
+        /**
+         * This selects the functions to which the budget applies.
+         */
+        std::string pattern;
+
+        /**
+         * This is the amount of time, in seconds, which a call must
+         * exceed in order to count as a violation of the budget.
+         */
+        double budget = 0.0;
+
+        /**
+         * This is the number of calls subject to the budget.
+         */
+        size_t numCalls = 0;
+
+        /**
+         * This is the number of calls which violated the budget.
+         */
+        size_t numViolations = 0;
+
+        /**
+         * This holds the most recent time windows over which the burn rate
+         * of the budget was tracked, oldest first.  The last one is the
+         * current window.
+         */
+        std::deque< LatencyBudgetWindow > windows;
+    };
+
+    /**
+     * This holds information about a Lua function call detected by the
+     * stall detector as running for too long without returning.
+     */
+    struct StallInformation {
+        /**
+         * This represents the path to the innermost function found
+         * running for too long.
+         */
+        Path path;
+
+        /**
+         * This holds the paths to all the functions on the call stack
+         * when the stall was detected, starting with the outermost call
+         * and ending with the stalled function itself.
+         */
+        std::vector< Path > callStack;
+
+        /**
+         * This is the value sampled from the real-time clock
+         * when the stalled function was called.
+         */
+        double start = 0.0;
+
+        /**
+         * This is the value sampled from the real-time clock
+         * when the stall was detected.
+         */
+        double detected = 0.0;
+
+        /**
+         * This indicates whether or not the stall detector requested
+         * that the stalled call be aborted.
+         */
+        bool aborted = false;
+    };
+
+    /**
+     * This is the type of function called by the stall detector whenever
+     * it detects a stalled call.  It is called from the stall detector's
+     * own thread, not the thread running Lua.
+     *
+     * @param[in] stall
+     *     This holds information about the stalled call.
+     */
+    using StallCallback = std::function< void(const StallInformation& stall) >;
+
+    /**
+     * This holds the settings which control the stall detector, which
+     * watches from a separate thread for calls which run for too long
+     * without returning.
+     *
+     * @note
+     *     The stall detector thread calls GetCurrentTime on the clock set
+     *     by MoonClock::SetClock while the thread running Lua also uses it,
+     *     so enabling the stall detector requires a clock whose
+     *     GetCurrentTime is safe to call from two threads at once.
+     */
+    struct StallDetectorOptions {
+        /**
+         * This is the amount of time, in seconds, a call must run without
+         * returning in order to be considered stalled.  The stall detector
+         * is disabled if this is infinite.
+         */
+        double threshold = std::numeric_limits< decltype(threshold) >::infinity();
+
+        /**
+         * This is the amount of time, in seconds, the stall detector waits
+         * between checks of the call stack.
+         */
+        double pollInterval = 0.1;
+
+        /**
+         * This is the number of levels of the call stack, starting with
+         * the outermost call, watched by the stall detector.
+         */
+        size_t maxDepth = 256;
+
+        /**
+         * This indicates whether or not the stall detector should abort
+         * stalled calls, by setting a Lua hook which raises an error.
+         *
+         * @note
+         *     Only calls made on the main Lua thread are aborted, not
+         *     those made by coroutines.  The hook temporarily replaces
+         *     any hook already set on the main Lua thread, such as the
+         *     one used to count instructions, and sets it back when it
+         *     runs.  The hook is set from the stall detector thread, so
+         *     a hook set from Lua (such as with debug.sethook) while an
+         *     abort is pending is replaced when the abort happens.
+         *     If the call returns before the hook runs, it isn't aborted.
+         *     Calls stalled inside C functions are only aborted once
+         *     control returns to Lua code, and only one abort is pending
+         *     at a time.
+         */
+        bool abort = false;
+
+        /**
+         * If not null, this is called whenever a stalled call is detected.
+         */
+        StallCallback onStall;
+    };
+
+    /**
+     * This holds information about the loading of a Lua module through
+     * the "require" function, including any modules it required in turn
+     * while loading.
+     */
+    struct ModuleLoadInformation {
+        /**
+         * This is the name of the module.
+         */
+        std::string name;
+
+        /**
+         * This is the value sampled from the real-time clock
+         * when the module started loading.
+         */
+        double start = 0.0;
+
+        /**
+         * This is the total amount of time elapsed, in seconds,
+         * loading the module, including the modules it required.
+         */
+        double totalTime = 0.0;
+
+        /**
+         * This is the amount of time elapsed, in seconds, loading the module,
+         * not counting the modules it required.
+         */
+        double selfTime = 0.0;
+
+        /**
+         * This indicates whether or not the module finished loading.
+         * It doesn't if an error occurs while loading it.
+         */
+        bool completed = false;
+
+        /**
+         * This holds information about the modules required
+         * while loading this module, in the order they were loaded.
+         */
+        std::vector< ModuleLoadInformation > requiredModules;
+    };
+
+    /**
+     * This holds information about the memory allocated by the Lua
+     * interpreter while instrumented, if memory tracking is enabled.
+     */
+    struct MemoryInformation {
+        /**
+         * This indicates whether or not memory was tracked.
+         */
+        bool tracked = false;
+
+        /**
+         * This is the number of bytes in use by the Lua interpreter
+         * when the instrumentation started.
+         */
+        size_t startBytes = 0;
+
+        /**
+         * This is the largest number of bytes in use by the Lua
+         * interpreter at any time while instrumented.
+         */
+        size_t peakBytes = 0;
+
+        /**
+         * This is the number of bytes in use by the Lua interpreter
+         * when the instrumentation stopped.
+         */
+        size_t endBytes = 0;
+
+        /**
+         * This is the number of blocks of memory newly allocated
+         * while instrumented.
+         */
+        size_t numAllocations = 0;
+
+        /**
+         * This is the total number of bytes newly allocated (including
+         * the growth of blocks reallocated) while instrumented.
+         */
+        size_t bytesAllocated = 0;
+    };
+
+    /**
+     * This holds information about the loading and execution of a chunk
+     * of Lua code through the LoadChunk function.
+     */
+    struct ChunkLoadInformation {
+        /**
+         * This is the name of the chunk, used in Lua error messages.
+         */
+        std::string name;
+
+        /**
+         * This is the value sampled from the real-time clock
+         * when the chunk started loading.
+         */
+        double start = 0.0;
+
+        /**
+         * This is the amount of time elapsed, in seconds, parsing and
+         * compiling the chunk.
+         */
+        double compileTime = 0.0;
+
+        /**
+         * This is the amount of time elapsed, in seconds, executing
+         * the top level of the chunk, including any functions it called.
+         */
+        double executionTime = 0.0;
+
+        /**
+         * This indicates whether or not the chunk was compiled and
+         * executed without errors.
+         */
+        bool succeeded = false;
+
+        /**
+         * If the chunk couldn't be compiled or executed, this
+         * is the error message from Lua.
+         */
+        std::string errorMessage;
+    };
+
     /**
      * This holds all information collected by the default instruments,
      * if they are used.
@@ -178,11 +832,105 @@ namespace MoonClock {
          */
         std::map< Path, FunctionInformation > functionInfo;
 
+        /**
+         * This is the reverse of the "calls" information of each function.
+         * For each Lua function called from another instrumented function,
+         * it holds information about the calls made to it by each caller,
+         * keyed by the path of the called function and then by the path
+         * of the caller.  It's derived when the report is generated
+         * (see IndexCallers).
+         */
+        std::map< Path, std::map< Path, CallsInformation > > callers;
+
+        /**
+         * This holds information about where each instrumented Lua
+         * function was defined, keyed by the path to the function.
+         */
+        std::map< Path, SourceInformation > sources;
+
+        /**
+         * If call tree tracking is enabled, this holds the nodes of the
+         * call tree.  The first node is the root, whose children are
+         * the top-level calls.  Every node comes after its parent.
+         */
+        std::vector< CallTreeNode > callTree;
+
         /**
          * This records the total amount of time that elapsed while
          * the Lua functions were instrumented.
          */
         double totalTime = 0.0;
+
+        /**
+         * This holds the most recent calls which took longer than
+         * the slow-call threshold configured for them, oldest first.
+         */
+        std::deque< SlowCallInformation > slowCalls;
+
+        /**
+         * This is the number of slow calls discarded from the report
+         * because the slow-call log was full.
+         */
+        size_t numSlowCallsDropped = 0;
+
+        /**
+         * If critical path tracking is enabled, this holds the critical
+         * paths through the most recent top-level calls, oldest first.
+         */
+        std::deque< CriticalPathInformation > criticalPaths;
+
+        /**
+         * This is the number of critical paths discarded from the report
+         * because the critical path log was full.
+         */
+        size_t numCriticalPathsDropped = 0;
+
+        /**
+         * If critical path tracking is enabled, this holds how much each
+         * Lua function appeared on the critical paths through all
+         * top-level calls, including those whose critical paths
+         * were discarded.
+         */
+        std::map< Path, CriticalPathFunctionInformation > criticalPathFunctions;
+
+        /**
+         * This holds information collected about each latency budget,
+         * in the order the budgets were added.
+         */
+        std::vector< LatencyBudgetInformation > latencyBudgets;
+
+        /**
+         * This holds information about each stalled call detected
+         * by the stall detector, in the order they were detected.
+         */
+        std::vector< StallInformation > stalls;
+
+        /**
+         * If module load profiling is enabled, this holds information about
+         * each module loaded by a call to "require" which wasn't made
+         * while loading another module, in the order they were loaded.
+         */
+        std::vector< ModuleLoadInformation > moduleLoads;
+
+        /**
+         * This holds information about each chunk of Lua code loaded
+         * through the LoadChunk function while instrumenting,
+         * in the order they were loaded.
+         */
+        std::vector< ChunkLoadInformation > chunkLoads;
+
+        /**
+         * This holds information about the memory allocated
+         * while instrumented, if memory tracking is enabled.
+         */
+        MemoryInformation memory;
+
+        /**
+         * If instruction counting is enabled, this is the number of
+         * Lua virtual machine instructions executed while instrumented,
+         * to the granularity of the instruction counting.
+         */
+        size_t numInstructions = 0;
     };
 
     /**
@@ -226,6 +974,75 @@ namespace MoonClock {
      */
     bool DoNotSearch(lua_State* lua, int compositeIndex);
 
+    /**
+     * Determine whether or not the given path matches the given pattern.
+     *
+     * The pattern is a list of keys separated by periods, such as
+     * "api.db.query".  A key of "*" matches any single key, except when it
+     * is the last key of the pattern, in which case it matches one or more
+     * keys.  For example, "api.*" matches "api.get" and "api.db.query",
+     * but not "api".
+     *
+     * @param[in] path
+     *     This is the path to check.
+     *
+     * @param[in] pattern
+     *     This is the pattern to match against the path.
+     *
+     * @return
+     *     An indication of whether or not the path matches the pattern
+     *     is returned.
+     */
+    bool PathMatchesPattern(const Path& path, const std::string& pattern);
+
+    /**
+     * Rebuild the "callers" information of the given report from
+     * the "calls" information of each function in it.  Reports made
+     * by GenerateReport and MergeReports already have it built.
+     *
+     * @param[in,out] report
+     *     This is the report whose "callers" information to rebuild.
+     */
+    void IndexCallers(Report& report);
+
+    /**
+     * Return the index of the latency histogram bucket which counts calls
+     * taking the given amount of time.  The first bucket counts calls
+     * taking less than LATENCY_HISTOGRAM_FIRST_LIMIT, each bucket after
+     * that counts calls taking less than twice as long as the limit of the
+     * bucket before it, and the last bucket counts all longer calls too.
+     *
+     * @param[in] time
+     *     This is the amount of time, in seconds, taken by a call.
+     *
+     * @return
+     *     The index of the bucket which counts the call is returned.
+     */
+    size_t GetLatencyHistogramBucket(double time);
+
+    /**
+     * Combine the given reports, such as those generated by instrumenting
+     * several Lua interpreters running the same code concurrently, into
+     * a single report.
+     *
+     * Information about functions with the same path is combined: call
+     * counts and times are added together, and minimum and maximum times
+     * are taken across all the reports.  The total times of the reports
+     * are added together as well.  Information about latency budgets with
+     * the same index and pattern is combined, with the windows of all the
+     * reports listed in order of their start times.  Memory counters are
+     * added together, so the combined peak is an upper bound of the memory
+     * in use at any one time.  Everything else (slow calls, stalls, module
+     * loads, and chunk loads) is listed in the order of the reports given.
+     *
+     * @param[in] reports
+     *     These are the reports to combine.
+     *
+     * @return
+     *     The combined report is returned.
+     */
+    Report MergeReports(const std::vector< Report >& reports);
+
     /**
      * This class represents a suite of tools used to measure the performance
      * of Lua functions.
@@ -282,6 +1099,45 @@ namespace MoonClock {
          */
         static void DefaultAfterInstrument(lua_State* lua, void* context, const Path& path);
 
+        /**
+         * This is an alternative to the default instrumentation to apply
+         * at the beginning of each Lua function call.  It only counts calls,
+         * and calls made from each function to others, without
+         * measuring time, so it's much cheaper to leave in place.
+         *
+         * @param[in,out] lua
+         *     This points to the Lua interpreter's state.
+         *
+         * @param[in,out] context
+         *     This points to context information shared by the
+         *     instrumentation, which must be the value returned by the
+         *     GetDefaultContext method.
+         *
+         * @param[in] path
+         *     This represents the path to the Lua function being instrumented,
+         *     from a reference point such as the global Lua variables.
+         */
+        static void CountingBeforeInstrument(lua_State* lua, void* context, const Path& path);
+
+        /**
+         * This is the instrumentation to apply at the end of each Lua
+         * function call, when CountingBeforeInstrument is applied at the
+         * beginning of each Lua function call.
+         *
+         * @param[in,out] lua
+         *     This points to the Lua interpreter's state.
+         *
+         * @param[in,out] context
+         *     This points to context information shared by the
+         *     instrumentation, which must be the value returned by the
+         *     GetDefaultContext method.
+         *
+         * @param[in] path
+         *     This represents the path to the Lua function being instrumented,
+         *     from a reference point such as the global Lua variables.
+         */
+        static void CountingAfterInstrument(lua_State* lua, void* context, const Path& path);
+
         /**
          * Return the context to use when using the default
          * before/after instruments.
@@ -297,12 +1153,197 @@ namespace MoonClock {
          * to measure real time.  It must be called before
          * StartInstrumentation if the default instruments are used.
          *
+         * @note
+         *     If the stall detector is enabled (see SetStallDetectorOptions),
+         *     the clock is also used from the stall detector thread, at the
+         *     same time as from the thread running Lua, so it must be
+         *     thread-safe.
+         *
          * @param[in] clock
          *     This is the object the default instruments should use
          *     to measure real time.
          */
         void SetClock(std::shared_ptr< Timekeeping::Clock > clock);
 
+        /**
+         * Set the object the default instruments should use to measure
+         * time to a virtual clock, and arrange for the instrumented Lua
+         * interpreter to drive it by the Lua virtual machine instructions
+         * it executes and the blocks of memory it allocates.  This enables
+         * memory tracking, and instruction counting with a granularity of
+         * one unless it's already enabled.  It replaces any clock set by
+         * SetClock, and must be called before StartInstrumentation.
+         *
+         * @note
+         *     The virtual clock advances in steps of the instruction
+         *     counting granularity.
+         *
+         * @param[in] clock
+         *     This is the virtual clock the default instruments should use.
+         */
+        void UseVirtualClock(std::shared_ptr< VirtualClock > clock);
+
+        /**
+         * Configure how the default instruments capture calls which take
+         * longer than expected.  Captured calls are listed in the
+         * slowCalls of the report returned by GenerateReport.
+         *
+         * @param[in] options
+         *     These are the settings to use for capturing slow calls.
+         */
+        void SetSlowCallOptions(const SlowCallOptions& options);
+
+        /**
+         * Enable or disable critical path tracking.  If enabled, the
+         * default instruments find the critical path through each top-level
+         * call (the chain of calls which took the most time) and report
+         * which functions are most often on critical paths.
+         *
+         * @param[in] enable
+         *     This indicates whether or not to track critical paths.
+         *
+         * @param[in] capacity
+         *     This is the maximum number of critical paths kept in the
+         *     report.  Once reached, the oldest critical path is discarded
+         *     whenever a new one is found.
+         */
+        void SetCriticalPathTracking(bool enable, size_t capacity = 100);
+
+        /**
+         * Enable or disable call tree tracking.  If enabled, the default
+         * instruments collect information about calls separately for each
+         * chain of calls leading to them from the top level, rather than
+         * only for each pair of caller and called function.  This is needed
+         * to reconstruct full call stacks, such as for exporting profiles,
+         * but costs more memory for deep or highly recursive code.
+         *
+         * @param[in] enable
+         *     This indicates whether or not to collect the call tree.
+         */
+        void SetCallTreeTracking(bool enable);
+
+        /**
+         * Enable or disable latency histograms.  If enabled, the default
+         * instruments count the calls to each function by how long they
+         * took, in buckets whose limits double from one to the next
+         * (see FunctionInformation::latencyHistogram).
+         *
+         * @param[in] enable
+         *     This indicates whether or not to collect latency histograms.
+         */
+        void SetLatencyHistograms(bool enable);
+
+        /**
+         * Start or stop publishing live statistics about the instrumented
+         * functions in a POSIX shared memory segment, for other processes
+         * (such as moonclock-top) to watch while Lua runs.  The default
+         * instruments update the statistics of a function each time
+         * it returns.  The layout of the segment is declared in
+         * MoonClock/SharedStatistics.hpp.
+         *
+         * @param[in] name
+         *     This is the name of the shared memory segment to create.
+         *     If empty, publishing stops and any segment created
+         *     before is removed.  Creating the segment fails if one
+         *     with the same name already exists.
+         *
+         * @param[in] capacity
+         *     This is the largest number of functions whose statistics
+         *     can be published.  Functions beyond this number
+         *     aren't published.
+         *
+         * @return
+         *     An indication of whether or not the shared memory segment
+         *     was created (or, if the name is empty, removed) is returned.
+         *     It can't be created on systems without POSIX shared memory.
+         */
+        bool SetSharedStatistics(const std::string& name, size_t capacity = 1024);
+
+        /**
+         * Add a latency budget for the default instruments to enforce.
+         * Violations and burn rates are listed in the latencyBudgets of the
+         * report returned by GenerateReport.  If called while Lua functions
+         * are instrumented, the budget is enforced from then on.
+         *
+         * @param[in] budget
+         *     This describes the amount of time calls to a group
+         *     of Lua functions are expected to take.
+         */
+        void AddLatencyBudget(const LatencyBudget& budget);
+
+        /**
+         * Remove all latency budgets previously added.  If called while
+         * Lua functions are instrumented, the latency budgets are also
+         * removed from the report being collected.
+         */
+        void ClearLatencyBudgets();
+
+        /**
+         * Configure the stall detector, which watches for calls which run
+         * for too long without returning.  If enabled, the stall detector
+         * runs in a separate thread from StartInstrumentation until
+         * StopInstrumentation, and only works with the default instruments.
+         * Detected stalls are listed in the stalls of the report returned by
+         * GenerateReport.
+         *
+         * @note
+         *     The stall detector samples the clock set by SetClock from
+         *     its own thread, so the clock must be safe to use concurrently.
+         *
+         * @param[in] options
+         *     These are the settings to use for the stall detector.
+         */
+        void SetStallDetectorOptions(const StallDetectorOptions& options);
+
+        /**
+         * Enable or disable module load profiling.  If enabled, the
+         * package.searchers functions are intercepted from
+         * StartInstrumentation until StopInstrumentation, to measure the
+         * time taken to load each module required, and to instrument the
+         * functions of each module loaded.  The paths of the functions of a
+         * module named "m" start with "require:m".  This is useful for modules
+         * which aren't assigned to global variables.  It must be called before
+         * StartInstrumentation in order to take effect.
+         *
+         * @param[in] enable
+         *     This indicates whether or not to profile module loads.
+         */
+        void SetModuleLoadProfiling(bool enable);
+
+        /**
+         * Enable or disable memory tracking.  If enabled, the allocator
+         * function of the Lua interpreter is wrapped from
+         * StartInstrumentation until StopInstrumentation, to count the
+         * memory allocated and track the peak amount of memory in use.
+         * It must be called before StartInstrumentation in order
+         * to take effect.
+         *
+         * @param[in] enable
+         *     This indicates whether or not to track memory.
+         */
+        void SetMemoryTracking(bool enable);
+
+        /**
+         * Enable or disable instruction counting.  If enabled, a count hook
+         * is set on the Lua interpreter from StartInstrumentation until
+         * StopInstrumentation, to count the Lua virtual machine instructions
+         * executed by each function.  Instruction counts don't depend on the
+         * speed of the machine, which makes them useful for comparing
+         * against baselines.  It must be called before StartInstrumentation
+         * in order to take effect.
+         *
+         * @note
+         *     The hook replaces any other hook set on the Lua interpreter,
+         *     and only applies to coroutines created after
+         *     StartInstrumentation is called.
+         *
+         * @param[in] granularity
+         *     This is the number of instructions to execute between calls
+         *     of the hook.  Smaller values give more exact counts at a higher
+         *     cost.  Zero disables instruction counting.
+         */
+        void SetInstructionCounting(size_t granularity);
+
         /**
          * Attach instruments to all Lua functions.  The default instruments
          * collect the information returned by GenerateReport.  Any Lua
@@ -313,6 +1354,8 @@ namespace MoonClock {
          * @note
          *     If the default instrumentation is used, SetClock must be
          *     called first to provide the means of measuring real time.
+         *     This isn't necessary for the counting instrumentation
+         *     (CountingBeforeInstrument and CountingAfterInstrument).
          *
          * @param[in,out] lua
          *     This points to the Lua interpreter's state.
@@ -337,6 +1380,49 @@ namespace MoonClock {
             void* context = nullptr
         );
 
+        /**
+         * Search the Lua global variables again for functions, such as after
+         * code is reloaded, without restarting the instrumentation.
+         * Functions found which aren't instrumented yet are instrumented,
+         * and functions instrumented before but no longer found have their
+         * instrumentation removed.  Functions still found are left alone,
+         * and all information collected so far is kept.  Calls still in
+         * progress to functions whose instrumentation is removed, such as
+         * in suspended coroutines, are still finished when they return.
+         */
+        void Rescan();
+
+        /**
+         * Compile the given chunk of Lua code and execute it, measuring
+         * the time taken to do each.  This is useful for profiling the
+         * startup of a script, which is normally loaded before the
+         * instrumentation starts.  It must be called between
+         * StartInstrumentation and StopInstrumentation, and uses the Lua
+         * interpreter given to StartInstrumentation.
+         *
+         * Functions assigned to global variables while the chunk executes
+         * are instrumented as soon as they are assigned, so calls made to
+         * them by the top level of the chunk are measured too.  This is done
+         * by temporarily setting a metatable with a __newindex metamethod
+         * on the table of global variables, if it doesn't already have
+         * a metatable.  Global variables are searched again for functions,
+         * as by Rescan, once the chunk has executed.  The information
+         * returned is also added to the chunk loads of the report.
+         *
+         * @param[in] name
+         *     This is the name of the chunk, used in Lua error messages.
+         *
+         * @param[in] chunk
+         *     This is the Lua code (source or precompiled) to load.
+         *
+         * @return
+         *     Information about the loading of the chunk is returned.
+         */
+        ChunkLoadInformation LoadChunk(
+            const std::string& name,
+            const std::string& chunk
+        );
+
         /**
          * Remove any instrumentation applied by the last StartInstrumentation
          * function call.
@@ -0,0 +1,164 @@
+#pragma once
+
+/**
+ * @file PoolAllocator.hpp
+ *
+ * This module declares the MoonClock::PoolAllocator class.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include <memory>
+#include <stddef.h>
+
+/**
+ * Forward-declare the Lua interpreter state structure in order to correctly
+ * specify the interface without requiring the user to know the implementation.
+ */
+struct lua_State;
+
+namespace MoonClock {
+
+    /**
+     * This is a memory allocator for Lua interpreters which serves small
+     * blocks of memory from pools, one for each of a number of size classes,
+     * and passes larger requests on to the C library's allocator.
+     *
+     * Lua makes many small allocations (strings, tables, closures, upvalues)
+     * which are freed soon after, so recycling blocks of the same size
+     * from a free list is much cheaper than going to the general-purpose
+     * allocator every time.  Since Lua tells the allocator the size of
+     * every block it reallocates or frees, blocks carry no headers.
+     *
+     * An allocator is not thread-safe.  Give each Lua interpreter (and so
+     * each thread running one) its own allocator.  The allocator must
+     * outlive the Lua interpreters using it.
+     */
+    class PoolAllocator {
+        // Types
+    public:
+        /**
+         * This holds counters kept by the allocator.
+         */
+        struct Statistics {
+            /**
+             * This is the number of blocks currently allocated from pools.
+             */
+            size_t numPooledBlocks = 0;
+
+            /**
+             * This is the number of blocks currently allocated from
+             * the C library's allocator because they are too large
+             * for the pools.
+             */
+            size_t numLargeBlocks = 0;
+
+            /**
+             * This is the number of bytes currently allocated,
+             * as requested by Lua.
+             */
+            size_t bytesAllocated = 0;
+
+            /**
+             * This is the number of bytes obtained from the C library's
+             * allocator to carve into pooled blocks.
+             */
+            size_t bytesReserved = 0;
+        };
+
+        // Constants
+    public:
+        /**
+         * This is the granularity of the size classes, in bytes.
+         * It's also the alignment of pooled blocks.
+         */
+        static constexpr size_t SIZE_CLASS_GRANULARITY = 16;
+
+        /**
+         * This is the size, in bytes, of the largest block served from
+         * a pool.  Larger blocks come from the C library's allocator.
+         */
+        static constexpr size_t MAX_POOLED_SIZE = 256;
+
+        /**
+         * This is the size, in bytes, of each slab of memory obtained
+         * from the C library's allocator to be carved into pooled blocks.
+         */
+        static constexpr size_t SLAB_SIZE = 64 * 1024;
+
+        // Lifecycle management
+        //
+        // The allocator can't be moved, because Lua interpreters using it
+        // hold a pointer to it.
+    public:
+        ~PoolAllocator() noexcept;
+        PoolAllocator(const PoolAllocator&) = delete;
+        PoolAllocator(PoolAllocator&&) noexcept = delete;
+        PoolAllocator& operator=(const PoolAllocator&) = delete;
+        PoolAllocator& operator=(PoolAllocator&&) noexcept = delete;
+
+        // Public methods
+    public:
+        /**
+         * This is the default constructor for the class.
+         */
+        PoolAllocator();
+
+        /**
+         * This is the function to give to lua_newstate or lua_setallocf,
+         * along with a pointer to the allocator as the "ud" pointer.
+         *
+         * @param[in] ud
+         *     This points to the PoolAllocator to use.
+         *
+         * @param[in] ptr
+         *     If not NULL, this points to the memory block to be
+         *     freed or reallocated.
+         *
+         * @param[in] osize
+         *     This is the size of the memory block pointed to by "ptr".
+         *
+         * @param[in] nsize
+         *     This is the number of bytes of memory to allocate or
+         *     reallocate, or zero if the given block should be freed instead.
+         *
+         * @return
+         *     A pointer to the allocated or reallocated memory block is
+         *     returned, or NULL is returned if the given memory block was
+         *     freed or the memory could not be allocated.
+         */
+        static void* Allocate(void* ud, void* ptr, size_t osize, size_t nsize);
+
+        /**
+         * Create a new Lua interpreter which uses the allocator.
+         *
+         * @return
+         *     The new Lua interpreter is returned, or nullptr is returned
+         *     if it couldn't be created.
+         */
+        lua_State* NewState();
+
+        /**
+         * Return the counters kept by the allocator.
+         *
+         * @return
+         *     The counters kept by the allocator are returned.
+         */
+        Statistics GetStatistics() const;
+
+        // Private properties
+    private:
+        /**
+         * This is the type of structure that contains the private
+         * properties of the instance.  It is defined in the implementation
+         * and declared here to ensure that it is scoped inside the class.
+         */
+        struct Impl;
+
+        /**
+         * This contains the private properties of the instance.
+         */
+        std::unique_ptr< Impl > impl_;
+    };
+
+}
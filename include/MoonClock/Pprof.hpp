@@ -0,0 +1,51 @@
+#pragma once
+
+/**
+ * @file Pprof.hpp
+ *
+ * This module declares the function which exports a MoonClock::Report
+ * as a profile in the format used by the pprof tools.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include <MoonClock/MoonClock.hpp>
+#include <string>
+
+namespace MoonClock {
+
+    /**
+     * Encode the given report as a profile in the format read by the pprof
+     * tools ("go tool pprof" and others): an uncompressed protocol buffer
+     * of the perftools.profiles.Profile message.  Each sample has these
+     * values, in this order:
+     * - calls (count): the number of calls made through the sample's stack
+     * - wall (nanoseconds): the time spent in the function at the top of
+     *   the sample's stack, not including the instrumented functions
+     *   it called
+     * - alloc_objects (count) and alloc_space (bytes): the memory allocated
+     *   by the function at the top of the sample's stack, not including
+     *   the instrumented functions it called
+     * - instructions (count): the Lua virtual machine instructions executed
+     *   by the function at the top of the sample's stack, not including
+     *   the instrumented functions it called
+     *
+     * If the report has a call tree (see MoonClock::SetCallTreeTracking),
+     * there is a sample for each node of the call tree, with its full call
+     * stack.  Otherwise, there is a sample for each function with only the
+     * function itself on the stack.  Functions and locations refer to the
+     * source where each function was defined, when known.
+     *
+     * @note
+     *     Lua functions aren't sampled, so there are no CPU time values;
+     *     "wall" holds the time measured by the default instruments.
+     *
+     * @param[in] report
+     *     This is the report to encode.
+     *
+     * @return
+     *     The encoded profile is returned.
+     */
+    std::string EncodePprofProfile(const Report& report);
+
+}
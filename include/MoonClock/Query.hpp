@@ -0,0 +1,392 @@
+#pragma once
+
+/**
+ * @file Query.hpp
+ *
+ * This module declares functions which answer common questions about
+ * a MoonClock::Report, such as which functions took the most time,
+ * without the caller having to walk and sort the whole report.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include <functional>
+#include <map>
+#include <MoonClock/MoonClock.hpp>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace MoonClock {
+
+    /**
+     * This refers to the information about one function in a report.
+     */
+    using FunctionReference = std::map< Path, FunctionInformation >::const_iterator;
+
+    /**
+     * These are the quantities by which functions may be ranked.
+     */
+    enum class Metric {
+        /**
+         * This is the number of times the function was called.
+         */
+        Calls,
+
+        /**
+         * This is the total time elapsed during all calls to the function,
+         * including the functions it called.
+         */
+        TotalTime,
+
+        /**
+         * This is the total time elapsed during all calls to the function,
+         * not including the time accounted for by the instrumented
+         * functions it called.  See GetSelfTime.
+         */
+        SelfTime,
+
+        /**
+         * This is the time elapsed during the slowest call to the function.
+         */
+        MaxTime,
+
+        /**
+         * This is the number of blocks of memory allocated
+         * during all calls to the function.
+         */
+        Allocations,
+
+        /**
+         * This is the number of bytes allocated during all calls
+         * to the function.
+         */
+        BytesAllocated,
+
+        /**
+         * This is the number of Lua virtual machine instructions
+         * executed during all calls to the function.
+         */
+        Instructions,
+    };
+
+    /**
+     * This holds one function selected by GetTopFunctions, along with
+     * the value of the metric by which it was ranked.
+     */
+    struct RankedFunction {
+        /**
+         * This refers to the information about the function.
+         */
+        FunctionReference function;
+
+        /**
+         * This is the value of the metric by which the function was ranked.
+         */
+        double value = 0.0;
+    };
+
+    /**
+     * This is a view of the functions in a report whose paths share
+     * a common prefix.  Since paths in a report are kept in order, these
+     * functions are all next to each other, so the view simply holds
+     * the range of them.
+     */
+    struct FunctionRange {
+        /**
+         * This refers to the first function in the range.
+         */
+        FunctionReference first;
+
+        /**
+         * This refers to the function just past the last function
+         * in the range.
+         */
+        FunctionReference last;
+
+        /**
+         * Return the first function in the range.
+         *
+         * @return
+         *     The first function in the range is returned.
+         */
+        FunctionReference begin() const;
+
+        /**
+         * Return the function just past the last function in the range.
+         *
+         * @return
+         *     The function just past the last function in the range
+         *     is returned.
+         */
+        FunctionReference end() const;
+
+        /**
+         * Determine whether or not the range is empty.
+         *
+         * @return
+         *     An indication of whether or not the range is empty
+         *     is returned.
+         */
+        bool empty() const;
+    };
+
+    /**
+     * This holds information about a group of functions, such as all the
+     * functions of a library, treated as though they were one function.
+     */
+    struct RollupInformation {
+        /**
+         * This is the number of functions in the group.
+         */
+        size_t numFunctions = 0;
+
+        /**
+         * This is the number of times the group was entered, which is
+         * the number of calls to functions in the group, other than
+         * calls made from functions in the group.
+         */
+        size_t numCalls = 0;
+
+        /**
+         * This is the total time elapsed, in seconds, while the group
+         * was entered.  Calls between functions in the group are
+         * not counted twice.
+         */
+        double totalTime = 0.0;
+
+        /**
+         * This is the total time elapsed, in seconds, in functions of the
+         * group, not including the time accounted for by instrumented
+         * functions outside the group which they called.
+         */
+        double selfTime = 0.0;
+    };
+
+    /**
+     * This holds the costs of a function, or of a node of the call tree,
+     * not including the costs accounted for by the instrumented functions
+     * it called.
+     */
+    struct SelfCosts {
+        /**
+         * This is the time elapsed, in seconds.
+         */
+        double time = 0.0;
+
+        /**
+         * This is the number of blocks of memory newly allocated.
+         */
+        size_t numAllocations = 0;
+
+        /**
+         * This is the number of bytes of memory newly allocated.
+         */
+        size_t bytesAllocated = 0;
+
+        /**
+         * This is the number of Lua virtual machine instructions executed.
+         */
+        size_t numInstructions = 0;
+    };
+
+    /**
+     * Return the time elapsed during all calls to the given function,
+     * not including the time accounted for by the instrumented functions
+     * it called.
+     *
+     * @note
+     *     For recursive functions, the time of the inner calls is counted
+     *     both in the total time of the function and as time accounted for
+     *     by a function it called, so the self time is only approximate.
+     *
+     * @param[in] functionInfo
+     *     This is the information about the function.
+     *
+     * @return
+     *     The self time of the function, in seconds, is returned.
+     */
+    double GetSelfTime(const FunctionInformation& functionInfo);
+
+    /**
+     * Return the costs of all calls to the given function, not including
+     * the costs accounted for by the instrumented functions it called.
+     * Costs which would come out negative, such as for recursive
+     * functions (see GetSelfTime), are returned as zero.
+     *
+     * @param[in] functionInfo
+     *     This is the information about the function.
+     *
+     * @return
+     *     The self costs of the function are returned.
+     */
+    SelfCosts GetSelfCosts(const FunctionInformation& functionInfo);
+
+    /**
+     * Return the costs of the given node of the call tree of the given
+     * report, not including the costs of its children.  Costs which would
+     * come out negative, from rounding, are returned as zero.
+     *
+     * @param[in] report
+     *     This is the report holding the call tree.
+     *
+     * @param[in] node
+     *     This is the index of the node in the call tree.
+     *
+     * @return
+     *     The self costs of the node are returned.
+     */
+    SelfCosts GetSelfCosts(const Report& report, size_t node);
+
+    /**
+     * Convert the given time to a whole number of nanoseconds,
+     * as used by the profile formats MoonClock exports.
+     *
+     * @param[in] seconds
+     *     This is the time to convert, in seconds.
+     *
+     * @return
+     *     The time, in nanoseconds, is returned.  Negative times,
+     *     which can result from rounding, are returned as zero.
+     */
+    uint64_t ToNanoseconds(double seconds);
+
+    /**
+     * Return the value of the given metric for the given function.
+     *
+     * @param[in] functionInfo
+     *     This is the information about the function.
+     *
+     * @param[in] metric
+     *     This selects the metric to return.
+     *
+     * @return
+     *     The value of the given metric for the given function is returned.
+     */
+    double GetMetric(const FunctionInformation& functionInfo, Metric metric);
+
+    /**
+     * Return a view of all the functions in the given report whose paths
+     * start with the given prefix.  This takes time logarithmic in the
+     * number of functions in the report.
+     *
+     * @param[in] report
+     *     This is the report holding the functions.
+     *
+     * @param[in] prefix
+     *     This is the prefix of the paths of the functions to select.
+     *     An empty prefix selects every function.
+     *
+     * @return
+     *     A view of the selected functions is returned.
+     */
+    FunctionRange GetFunctionsWithPrefix(const Report& report, const Path& prefix);
+
+    /**
+     * Return all the functions in the given report whose paths match the
+     * given pattern (see PathMatchesPattern), in order of their paths.
+     * Only the functions whose paths start with the keys of the pattern
+     * before its first wildcard are examined.
+     *
+     * @param[in] report
+     *     This is the report holding the functions.
+     *
+     * @param[in] pattern
+     *     This is the pattern matching the paths of the functions to select.
+     *
+     * @return
+     *     The selected functions are returned.
+     */
+    std::vector< FunctionReference > GetFunctionsMatching(
+        const Report& report,
+        const std::string& pattern
+    );
+
+    /**
+     * Return all the functions in the given report for which the given
+     * filter returns true, in order of their paths.
+     *
+     * @param[in] report
+     *     This is the report holding the functions.
+     *
+     * @param[in] filter
+     *     This is called for each function in the report, to determine
+     *     whether or not to select it.
+     *
+     * @return
+     *     The selected functions are returned.
+     */
+    std::vector< FunctionReference > FilterFunctions(
+        const Report& report,
+        std::function< bool(const Path& path, const FunctionInformation& functionInfo) > filter
+    );
+
+    /**
+     * Return the functions in the given report with the largest values of
+     * the given metric, in descending order of the metric.  Functions with
+     * equal values are listed in order of their paths.  Only the top
+     * functions are fully sorted.
+     *
+     * @param[in] report
+     *     This is the report holding the functions.
+     *
+     * @param[in] metric
+     *     This selects the metric by which to rank the functions.
+     *
+     * @param[in] n
+     *     This is the largest number of functions to return.
+     *
+     * @param[in] prefix
+     *     If not empty, only functions whose paths start with this
+     *     prefix are ranked.
+     *
+     * @return
+     *     The top functions are returned.
+     */
+    std::vector< RankedFunction > GetTopFunctions(
+        const Report& report,
+        Metric metric,
+        size_t n,
+        const Path& prefix = {}
+    );
+
+    /**
+     * Return the top functions, as GetTopFunctions does,
+     * from among the given functions.
+     *
+     * @param[in] functions
+     *     These are the functions to rank.
+     *
+     * @param[in] metric
+     *     This selects the metric by which to rank the functions.
+     *
+     * @param[in] n
+     *     This is the largest number of functions to return.
+     *
+     * @return
+     *     The top functions are returned.
+     */
+    std::vector< RankedFunction > GetTopFunctions(
+        const std::vector< FunctionReference >& functions,
+        Metric metric,
+        size_t n
+    );
+
+    /**
+     * Combine the information about all the functions in the given report
+     * whose paths start with the given prefix, such as all the functions of
+     * the "string" library, treating them as though they were one function.
+     *
+     * @param[in] report
+     *     This is the report holding the functions.
+     *
+     * @param[in] prefix
+     *     This is the prefix of the paths of the functions to combine.
+     *
+     * @return
+     *     The combined information about the functions is returned.
+     */
+    RollupInformation RollUp(const Report& report, const Path& prefix);
+
+}
@@ -0,0 +1,379 @@
+#pragma once
+
+/**
+ * @file SharedStatistics.hpp
+ *
+ * This module declares the layout of the shared memory segment in which
+ * MoonClock publishes live statistics about Lua functions for other
+ * processes to watch, along with the MoonClock::SharedStatisticsWriter
+ * and MoonClock::SharedStatisticsReader classes which use it.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include <atomic>
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace MoonClock {
+
+    /**
+     * This identifies a shared memory segment holding MoonClock statistics.
+     * It spells "MCLK" in ASCII.
+     */
+    constexpr uint32_t SHARED_STATISTICS_MAGIC = 0x4D434C4B;
+
+    /**
+     * This is the version of the layout of the shared memory segment.
+     * It is changed whenever the layout changes, so that readers never
+     * misinterpret a segment written by a different version of MoonClock.
+     */
+    constexpr uint32_t SHARED_STATISTICS_VERSION = 1;
+
+    /**
+     * This is the size of the space for the name of each function in the
+     * shared memory segment, including the terminating null character.
+     * Longer names are cut short.
+     */
+    constexpr size_t SHARED_STATISTICS_NAME_SIZE = 112;
+
+    /**
+     * This is found at the start of the shared memory segment.
+     * All fields except numEntries are written once, when the segment
+     * is created, before any reader can open it.
+     */
+    struct SharedStatisticsHeader {
+        /**
+         * This is always SHARED_STATISTICS_MAGIC.
+         */
+        uint32_t magic;
+
+        /**
+         * This is the SHARED_STATISTICS_VERSION of the writer.
+         */
+        uint32_t version;
+
+        /**
+         * This is the size of the header, in bytes.
+         */
+        uint32_t headerSize;
+
+        /**
+         * This is the size of each entry, in bytes.
+         */
+        uint32_t entrySize;
+
+        /**
+         * This is the number of entries for which there is space
+         * in the segment, following the header.
+         */
+        uint32_t capacity;
+
+        /**
+         * This is the identifier of the process writing the segment.
+         */
+        uint32_t processId;
+
+        /**
+         * This is the number of entries in use.  Each entry is fully
+         * set up before this is increased to include it.
+         */
+        std::atomic< uint32_t > numEntries;
+
+        /**
+         * This is not used, and keeps the entries aligned.
+         */
+        uint32_t reserved;
+    };
+
+    /**
+     * This holds the statistics of one function in the shared memory
+     * segment.  The name is written once, before the entry is counted
+     * in the header.  The statistics are protected by a sequence lock:
+     * the writer makes the sequence number odd before changing them and
+     * even again afterwards, so a reader knows its copy is consistent if
+     * the sequence number was even and didn't change while it was copying.
+     */
+    struct SharedStatisticsEntry {
+        /**
+         * This is the sequence number of the statistics.
+         */
+        std::atomic< uint32_t > sequence;
+
+        /**
+         * This is not used, and keeps the statistics aligned.
+         */
+        uint32_t reserved;
+
+        /**
+         * This is the path to the function, with its keys separated
+         * by periods, as a null-terminated string.
+         */
+        char name[SHARED_STATISTICS_NAME_SIZE];
+
+        /**
+         * This is the number of times the function was called.
+         */
+        std::atomic< uint64_t > numCalls;
+
+        /**
+         * This is the total amount of time elapsed, in nanoseconds,
+         * during all calls to the function which have returned.
+         */
+        std::atomic< uint64_t > totalNanoseconds;
+
+        /**
+         * This is the amount of time elapsed, in nanoseconds,
+         * during the call which took the most amount of time.
+         */
+        std::atomic< uint64_t > maxNanoseconds;
+
+        /**
+         * This is the number of blocks of memory newly allocated
+         * during all calls to the function, if memory is tracked.
+         */
+        std::atomic< uint64_t > numAllocations;
+
+        /**
+         * This is the number of bytes newly allocated during all calls
+         * to the function, if memory is tracked.
+         */
+        std::atomic< uint64_t > bytesAllocated;
+
+        /**
+         * This is the number of Lua virtual machine instructions executed
+         * during all calls to the function, if instructions are counted.
+         */
+        std::atomic< uint64_t > numInstructions;
+    };
+
+    /**
+     * This is a consistent copy of the statistics of one function
+     * read from a shared memory segment.
+     */
+    struct SharedFunctionStatistics {
+        /**
+         * This is the path to the function, with its keys
+         * separated by periods.
+         */
+        std::string name;
+
+        /**
+         * This is the number of times the function was called.
+         */
+        uint64_t numCalls = 0;
+
+        /**
+         * This is the total amount of time elapsed, in seconds,
+         * during all calls to the function which have returned.
+         */
+        double totalTime = 0.0;
+
+        /**
+         * This is the amount of time elapsed, in seconds, during
+         * the call which took the most amount of time.
+         */
+        double maxTime = 0.0;
+
+        /**
+         * This is the number of blocks of memory newly allocated
+         * during all calls to the function.
+         */
+        uint64_t numAllocations = 0;
+
+        /**
+         * This is the number of bytes newly allocated during
+         * all calls to the function.
+         */
+        uint64_t bytesAllocated = 0;
+
+        /**
+         * This is the number of Lua virtual machine instructions
+         * executed during all calls to the function.
+         */
+        uint64_t numInstructions = 0;
+    };
+
+    /**
+     * This creates a POSIX shared memory segment and publishes statistics
+     * about functions in it.  All statistics must be published from the
+     * same thread.  On systems without POSIX shared memory, the segment
+     * can't be created.
+     */
+    class SharedStatisticsWriter {
+        // Lifecycle management
+    public:
+        ~SharedStatisticsWriter() noexcept;
+        SharedStatisticsWriter(const SharedStatisticsWriter&) = delete;
+        SharedStatisticsWriter(SharedStatisticsWriter&&) noexcept;
+        SharedStatisticsWriter& operator=(const SharedStatisticsWriter&) = delete;
+        SharedStatisticsWriter& operator=(SharedStatisticsWriter&&) noexcept;
+
+        // Public methods
+    public:
+        /**
+         * This is the default constructor for the class.
+         */
+        SharedStatisticsWriter();
+
+        /**
+         * Create the shared memory segment with the given name, closing
+         * any segment created before by this writer.
+         *
+         * This fails if a segment with the given name already exists,
+         * such as one another process is publishing in, rather than
+         * taking it over.  A segment left behind by a process which
+         * didn't exit cleanly must be removed before its name
+         * can be used again.
+         *
+         * @param[in] name
+         *     This is the name of the shared memory segment.  A slash is
+         *     put at the front of the name if it doesn't already start
+         *     with one.
+         *
+         * @param[in] capacity
+         *     This is the largest number of functions whose statistics
+         *     can be published in the segment.
+         *
+         * @return
+         *     An indication of whether or not the segment
+         *     was created is returned.
+         */
+        bool Create(const std::string& name, size_t capacity);
+
+        /**
+         * Remove the shared memory segment created by the writer, if any.
+         * Readers which have it open may continue to read it.
+         */
+        void Close();
+
+        /**
+         * Return the index of the entry for the function with the given
+         * name, adding an entry for it if it doesn't already have one.
+         *
+         * @param[in] name
+         *     This is the path to the function, with its keys
+         *     separated by periods.
+         *
+         * @param[out] index
+         *     This is where to store the index of the entry.
+         *
+         * @return
+         *     An indication of whether or not the function has an entry
+         *     is returned.  This is false if no segment is open, or if the
+         *     segment has no space left for another entry.
+         */
+        bool FindEntry(const std::string& name, size_t& index);
+
+        /**
+         * Publish the given statistics of the function with the given entry.
+         *
+         * @param[in] index
+         *     This is the index of the entry of the function,
+         *     as returned by FindEntry.
+         *
+         * @param[in] statistics
+         *     These are the statistics to publish.  The name is ignored.
+         */
+        void Publish(size_t index, const SharedFunctionStatistics& statistics);
+
+        // Private properties
+    private:
+        /**
+         * This is the type of structure that contains the private
+         * properties of the instance.  It is defined in the implementation
+         * and declared here to ensure that it is scoped inside the class.
+         */
+        struct Impl;
+
+        /**
+         * This contains the private properties of the instance.
+         */
+        std::unique_ptr< Impl > impl_;
+    };
+
+    /**
+     * This opens a shared memory segment created by a
+     * SharedStatisticsWriter, without the ability to change it,
+     * and reads consistent copies of the statistics in it.
+     */
+    class SharedStatisticsReader {
+        // Lifecycle management
+    public:
+        ~SharedStatisticsReader() noexcept;
+        SharedStatisticsReader(const SharedStatisticsReader&) = delete;
+        SharedStatisticsReader(SharedStatisticsReader&&) noexcept;
+        SharedStatisticsReader& operator=(const SharedStatisticsReader&) = delete;
+        SharedStatisticsReader& operator=(SharedStatisticsReader&&) noexcept;
+
+        // Public methods
+    public:
+        /**
+         * This is the default constructor for the class.
+         */
+        SharedStatisticsReader();
+
+        /**
+         * Open the shared memory segment with the given name,
+         * closing any segment opened before by this reader.
+         *
+         * @param[in] name
+         *     This is the name of the shared memory segment.  A slash is
+         *     put at the front of the name if it doesn't already start
+         *     with one.
+         *
+         * @param[out] errorMessage
+         *     If the segment can't be opened, or has the wrong layout,
+         *     this is where to store a description of the problem.
+         *
+         * @return
+         *     An indication of whether or not the segment
+         *     was opened is returned.
+         */
+        bool Open(const std::string& name, std::string& errorMessage);
+
+        /**
+         * Close the shared memory segment opened by the reader, if any.
+         */
+        void Close();
+
+        /**
+         * Return the identifier of the process writing the segment.
+         *
+         * @return
+         *     The identifier of the process writing the segment is
+         *     returned, or zero if no segment is open.
+         */
+        unsigned int GetProcessId() const;
+
+        /**
+         * Read consistent copies of the statistics of all the functions
+         * in the segment.
+         *
+         * @return
+         *     The statistics of all the functions in the segment,
+         *     in the order they were added, are returned.  Any function
+         *     whose statistics couldn't be copied consistently, such as
+         *     because the writer stopped while changing them, is left out.
+         */
+        std::vector< SharedFunctionStatistics > Read() const;
+
+        // Private properties
+    private:
+        /**
+         * This is the type of structure that contains the private
+         * properties of the instance.  It is defined in the implementation
+         * and declared here to ensure that it is scoped inside the class.
+         */
+        struct Impl;
+
+        /**
+         * This contains the private properties of the instance.
+         */
+        std::unique_ptr< Impl > impl_;
+    };
+
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+/**
+ * @file VirtualClock.hpp
+ *
+ * This module declares the MoonClock::VirtualClock class.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include <memory>
+#include <stddef.h>
+#include <Timekeeping/Clock.hpp>
+
+namespace MoonClock {
+
+    /**
+     * This is a clock which, rather than measuring real time, advances
+     * by a fixed cost for each Lua virtual machine instruction executed
+     * and each block of memory allocated by a Lua interpreter.  Times
+     * measured with it are a deterministic function of the code executed,
+     * so reports made with it can be compared exactly from one run to
+     * the next, regardless of the speed or load of the machine.
+     *
+     * Give the clock to MoonClock::UseVirtualClock, which arranges for
+     * the instrumented Lua interpreter to drive it.  Time spent in C
+     * functions called from Lua, other than in allocating memory,
+     * does not advance the clock.
+     *
+     * The clock may be read from any thread.
+     */
+    class VirtualClock
+        : public Timekeeping::Clock
+    {
+        // Lifecycle management
+    public:
+        ~VirtualClock() noexcept;
+        VirtualClock(const VirtualClock&) = delete;
+        VirtualClock(VirtualClock&&) noexcept;
+        VirtualClock& operator=(const VirtualClock&) = delete;
+        VirtualClock& operator=(VirtualClock&&) noexcept;
+
+        // Public methods
+    public:
+        /**
+         * This is the default constructor for the class.
+         *
+         * @param[in] secondsPerInstruction
+         *     This is the amount by which to advance the clock
+         *     for each Lua virtual machine instruction executed.
+         *
+         * @param[in] secondsPerAllocation
+         *     This is the amount by which to advance the clock
+         *     for each block of memory allocated.
+         */
+        VirtualClock(
+            double secondsPerInstruction = 1e-8,
+            double secondsPerAllocation = 1e-7
+        );
+
+        /**
+         * Advance the clock by the cost of the given number of
+         * Lua virtual machine instructions.
+         *
+         * @param[in] numInstructions
+         *     This is the number of instructions executed.
+         */
+        void CountInstructions(size_t numInstructions);
+
+        /**
+         * Advance the clock by the cost of the given number of
+         * blocks of memory allocated.
+         *
+         * @param[in] numAllocations
+         *     This is the number of blocks of memory allocated.
+         */
+        void CountAllocations(size_t numAllocations);
+
+        /**
+         * Return the number of Lua virtual machine instructions
+         * counted by the clock.
+         *
+         * @return
+         *     The number of Lua virtual machine instructions
+         *     counted by the clock is returned.
+         */
+        size_t GetInstructionCount() const;
+
+        /**
+         * Return the number of blocks of memory allocated
+         * counted by the clock.
+         *
+         * @return
+         *     The number of blocks of memory allocated
+         *     counted by the clock is returned.
+         */
+        size_t GetAllocationCount() const;
+
+        // Timekeeping::Clock
+    public:
+        virtual double GetCurrentTime() override;
+
+        // Private properties
+    private:
+        /**
+         * This is the type of structure that contains the private
+         * properties of the instance.  It is defined in the implementation
+         * and declared here to ensure that it is scoped inside the class.
+         */
+        struct Impl;
+
+        /**
+         * This contains the private properties of the instance.
+         */
+        std::unique_ptr< Impl > impl_;
+    };
+
+}
@@ -0,0 +1,202 @@
+/**
+ * @file Callgrind.cpp
+ *
+ * This module contains the implementation of the function which exports
+ * a MoonClock::Report as a profile in the Callgrind format.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include <algorithm>
+#include <map>
+#include <MoonClock/Callgrind.hpp>
+#include <MoonClock/Query.hpp>
+#include <sstream>
+#include <stdint.h>
+#include <StringExtensions/StringExtensions.hpp>
+
+namespace {
+
+    /**
+     * This is the name given to the source file of functions
+     * whose source isn't known.
+     */
+    const std::string UNKNOWN_SOURCE = "???";
+
+    /**
+     * This assigns short identifiers to names, such as file and function
+     * names, so that each name is only written out in full once.
+     */
+    struct NameCompressor {
+        // Properties
+
+        /**
+         * This holds the identifier assigned to each name
+         * written out so far.
+         */
+        std::map< std::string, size_t > ids;
+
+        // Methods
+
+        /**
+         * Return the text to write in place of the given name.  The first
+         * time a name is given, this is its new identifier followed by the
+         * name itself.  After that, this is just its identifier.
+         *
+         * @param[in] name
+         *     This is the name to write.
+         *
+         * @return
+         *     The text to write in place of the given name is returned.
+         */
+        std::string Compress(const std::string& name) {
+            const auto id = ids.find(name);
+            if (id != ids.end()) {
+                return StringExtensions::sprintf("(%zu)", id->second);
+            }
+            const auto newId = ids.size() + 1;
+            ids[name] = newId;
+            return StringExtensions::sprintf("(%zu) %s", newId, name.c_str());
+        }
+    };
+
+    /**
+     * This holds the costs of one function or call, in the order of
+     * the events of the profile.
+     */
+    struct Costs {
+        /**
+         * This is the time elapsed, in nanoseconds.
+         */
+        uint64_t time = 0;
+
+        /**
+         * This is the number of Lua virtual machine instructions executed.
+         */
+        uint64_t instructions = 0;
+
+        /**
+         * This is the number of blocks of memory allocated.
+         */
+        uint64_t allocations = 0;
+
+        /**
+         * This is the number of bytes allocated.
+         */
+        uint64_t bytes = 0;
+    };
+
+    /**
+     * Write a line of the profile giving the given costs
+     * at the given line of source.
+     *
+     * @param[in,out] output
+     *     This is where to write the line.
+     *
+     * @param[in] line
+     *     This is the line of source to which the costs apply.
+     *
+     * @param[in] costs
+     *     These are the costs to write.
+     */
+    void WriteCosts(
+        std::ostringstream& output,
+        int line,
+        const Costs& costs
+    ) {
+        output
+            << line
+            << ' ' << costs.time
+            << ' ' << costs.instructions
+            << ' ' << costs.allocations
+            << ' ' << costs.bytes
+            << '\n';
+    }
+
+}
+
+namespace MoonClock {
+
+    std::string FormatCallgrindProfile(const Report& report) {
+        std::ostringstream output;
+        output
+            << "# callgrind format\n"
+            << "version: 1\n"
+            << "creator: MoonClock\n"
+            << "positions: line\n"
+            << "event: Time : Time (ns)\n"
+            << "event: Ir : Lua Instructions\n"
+            << "event: Allocs : Allocations\n"
+            << "event: Bytes : Bytes Allocated\n"
+            << "events: Time Ir Allocs Bytes\n";
+        Costs totals;
+        totals.time = ToNanoseconds(report.totalTime);
+        totals.instructions = report.numInstructions;
+        totals.allocations = report.memory.numAllocations;
+        totals.bytes = report.memory.bytesAllocated;
+        output
+            << "summary: " << totals.time
+            << ' ' << totals.instructions
+            << ' ' << totals.allocations
+            << ' ' << totals.bytes
+            << "\n";
+
+        // Write each function called, with the calls it made.
+        NameCompressor files;
+        NameCompressor functions;
+        const auto getSourceInfo = [&report](const Path& path){
+            SourceInformation sourceInfo;
+            const auto sourceInfoEntry = report.sources.find(path);
+            if (sourceInfoEntry != report.sources.end()) {
+                sourceInfo = sourceInfoEntry->second;
+            }
+            if (sourceInfo.source.empty()) {
+                sourceInfo.source = UNKNOWN_SOURCE;
+            }
+            return sourceInfo;
+        };
+        for (const auto& functionInfoEntry: report.functionInfo) {
+            const auto& functionInfo = functionInfoEntry.second;
+            if (functionInfo.numCalls == 0) {
+                continue;
+            }
+            const auto sourceInfo = getSourceInfo(functionInfoEntry.first);
+            output
+                << "\nfl=" << files.Compress(sourceInfo.source)
+                << "\nfn=" << functions.Compress(StringExtensions::Join(functionInfoEntry.first, "."))
+                << "\n";
+
+            // The exclusive costs of the function are what's left of its
+            // inclusive costs after taking out the costs of its calls.
+            const auto functionSelfCosts = GetSelfCosts(functionInfo);
+            Costs selfCosts;
+            selfCosts.time = ToNanoseconds(functionSelfCosts.time);
+            selfCosts.instructions = functionSelfCosts.numInstructions;
+            selfCosts.allocations = functionSelfCosts.numAllocations;
+            selfCosts.bytes = functionSelfCosts.bytesAllocated;
+            WriteCosts(output, sourceInfo.lineDefined, selfCosts);
+
+            // Write the calls made by the function.
+            for (const auto& callsEntry: functionInfo.calls) {
+                const auto& callsInfo = callsEntry.second;
+                if (callsInfo.numCalls == 0) {
+                    continue;
+                }
+                const auto calleeSourceInfo = getSourceInfo(callsEntry.first);
+                output
+                    << "cfi=" << files.Compress(calleeSourceInfo.source)
+                    << "\ncfn=" << functions.Compress(StringExtensions::Join(callsEntry.first, "."))
+                    << "\ncalls=" << callsInfo.numCalls << ' ' << calleeSourceInfo.lineDefined
+                    << "\n";
+                Costs callCosts;
+                callCosts.time = ToNanoseconds(callsInfo.totalTime);
+                callCosts.instructions = callsInfo.numInstructions;
+                callCosts.allocations = callsInfo.numAllocations;
+                callCosts.bytes = callsInfo.bytesAllocated;
+                WriteCosts(output, sourceInfo.lineDefined, callCosts);
+            }
+        }
+        return output.str();
+    }
+
+}
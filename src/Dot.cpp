@@ -0,0 +1,260 @@
+/**
+ * @file Dot.cpp
+ *
+ * This module contains the implementation of the function which exports
+ * the call graph of a MoonClock::Report in the DOT language.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include <algorithm>
+#include <map>
+#include <math.h>
+#include <MoonClock/Dot.hpp>
+#include <MoonClock/Query.hpp>
+#include <sstream>
+#include <StringExtensions/StringExtensions.hpp>
+
+namespace {
+
+    /**
+     * This is the size of the labels of functions with no self time.
+     */
+    constexpr double MIN_FONT_SIZE = 8.0;
+
+    /**
+     * This is the size of the label of the function with the
+     * most self time.
+     */
+    constexpr double MAX_FONT_SIZE = 32.0;
+
+    /**
+     * This is the width of arrows for calls taking no time.
+     */
+    constexpr double MIN_PEN_WIDTH = 1.0;
+
+    /**
+     * This is the width of arrows for calls taking all the time.
+     */
+    constexpr double MAX_PEN_WIDTH = 6.0;
+
+    /**
+     * Return the given text as a quoted string in the DOT language.
+     * Line breaks become the escape sequence which Graphviz draws
+     * as a centered line break.
+     *
+     * @param[in] text
+     *     This is the text to quote.
+     *
+     * @return
+     *     The quoted text is returned.
+     */
+    std::string Quote(const std::string& text) {
+        std::string quoted = "\"";
+        for (const auto c: text) {
+            if (c == '\n') {
+                quoted += "\\n";
+                continue;
+            }
+            if (
+                (c == '"')
+                || (c == '\\')
+            ) {
+                quoted.push_back('\\');
+            }
+            quoted.push_back(c);
+        }
+        quoted.push_back('"');
+        return quoted;
+    }
+
+    /**
+     * Format the given time, along with the given fraction
+     * of the total time it represents.
+     *
+     * @param[in] time
+     *     This is the time to format, in seconds.
+     *
+     * @param[in] fraction
+     *     This is the fraction of the total time represented by the time.
+     *
+     * @return
+     *     The formatted time is returned.
+     */
+    std::string FormatTime(double time, double fraction) {
+        return StringExtensions::sprintf(
+            "%.3f ms (%.1f%%)",
+            time * 1000.0,
+            fraction * 100.0
+        );
+    }
+
+    /**
+     * Return the color with which to fill the box of a function
+     * with the given share of the largest self time.  Colors run from
+     * a light gray, for no self time, to a dark red.
+     *
+     * @param[in] share
+     *     This is the self time of the function, as a fraction of the
+     *     largest self time of any function in the graph.
+     *
+     * @return
+     *     The color, in the "#rrggbb" form, is returned.
+     */
+    std::string GetFillColor(double share) {
+        share = std::min(std::max(share, 0.0), 1.0);
+        const auto blend = [share](int from, int to){
+            return (int)(from + (to - from) * share + 0.5);
+        };
+        return StringExtensions::sprintf(
+            "#%02x%02x%02x",
+            blend(0xee, 0xb2),
+            blend(0xee, 0x00),
+            blend(0xec, 0x00)
+        );
+    }
+
+}
+
+namespace MoonClock {
+
+    std::string FormatDotGraph(
+        const Report& report,
+        const DotOptions& options
+    ) {
+        // Find the time against which to measure functions and calls.
+        // If the report's own total time isn't known, use the total
+        // self time of all functions instead.
+        std::map< Path, double > selfTimes;
+        double totalSelfTime = 0.0;
+        double maxSelfTime = 0.0;
+        for (const auto& functionInfoEntry: report.functionInfo) {
+            const auto selfTime = GetSelfTime(functionInfoEntry.second);
+            selfTimes[functionInfoEntry.first] = selfTime;
+            totalSelfTime += selfTime;
+            maxSelfTime = std::max(maxSelfTime, selfTime);
+        }
+        const auto totalTime = (
+            (report.totalTime > 0.0)
+            ? report.totalTime
+            : totalSelfTime
+        );
+        const auto fractionOf = [totalTime](double time){
+            return (
+                (totalTime > 0.0)
+                ? (time / totalTime)
+                : 0.0
+            );
+        };
+
+        // Draw the functions above the threshold.
+        std::ostringstream output;
+        output
+            << "digraph MoonClock {\n"
+            << "    node [shape=box, style=filled, fontname=\"Helvetica\"];\n"
+            << "    edge [fontname=\"Helvetica\"];\n";
+        std::map< Path, size_t > nodeIds;
+        size_t numNodesHidden = 0;
+        for (const auto& functionInfoEntry: report.functionInfo) {
+            const auto& functionInfo = functionInfoEntry.second;
+            if (functionInfo.numCalls == 0) {
+                continue;
+            }
+            const auto totalFraction = fractionOf(functionInfo.totalTime);
+            if (totalFraction < options.nodeThreshold) {
+                ++numNodesHidden;
+                continue;
+            }
+            const auto nodeId = nodeIds.size() + 1;
+            nodeIds[functionInfoEntry.first] = nodeId;
+            const auto selfTime = selfTimes[functionInfoEntry.first];
+            const auto share = (
+                (maxSelfTime > 0.0)
+                ? (selfTime / maxSelfTime)
+                : 0.0
+            );
+            const auto label = StringExtensions::sprintf(
+                "%s\nself %s\ntotal %s\n%zu calls",
+                StringExtensions::Join(functionInfoEntry.first, ".").c_str(),
+                FormatTime(selfTime, fractionOf(selfTime)).c_str(),
+                FormatTime(functionInfo.totalTime, totalFraction).c_str(),
+                functionInfo.numCalls
+            );
+            output
+                << "    N" << nodeId
+                << " [label=" << Quote(label)
+                << ", fontsize=" << StringExtensions::sprintf(
+                    "%.1f",
+                    MIN_FONT_SIZE + (MAX_FONT_SIZE - MIN_FONT_SIZE) * sqrt(share)
+                )
+                << ", fillcolor=" << Quote(GetFillColor(share))
+                << "];\n";
+        }
+
+        // Find the most calls between any two functions, against which
+        // the number of calls along each arrow is weighed.
+        size_t maxEdgeCalls = 0;
+        for (const auto& functionInfoEntry: report.functionInfo) {
+            for (const auto& callsEntry: functionInfoEntry.second.calls) {
+                maxEdgeCalls = std::max(maxEdgeCalls, callsEntry.second.numCalls);
+            }
+        }
+
+        // Draw the calls above the threshold between functions drawn.
+        size_t numEdgesHidden = 0;
+        for (const auto& functionInfoEntry: report.functionInfo) {
+            const auto callerId = nodeIds.find(functionInfoEntry.first);
+            for (const auto& callsEntry: functionInfoEntry.second.calls) {
+                const auto& callsInfo = callsEntry.second;
+                if (callsInfo.numCalls == 0) {
+                    continue;
+                }
+                const auto calleeId = nodeIds.find(callsEntry.first);
+                const auto fraction = fractionOf(callsInfo.totalTime);
+                if (
+                    (callerId == nodeIds.end())
+                    || (calleeId == nodeIds.end())
+                    || (fraction < options.edgeThreshold)
+                ) {
+                    ++numEdgesHidden;
+                    continue;
+                }
+                const auto callShare = (double)callsInfo.numCalls / maxEdgeCalls;
+                const auto label = StringExtensions::sprintf(
+                    "%zu calls\n%s",
+                    callsInfo.numCalls,
+                    FormatTime(callsInfo.totalTime, fraction).c_str()
+                );
+                output
+                    << "    N" << callerId->second
+                    << " -> N" << calleeId->second
+                    << " [label=" << Quote(label)
+                    << ", penwidth=" << StringExtensions::sprintf(
+                        "%.2f",
+                        MIN_PEN_WIDTH + (MAX_PEN_WIDTH - MIN_PEN_WIDTH) * std::min(fraction, 1.0)
+                    )
+                    << ", weight=" << (1 + (int)((std::min(fraction, 1.0) + callShare) * 50.0))
+                    << "];\n";
+            }
+        }
+
+        // Note what was left out.
+        if (
+            (numNodesHidden > 0)
+            || (numEdgesHidden > 0)
+        ) {
+            output
+                << "    label=" << Quote(
+                    StringExtensions::sprintf(
+                        "%zu functions and %zu calls below thresholds not shown",
+                        numNodesHidden,
+                        numEdgesHidden
+                    )
+                )
+                << ";\n";
+        }
+        output << "}\n";
+        return output.str();
+    }
+
+}
@@ -0,0 +1,608 @@
+/**
+ * @file Html.cpp
+ *
+ * This module contains the implementation of the function which formats
+ * a MoonClock::Report as a self-contained, interactive HTML page.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include <limits>
+#include <map>
+#include <math.h>
+#include <MoonClock/Html.hpp>
+#include <MoonClock/Query.hpp>
+#include <sstream>
+#include <StringExtensions/StringExtensions.hpp>
+#include <vector>
+
+namespace {
+
+    /**
+     * This is the part of the page before the title.
+     */
+    const char* const PAGE_START = R"html(<!DOCTYPE html>
+<html>
+<head>
+<meta charset="utf-8">
+<title>)html";
+
+    /**
+     * This is the part of the page between the title in the head
+     * and the title in the body, including the styles of the page.
+     */
+    const char* const PAGE_HEAD = R"html(</title>
+<style>
+body { font-family: Helvetica, Arial, sans-serif; font-size: 14px; margin: 1em 2em; color: #222; }
+h1 { font-size: 1.6em; }
+h2 { font-size: 1.3em; margin-top: 1.5em; border-bottom: 1px solid #ccc; }
+table { border-collapse: collapse; }
+th, td { padding: 2px 8px; text-align: right; white-space: nowrap; }
+th:first-child, td:first-child { text-align: left; }
+#functions th { cursor: pointer; background: #eee; position: sticky; top: 0; }
+#functions tbody tr { cursor: pointer; }
+#functions tbody tr:nth-child(even) { background: #f7f7f7; }
+#functions tbody tr:hover { background: #e3ecfa; }
+#functions tbody tr.selected { background: #c9dcf8; }
+#functions-wrapper { max-height: 32em; overflow: auto; }
+#filter { margin-bottom: 0.5em; width: 20em; }
+#flame { position: relative; width: 100%; overflow: hidden; font-size: 12px; }
+.frame { position: absolute; height: 17px; line-height: 17px; padding: 0 3px; box-sizing: border-box; overflow: hidden; text-overflow: ellipsis; white-space: nowrap; border: 1px solid #fff; cursor: pointer; }
+.frame.selected { border-color: #000; }
+.frame.ancestor { opacity: 0.6; }
+.histogram-bar { display: inline-block; height: 12px; background: #d9534f; vertical-align: middle; }
+.muted { color: #777; }
+</style>
+</head>
+<body>
+<h1>)html";
+
+    /**
+     * This is the part of the page between the title in the body
+     * and the report's information, laying out the parts of the page.
+     */
+    const char* const PAGE_BODY = R"html(</h1>
+<div id="summary"></div>
+<h2>Functions</h2>
+<input id="filter" type="search" placeholder="Filter by name">
+<div id="functions-wrapper"><table id="functions"><thead></thead><tbody></tbody></table></div>
+<h2>Flame Graph</h2>
+<p><button id="flame-reset">Reset zoom</button> <span class="muted">Click a frame to zoom into it.</span></p>
+<div id="flame"></div>
+<h2>Details</h2>
+<div id="details"><p class="muted">Select a function to see its details.</p></div>
+<script type="application/json" id="report-data">)html";
+
+    /**
+     * This is the part of the page after the report's information,
+     * including the script which presents it.
+     */
+    const char* const PAGE_END = R"html(</script>
+<script>
+(function () {
+    "use strict";
+    var data = JSON.parse(document.getElementById("report-data").textContent);
+    var functions = data.functions;
+    var selected = -1;
+
+    function escapeHtml(text) {
+        return String(text).replace(/[&<>"']/g, function (c) {
+            return {"&": "&amp;", "<": "&lt;", ">": "&gt;", "\"": "&quot;", "'": "&#39;"}[c];
+        });
+    }
+
+    function formatTime(seconds) {
+        if (seconds >= 1) {
+            return seconds.toFixed(3) + " s";
+        }
+        if (seconds >= 1e-3) {
+            return (seconds * 1e3).toFixed(3) + " ms";
+        }
+        return (seconds * 1e6).toFixed(3) + " µs";
+    }
+
+    var totalTime = data.totalTime;
+    if (!(totalTime > 0)) {
+        totalTime = 0;
+        functions.forEach(function (f) { totalTime += f.selfTime; });
+    }
+
+    function formatShare(time) {
+        return (totalTime > 0) ? ((time / totalTime) * 100).toFixed(1) + "%" : "-";
+    }
+
+    function functionLink(index) {
+        return "<a href=\"#function-" + index + "\">" + escapeHtml(functions[index].name) + "</a>";
+    }
+
+    // Derive the callers of each function from the callees of each function.
+    functions.forEach(function (f) {
+        f.callers = [];
+        f.averageTime = (f.calls > 0) ? (f.totalTime / f.calls) : 0;
+    });
+    functions.forEach(function (f, i) {
+        f.callees.forEach(function (callee) {
+            functions[callee[0]].callers.push([i, callee[1], callee[2]]);
+        });
+    });
+
+    // Summary
+    var summary = [
+        ["Total time", formatTime(data.totalTime)],
+        ["Functions called", functions.length]
+    ];
+    if (data.numInstructions > 0) {
+        summary.push(["Lua instructions", data.numInstructions]);
+    }
+    if (data.memory.tracked) {
+        summary.push(["Allocations", data.memory.numAllocations]);
+        summary.push(["Bytes allocated", data.memory.bytesAllocated]);
+        summary.push(["Peak bytes in use", data.memory.peakBytes]);
+    }
+    document.getElementById("summary").innerHTML = "<table>" + summary.map(function (row) {
+        return "<tr><td>" + escapeHtml(row[0]) + "</td><td>" + escapeHtml(row[1]) + "</td></tr>";
+    }).join("") + "</table>";
+
+    // Table of functions
+    var columns = [
+        {key: "name", title: "Function", text: true},
+        {key: "calls", title: "Calls"},
+        {key: "totalTime", title: "Total", time: true, share: true},
+        {key: "selfTime", title: "Self", time: true, share: true},
+        {key: "averageTime", title: "Average", time: true},
+        {key: "minTime", title: "Min", time: true},
+        {key: "maxTime", title: "Max", time: true},
+        {key: "allocations", title: "Allocations"},
+        {key: "bytes", title: "Bytes"},
+        {key: "instructions", title: "Instructions"}
+    ];
+    var sortColumn = columns[3];
+    var sortDescending = true;
+    var table = document.getElementById("functions");
+    var filter = document.getElementById("filter");
+
+    function renderTable() {
+        table.tHead.innerHTML = "<tr>" + columns.map(function (column, i) {
+            var arrow = (column === sortColumn) ? (sortDescending ? " ▼" : " ▲") : "";
+            return "<th data-column=\"" + i + "\">" + escapeHtml(column.title) + arrow + "</th>";
+        }).join("") + "</tr>";
+        var pattern = filter.value.toLowerCase();
+        var order = [];
+        functions.forEach(function (f, i) {
+            if (f.name.toLowerCase().indexOf(pattern) >= 0) {
+                order.push(i);
+            }
+        });
+        order.sort(function (a, b) {
+            var x = functions[a][sortColumn.key];
+            var y = functions[b][sortColumn.key];
+            var result = sortColumn.text ? x.localeCompare(y) : (x - y);
+            if (sortDescending) {
+                result = -result;
+            }
+            return (result !== 0) ? result : functions[a].name.localeCompare(functions[b].name);
+        });
+        table.tBodies[0].innerHTML = order.map(function (i) {
+            var f = functions[i];
+            return "<tr data-index=\"" + i + "\"" + ((i === selected) ? " class=\"selected\"" : "") + ">"
+                + columns.map(function (column) {
+                    var value = f[column.key];
+                    var text = column.time ? formatTime(value) : String(value);
+                    if (column.share) {
+                        text += " (" + formatShare(value) + ")";
+                    }
+                    return "<td>" + escapeHtml(text) + "</td>";
+                }).join("")
+                + "</tr>";
+        }).join("");
+    }
+
+    table.tHead.addEventListener("click", function (event) {
+        var heading = event.target.closest("th");
+        if (!heading) {
+            return;
+        }
+        var column = columns[Number(heading.getAttribute("data-column"))];
+        if (column === sortColumn) {
+            sortDescending = !sortDescending;
+        } else {
+            sortColumn = column;
+            sortDescending = !column.text;
+        }
+        renderTable();
+    });
+    table.tBodies[0].addEventListener("click", function (event) {
+        var row = event.target.closest("tr");
+        if (row) {
+            location.hash = "#function-" + row.getAttribute("data-index");
+        }
+    });
+    filter.addEventListener("input", renderTable);
+
+    // Flame graph
+    var flame = document.getElementById("flame");
+    var nodes = data.tree.map(function (node) {
+        return {f: node[0], parent: node[1], calls: node[2], time: node[3], children: []};
+    });
+    nodes.forEach(function (node, i) {
+        if (i > 0) {
+            nodes[node.parent].children.push(i);
+        }
+    });
+    nodes.forEach(function (node) {
+        node.children.sort(function (a, b) {
+            return functions[nodes[a].f].name.localeCompare(functions[nodes[b].f].name);
+        });
+    });
+    if (nodes.length > 0) {
+        nodes[0].time = 0;
+        nodes[0].children.forEach(function (child) { nodes[0].time += nodes[child].time; });
+    }
+    var zoom = 0;
+    var FRAME_HEIGHT = 18;
+
+    function frameColor(name) {
+        var hash = 0;
+        for (var i = 0; i < name.length; ++i) {
+            hash = (hash * 31 + name.charCodeAt(i)) % 1000;
+        }
+        return "hsl(" + (hash % 55) + ", 80%, " + (60 + hash % 15) + "%)";
+    }
+
+    function renderFlame() {
+        if (nodes.length <= 1) {
+            flame.innerHTML = "<p class=\"muted\">This report has no call tree."
+                + " Enable call tree tracking to see a flame graph.</p>";
+            return;
+        }
+        var width = flame.clientWidth;
+        var html = [];
+        var maxDepth = 0;
+        function addFrame(index, x, frameWidth, depth, className) {
+            var node = nodes[index];
+            var f = functions[node.f];
+            maxDepth = Math.max(maxDepth, depth);
+            html.push(
+                "<div class=\"frame" + className + ((node.f === selected) ? " selected" : "") + "\""
+                + " data-node=\"" + index + "\""
+                + " style=\"left:" + x + "px;top:" + (depth * FRAME_HEIGHT) + "px;width:" + frameWidth + "px;"
+                + "background:" + frameColor(f.name) + "\""
+                + " title=\"" + escapeHtml(f.name + "\n" + formatTime(node.time) + " (" + formatShare(node.time)
+                    + ")\n" + node.calls + " calls") + "\">"
+                + ((frameWidth > 30) ? escapeHtml(f.name) : "")
+                + "</div>"
+            );
+        }
+        function layOut(index, x, frameWidth, depth) {
+            if (index > 0) {
+                addFrame(index, x, frameWidth, depth, "");
+                ++depth;
+            }
+            var node = nodes[index];
+            if (!(node.time > 0)) {
+                return;
+            }
+            node.children.forEach(function (child) {
+                var childWidth = frameWidth * nodes[child].time / node.time;
+                if (childWidth >= 1) {
+                    layOut(child, x, childWidth, depth);
+                }
+                x += childWidth;
+            });
+        }
+        var ancestors = [];
+        for (var index = nodes[zoom].parent; (zoom > 0) && (index > 0); index = nodes[index].parent) {
+            ancestors.unshift(index);
+        }
+        ancestors.forEach(function (ancestor, depth) {
+            addFrame(ancestor, 0, width, depth, " ancestor");
+        });
+        layOut(zoom, 0, width, ancestors.length);
+        flame.style.height = ((maxDepth + 1) * FRAME_HEIGHT) + "px";
+        flame.innerHTML = html.join("");
+    }
+
+    flame.addEventListener("click", function (event) {
+        var frame = event.target.closest(".frame");
+        if (frame) {
+            zoom = Number(frame.getAttribute("data-node"));
+            location.hash = "#function-" + nodes[zoom].f;
+            renderFlame();
+        }
+    });
+    document.getElementById("flame-reset").addEventListener("click", function () {
+        zoom = 0;
+        renderFlame();
+    });
+    window.addEventListener("resize", renderFlame);
+
+    // Details of the selected function
+    function renderCalls(title, calls) {
+        if (calls.length === 0) {
+            return "<h4>" + title + "</h4><p class=\"muted\">None</p>";
+        }
+        calls = calls.slice().sort(function (a, b) { return b[2] - a[2]; });
+        return "<h4>" + title + "</h4><table><tr><th>Function</th><th>Calls</th><th>Time</th></tr>"
+            + calls.map(function (call) {
+                return "<tr><td>" + functionLink(call[0]) + "</td><td>" + call[1] + "</td><td>"
+                    + escapeHtml(formatTime(call[2]) + " (" + formatShare(call[2]) + ")") + "</td></tr>";
+            }).join("")
+            + "</table>";
+    }
+
+    function renderHistogram(histogram) {
+        var first = -1;
+        var last = -1;
+        var maxCount = 0;
+        histogram.forEach(function (count, i) {
+            if (count > 0) {
+                if (first < 0) {
+                    first = i;
+                }
+                last = i;
+                maxCount = Math.max(maxCount, count);
+            }
+        });
+        if (first < 0) {
+            return "<h4>Latency</h4><p class=\"muted\">No latency histogram was collected.</p>";
+        }
+        var html = "<h4>Latency</h4><table>";
+        for (var i = first; i <= last; ++i) {
+            var limit = data.histogramFirstLimit * Math.pow(2, i);
+            var label = (i === histogram.length - 1)
+                ? "≥ " + formatTime(limit / 2)
+                : "< " + formatTime(limit);
+            html += "<tr><td>" + escapeHtml(label) + "</td><td>" + histogram[i] + "</td><td style=\"text-align:left\">"
+                + "<span class=\"histogram-bar\" style=\"width:" + Math.round(300 * histogram[i] / maxCount) + "px\"></span>"
+                + "</td></tr>";
+        }
+        return html + "</table>";
+    }
+
+    function renderDetails() {
+        var details = document.getElementById("details");
+        var f = functions[selected];
+        if (!f) {
+            return;
+        }
+        var stats = [
+            ["Calls", f.calls],
+            ["Total time", formatTime(f.totalTime) + " (" + formatShare(f.totalTime) + ")"],
+            ["Self time", formatTime(f.selfTime) + " (" + formatShare(f.selfTime) + ")"],
+            ["Average time", formatTime(f.averageTime)],
+            ["Min time", formatTime(f.minTime)],
+            ["Max time", formatTime(f.maxTime)],
+            ["Allocations", f.allocations],
+            ["Bytes allocated", f.bytes],
+            ["Lua instructions", f.instructions]
+        ];
+        details.innerHTML = "<h3>" + escapeHtml(f.name) + "</h3>"
+            + (f.source ? "<p class=\"muted\">Defined in " + escapeHtml(f.source)
+                + ((f.line > 0) ? " at line " + f.line : "") + "</p>" : "")
+            + "<table>" + stats.map(function (row) {
+                return "<tr><td>" + escapeHtml(row[0]) + "</td><td>" + escapeHtml(row[1]) + "</td></tr>";
+            }).join("") + "</table>"
+            + renderHistogram(f.histogram)
+            + renderCalls("Called by", f.callers)
+            + renderCalls("Calls", f.callees);
+    }
+
+    function selectFromLocation() {
+        var match = /^#function-(\d+)$/.exec(location.hash);
+        selected = match ? Number(match[1]) : -1;
+        renderTable();
+        renderFlame();
+        renderDetails();
+    }
+    window.addEventListener("hashchange", selectFromLocation);
+    selectFromLocation();
+})();
+</script>
+</body>
+</html>
+)html";
+
+    /**
+     * Return the given text with the characters which have special
+     * meaning in HTML replaced by character references.
+     *
+     * @param[in] text
+     *     This is the text to escape.
+     *
+     * @return
+     *     The escaped text is returned.
+     */
+    std::string EscapeHtml(const std::string& text) {
+        std::string escaped;
+        for (const auto c: text) {
+            switch (c) {
+                case '&': escaped += "&amp;"; break;
+                case '<': escaped += "&lt;"; break;
+                case '>': escaped += "&gt;"; break;
+                case '"': escaped += "&quot;"; break;
+                default: escaped.push_back(c); break;
+            }
+        }
+        return escaped;
+    }
+
+    /**
+     * Return the given text as a JSON string.  The characters which have
+     * special meaning in HTML are escaped as well, so that the string can't
+     * end the script element holding it.
+     *
+     * @param[in] text
+     *     This is the text to quote.
+     *
+     * @return
+     *     The quoted text is returned.
+     */
+    std::string JsonString(const std::string& text) {
+        std::string quoted = "\"";
+        for (const auto c: text) {
+            if (
+                (c == '"')
+                || (c == '\\')
+            ) {
+                quoted.push_back('\\');
+                quoted.push_back(c);
+            } else if (
+                ((unsigned char)c < 0x20)
+                || (c == '<')
+                || (c == '>')
+                || (c == '&')
+            ) {
+                quoted += StringExtensions::sprintf("\\u%04x", (unsigned char)c);
+            } else {
+                quoted.push_back(c);
+            }
+        }
+        quoted.push_back('"');
+        return quoted;
+    }
+
+    /**
+     * Return the given number in JSON form.  Numbers which JSON can't
+     * represent, such as the minimum time of functions never called,
+     * are given as zero.
+     *
+     * @param[in] number
+     *     This is the number to format.
+     *
+     * @return
+     *     The formatted number is returned.
+     */
+    std::string JsonNumber(double number) {
+        if (
+            isnan(number)
+            || isinf(number)
+            || (number == std::numeric_limits< double >::max())
+        ) {
+            return "0";
+        }
+        return StringExtensions::sprintf("%.9g", number);
+    }
+
+    /**
+     * Write the information in the given report which is presented
+     * by the page, as JSON.
+     *
+     * @param[in,out] output
+     *     This is where to write the information.
+     *
+     * @param[in] report
+     *     This is the report whose information to write.
+     */
+    void WriteReportData(
+        std::ostringstream& output,
+        const MoonClock::Report& report
+    ) {
+        // List the functions called, along with any others
+        // in the call tree, and assign each its index in the list.
+        std::map< MoonClock::Path, size_t > indices;
+        for (const auto& functionInfoEntry: report.functionInfo) {
+            if (functionInfoEntry.second.numCalls > 0) {
+                (void)indices.insert({functionInfoEntry.first, indices.size()});
+            }
+        }
+        for (size_t i = 1; i < report.callTree.size(); ++i) {
+            (void)indices.insert({report.callTree[i].path, indices.size()});
+        }
+        std::vector< MoonClock::Path > paths(indices.size());
+        for (const auto& index: indices) {
+            paths[index.second] = index.first;
+        }
+
+        // Write the report as a whole.
+        output
+            << "{\"totalTime\":" << JsonNumber(report.totalTime)
+            << ",\"numInstructions\":" << report.numInstructions
+            << ",\"memory\":{\"tracked\":" << (report.memory.tracked ? "true" : "false")
+            << ",\"numAllocations\":" << report.memory.numAllocations
+            << ",\"bytesAllocated\":" << report.memory.bytesAllocated
+            << ",\"peakBytes\":" << report.memory.peakBytes
+            << "},\"histogramFirstLimit\":" << JsonNumber(MoonClock::LATENCY_HISTOGRAM_FIRST_LIMIT);
+
+        // Write the functions.
+        output << ",\"functions\":[";
+        const MoonClock::FunctionInformation noFunctionInfo;
+        for (size_t i = 0; i < paths.size(); ++i) {
+            const auto functionInfoEntry = report.functionInfo.find(paths[i]);
+            const auto& functionInfo = (
+                (functionInfoEntry == report.functionInfo.end())
+                ? noFunctionInfo
+                : functionInfoEntry->second
+            );
+            const auto sourceInfoEntry = report.sources.find(paths[i]);
+            MoonClock::SourceInformation sourceInfo;
+            if (sourceInfoEntry != report.sources.end()) {
+                sourceInfo = sourceInfoEntry->second;
+            }
+            output
+                << ((i == 0) ? "" : ",")
+                << "{\"name\":" << JsonString(StringExtensions::Join(paths[i], "."))
+                << ",\"source\":" << JsonString(sourceInfo.source)
+                << ",\"line\":" << sourceInfo.lineDefined
+                << ",\"calls\":" << functionInfo.numCalls
+                << ",\"totalTime\":" << JsonNumber(functionInfo.totalTime)
+                << ",\"selfTime\":" << JsonNumber(MoonClock::GetSelfTime(functionInfo))
+                << ",\"minTime\":" << JsonNumber(functionInfo.minTime)
+                << ",\"maxTime\":" << JsonNumber(functionInfo.maxTime)
+                << ",\"allocations\":" << functionInfo.numAllocations
+                << ",\"bytes\":" << functionInfo.bytesAllocated
+                << ",\"instructions\":" << functionInfo.numInstructions
+                << ",\"callees\":[";
+            bool isFirstCallee = true;
+            for (const auto& callsEntry: functionInfo.calls) {
+                const auto callee = indices.find(callsEntry.first);
+                if (callee == indices.end()) {
+                    continue;
+                }
+                output
+                    << (isFirstCallee ? "" : ",")
+                    << "[" << callee->second
+                    << "," << callsEntry.second.numCalls
+                    << "," << JsonNumber(callsEntry.second.totalTime)
+                    << "]";
+                isFirstCallee = false;
+            }
+            output << "],\"histogram\":[";
+            for (size_t j = 0; j < functionInfo.latencyHistogram.size(); ++j) {
+                output << ((j == 0) ? "" : ",") << functionInfo.latencyHistogram[j];
+            }
+            output << "]}";
+        }
+
+        // Write the call tree, with each node as its function's index,
+        // its parent's index, its number of calls, and its total time.
+        output << "],\"tree\":[";
+        for (size_t i = 0; i < report.callTree.size(); ++i) {
+            const auto& node = report.callTree[i];
+            output
+                << ((i == 0) ? "" : ",")
+                << "[" << ((i == 0) ? 0 : indices[node.path])
+                << "," << node.parent
+                << "," << node.numCalls
+                << "," << JsonNumber(node.totalTime)
+                << "]";
+        }
+        output << "]}";
+    }
+
+}
+
+namespace MoonClock {
+
+    std::string FormatHtmlReport(
+        const Report& report,
+        const std::string& title
+    ) {
+        std::ostringstream output;
+        const auto escapedTitle = EscapeHtml(title);
+        output << PAGE_START << escapedTitle << PAGE_HEAD << escapedTitle << PAGE_BODY;
+        WriteReportData(output, report);
+        output << PAGE_END;
+        return output.str();
+    }
+
+}
@@ -6,13 +6,20 @@
  * © 2019 by Richard Walters
  */
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <limits>
 #include <math.h>
 #include <MoonClock/MoonClock.hpp>
+#include <MoonClock/SharedStatistics.hpp>
+#include <mutex>
+#include <new>
 #include <set>
-#include <stack>
 #include <string>
 #include <StringExtensions/StringExtensions.hpp>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
 extern "C" {
@@ -45,38 +52,6 @@ namespace {
         }
     }
 
-    /**
-     * Extract a vector of strings from a Lua list of strings.
-     *
-     * @param[in,out] lua
-     *     This is the state of the Lua interpreter to use.
-     *
-     * @param[in] listIndex
-     *     This is the index of the list on the Lua stack to read.
-     *
-     * @return
-     *     The vector of strings extracted from the Lua list is returned.
-     */
-    std::vector< std::string > ReadLuaStringList(
-        lua_State* lua,
-        int listIndex
-    ) {
-        if (
-            (listIndex < 0)
-            && (listIndex >= -LUAI_MAXSTACK)
-        ) {
-            listIndex = lua_gettop(lua) + listIndex + 1;
-        }
-        std::vector< std::string > list(lua_rawlen(lua, listIndex));
-        for (size_t i = 0; i < list.size(); ++i) {
-            lua_pushinteger(lua, i + 1); // -1 = i
-            lua_rawget(lua, listIndex); // -1 = list[i]
-            list[i] = lua_tostring(lua, -1);
-            lua_pop(lua, 1); // (stack empty)
-        }
-        return list;
-    }
-
     /**
      * Determine whether or not the value at the given index on the Lua
      * stack has metamethods which support iteration to find and instrument
@@ -120,34 +95,183 @@ namespace {
         );
     }
 
+    /**
+     * This is the maximum number of characters of a Lua string to include
+     * when summarizing it.
+     */
+    constexpr size_t MAX_SUMMARIZED_STRING_LENGTH = 32;
+
+    /**
+     * Produce a short, human-readable summary of the value at the given
+     * index on the Lua stack, without invoking any metamethods.
+     *
+     * @param[in,out] lua
+     *     This is the state of the Lua interpreter to use.
+     *
+     * @param[in] valueIndex
+     *     This is the index on the Lua stack of the value to summarize.
+     *
+     * @return
+     *     A short summary of the value is returned.
+     */
+    std::string SummarizeLuaValue(lua_State* lua, int valueIndex) {
+        switch (lua_type(lua, valueIndex)) {
+            case LUA_TNIL: {
+                return "nil";
+            }
+
+            case LUA_TBOOLEAN: {
+                return lua_toboolean(lua, valueIndex) ? "true" : "false";
+            }
+
+            case LUA_TNUMBER: {
+                lua_pushvalue(lua, valueIndex); // -1 = value
+                std::string summary = lua_tostring(lua, -1);
+                lua_pop(lua, 1); // (stack empty)
+                return summary;
+            }
+
+            case LUA_TSTRING: {
+                size_t length;
+                const auto value = lua_tolstring(lua, valueIndex, &length);
+                if (length > MAX_SUMMARIZED_STRING_LENGTH) {
+                    return "\"" + std::string(value, MAX_SUMMARIZED_STRING_LENGTH) + "\"...";
+                } else {
+                    return "\"" + std::string(value, length) + "\"";
+                }
+            }
+
+            default: {
+                return StringExtensions::sprintf(
+                    "%s: %p",
+                    luaL_typename(lua, valueIndex),
+                    lua_topointer(lua, valueIndex)
+                );
+            }
+        }
+    }
+
+    /**
+     * This is the message handler used when executing chunks of Lua code
+     * loaded through LoadChunk.  It adds a traceback to error messages.
+     *
+     * @param[in,out] lua
+     *     This is the state of the Lua interpreter to use.
+     *
+     * @return
+     *     The number of values returned (one: the error message)
+     *     is returned.
+     */
+    int ChunkTraceback(lua_State* lua) {
+        const char* message = lua_tostring(lua, 1);
+        if (message == NULL) {
+            if (
+                !lua_isnoneornil(lua, 1)
+                && !luaL_callmeta(lua, 1, "__tostring")
+            ) {
+                lua_pushliteral(lua, "(no error message)");
+            }
+        } else {
+            luaL_traceback(lua, lua, message, 1);
+        }
+        return 1;
+    }
+
+    /**
+     * The address of this variable is used as the key in the Lua registry
+     * under which the MoonClock instance counting instructions is stored,
+     * for the instruction counting hook to find it.
+     */
+    char INSTRUCTION_COUNTING_KEY;
+
+    /**
+     * The address of this variable is used as the key in the Lua registry
+     * under which the MoonClock instance running the stall detector is
+     * stored, for the hook which aborts stalled calls to find it.
+     */
+    char STALL_DETECTOR_KEY;
+
+    /**
+     * This is the type of function called for each function found when
+     * searching a Lua composite hierarchy for functions.
+     *
+     * On entry, the top value on the Lua stack is the function found, and
+     * the next value on the Lua stack, from the top, is the function's key
+     * in the composite containing it.  The function must leave the Lua stack
+     * as it found it.
+     *
+     * @param[in,out] lua
+     *     This is the state of the Lua interpreter to use.
+     *
+     * @param[in] parentIndex
+     *     This is the index into the Lua stack where the composite
+     *     containing the function can be found.
+     *
+     * @param[in] path
+     *     This is the list of keys to use to locate the function
+     *     within the composite hierarchy.
+     */
+    using FunctionFoundHandler = std::function<
+        void(
+            lua_State* lua,
+            int parentIndex,
+            const MoonClock::Path& path
+        )
+    >;
+
+    /**
+     * Convert the key at the given index on the Lua stack into a string
+     * to use as a step in a path, without modifying the key itself
+     * (which would confuse lua_next).
+     *
+     * @param[in,out] lua
+     *     This is the state of the Lua interpreter to use.
+     *
+     * @param[in] keyIndex
+     *     This is the index on the Lua stack of the key to convert.
+     *
+     * @return
+     *     The string form of the key is returned.
+     */
+    std::string KeyToString(lua_State* lua, int keyIndex) {
+        switch (lua_type(lua, keyIndex)) {
+            case LUA_TSTRING:
+            case LUA_TNUMBER: {
+                lua_pushvalue(lua, keyIndex); // -1 = key
+                std::string key = lua_tostring(lua, -1);
+                lua_pop(lua, 1); // (stack empty)
+                return key;
+            }
+
+            default: {
+                return "[" + SummarizeLuaValue(lua, keyIndex) + "]";
+            }
+        }
+    }
+
     // Forward-declare these functions since they re-enter each other.
     void FindFunctionsInCompositeLuaTable(
         lua_State* lua,
         int tableIndex,
-        int resultsIndex,
+        const FunctionFoundHandler& onFunctionFound,
         std::vector< std::string >& path
     );
     void FindFunctionsInCompositeLuaMeta(
         lua_State* lua,
         int metaIndex,
-        int resultsIndex,
+        const FunctionFoundHandler& onFunctionFound,
         std::vector< std::string >& path
     );
     void FindFunctionsInCompositeLuaKeyValue(
         lua_State* lua,
         int parentIterableIndex,
-        int resultsIndex,
+        const FunctionFoundHandler& onFunctionFound,
         std::vector< std::string >& path
     );
 
     /**
-     * Search a Lua table's hierarchy for Lua functions.  Add to a result list
-     * table, each containing the following, one for every function found
-     * within the table hierarchy:
-     * - parent: the composite containing the function (could be nested)
-     * - path: list of keys to use to locate the function within
-     *         the composite hierarchy
-     * - fn: the function itself
+     * Search a Lua table's hierarchy for Lua functions, calling the given
+     * handler for every function found within the table hierarchy.
      *
      * @param[in,out] lua
      *     This is the state of the Lua interpreter to use.
@@ -156,9 +280,8 @@ namespace {
      *     This is the index into the Lua stack where the table to search
      *     can be found.
      *
-     * @param[in] resultsIndex
-     *     This is the index into the Lua stack where the table to which
-     *     results should be added can be found.
+     * @param[in] onFunctionFound
+     *     This is the function to call for every function found.
      *
      * @param[in,out] path
      *     This is used to keep track of the current path through the
@@ -167,7 +290,7 @@ namespace {
     void FindFunctionsInCompositeLuaTable(
         lua_State* lua,
         int tableIndex,
-        int resultsIndex,
+        const FunctionFoundHandler& onFunctionFound,
         std::vector< std::string >& path
     ) {
         if (tableIndex < 0) {
@@ -175,19 +298,14 @@ namespace {
         }
         lua_pushnil(lua);  // -1 = old key
         while (lua_next(lua, tableIndex) != 0) { // -1 = new value, -2 = new key
-            FindFunctionsInCompositeLuaKeyValue(lua, tableIndex, resultsIndex, path);
+            FindFunctionsInCompositeLuaKeyValue(lua, tableIndex, onFunctionFound, path);
             lua_pop(lua, 1); // -1 = old key
         } // (stack empty)
     }
 
     /**
-     * Search a Lua value with __pairs metamethod for Lua functions.  Add to a
-     * result list table, each containing the following, one for every function
-     * found within the table hierarchy:
-     * - parent: the composite containing the function (could be nested)
-     * - path: list of keys to use to locate the function within
-     *         the composite hierarchy
-     * - fn: the function itself
+     * Search a Lua value with __pairs metamethod for Lua functions, calling
+     * the given handler for every function found within the hierarchy.
      *
      * @param[in,out] lua
      *     This is the state of the Lua interpreter to use.
@@ -196,9 +314,8 @@ namespace {
      *     This is the index into the Lua stack where the value to search
      *     can be found.
      *
-     * @param[in] resultsIndex
-     *     This is the index into the Lua stack where the table to which
-     *     results should be added can be found.
+     * @param[in] onFunctionFound
+     *     This is the function to call for every function found.
      *
      * @param[in,out] path
      *     This is used to keep track of the current path through the
@@ -207,7 +324,7 @@ namespace {
     void FindFunctionsInCompositeLuaMeta(
         lua_State* lua,
         int metaIndex,
-        int resultsIndex,
+        const FunctionFoundHandler& onFunctionFound,
         std::vector< std::string >& path
     ) {
         if (metaIndex < 0) {
@@ -229,29 +346,24 @@ namespace {
                 return;
             }
             lua_remove(lua, -3); // -1 = new value, -2 = new key, -3 = state, -4 = iterator
-            const std::string key = lua_tostring(lua, -2);
+            const auto key = KeyToString(lua, -2);
             if (
                 (key != "__index")
                 && (key != "__newindex")
                 && (key != "__pairs")
             ) {
-                FindFunctionsInCompositeLuaKeyValue(lua, metaIndex, resultsIndex, path);
+                FindFunctionsInCompositeLuaKeyValue(lua, metaIndex, onFunctionFound, path);
             }
             lua_pop(lua, 1); // -1 = old key, -2 = state, -3 = iterator
         }
     }
 
     /**
-     * If the given Lua value is a function, add to the given result list
-     * a table containing the following:
-     * - parent: the composite containing the function (could be nested)
-     * - path: list of keys to use to locate the function within
-     *         the composite hierarchy
-     * - fn: the function itself
+     * If the given Lua value is a function, call the given handler for it.
      *
      * If the given Lua value is a table or value supporting the __pairs,
      * __index, and __newindex metamethods, search its hierarchy for functions
-     * to add to the result list.
+     * for which to call the given handler.
      *
      * On entry, the top value on the Lua must be the value to check, and the
      * next value on the Lua stack, from the top, must be the value's key in
@@ -264,9 +376,8 @@ namespace {
      *     This is the index into the Lua stack where the composite containing
      *     the value can be found.
      *
-     * @param[in] resultsIndex
-     *     This is the index into the Lua stack where the table to which
-     *     results should be added can be found.
+     * @param[in] onFunctionFound
+     *     This is the function to call for every function found.
      *
      * @param[in,out] path
      *     This is used to keep track of the current path through the
@@ -275,7 +386,7 @@ namespace {
     void FindFunctionsInCompositeLuaKeyValue(
         lua_State* lua,
         int parentIterableIndex,
-        int resultsIndex,
+        const FunctionFoundHandler& onFunctionFound,
         std::vector< std::string >& path
     ) {
         if (lua_compare(lua, parentIterableIndex, -1, LUA_OPEQ) == 1) {
@@ -285,30 +396,53 @@ namespace {
             return;
         }
         if (IsInstrumentableLuaMeta(lua, -1)) {
-            path.push_back(lua_tostring(lua, -2));
-            FindFunctionsInCompositeLuaMeta(lua, -1, resultsIndex, path);
+            path.push_back(KeyToString(lua, -2));
+            FindFunctionsInCompositeLuaMeta(lua, -1, onFunctionFound, path);
             path.pop_back();
         }
         if (lua_istable(lua, -1)) {
-            path.push_back(lua_tostring(lua, -2));
-            FindFunctionsInCompositeLuaTable(lua, -1, resultsIndex, path);
+            path.push_back(KeyToString(lua, -2));
+            FindFunctionsInCompositeLuaTable(lua, -1, onFunctionFound, path);
             path.pop_back();
         } else if (lua_isfunction(lua, -1)) {
-            const auto nextResultsEntryIndex = lua_rawlen(lua, resultsIndex) + 1;
-            lua_pushinteger(lua, nextResultsEntryIndex); // -1 = #results+1, -2 = new value, -3 = new key
-            lua_newtable(lua); // -1 = resultsEntry, -2 = #results+1, -3 = new value, -4 = new key
-            lua_pushstring(lua, "path"); // -1 = "path", -2 = resultsEntry, -3 = #results+1, -4 = new value, -5 = new key
-            path.push_back(lua_tostring(lua, -5));
-            PushLuaStringList(lua, path); // -1 = path, -2 = "path", -3 = resultsEntry, -4 = #results+1, -5 = new value, -6 = new key
+            path.push_back(KeyToString(lua, -2));
+            onFunctionFound(lua, parentIterableIndex, path);
             path.pop_back();
-            lua_rawset(lua, -3); // -1 = resultsEntry, -2 = #results+1, -3 = new value, -4 = new key
-            lua_pushstring(lua, "fn"); // -1 = "fn", -2 = resultsEntry, -3 = #results+1, -4 = new value, -5 = new key
-            lua_pushvalue(lua, -4); // -1 = new value, -2 = "fn", -3 = resultsEntry, -4 = #results+1, -5 = new value, -6 = new key
-            lua_rawset(lua, -3); // -1 = resultsEntry, -2 = #results+1, -3 = new value, -4 = new key
-            lua_pushstring(lua, "parent"); // -1 = "parent", -2 = resultsEntry, -3 = #results+1, -4 = new value, -5 = new key
-            lua_pushvalue(lua, parentIterableIndex); // -1 = tableIndex, -2 = "parent", -3 = resultsEntry, -4 = #results+1, -5 = new value, -6 = new key
-            lua_rawset(lua, -3); // -1 = resultsEntry, -2 = #results+1, -3 = new value, -4 = new key
-            lua_rawset(lua, resultsIndex); // -1 = new value, -2 = new key
+        }
+    }
+
+    /**
+     * Search a Lua composite (table or value supporting the __pairs, __index,
+     * and __newindex metamethods) hierarchy for Lua functions, calling the
+     * given handler for every function found within the hierarchy.
+     *
+     * @param[in,out] lua
+     *     This is the state of the Lua interpreter to use.
+     *
+     * @param[in] compositeIndex
+     *     This is the index into the Lua stack where the composite to search
+     *     can be found.
+     *
+     * @param[in] basePath
+     *     This is the path to prepend to the path of every function found.
+     *
+     * @param[in] onFunctionFound
+     *     This is the function to call for every function found.
+     */
+    void FindFunctions(
+        lua_State* lua,
+        int compositeIndex,
+        const MoonClock::Path& basePath,
+        const FunctionFoundHandler& onFunctionFound
+    ) {
+        if (compositeIndex < 0) {
+            compositeIndex = lua_gettop(lua) + compositeIndex + 1;
+        }
+        auto path = basePath;
+        if (IsInstrumentableLuaMeta(lua, compositeIndex)) {
+            FindFunctionsInCompositeLuaMeta(lua, compositeIndex, onFunctionFound, path);
+        } else {
+            FindFunctionsInCompositeLuaTable(lua, compositeIndex, onFunctionFound, path);
         }
     }
 
@@ -326,6 +460,9 @@ namespace MoonClock {
         return (
             (numCalls == other.numCalls)
             && (fabs(totalTime - other.totalTime) <= std::numeric_limits< decltype(totalTime) >::epsilon() * 2)
+            && (numAllocations == other.numAllocations)
+            && (bytesAllocated == other.bytesAllocated)
+            && (numInstructions == other.numInstructions)
         );
     }
 
@@ -335,6 +472,9 @@ namespace MoonClock {
     ) {
         *os << "{numCalls=" << callsInformation.numCalls;
         *os << ", totalTime=" << callsInformation.totalTime;
+        *os << ", numAllocations=" << callsInformation.numAllocations;
+        *os << ", bytesAllocated=" << callsInformation.bytesAllocated;
+        *os << ", numInstructions=" << callsInformation.numInstructions;
         *os << "}";
     }
 
@@ -360,6 +500,10 @@ namespace MoonClock {
             && (fabs(totalTime - other.totalTime) <= std::numeric_limits< decltype(totalTime) >::epsilon() * 2)
             && (fabs(maxTime - other.maxTime) <= std::numeric_limits< decltype(maxTime) >::epsilon() * 2)
             && (calls == other.calls)
+            && (numAllocations == other.numAllocations)
+            && (bytesAllocated == other.bytesAllocated)
+            && (numInstructions == other.numInstructions)
+            && (latencyHistogram == other.latencyHistogram)
         );
     }
 
@@ -387,6 +531,19 @@ namespace MoonClock {
             PrintTo(entry.second, os);
         }
         *os << ")";
+        *os << ", numAllocations=" << functionInformation.numAllocations;
+        *os << ", bytesAllocated=" << functionInformation.bytesAllocated;
+        *os << ", numInstructions=" << functionInformation.numInstructions;
+        *os << ", latencyHistogram=(";
+        bool isFirstBucket = true;
+        for (const auto bucket: functionInformation.latencyHistogram) {
+            if (!isFirstBucket) {
+                *os << ", ";
+            }
+            isFirstBucket = false;
+            *os << bucket;
+        }
+        *os << ")";
         *os << "}";
     }
 
@@ -394,14 +551,28 @@ namespace MoonClock {
         if (compositeIndex < 0) {
             compositeIndex = lua_gettop(lua) + compositeIndex + 1;
         }
-        std::vector< std::string > path;
         lua_newtable(lua); // -1 = results
         const auto resultsIndex = lua_gettop(lua);
-        if (IsInstrumentableLuaMeta(lua, compositeIndex)) {
-            FindFunctionsInCompositeLuaMeta(lua, compositeIndex, resultsIndex, path);
-        } else {
-            FindFunctionsInCompositeLuaTable(lua, compositeIndex, resultsIndex, path);
-        }
+        FindFunctions(
+            lua,
+            compositeIndex,
+            {},
+            [resultsIndex](lua_State* lua, int parentIndex, const Path& path){
+                // -1 = fn, -2 = key
+                lua_pushinteger(lua, lua_rawlen(lua, resultsIndex) + 1); // -1 = #results+1, -2 = fn, -3 = key
+                lua_newtable(lua); // -1 = resultsEntry, -2 = #results+1, -3 = fn, -4 = key
+                lua_pushstring(lua, "path"); // -1 = "path", -2 = resultsEntry, -3 = #results+1, -4 = fn, -5 = key
+                PushLuaStringList(lua, path); // -1 = path, -2 = "path", -3 = resultsEntry, -4 = #results+1, -5 = fn, -6 = key
+                lua_rawset(lua, -3); // -1 = resultsEntry, -2 = #results+1, -3 = fn, -4 = key
+                lua_pushstring(lua, "fn"); // -1 = "fn", -2 = resultsEntry, -3 = #results+1, -4 = fn, -5 = key
+                lua_pushvalue(lua, -4); // -1 = fn, -2 = "fn", -3 = resultsEntry, -4 = #results+1, -5 = fn, -6 = key
+                lua_rawset(lua, -3); // -1 = resultsEntry, -2 = #results+1, -3 = fn, -4 = key
+                lua_pushstring(lua, "parent"); // -1 = "parent", -2 = resultsEntry, -3 = #results+1, -4 = fn, -5 = key
+                lua_pushvalue(lua, parentIndex); // -1 = parent, -2 = "parent", -3 = resultsEntry, -4 = #results+1, -5 = fn, -6 = key
+                lua_rawset(lua, -3); // -1 = resultsEntry, -2 = #results+1, -3 = fn, -4 = key
+                lua_rawset(lua, resultsIndex); // -1 = fn, -2 = key
+            }
+        );
     }
 
     bool DoNotSearch(lua_State* lua, int compositeIndex) {
@@ -429,12 +600,202 @@ namespace MoonClock {
         return false;
     }
 
+    bool PathMatchesPattern(const Path& path, const std::string& pattern) {
+        const auto patternKeys = StringExtensions::Split(pattern, '.');
+        for (size_t i = 0; i < patternKeys.size(); ++i) {
+            if (i >= path.size()) {
+                return false;
+            }
+            if (patternKeys[i] == "*") {
+                if (i + 1 == patternKeys.size()) {
+                    return true;
+                }
+            } else if (patternKeys[i] != path[i]) {
+                return false;
+            }
+        }
+        return (path.size() == patternKeys.size());
+    }
+
+    void IndexCallers(Report& report) {
+        report.callers.clear();
+        for (const auto& functionInfoEntry: report.functionInfo) {
+            for (const auto& callsInfoEntry: functionInfoEntry.second.calls) {
+                report.callers[callsInfoEntry.first][functionInfoEntry.first] = callsInfoEntry.second;
+            }
+        }
+    }
+
+    size_t GetLatencyHistogramBucket(double time) {
+        if (!(time >= LATENCY_HISTOGRAM_FIRST_LIMIT)) {
+            return 0;
+        }
+
+        // The exponent of the ratio of the time to the limit of the first
+        // bucket is one more than the number of times the limit doubles
+        // before exceeding the time, which is the index of the bucket.
+        int exponent;
+        (void)frexp(time / LATENCY_HISTOGRAM_FIRST_LIMIT, &exponent);
+        return std::min((size_t)exponent, NUM_LATENCY_HISTOGRAM_BUCKETS - 1);
+    }
+
+    Report MergeReports(const std::vector< Report >& reports) {
+        Report merged;
+        for (const auto& report: reports) {
+            for (const auto& functionInfoEntry: report.functionInfo) {
+                const auto& functionInfo = functionInfoEntry.second;
+                auto& mergedFunctionInfo = merged.functionInfo[functionInfoEntry.first];
+                mergedFunctionInfo.numCalls += functionInfo.numCalls;
+                mergedFunctionInfo.minTime = std::min(mergedFunctionInfo.minTime, functionInfo.minTime);
+                mergedFunctionInfo.totalTime += functionInfo.totalTime;
+                mergedFunctionInfo.maxTime = std::max(mergedFunctionInfo.maxTime, functionInfo.maxTime);
+                mergedFunctionInfo.numAllocations += functionInfo.numAllocations;
+                mergedFunctionInfo.bytesAllocated += functionInfo.bytesAllocated;
+                mergedFunctionInfo.numInstructions += functionInfo.numInstructions;
+                if (!functionInfo.latencyHistogram.empty()) {
+                    mergedFunctionInfo.latencyHistogram.resize(NUM_LATENCY_HISTOGRAM_BUCKETS);
+                    for (size_t i = 0; i < functionInfo.latencyHistogram.size(); ++i) {
+                        mergedFunctionInfo.latencyHistogram[i] += functionInfo.latencyHistogram[i];
+                    }
+                }
+                for (const auto& callsInfoEntry: functionInfo.calls) {
+                    auto& mergedCallsInfo = mergedFunctionInfo.calls[callsInfoEntry.first];
+                    mergedCallsInfo.numCalls += callsInfoEntry.second.numCalls;
+                    mergedCallsInfo.totalTime += callsInfoEntry.second.totalTime;
+                    mergedCallsInfo.numAllocations += callsInfoEntry.second.numAllocations;
+                    mergedCallsInfo.bytesAllocated += callsInfoEntry.second.bytesAllocated;
+                    mergedCallsInfo.numInstructions += callsInfoEntry.second.numInstructions;
+                }
+            }
+            merged.totalTime += report.totalTime;
+            merged.slowCalls.insert(
+                merged.slowCalls.end(),
+                report.slowCalls.begin(),
+                report.slowCalls.end()
+            );
+            merged.numSlowCallsDropped += report.numSlowCallsDropped;
+            merged.criticalPaths.insert(
+                merged.criticalPaths.end(),
+                report.criticalPaths.begin(),
+                report.criticalPaths.end()
+            );
+            merged.numCriticalPathsDropped += report.numCriticalPathsDropped;
+            merged.sources.insert(report.sources.begin(), report.sources.end());
+            if (!report.callTree.empty()) {
+                if (merged.callTree.empty()) {
+                    merged.callTree.resize(1);
+                }
+
+                // Every node comes after its parent, so the parent of each
+                // node has already been matched with a merged node by the
+                // time the node itself is reached.
+                std::vector< size_t > mergedIndices(report.callTree.size(), 0);
+                for (size_t i = 1; i < report.callTree.size(); ++i) {
+                    const auto& node = report.callTree[i];
+                    const auto mergedParent = mergedIndices[node.parent];
+                    const auto mergedChild = merged.callTree[mergedParent].children.find(node.path);
+                    if (mergedChild == merged.callTree[mergedParent].children.end()) {
+                        mergedIndices[i] = merged.callTree.size();
+                        merged.callTree[mergedParent].children[node.path] = mergedIndices[i];
+                        CallTreeNode mergedNode;
+                        mergedNode.path = node.path;
+                        mergedNode.parent = mergedParent;
+                        merged.callTree.push_back(std::move(mergedNode));
+                    } else {
+                        mergedIndices[i] = mergedChild->second;
+                    }
+                    auto& mergedNode = merged.callTree[mergedIndices[i]];
+                    mergedNode.numCalls += node.numCalls;
+                    mergedNode.totalTime += node.totalTime;
+                    mergedNode.numAllocations += node.numAllocations;
+                    mergedNode.bytesAllocated += node.bytesAllocated;
+                    mergedNode.numInstructions += node.numInstructions;
+                }
+            }
+            for (const auto& criticalPathFunctionEntry: report.criticalPathFunctions) {
+                const auto& functionInfo = criticalPathFunctionEntry.second;
+                auto& mergedFunctionInfo = merged.criticalPathFunctions[criticalPathFunctionEntry.first];
+                mergedFunctionInfo.numOccurrences += functionInfo.numOccurrences;
+                mergedFunctionInfo.totalTime += functionInfo.totalTime;
+                mergedFunctionInfo.selfTime += functionInfo.selfTime;
+            }
+            for (size_t i = 0; i < report.latencyBudgets.size(); ++i) {
+                const auto& latencyBudgetInfo = report.latencyBudgets[i];
+                if (i >= merged.latencyBudgets.size()) {
+                    merged.latencyBudgets.push_back(latencyBudgetInfo);
+                    continue;
+                }
+                auto& mergedLatencyBudgetInfo = merged.latencyBudgets[i];
+                if (mergedLatencyBudgetInfo.pattern != latencyBudgetInfo.pattern) {
+                    continue;
+                }
+                mergedLatencyBudgetInfo.numCalls += latencyBudgetInfo.numCalls;
+                mergedLatencyBudgetInfo.numViolations += latencyBudgetInfo.numViolations;
+                mergedLatencyBudgetInfo.windows.insert(
+                    mergedLatencyBudgetInfo.windows.end(),
+                    latencyBudgetInfo.windows.begin(),
+                    latencyBudgetInfo.windows.end()
+                );
+            }
+            merged.stalls.insert(
+                merged.stalls.end(),
+                report.stalls.begin(),
+                report.stalls.end()
+            );
+            merged.moduleLoads.insert(
+                merged.moduleLoads.end(),
+                report.moduleLoads.begin(),
+                report.moduleLoads.end()
+            );
+            merged.chunkLoads.insert(
+                merged.chunkLoads.end(),
+                report.chunkLoads.begin(),
+                report.chunkLoads.end()
+            );
+            merged.memory.tracked = merged.memory.tracked || report.memory.tracked;
+            merged.memory.startBytes += report.memory.startBytes;
+            merged.memory.peakBytes += report.memory.peakBytes;
+            merged.memory.endBytes += report.memory.endBytes;
+            merged.memory.numAllocations += report.memory.numAllocations;
+            merged.memory.bytesAllocated += report.memory.bytesAllocated;
+            merged.numInstructions += report.numInstructions;
+        }
+        for (auto& latencyBudgetInfo: merged.latencyBudgets) {
+            std::stable_sort(
+                latencyBudgetInfo.windows.begin(),
+                latencyBudgetInfo.windows.end(),
+                [](const LatencyBudgetWindow& lhs, const LatencyBudgetWindow& rhs){
+                    return lhs.start < rhs.start;
+                }
+            );
+        }
+        IndexCallers(merged);
+        return merged;
+    }
+
     /**
      * This contains the private properties of a MoonClock instance.
      */
     struct MoonClock::Impl {
         // Types
 
+        /**
+         * This holds information about one call on a critical path
+         * while the critical path is being found.
+         */
+        struct CriticalPathLink {
+            /**
+             * This points to the path to the function called.
+             */
+            const Path* path = nullptr;
+
+            /**
+             * This is the amount of time elapsed, in seconds,
+             * during the call.
+             */
+            double totalTime = 0.0;
+        };
+
         /**
          * This holds information needed about one level of the Lua call stack,
          * when the default instrumentation is used.
@@ -448,88 +809,609 @@ namespace MoonClock {
             double start = 0.0;
 
             /**
-             * This represents the path to the function at this level
+             * This points to the path to the function at this level
              * of the Lua call stack, relative to some reference such as
-             * the Lua global variables.
+             * the Lua global variables.  The path is the key of the
+             * function's entry in the report.
              */
-            Path path;
-        };
+            const Path* path = nullptr;
 
-        /**
-         * This holds information needed at each level of the Lua call stack,
-         * when the default instrumentation is used.
-         */
-        using CallStack = std::stack< CallStackLocation >;
+            /**
+             * This is the Lua thread which called the function at this
+             * level of the Lua call stack.  Calls made by all coroutines
+             * share the one call stack, so this tells them apart.
+             */
+            lua_State* lua = nullptr;
 
-        // Properties
+            /**
+             * This points to the entry in the report for the function
+             * at this level of the Lua call stack.
+             */
+            FunctionInformation* functionInfo = nullptr;
+
+            /**
+             * If slow-call argument capture is enabled, this holds
+             * a summary of each argument passed to the function at this
+             * level of the Lua call stack.
+             */
+            std::vector< std::string > arguments;
+
+            /**
+             * This is the number of blocks of memory newly allocated
+             * while instrumented, when the function at this level
+             * of the Lua call stack was called.
+             */
+            size_t startAllocations = 0;
+
+            /**
+             * This is the number of bytes newly allocated while
+             * instrumented, when the function at this level of the
+             * Lua call stack was called.
+             */
+            size_t startBytesAllocated = 0;
+
+            /**
+             * This is the number of Lua virtual machine instructions
+             * executed while instrumented, when the function at this level
+             * of the Lua call stack was called.
+             */
+            size_t startInstructions = 0;
+
+            /**
+             * If critical path tracking is enabled, this is the amount of
+             * time elapsed, in seconds, during the longest call made so far
+             * by the function at this level of the Lua call stack,
+             * or a negative number if no calls have been made.
+             */
+            double longestCallTime = -1.0;
+
+            /**
+             * If critical path tracking is enabled, this holds the critical
+             * path through the longest call made so far by the function
+             * at this level of the Lua call stack, innermost call first.
+             */
+            std::vector< CriticalPathLink > criticalPath;
+
+            /**
+             * If call tree tracking is enabled, this is the index in the
+             * call tree of the node for the function at this level
+             * of the Lua call stack.
+             */
+            size_t callTreeNode = 0;
+
+            /**
+             * If the function at this level of the Lua call stack was called
+             * through its instrumented wrapper, this points to the indices
+             * of the latency budgets which apply to it.
+             */
+            const std::vector< size_t >* latencyBudgets = nullptr;
+        };
 
         /**
          * This holds information needed at each level of the Lua call stack,
-         * when the default instrumentation is used.
+         * when the default instrumentation is used.  The innermost call
+         * is at the back.
          */
-        CallStack callStack;
+        using CallStack = std::vector< CallStackLocation >;
 
         /**
-         * When the default instrumentation is used, the data collected
-         * by the instrumentation is stored here.
+         * This is a copy of one level of the Lua call stack, published
+         * by the thread running Lua for the stall detector to read.
          */
-        Report report;
+        struct PublishedCallStackLocation {
+            /**
+             * This is the value sampled from the real-time clock
+             * when the function at this level of the Lua call stack
+             * was called.
+             */
+            std::atomic< double > start;
 
-        /**
-         * This points to the Lua interpreter's state.
-         */
-        std::shared_ptr< lua_State > lua;
+            /**
+             * This points to the path to the function at this level
+             * of the Lua call stack.
+             */
+            std::atomic< const Path* > path;
 
-        /**
-         * When the default instrumentation is used, this object is used
-         * to measure real-time.
-         */
-        std::shared_ptr< Timekeeping::Clock > clock;
+            /**
+             * This indicates whether or not the function at this level
+             * of the Lua call stack was called on the main Lua thread,
+             * rather than by a coroutine.  Only such calls are aborted.
+             */
+            std::atomic< bool > mainThread;
+        };
 
         /**
-         * This is the time, according to the object used to measure real-time,
-         * when instrumentation of the Lua functions was started.
+         * This holds information about a stalled call which the stall
+         * detector asked to abort, for the hook it set to use.
          */
-        double startTime = 0.0;
+        struct StallAbort {
+            /**
+             * This indicates whether or not the stall detector has asked
+             * to abort any stalled call since it was started.
+             */
+            bool requested = false;
 
-        /**
-         * This is the Lua registry index of the table of instrumented
-         * functions.
-         */
-        int luaRegistryIndex = 0;
+            /**
+             * This is the level of the Lua call stack, counting from zero
+             * for the outermost call, at which the stalled call was made.
+             */
+            size_t level = 0;
 
-        // Lifecycle management
+            /**
+             * This is the value sampled from the real-time clock
+             * when the stalled call was made.
+             */
+            double start = 0.0;
 
-        ~Impl() noexcept = default;
-        Impl(const Impl&) = delete;
-        Impl(Impl&&) = default;
-        Impl& operator=(const Impl&) = delete;
-        Impl& operator=(Impl&&) noexcept = default;
+            /**
+             * This is the hook which was set on the main Lua thread before
+             * the stall detector replaced it, to set back afterwards.
+             */
+            lua_Hook previousHook = NULL;
 
-        // Methods
+            /**
+             * This is the mask of the hook which was set on the main
+             * Lua thread before the stall detector replaced it.
+             */
+            int previousHookMask = 0;
 
-        /**
-         * This is the default constructor.
-         */
-        Impl() = default;
+            /**
+             * This is the count of the hook which was set on the main
+             * Lua thread before the stall detector replaced it.
+             */
+            int previousHookCount = 0;
+        };
 
         /**
-         * Attach instruments to all Lua functions.
-         *
-         * @param[in,out] lua
-         *     This points to the Lua interpreter's state.
-         *
-         * @param[in] before
-         *     This is the instrumentation to apply at the beginning
-         *     of each Lua function call.
-         *
-         * @param[in] after
-         *     This is the instrumentation to apply at the end
-         *     of each Lua function call.
-         *
-         * @param[in] context
-         *     This is the pointer to provide to the before and after
-         *     instruments whenever they are called.
+         * This holds the Lua registry references and other information
+         * needed about one instrumented Lua function, in order to call
+         * the instruments and to remove the instrumentation later.
+         */
+        struct InstrumentedFunction {
+            /**
+             * This represents the path to the function, relative to some
+             * reference such as the Lua global variables.
+             */
+            Path path;
+
+            /**
+             * This is the Lua registry reference to the composite
+             * containing the function.
+             */
+            int parentRef = LUA_NOREF;
+
+            /**
+             * This is the Lua registry reference to the key of the function
+             * in the composite containing it.
+             */
+            int keyRef = LUA_NOREF;
+
+            /**
+             * This is the Lua registry reference to the original function.
+             */
+            int originalRef = LUA_NOREF;
+
+            /**
+             * This is the Lua registry reference to the instrumented wrapper
+             * which replaced the original function.
+             */
+            int wrapperRef = LUA_NOREF;
+
+            /**
+             * This holds information about where the function was defined.
+             */
+            SourceInformation sourceInfo;
+
+            /**
+             * These are the indices of the latency budgets
+             * which apply to the function.
+             */
+            std::vector< size_t > latencyBudgets;
+        };
+
+        /**
+         * This holds information needed about a module which was loaded
+         * while module load profiling is enabled, in order to search it
+         * again for functions when rescanning.
+         */
+        struct ModuleRoot {
+            /**
+             * This is the path to prepend to the paths of the functions
+             * found in the module.
+             */
+            Path basePath;
+
+            /**
+             * This is the Lua registry reference to the module.
+             */
+            int ref = LUA_NOREF;
+        };
+
+        /**
+         * This holds information needed about a function in package.searchers
+         * which was intercepted for module load profiling.
+         */
+        struct InterceptedSearcher {
+            /**
+             * This is the index of the function in package.searchers.
+             */
+            lua_Integer index = 0;
+
+            /**
+             * This is the Lua registry reference to the original function.
+             */
+            int originalRef = LUA_NOREF;
+
+            /**
+             * This is the Lua registry reference to the function which
+             * replaced the original function.
+             */
+            int interceptorRef = LUA_NOREF;
+        };
+
+        /**
+         * This holds information about a module currently being loaded.
+         */
+        struct ModuleLoad {
+            /**
+             * This holds the information collected so far about the
+             * loading of the module.
+             */
+            ModuleLoadInformation info;
+
+            /**
+             * This is the number of levels of the Lua call stack when the
+             * module started loading.  It's used to detect modules which
+             * never finished loading because of Lua errors.
+             */
+            int level = 0;
+        };
+
+        // Properties
+
+        /**
+         * This holds information needed at each level of the Lua call stack,
+         * when the default instrumentation is used.
+         */
+        CallStack callStack;
+
+        /**
+         * This indicates whether or not module load profiling is enabled.
+         */
+        bool moduleLoadProfilingEnabled = false;
+
+        /**
+         * This indicates whether or not memory tracking is enabled.
+         */
+        bool memoryTrackingEnabled = false;
+
+        /**
+         * While memory is tracked, this is the allocator function
+         * which the Lua interpreter used before it was wrapped.
+         */
+        lua_Alloc originalAllocator = nullptr;
+
+        /**
+         * While memory is tracked, this is the opaque pointer given
+         * to the allocator function which the Lua interpreter used
+         * before it was wrapped.
+         */
+        void* originalAllocatorUd = nullptr;
+
+        /**
+         * While memory is tracked, this is the number of bytes
+         * currently in use by the Lua interpreter.
+         */
+        size_t memoryInUse = 0;
+
+        /**
+         * This is the number of instructions to execute between calls
+         * of the instruction counting hook, or zero if instruction
+         * counting is disabled.
+         */
+        size_t instructionCountingGranularity = 0;
+
+        /**
+         * This indicates whether or not the instruction counting hook
+         * is set on the Lua interpreter.
+         */
+        bool countingInstructions = false;
+
+        /**
+         * If the default instruments use a virtual clock, this points
+         * to it, so that it can be driven by the Lua interpreter.
+         */
+        std::shared_ptr< VirtualClock > virtualClock;
+
+        /**
+         * This holds information about each module loaded while module load
+         * profiling is enabled.
+         */
+        std::vector< ModuleRoot > moduleRoots;
+
+        /**
+         * This holds information about each function in package.searchers
+         * intercepted for module load profiling.
+         */
+        std::vector< InterceptedSearcher > interceptedSearchers;
+
+        /**
+         * These are the Lua registry references to the loaders returned by
+         * the intercepted functions in package.searchers, which are kept in
+         * order to detach them from this instance when module load profiling
+         * is stopped, in case anything still holds them.
+         */
+        std::vector< int > profiledLoaderRefs;
+
+        /**
+         * This holds information about the modules currently being loaded,
+         * with the innermost at the back.
+         */
+        std::vector< ModuleLoad > moduleLoadStack;
+
+        /**
+         * This holds information about every instrumented Lua function.
+         * The index of each function is its ID, which is captured by its
+         * instrumented wrapper.  A deque is used so that references to
+         * the paths stay valid when more functions are instrumented.
+         */
+        std::deque< InstrumentedFunction > instrumentedFunctions;
+
+        /**
+         * These are the IDs of the functions whose instrumentation was
+         * removed by a rescan, by path.  A slot is only reused for a
+         * function found later at the same path, so that the after
+         * instrument of a call still in progress through a removed
+         * wrapper is given the right path, and so that reloading
+         * functions doesn't grow the instrumented functions without bound.
+         */
+        std::map< Path, std::vector< size_t > > freeIdsByPath;
+
+        /**
+         * This is the Lua registry reference to the full userdata shared,
+         * as an upvalue, by all the instrumented wrappers made while
+         * instrumenting.  It holds a pointer to this instance, which is
+         * cleared when instrumentation is stopped, in order to detach
+         * every wrapper at once, even those already removed by a rescan.
+         */
+        int wrapperAttachmentRef = LUA_NOREF;
+
+        /**
+         * This points to the pointer held in the full userdata referenced
+         * by wrapperAttachmentRef, or is nullptr if not instrumenting.
+         */
+        Impl** wrapperAttachment = nullptr;
+
+        /**
+         * This points to the instrumented function whose wrapper most
+         * recently called the before instrument, so that the default
+         * before instrument can find it without looking up its path.
+         */
+        const InstrumentedFunction* calledFunction = nullptr;
+
+        /**
+         * This is the instrumentation to apply at the beginning
+         * of each Lua function call.
+         */
+        Instrument before = nullptr;
+
+        /**
+         * This is the instrumentation to apply at the end
+         * of each Lua function call.
+         */
+        Instrument after = nullptr;
+
+        /**
+         * This is the pointer to provide to the before and after
+         * instruments whenever they are called.
+         */
+        void* context = nullptr;
+
+        /**
+         * This indicates whether or not Lua functions are instrumented.
+         */
+        bool instrumenting = false;
+
+        /**
+         * When the default instrumentation is used, the data collected
+         * by the instrumentation is stored here.
+         */
+        Report report;
+
+        /**
+         * This points to the Lua interpreter's state.
+         */
+        std::shared_ptr< lua_State > lua;
+
+        /**
+         * When the default instrumentation is used, this object is used
+         * to measure real-time.
+         */
+        std::shared_ptr< Timekeeping::Clock > clock;
+
+        /**
+         * This is the time, according to the object used to measure real-time,
+         * when instrumentation of the Lua functions was started.
+         */
+        double startTime = 0.0;
+
+        /**
+         * These are the settings which control how the default instruments
+         * capture calls which take longer than expected.
+         */
+        SlowCallOptions slowCallOptions;
+
+        /**
+         * This indicates whether or not any slow-call threshold is set,
+         * so that the default instruments can skip checking for slow calls
+         * altogether when it isn't.
+         */
+        bool slowCallCaptureEnabled = false;
+
+        /**
+         * This indicates whether or not the default instruments find
+         * the critical path through each top-level call.
+         */
+        bool criticalPathTrackingEnabled = false;
+
+        /**
+         * This is the maximum number of critical paths kept in the report.
+         */
+        size_t criticalPathCapacity = 100;
+
+        /**
+         * This indicates whether or not the default instruments
+         * collect the call tree.
+         */
+        bool callTreeTrackingEnabled = false;
+
+        /**
+         * This indicates whether or not the default instruments
+         * collect latency histograms.
+         */
+        bool latencyHistogramsEnabled = false;
+
+        /**
+         * If live statistics are published in shared memory,
+         * this is used to publish them.
+         */
+        std::unique_ptr< SharedStatisticsWriter > sharedStatistics;
+
+        /**
+         * This holds the index of the shared statistics entry of each
+         * function in the report which has been published.
+         */
+        std::unordered_map< const FunctionInformation*, size_t > sharedStatisticsEntries;
+
+        /**
+         * These are the latency budgets enforced by the default instruments.
+         */
+        std::vector< LatencyBudget > latencyBudgets;
+
+        /**
+         * This caches, for each function path encountered which isn't the
+         * path of an instrumented function, the indices of the latency
+         * budgets which apply to the function.
+         */
+        std::map< Path, std::vector< size_t > > latencyBudgetsByPath;
+
+        /**
+         * These are the settings which control the stall detector.
+         */
+        StallDetectorOptions stallDetectorOptions;
+
+        /**
+         * This indicates whether or not the stall detector is running,
+         * and so whether the default instruments publish the call stack.
+         */
+        bool stallDetectorEnabled = false;
+
+        /**
+         * This holds the levels of the Lua call stack published
+         * for the stall detector, starting with the outermost call.
+         */
+        std::unique_ptr< PublishedCallStackLocation[] > publishedCallStack;
+
+        /**
+         * This is the number of levels of the Lua call stack,
+         * including levels too deep to be published.
+         */
+        std::atomic< size_t > publishedCallStackDepth{0};
+
+        /**
+         * This is incremented before and after each change to the published
+         * call stack, so that the stall detector can tell when it reads
+         * the published call stack while it's being changed.
+         */
+        std::atomic< unsigned int > publishedCallStackSequence{0};
+
+        /**
+         * This is the thread which runs the stall detector.
+         */
+        std::thread stallDetectorThread;
+
+        /**
+         * This is used to wake up the stall detector thread when
+         * it's time for it to stop.
+         */
+        std::condition_variable stallDetectorWakeCondition;
+
+        /**
+         * This is used to synchronize access to the stallDetectorStop flag.
+         */
+        std::mutex stallDetectorMutex;
+
+        /**
+         * This flag is set when the stall detector thread should stop.
+         */
+        bool stallDetectorStop = false;
+
+        /**
+         * This holds information about each stalled call detected by the
+         * stall detector.
+         */
+        std::vector< StallInformation > stalls;
+
+        /**
+         * This is used to synchronize access to the stalls detected by the
+         * stall detector.
+         */
+        mutable std::mutex stallsMutex;
+
+        /**
+         * This holds information about the stalled call the stall detector
+         * most recently asked to abort.
+         */
+        StallAbort stallAbort;
+
+        /**
+         * This is used to synchronize access to stallAbort, and to the hook
+         * of the main Lua thread while the stall detector changes it.
+         */
+        std::mutex stallAbortMutex;
+
+        /**
+         * This is set by the stall detector thread when it asks to abort
+         * a stalled call, and cleared by the hook it sets once the hook
+         * has run, or when the stall detector is stopped.
+         */
+        std::atomic< bool > stallAbortPending{false};
+
+        // Lifecycle management
+
+        ~Impl() noexcept {
+            StopInstrumentation();
+            StopStallDetector();
+        }
+        Impl(const Impl&) = delete;
+        Impl(Impl&&) noexcept = delete;
+        Impl& operator=(const Impl&) = delete;
+        Impl& operator=(Impl&&) noexcept = delete;
+
+        // Methods
+
+        /**
+         * This is the default constructor.
+         */
+        Impl() = default;
+
+        /**
+         * Attach instruments to all Lua functions.
+         *
+         * @param[in,out] lua
+         *     This points to the Lua interpreter's state.
+         *
+         * @param[in] before
+         *     This is the instrumentation to apply at the beginning
+         *     of each Lua function call.
+         *
+         * @param[in] after
+         *     This is the instrumentation to apply at the end
+         *     of each Lua function call.
+         *
+         * @param[in] context
+         *     This is the pointer to provide to the before and after
+         *     instruments whenever they are called.
          */
         void StartInstrumentation(
             const std::shared_ptr< lua_State >& lua,
@@ -537,72 +1419,1661 @@ namespace MoonClock {
             Instrument after,
             void* context
         ) {
-            if (luaRegistryIndex != 0) {
+            if (instrumenting) {
+                return;
+            }
+            this->lua = lua;
+            this->before = before;
+            this->after = after;
+            this->context = context;
+            wrapperAttachment = (Impl**)lua_newuserdata(lua.get(), sizeof(Impl*)); // -1 = attachment
+            *wrapperAttachment = this;
+            wrapperAttachmentRef = luaL_ref(lua.get(), LUA_REGISTRYINDEX); // (stack empty)
+            lua_getglobal(lua.get(), "_G"); // -1 = _G
+            FindFunctions(
+                lua.get(),
+                -1,
+                {},
+                [this](lua_State* lua, int parentIndex, const Path& path){
+                    AddInstrumentedFunction(lua, parentIndex, path);
+                }
+            );
+            lua_pop(lua.get(), 1); // (stack empty)
+            for (size_t id = 0; id < instrumentedFunctions.size(); ++id) {
+                InstallWrapper(lua.get(), id);
+            }
+            if (moduleLoadProfilingEnabled) {
+                InterceptSearchers();
+            }
+            instrumenting = true;
+            if (clock != nullptr) {
+                startTime = clock->GetCurrentTime();
+            }
+            report = Report();
+            sharedStatisticsEntries.clear();
+            for (const auto& instrumentedFunction: instrumentedFunctions) {
+                report.sources[instrumentedFunction.path] = instrumentedFunction.sourceInfo;
+            }
+            if (callTreeTrackingEnabled) {
+                report.callTree.resize(1);
+            }
+            callStack.clear();
+            {
+                std::lock_guard< decltype(stallsMutex) > lock(stallsMutex);
+                stalls.clear();
+            }
+            if (memoryTrackingEnabled) {
+                StartMemoryTracking();
+            }
+            if (instructionCountingGranularity > 0) {
+                StartInstructionCounting();
+            }
+            for (const auto& latencyBudget: latencyBudgets) {
+                AddLatencyBudgetInformation(latencyBudget, startTime);
+            }
+
+            // The stall detector is started last, so that it finds any hook
+            // set above already in place if it needs to replace it.
+            StartStallDetector();
+        }
+
+        /**
+         * Add the information about the given latency budget to the report,
+         * starting its first time window at the given time.  The budgets
+         * in the report are kept in the same order as the latency budgets
+         * enforced, so that they share indices.
+         *
+         * @param[in] latencyBudget
+         *     This is the latency budget whose information to add.
+         *
+         * @param[in] start
+         *     This is the value sampled from the real-time clock when
+         *     the latency budget started being enforced.
+         */
+        void AddLatencyBudgetInformation(
+            const LatencyBudget& latencyBudget,
+            double start
+        ) {
+            LatencyBudgetInformation latencyBudgetInfo;
+            latencyBudgetInfo.pattern = latencyBudget.pattern;
+            latencyBudgetInfo.budget = latencyBudget.budget;
+            LatencyBudgetWindow window;
+            window.start = start;
+            latencyBudgetInfo.windows.push_back(window);
+            report.latencyBudgets.push_back(std::move(latencyBudgetInfo));
+        }
+
+        /**
+         * Find the indices of the latency budgets which apply
+         * to the function with the given path.
+         *
+         * @param[in] path
+         *     This represents the path to the function for which to
+         *     look up the latency budgets.
+         *
+         * @return
+         *     The indices of the latency budgets which apply to the function
+         *     with the given path are returned.
+         */
+        std::vector< size_t > MatchLatencyBudgets(const Path& path) const {
+            std::vector< size_t > indices;
+            for (size_t i = 0; i < latencyBudgets.size(); ++i) {
+                if (PathMatchesPattern(path, latencyBudgets[i].pattern)) {
+                    indices.push_back(i);
+                }
+            }
+            return indices;
+        }
+
+        /**
+         * Return the indices of the latency budgets which apply to the
+         * function with the given path, caching them for the next time.
+         * This is used for calls which didn't come through an instrumented
+         * wrapper, whose latency budgets are found ahead of time.
+         *
+         * @param[in] path
+         *     This represents the path to the function for which to
+         *     look up the latency budgets.
+         *
+         * @return
+         *     The indices of the latency budgets which apply to the function
+         *     with the given path are returned.
+         */
+        const std::vector< size_t >& GetLatencyBudgets(const Path& path) {
+            auto latencyBudgetsByPathEntry = latencyBudgetsByPath.find(path);
+            if (latencyBudgetsByPathEntry == latencyBudgetsByPath.end()) {
+                latencyBudgetsByPathEntry = latencyBudgetsByPath.insert({path, MatchLatencyBudgets(path)}).first;
+            }
+            return latencyBudgetsByPathEntry->second;
+        }
+
+        /**
+         * Find again the latency budgets which apply to each function,
+         * after the latency budgets were changed.
+         */
+        void UpdateLatencyBudgets() {
+            latencyBudgetsByPath.clear();
+            for (auto& instrumentedFunction: instrumentedFunctions) {
+                instrumentedFunction.latencyBudgets = MatchLatencyBudgets(instrumentedFunction.path);
+            }
+        }
+
+        /**
+         * Count a call against all latency budgets which apply to it.
+         *
+         * @param[in] path
+         *     This represents the path to the function which was called.
+         *
+         * @param[in] indices
+         *     These are the indices of the latency budgets
+         *     which apply to the function.
+         *
+         * @param[in] finish
+         *     This is the value sampled from the real-time clock
+         *     when the call returned.
+         *
+         * @param[in] total
+         *     This is the amount of time elapsed, in seconds,
+         *     during the call.
+         */
+        void ApplyLatencyBudgets(
+            const Path& path,
+            const std::vector< size_t >& indices,
+            double finish,
+            double total
+        ) {
+            for (const auto i: indices) {
+                const auto& latencyBudget = latencyBudgets[i];
+                auto& latencyBudgetInfo = report.latencyBudgets[i];
+
+                // Start a new time window if the current one has ended.
+                auto& currentWindow = latencyBudgetInfo.windows.back();
+                if (
+                    (latencyBudget.window > 0.0)
+                    && (finish >= currentWindow.start + latencyBudget.window)
+                ) {
+                    const auto windowsElapsed = floor((finish - currentWindow.start) / latencyBudget.window);
+                    LatencyBudgetWindow nextWindow;
+                    nextWindow.start = currentWindow.start + windowsElapsed * latencyBudget.window;
+                    latencyBudgetInfo.windows.push_back(nextWindow);
+                    while (
+                        (latencyBudgetInfo.windows.size() > 1)
+                        && (latencyBudgetInfo.windows.size() > latencyBudget.windowHistory)
+                    ) {
+                        latencyBudgetInfo.windows.pop_front();
+                    }
+                }
+                auto& window = latencyBudgetInfo.windows.back();
+
+                // Count the call, and the violation if the call exceeded
+                // the budget.
+                ++latencyBudgetInfo.numCalls;
+                ++window.numCalls;
+                if (total > latencyBudget.budget) {
+                    ++latencyBudgetInfo.numViolations;
+                    ++window.numViolations;
+                    if (latencyBudget.onViolation != nullptr) {
+                        latencyBudget.onViolation(path, total, latencyBudget.pattern, latencyBudget.budget);
+                    }
+                }
+
+                // Update the burn rate for the window.
+                const auto allowedViolationRatio = 1.0 - latencyBudget.objective;
+                const auto violationRatio = (double)window.numViolations / window.numCalls;
+                if (allowedViolationRatio > 0.0) {
+                    window.burnRate = violationRatio / allowedViolationRatio;
+                } else if (window.numViolations > 0) {
+                    window.burnRate = std::numeric_limits< decltype(window.burnRate) >::infinity();
+                } else {
+                    window.burnRate = 0.0;
+                }
+            }
+        }
+
+        /**
+         * This is the Lua C function which wraps each instrumented Lua
+         * function.  It calls the before instrument, the original function,
+         * and the after instrument.
+         *
+         * Its upvalues are:
+         * 1. full userdata holding a pointer to the Impl instance,
+         *    which is cleared once instrumentation is stopped
+         * 2. the ID of the instrumented function, or nil once
+         *    the instrumentation is removed
+         * 3. the original function
+         *
+         * @param[in,out] lua
+         *     This points to the Lua interpreter's state.
+         *
+         * The original function is called with a continuation, so that
+         * coroutines may yield through the wrapper (for example, when
+         * coroutine.yield itself is instrumented).
+         *
+         * @return
+         *     The number of values returned by the original function
+         *     is returned.
+         */
+        static int InstrumentedCall(lua_State* lua) {
+            const auto self = *(Impl**)lua_touserdata(lua, lua_upvalueindex(1));
+            const auto numArgs = lua_gettop(lua);
+            lua_KContext instrumented = 0;
+            if (
+                (self != nullptr)
+                && !lua_isnil(lua, lua_upvalueindex(2))
+            ) {
+                const auto id = (size_t)lua_tointeger(lua, lua_upvalueindex(2));
+                const auto& instrumentedFunction = self->instrumentedFunctions[id];
+                self->calledFunction = &instrumentedFunction;
+                self->before(lua, self->context, instrumentedFunction.path);
+                instrumented = (lua_KContext)(id + 1);
+            }
+            lua_pushvalue(lua, lua_upvalueindex(3));
+            lua_insert(lua, 1);
+            lua_callk(lua, numArgs, LUA_MULTRET, instrumented, InstrumentedCallFinish);
+            return InstrumentedCallFinish(lua, LUA_OK, instrumented);
+        }
+
+        /**
+         * This function finishes a call made through InstrumentedCall,
+         * either directly when the original function returns without
+         * yielding, or as the continuation when a coroutine which
+         * yielded through the wrapper is resumed and the original
+         * function returns.
+         *
+         * The after-instrument is only called if the before-instrument
+         * was called for this call, and instrumentation hasn't been
+         * stopped in the meantime (which can happen while a coroutine
+         * is suspended).  It is still called if only this function's
+         * wrapper was removed by a rescan, so that the call is popped
+         * from the call stack.
+         *
+         * @param[in,out] lua
+         *     This points to the Lua interpreter's state.
+         *
+         * @param[in] status
+         *     This is LUA_OK if the original function returned without
+         *     yielding, or LUA_YIELD if the call is being continued
+         *     after the coroutine was resumed.
+         *
+         * @param[in] instrumented
+         *     If the before-instrument was called, this is one more than
+         *     the ID of the instrumented function.  Otherwise, it's zero.
+         *
+         * @return
+         *     The number of values returned by the original function
+         *     is returned.
+         */
+        static int InstrumentedCallFinish(lua_State* lua, int status, lua_KContext instrumented) {
+            (void)status;
+            const auto self = *(Impl**)lua_touserdata(lua, lua_upvalueindex(1));
+            if (
+                (self != nullptr)
+                && (instrumented != 0)
+            ) {
+                const auto id = (size_t)(instrumented - 1);
+                self->after(lua, self->context, self->instrumentedFunctions[id].path);
+            }
+            return lua_gettop(lua);
+        }
+
+        /**
+         * Add a function found in a Lua composite hierarchy to the
+         * instrumented functions, without installing its wrapper yet.
+         * If the instrumentation of a function at the same path was
+         * removed before, its ID is reused.
+         *
+         * On entry, the top value on the Lua stack is the function, and
+         * the next value on the Lua stack, from the top, is the function's
+         * key in the composite containing it.
+         *
+         * @param[in,out] lua
+         *     This is the state of the Lua interpreter to use.
+         *
+         * @param[in] parentIndex
+         *     This is the index into the Lua stack where the composite
+         *     containing the function can be found.
+         *
+         * @param[in] path
+         *     This represents the path to the function.
+         *
+         * @return
+         *     The ID of the function is returned.
+         */
+        size_t AddInstrumentedFunction(
+            lua_State* lua,
+            int parentIndex,
+            const Path& path
+        ) {
+            InstrumentedFunction instrumentedFunction;
+            instrumentedFunction.path = path;
+            lua_pushvalue(lua, parentIndex); // -1 = parent, -2 = fn, -3 = key
+            instrumentedFunction.parentRef = luaL_ref(lua, LUA_REGISTRYINDEX); // -1 = fn, -2 = key
+            lua_pushvalue(lua, -2); // -1 = key, -2 = fn, -3 = key
+            instrumentedFunction.keyRef = luaL_ref(lua, LUA_REGISTRYINDEX); // -1 = fn, -2 = key
+            lua_pushvalue(lua, -1); // -1 = fn, -2 = fn, -3 = key
+            instrumentedFunction.originalRef = luaL_ref(lua, LUA_REGISTRYINDEX); // -1 = fn, -2 = key
+            lua_Debug ar;
+            lua_pushvalue(lua, -1); // -1 = fn, -2 = fn, -3 = key
+            if (lua_getinfo(lua, ">S", &ar) != 0) { // -1 = fn, -2 = key
+                instrumentedFunction.sourceInfo.source = ar.short_src;
+                instrumentedFunction.sourceInfo.lineDefined = std::max(ar.linedefined, 0);
+                instrumentedFunction.sourceInfo.lastLineDefined = std::max(ar.lastlinedefined, 0);
+            }
+            report.sources[path] = instrumentedFunction.sourceInfo;
+            instrumentedFunction.latencyBudgets = MatchLatencyBudgets(path);
+            const auto freeIdsByPathEntry = freeIdsByPath.find(path);
+            if (freeIdsByPathEntry != freeIdsByPath.end()) {
+                auto& freeIds = freeIdsByPathEntry->second;
+                const auto id = freeIds.back();
+                freeIds.pop_back();
+                if (freeIds.empty()) {
+                    (void)freeIdsByPath.erase(freeIdsByPathEntry);
+                }
+                instrumentedFunctions[id] = std::move(instrumentedFunction);
+                return id;
+            }
+            instrumentedFunctions.push_back(std::move(instrumentedFunction));
+            return instrumentedFunctions.size() - 1;
+        }
+
+        /**
+         * Construct the instrumented wrapper for the given function,
+         * and replace the function with it in the composite containing it.
+         *
+         * @param[in,out] lua
+         *     This is the state of the Lua interpreter to use.
+         *
+         * @param[in] id
+         *     This is the ID of the function to instrument.
+         */
+        void InstallWrapper(lua_State* lua, size_t id) {
+            auto& instrumentedFunction = instrumentedFunctions[id];
+            lua_rawgeti(lua, LUA_REGISTRYINDEX, instrumentedFunction.parentRef); // -1 = parent
+            lua_rawgeti(lua, LUA_REGISTRYINDEX, instrumentedFunction.keyRef); // -1 = key, -2 = parent
+            lua_rawgeti(lua, LUA_REGISTRYINDEX, wrapperAttachmentRef); // -1 = attachment, -2 = key, -3 = parent
+            lua_pushinteger(lua, (lua_Integer)id); // -1 = id, -2 = attachment, -3 = key, -4 = parent
+            lua_rawgeti(lua, LUA_REGISTRYINDEX, instrumentedFunction.originalRef); // -1 = fn, -2 = id, -3 = attachment, -4 = key, -5 = parent
+            lua_pushcclosure(lua, InstrumentedCall, 3); // -1 = wrapper, -2 = key, -3 = parent
+            lua_pushvalue(lua, -1); // -1 = wrapper, -2 = wrapper, -3 = key, -4 = parent
+            instrumentedFunction.wrapperRef = luaL_ref(lua, LUA_REGISTRYINDEX); // -1 = wrapper, -2 = key, -3 = parent
+            lua_settable(lua, -3); // -1 = parent
+            lua_pop(lua, 1); // (stack empty)
+        }
+
+        /**
+         * Reinstall the original function in place of its instrumented
+         * wrapper, detach the wrapper so that it no longer calls the
+         * instruments for new calls if anything still holds it, and
+         * release all the Lua registry references held for the function.
+         * Calls already in progress through the wrapper still call the
+         * after instrument when they return, until instrumentation is
+         * stopped.
+         *
+         * @param[in,out] instrumentedFunction
+         *     This holds information about the function to restore.
+         */
+        void RemoveWrapper(InstrumentedFunction& instrumentedFunction) {
+            if (instrumentedFunction.wrapperRef != LUA_NOREF) {
+                // Reinstall the original function, unless the wrapper was
+                // already replaced with something else.
+                lua_rawgeti(lua.get(), LUA_REGISTRYINDEX, instrumentedFunction.wrapperRef); // -1 = wrapper
+                lua_rawgeti(lua.get(), LUA_REGISTRYINDEX, instrumentedFunction.parentRef); // -1 = parent, -2 = wrapper
+                lua_rawgeti(lua.get(), LUA_REGISTRYINDEX, instrumentedFunction.keyRef); // -1 = key, -2 = parent, -3 = wrapper
+                (void)lua_gettable(lua.get(), -2); // -1 = parent[key], -2 = parent, -3 = wrapper
+                const auto wrapperInstalled = (lua_rawequal(lua.get(), -1, -3) == 1);
+                lua_pop(lua.get(), 1); // -1 = parent, -2 = wrapper
+                if (wrapperInstalled) {
+                    lua_rawgeti(lua.get(), LUA_REGISTRYINDEX, instrumentedFunction.keyRef); // -1 = key, -2 = parent, -3 = wrapper
+                    lua_rawgeti(lua.get(), LUA_REGISTRYINDEX, instrumentedFunction.originalRef); // -1 = fn, -2 = key, -3 = parent, -4 = wrapper
+                    lua_settable(lua.get(), -3); // -1 = parent, -2 = wrapper
+                }
+                lua_pop(lua.get(), 1); // -1 = wrapper
+
+                // Detach the wrapper from the instruments.
+                lua_pushnil(lua.get()); // -1 = nil, -2 = wrapper
+                (void)lua_setupvalue(lua.get(), -2, 2); // -1 = wrapper
+                lua_pop(lua.get(), 1); // (stack empty)
+            }
+            luaL_unref(lua.get(), LUA_REGISTRYINDEX, instrumentedFunction.parentRef);
+            luaL_unref(lua.get(), LUA_REGISTRYINDEX, instrumentedFunction.keyRef);
+            luaL_unref(lua.get(), LUA_REGISTRYINDEX, instrumentedFunction.originalRef);
+            luaL_unref(lua.get(), LUA_REGISTRYINDEX, instrumentedFunction.wrapperRef);
+            instrumentedFunction.parentRef = LUA_NOREF;
+            instrumentedFunction.keyRef = LUA_NOREF;
+            instrumentedFunction.originalRef = LUA_NOREF;
+            instrumentedFunction.wrapperRef = LUA_NOREF;
+        }
+
+        /**
+         * This is the Lua C function which replaces each function in
+         * package.searchers while module load profiling is enabled.  It calls
+         * the original function, and if that returns a loader, replaces the
+         * loader with one which profiles it.
+         *
+         * Its upvalues are:
+         * 1. light userdata pointing to the Impl instance, or nil once
+         *    module load profiling is stopped
+         * 2. the original function
+         *
+         * @param[in,out] lua
+         *     This points to the Lua interpreter's state.
+         *
+         * @return
+         *     The number of values returned by the original function
+         *     is returned.
+         */
+        static int InterceptedSearcherCall(lua_State* lua) {
+            const auto self = (Impl*)lua_touserdata(lua, lua_upvalueindex(1));
+            const auto numArgs = lua_gettop(lua);
+            lua_pushvalue(lua, lua_upvalueindex(2));
+            lua_insert(lua, 1);
+            lua_call(lua, numArgs, LUA_MULTRET);
+            const auto numResults = lua_gettop(lua);
+            if (
+                (self != nullptr)
+                && (numResults >= 1)
+                && lua_isfunction(lua, 1)
+            ) {
+                lua_pushlightuserdata(lua, self);
+                lua_pushvalue(lua, 1);
+                lua_pushcclosure(lua, ProfiledLoaderCall, 2);
+                lua_pushvalue(lua, -1);
+                self->profiledLoaderRefs.push_back(luaL_ref(lua, LUA_REGISTRYINDEX));
+                lua_replace(lua, 1);
+            }
+            return numResults;
+        }
+
+        /**
+         * This is the Lua C function which replaces each module loader
+         * returned by package.searchers while module load profiling
+         * is enabled.  It measures the time taken to call the original
+         * loader, and instruments the module loaded.
+         *
+         * Its upvalues are:
+         * 1. light userdata pointing to the Impl instance, or nil once
+         *    module load profiling is stopped
+         * 2. the original loader
+         *
+         * @param[in,out] lua
+         *     This points to the Lua interpreter's state.
+         *
+         * @return
+         *     The number of values returned (one: the module)
+         *     is returned.
+         */
+        static int ProfiledLoaderCall(lua_State* lua) {
+            const auto self = (Impl*)lua_touserdata(lua, lua_upvalueindex(1));
+            const auto numArgs = lua_gettop(lua);
+            std::string name;
+            if (lua_type(lua, 1) == LUA_TSTRING) {
+                name = lua_tostring(lua, 1);
+            }
+            if (
+                (self == nullptr)
+                || !self->instrumenting
+            ) {
+                lua_pushvalue(lua, lua_upvalueindex(2));
+                lua_insert(lua, 1);
+                lua_call(lua, numArgs, 1);
+                return 1;
+            }
+            const auto level = GetCallStackLevel(lua);
+            self->StartModuleLoad(name, level);
+            lua_pushvalue(lua, lua_upvalueindex(2));
+            lua_insert(lua, 1);
+            lua_call(lua, numArgs, 1);
+            while (
+                !self->moduleLoadStack.empty()
+                && (self->moduleLoadStack.back().level > level)
+            ) {
+                self->FinishModuleLoad(false);
+            }
+            if (!self->moduleLoadStack.empty()) {
+                self->FinishModuleLoad(true);
+            }
+            self->InstrumentModule(lua, name);
+            return 1;
+        }
+
+        /**
+         * Return the number of levels of the Lua call stack.
+         *
+         * @param[in,out] lua
+         *     This points to the Lua interpreter's state.
+         *
+         * @return
+         *     The number of levels of the Lua call stack is returned.
+         */
+        static int GetCallStackLevel(lua_State* lua) {
+            lua_Debug ar;
+            int level = 0;
+            while (lua_getstack(lua, level, &ar) != 0) {
+                ++level;
+            }
+            return level;
+        }
+
+        /**
+         * Replace each function in package.searchers with one which
+         * intercepts the loaders it returns, for module load profiling.
+         */
+        void InterceptSearchers() {
+            lua_getglobal(lua.get(), "package"); // -1 = package
+            if (!lua_istable(lua.get(), -1)) {
+                lua_pop(lua.get(), 1); // (stack empty)
+                return;
+            }
+            lua_getfield(lua.get(), -1, "searchers"); // -1 = searchers, -2 = package
+            if (lua_istable(lua.get(), -1)) {
+                const auto numSearchers = (lua_Integer)lua_rawlen(lua.get(), -1);
+                for (lua_Integer i = 1; i <= numSearchers; ++i) {
+                    InterceptedSearcher interceptedSearcher;
+                    interceptedSearcher.index = i;
+                    lua_rawgeti(lua.get(), -1, i); // -1 = searchers[i], -2 = searchers, -3 = package
+                    interceptedSearcher.originalRef = luaL_ref(lua.get(), LUA_REGISTRYINDEX); // -1 = searchers, -2 = package
+                    lua_pushlightuserdata(lua.get(), this); // -1 = self, -2 = searchers, -3 = package
+                    lua_rawgeti(lua.get(), LUA_REGISTRYINDEX, interceptedSearcher.originalRef); // -1 = searchers[i], -2 = self, -3 = searchers, -4 = package
+                    lua_pushcclosure(lua.get(), InterceptedSearcherCall, 2); // -1 = interceptor, -2 = searchers, -3 = package
+                    lua_pushvalue(lua.get(), -1); // -1 = interceptor, -2 = interceptor, -3 = searchers, -4 = package
+                    interceptedSearcher.interceptorRef = luaL_ref(lua.get(), LUA_REGISTRYINDEX); // -1 = interceptor, -2 = searchers, -3 = package
+                    lua_rawseti(lua.get(), -2, i); // -1 = searchers, -2 = package
+                    interceptedSearchers.push_back(interceptedSearcher);
+                }
+            }
+            lua_pop(lua.get(), 2); // (stack empty)
+        }
+
+        /**
+         * Reinstall the original functions in package.searchers, detach
+         * the loaders they returned from this instance, and release the
+         * Lua registry references held for module load profiling.
+         */
+        void RestoreSearchers() {
+            lua_getglobal(lua.get(), "package"); // -1 = package
+            if (lua_istable(lua.get(), -1)) {
+                lua_getfield(lua.get(), -1, "searchers"); // -1 = searchers, -2 = package
+            } else {
+                lua_pushnil(lua.get()); // -1 = nil, -2 = package
+            }
+            for (const auto& interceptedSearcher: interceptedSearchers) {
+                lua_rawgeti(lua.get(), LUA_REGISTRYINDEX, interceptedSearcher.interceptorRef); // -1 = interceptor, -2 = searchers, -3 = package
+                if (lua_istable(lua.get(), -2)) {
+                    lua_rawgeti(lua.get(), -2, interceptedSearcher.index); // -1 = searchers[i], -2 = interceptor, -3 = searchers, -4 = package
+                    if (lua_rawequal(lua.get(), -1, -2) == 1) {
+                        lua_rawgeti(lua.get(), LUA_REGISTRYINDEX, interceptedSearcher.originalRef); // -1 = original, -2 = searchers[i], -3 = interceptor, -4 = searchers, -5 = package
+                        lua_rawseti(lua.get(), -4, interceptedSearcher.index); // -1 = searchers[i], -2 = interceptor, -3 = searchers, -4 = package
+                    }
+                    lua_pop(lua.get(), 1); // -1 = interceptor, -2 = searchers, -3 = package
+                }
+                lua_pushnil(lua.get()); // -1 = nil, -2 = interceptor, -3 = searchers, -4 = package
+                (void)lua_setupvalue(lua.get(), -2, 1); // -1 = interceptor, -2 = searchers, -3 = package
+                lua_pop(lua.get(), 1); // -1 = searchers, -2 = package
+                luaL_unref(lua.get(), LUA_REGISTRYINDEX, interceptedSearcher.originalRef);
+                luaL_unref(lua.get(), LUA_REGISTRYINDEX, interceptedSearcher.interceptorRef);
+            }
+            lua_pop(lua.get(), 2); // (stack empty)
+            interceptedSearchers.clear();
+            for (const auto profiledLoaderRef: profiledLoaderRefs) {
+                lua_rawgeti(lua.get(), LUA_REGISTRYINDEX, profiledLoaderRef); // -1 = loader
+                lua_pushnil(lua.get()); // -1 = nil, -2 = loader
+                (void)lua_setupvalue(lua.get(), -2, 1); // -1 = loader
+                lua_pop(lua.get(), 1); // (stack empty)
+                luaL_unref(lua.get(), LUA_REGISTRYINDEX, profiledLoaderRef);
+            }
+            profiledLoaderRefs.clear();
+            for (const auto& moduleRoot: moduleRoots) {
+                luaL_unref(lua.get(), LUA_REGISTRYINDEX, moduleRoot.ref);
+            }
+            moduleRoots.clear();
+        }
+
+        /**
+         * Record that a module started loading.
+         *
+         * @param[in] name
+         *     This is the name of the module.
+         *
+         * @param[in] level
+         *     This is the number of levels of the Lua call stack when the
+         *     module started loading.
+         */
+        void StartModuleLoad(const std::string& name, int level) {
+            // Any modules still loading at this level or deeper
+            // must have been abandoned because of Lua errors.
+            while (
+                !moduleLoadStack.empty()
+                && (moduleLoadStack.back().level >= level)
+            ) {
+                FinishModuleLoad(false);
+            }
+            ModuleLoad moduleLoad;
+            moduleLoad.info.name = name;
+            moduleLoad.level = level;
+            if (clock != nullptr) {
+                moduleLoad.info.start = clock->GetCurrentTime();
+            }
+            moduleLoadStack.push_back(std::move(moduleLoad));
+        }
+
+        /**
+         * Record that the innermost module currently loading is finished,
+         * and add its information to the module which required it,
+         * or to the report if it wasn't required by another module.
+         *
+         * @param[in] completed
+         *     This indicates whether or not the module loaded successfully.
+         */
+        void FinishModuleLoad(bool completed) {
+            auto info = std::move(moduleLoadStack.back().info);
+            moduleLoadStack.pop_back();
+            info.completed = completed;
+            if (
+                completed
+                && (clock != nullptr)
+            ) {
+                info.totalTime = clock->GetCurrentTime() - info.start;
+                info.selfTime = info.totalTime;
+                for (const auto& requiredModule: info.requiredModules) {
+                    info.selfTime -= requiredModule.totalTime;
+                }
+            }
+            if (moduleLoadStack.empty()) {
+                report.moduleLoads.push_back(std::move(info));
+            } else {
+                moduleLoadStack.back().info.requiredModules.push_back(std::move(info));
+            }
+        }
+
+        /**
+         * Instrument the functions of a module just loaded.
+         *
+         * On entry, the top value on the Lua stack is the value returned
+         * by the module's loader.  If the module is itself a function,
+         * this value is replaced by its instrumented wrapper.
+         *
+         * @param[in,out] lua
+         *     This points to the Lua interpreter's state.
+         *
+         * @param[in] name
+         *     This is the name of the module.
+         */
+        void InstrumentModule(lua_State* lua, const std::string& name) {
+            const Path basePath{"require:" + name};
+            std::vector< size_t > newIds;
+            lua_getfield(lua, LUA_REGISTRYINDEX, LUA_LOADED_TABLE); // -1 = package.loaded, -2 = result
+            if (lua_isnil(lua, -2)) {
+                (void)lua_getfield(lua, -1, name.c_str()); // -1 = module, -2 = package.loaded, -3 = result
+            } else {
+                lua_pushvalue(lua, -2); // -1 = module, -2 = package.loaded, -3 = result
+            }
+            if (
+                lua_istable(lua, -1)
+                || IsInstrumentableLuaMeta(lua, -1)
+            ) {
+                FindFunctions(
+                    lua,
+                    -1,
+                    basePath,
+                    [this, &newIds](lua_State* lua, int parentIndex, const Path& path){
+                        // Don't wrap functions which are already wrappers,
+                        // such as global functions the module re-exports.
+                        if (lua_tocfunction(lua, -1) != InstrumentedCall) {
+                            newIds.push_back(AddInstrumentedFunction(lua, parentIndex, path));
+                        }
+                    }
+                );
+                ModuleRoot moduleRoot;
+                moduleRoot.basePath = basePath;
+                lua_pushvalue(lua, -1); // -1 = module, -2 = module, -3 = package.loaded, -4 = result
+                moduleRoot.ref = luaL_ref(lua, LUA_REGISTRYINDEX); // -1 = module, -2 = package.loaded, -3 = result
+                moduleRoots.push_back(std::move(moduleRoot));
+                lua_pop(lua, 2); // -1 = result
+            } else if (lua_tocfunction(lua, -1) == InstrumentedCall) {
+                // The module is a function which is already instrumented,
+                // such as a global function, so leave it as it is.
+                lua_pop(lua, 2); // -1 = result
+                return;
+            } else if (lua_isfunction(lua, -1)) {
+                // The module is a function, so instrument it where it will
+                // be stored, in package.loaded.
+                lua_pushstring(lua, name.c_str()); // -1 = name, -2 = module, -3 = package.loaded, -4 = result
+                lua_insert(lua, -2); // -1 = module, -2 = name, -3 = package.loaded, -4 = result
+                const auto id = AddInstrumentedFunction(lua, -3, basePath);
+                lua_pop(lua, 2); // -1 = package.loaded, -2 = result
+                InstallWrapper(lua, id);
+                if (!lua_isnil(lua, -2)) {
+                    (void)lua_getfield(lua, -1, name.c_str()); // -1 = wrapper, -2 = package.loaded, -3 = result
+                    lua_replace(lua, -3); // -1 = package.loaded, -2 = wrapper
+                }
+                lua_pop(lua, 1); // -1 = result
+                return;
+            } else {
+                lua_pop(lua, 2); // -1 = result
+            }
+            for (const auto id: newIds) {
+                InstallWrapper(lua, id);
+            }
+        }
+
+        /**
+         * This is the allocator function given to the Lua interpreter
+         * while memory is tracked.  It calls the original allocator
+         * function and counts the memory allocated and freed.
+         *
+         * @param[in] ud
+         *     This points to the Impl instance.
+         *
+         * @param[in] ptr
+         *     If not NULL, this points to the memory block to be
+         *     freed or reallocated.
+         *
+         * @param[in] osize
+         *     This is the size of the memory block pointed to by "ptr".
+         *
+         * @param[in] nsize
+         *     This is the number of bytes of memory to allocate or
+         *     reallocate, or zero if the given block should be freed instead.
+         *
+         * @return
+         *     The value returned by the original allocator function
+         *     is returned.
+         */
+        static void* TrackingAllocator(void* ud, void* ptr, size_t osize, size_t nsize) {
+            const auto self = (Impl*)ud;
+            const auto result = self->originalAllocator(self->originalAllocatorUd, ptr, osize, nsize);
+            const size_t oldSize = ((ptr == NULL) ? 0 : osize);
+            if (nsize == 0) {
+                self->memoryInUse -= oldSize;
+            } else if (result != NULL) {
+                self->memoryInUse -= oldSize;
+                self->memoryInUse += nsize;
+                auto& memory = self->report.memory;
+                if (ptr == NULL) {
+                    ++memory.numAllocations;
+                    if (self->virtualClock != nullptr) {
+                        self->virtualClock->CountAllocations(1);
+                    }
+                }
+                if (nsize > oldSize) {
+                    memory.bytesAllocated += nsize - oldSize;
+                }
+                memory.peakBytes = std::max(memory.peakBytes, self->memoryInUse);
+            }
+            return result;
+        }
+
+        /**
+         * This is the hook set on the Lua interpreter while instructions
+         * are counted.  It adds the number of instructions executed since
+         * the hook was last called to the instruction count.
+         *
+         * @param[in,out] lua
+         *     This is the state of the Lua interpreter to use.
+         *
+         * @param[in] ar
+         *     This holds information about the event which triggered the hook.
+         */
+        static void InstructionCountingHook(lua_State* lua, lua_Debug* ar) {
+            (void)lua_rawgetp(lua, LUA_REGISTRYINDEX, &INSTRUCTION_COUNTING_KEY);
+            const auto self = (Impl*)lua_touserdata(lua, -1);
+            lua_pop(lua, 1);
+            if (self != nullptr) {
+                self->report.numInstructions += self->instructionCountingGranularity;
+                if (self->virtualClock != nullptr) {
+                    self->virtualClock->CountInstructions(self->instructionCountingGranularity);
+                }
+            }
+        }
+
+        /**
+         * Set the hook on the Lua interpreter to count instructions.
+         */
+        void StartInstructionCounting() {
+            lua_pushlightuserdata(lua.get(), this);
+            lua_rawsetp(lua.get(), LUA_REGISTRYINDEX, &INSTRUCTION_COUNTING_KEY);
+            countingInstructions = true;
+            ResetHook(lua.get());
+        }
+
+        /**
+         * Set the hook on the given Lua thread to the one used to count
+         * instructions, if instructions are being counted, or remove
+         * the hook otherwise.
+         *
+         * @param[in,out] lua
+         *     This is the Lua thread whose hook to set.
+         */
+        void ResetHook(lua_State* lua) {
+            if (countingInstructions) {
+                lua_sethook(
+                    lua,
+                    InstructionCountingHook,
+                    LUA_MASKCOUNT,
+                    (int)std::min(
+                        instructionCountingGranularity,
+                        (size_t)std::numeric_limits< int >::max()
+                    )
+                );
+            } else {
+                lua_sethook(lua, NULL, 0, 0);
+            }
+        }
+
+        /**
+         * Remove the hook set on the Lua interpreter to count instructions,
+         * if instructions are being counted.
+         */
+        void StopInstructionCounting() {
+            if (!countingInstructions) {
+                return;
+            }
+            if (lua_gethook(lua.get()) == InstructionCountingHook) {
+                lua_sethook(lua.get(), NULL, 0, 0);
+            }
+            lua_pushnil(lua.get());
+            lua_rawsetp(lua.get(), LUA_REGISTRYINDEX, &INSTRUCTION_COUNTING_KEY);
+            countingInstructions = false;
+        }
+
+        /**
+         * Wrap the allocator function of the Lua interpreter
+         * in order to track memory.
+         */
+        void StartMemoryTracking() {
+            originalAllocator = lua_getallocf(lua.get(), &originalAllocatorUd);
+            memoryInUse = (
+                (size_t)lua_gc(lua.get(), LUA_GCCOUNT, 0) * 1024
+                + (size_t)lua_gc(lua.get(), LUA_GCCOUNTB, 0)
+            );
+            report.memory.tracked = true;
+            report.memory.startBytes = memoryInUse;
+            report.memory.peakBytes = memoryInUse;
+            lua_setallocf(lua.get(), TrackingAllocator, this);
+        }
+
+        /**
+         * Restore the original allocator function of the Lua interpreter,
+         * if memory is being tracked.
+         */
+        void StopMemoryTracking() {
+            if (originalAllocator == nullptr) {
+                return;
+            }
+            report.memory.endBytes = memoryInUse;
+            void* ud;
+            if (
+                (lua_getallocf(lua.get(), &ud) == TrackingAllocator)
+                && (ud == this)
+            ) {
+                lua_setallocf(lua.get(), originalAllocator, originalAllocatorUd);
+            }
+            originalAllocator = nullptr;
+            originalAllocatorUd = nullptr;
+        }
+
+        /**
+         * Start the stall detector thread, if the stall detector is enabled.
+         */
+        void StartStallDetector() {
+            if (
+                (clock == nullptr)
+                || (stallDetectorOptions.threshold == std::numeric_limits< decltype(stallDetectorOptions.threshold) >::infinity())
+            ) {
+                return;
+            }
+            publishedCallStack.reset(new PublishedCallStackLocation[stallDetectorOptions.maxDepth]);
+            publishedCallStackDepth = 0;
+            if (stallDetectorOptions.abort) {
+                lua_pushlightuserdata(lua.get(), this);
+                lua_rawsetp(lua.get(), LUA_REGISTRYINDEX, &STALL_DETECTOR_KEY);
+            }
+            stallAbort = StallAbort();
+            stallAbortPending = false;
+            stallDetectorStop = false;
+            stallDetectorEnabled = true;
+            stallDetectorThread = std::thread(&Impl::RunStallDetector, this);
+        }
+
+        /**
+         * Stop the stall detector thread, if it's running.
+         */
+        void StopStallDetector() {
+            if (!stallDetectorThread.joinable()) {
+                return;
+            }
+            {
+                std::lock_guard< decltype(stallDetectorMutex) > lock(stallDetectorMutex);
+                stallDetectorStop = true;
+                stallDetectorWakeCondition.notify_all();
+            }
+            stallDetectorThread.join();
+            stallDetectorEnabled = false;
+
+            // If an abort was asked for which never happened, set back the
+            // hook replaced on the main Lua thread.
+            if (stallAbortPending) {
+                if (lua_gethook(lua.get()) == StallAbortHook) {
+                    lua_sethook(
+                        lua.get(),
+                        stallAbort.previousHook,
+                        stallAbort.previousHookMask,
+                        stallAbort.previousHookCount
+                    );
+                }
+                stallAbortPending = false;
+            }
+
+            // Coroutines created while an abort was pending inherited the
+            // hook which aborts stalled calls.  Leave the hook it replaced
+            // in place of the stall detector in the registry, for those
+            // copies of the hook to set back once they run.
+            if (stallDetectorOptions.abort) {
+                if (stallAbort.requested) {
+                    (void)new(lua_newuserdata(lua.get(), sizeof(StallAbort))) StallAbort(stallAbort);
+                } else {
+                    lua_pushnil(lua.get());
+                }
+                lua_rawsetp(lua.get(), LUA_REGISTRYINDEX, &STALL_DETECTOR_KEY);
+            }
+        }
+
+        /**
+         * Ask for the given stalled call, made on the main Lua thread,
+         * to be aborted, by setting a hook on the main Lua thread which
+         * raises an error.  This is called from the stall detector thread.
+         *
+         * Coroutines are never targeted, since they may be collected
+         * by the time the stall detector gets to them.
+         *
+         * @param[in] level
+         *     This is the level of the Lua call stack, counting from zero
+         *     for the outermost call, at which the stalled call was made.
+         *
+         * @param[in] start
+         *     This is the value sampled from the real-time clock
+         *     when the stalled call was made.
+         *
+         * @return
+         *     An indication of whether or not the abort was asked for
+         *     is returned.  It isn't if an earlier abort is still pending.
+         */
+        bool RequestStallAbort(size_t level, double start) {
+            std::lock_guard< decltype(stallAbortMutex) > lock(stallAbortMutex);
+            if (stallAbortPending.load(std::memory_order_acquire)) {
+                return false;
+            }
+            const auto mainLua = lua.get();
+            stallAbort.requested = true;
+            stallAbort.level = level;
+            stallAbort.start = start;
+            stallAbort.previousHook = lua_gethook(mainLua);
+            stallAbort.previousHookMask = lua_gethookmask(mainLua);
+            stallAbort.previousHookCount = lua_gethookcount(mainLua);
+            stallAbortPending.store(true, std::memory_order_seq_cst);
+            lua_sethook(mainLua, StallAbortHook, LUA_MASKCALL | LUA_MASKRET | LUA_MASKCOUNT, 1);
+            return true;
+        }
+
+        /**
+         * This is the hook set by the stall detector on the main Lua thread
+         * while it runs a stalled call, in order to abort the call.  It sets
+         * back the hook it replaced, and raises an error if the stalled call
+         * is still running, rather than having returned since it was
+         * detected.
+         *
+         * @param[in,out] lua
+         *     This is the state of the Lua interpreter to use.
+         *
+         * @param[in] ar
+         *     This holds information about the event which triggered the hook.
+         */
+        static void StallAbortHook(lua_State* lua, lua_Debug* ar) {
+            // Once the stall detector has stopped, the registry holds the
+            // hook it replaced rather than the stall detector itself.
+            (void)lua_rawgetp(lua, LUA_REGISTRYINDEX, &STALL_DETECTOR_KEY);
+            if (lua_type(lua, -1) != LUA_TLIGHTUSERDATA) {
+                const auto stoppedStallAbort = (const StallAbort*)lua_touserdata(lua, -1);
+                lua_pop(lua, 1);
+                if (stoppedStallAbort == nullptr) {
+                    lua_sethook(lua, NULL, 0, 0);
+                } else {
+                    lua_sethook(
+                        lua,
+                        stoppedStallAbort->previousHook,
+                        stoppedStallAbort->previousHookMask,
+                        stoppedStallAbort->previousHookCount
+                    );
+                }
+                return;
+            }
+            const auto self = (Impl*)lua_touserdata(lua, -1);
+            lua_pop(lua, 1);
+            std::unique_lock< decltype(self->stallAbortMutex) > lock(self->stallAbortMutex);
+            const auto& stallAbort = self->stallAbort;
+            lua_sethook(
+                lua,
+                stallAbort.previousHook,
+                stallAbort.previousHookMask,
+                stallAbort.previousHookCount
+            );
+
+            // This hook may also have been inherited by a coroutine created
+            // while the abort was pending, in which case it only needs to
+            // set back the hook.
+            if (
+                (lua != self->lua.get())
+                || !self->stallAbortPending.load(std::memory_order_acquire)
+            ) {
+                return;
+            }
+            const auto stillRunning = (
+                (stallAbort.level < self->callStack.size())
+                && (self->callStack[stallAbort.level].start == stallAbort.start)
+            );
+            self->stallAbortPending.store(false, std::memory_order_release);
+            lock.unlock();
+            if (stillRunning) {
+                (void)luaL_error(lua, "call aborted by MoonClock stall detector");
+            }
+        }
+
+        /**
+         * Publish the call just pushed onto the Lua call stack
+         * for the stall detector.
+         *
+         * @param[in,out] lua
+         *     This is the Lua thread making the call.
+         */
+        void PublishPush(lua_State* lua) {
+            const auto& call = callStack.back();
+            const auto depth = callStack.size() - 1;
+            const auto sequence = publishedCallStackSequence.load(std::memory_order_relaxed);
+            publishedCallStackSequence.store(sequence + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            if (depth < stallDetectorOptions.maxDepth) {
+                auto& publishedCall = publishedCallStack[depth];
+                publishedCall.start.store(call.start, std::memory_order_relaxed);
+                publishedCall.path.store(call.path, std::memory_order_relaxed);
+                publishedCall.mainThread.store(lua == this->lua.get(), std::memory_order_relaxed);
+            }
+            publishedCallStackDepth.store(depth + 1, std::memory_order_relaxed);
+            publishedCallStackSequence.store(sequence + 2, std::memory_order_release);
+        }
+
+        /**
+         * Find the most recent call to the given function made by the given
+         * Lua thread on the call stack, and discard any calls above it.
+         * These are calls which won't return normally, either because
+         * Lua errors unwound them, or because they were made by a coroutine
+         * which has since yielded.
+         *
+         * @param[in] lua
+         *     This is the Lua thread returning from the function.
+         *
+         * @param[in] path
+         *     This is the path to the function which is returning.
+         *
+         * @return
+         *     An indication of whether or not a call to the given function
+         *     was found on the call stack is returned.  If not, the call
+         *     stack is left unchanged.
+         */
+        bool DiscardCallsAbove(lua_State* lua, const Path& path) {
+            auto level = callStack.size();
+            while (
+                (level > 0)
+                && (
+                    (callStack[level - 1].lua != lua)
+                    || (*callStack[level - 1].path != path)
+                )
+            ) {
+                --level;
+            }
+            if (level == 0) {
+                return false;
+            }
+            callStack.erase(callStack.begin() + level, callStack.end());
+            return true;
+        }
+
+        /**
+         * Publish the current depth of the Lua call stack, after one or more
+         * calls were popped from it, for the stall detector.
+         */
+        void PublishPop() {
+            const auto sequence = publishedCallStackSequence.load(std::memory_order_relaxed);
+            publishedCallStackSequence.store(sequence + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            publishedCallStackDepth.store(callStack.size(), std::memory_order_relaxed);
+            publishedCallStackSequence.store(sequence + 2, std::memory_order_release);
+        }
+
+        /**
+         * This is the body of the stall detector thread.  It periodically
+         * reads the call stack published by the thread running Lua,
+         * and reports the innermost call which has been running for
+         * too long, once per call.
+         */
+        void RunStallDetector() {
+            const auto pollInterval = std::chrono::duration< double >(stallDetectorOptions.pollInterval);
+            std::vector< double > reportedStarts;
+            std::vector< double > snapshotStarts;
+            std::vector< const Path* > snapshotPaths;
+            std::vector< bool > snapshotMainThreads;
+            std::unique_lock< decltype(stallDetectorMutex) > lock(stallDetectorMutex);
+            while (!stallDetectorStop) {
+                (void)stallDetectorWakeCondition.wait_for(
+                    lock,
+                    pollInterval,
+                    [this]{ return stallDetectorStop; }
+                );
+                if (stallDetectorStop) {
+                    break;
+                }
+                lock.unlock();
+
+                // Take a consistent snapshot of the published call stack.
+                for (;;) {
+                    const auto sequenceBefore = publishedCallStackSequence.load(std::memory_order_acquire);
+                    if ((sequenceBefore & 1) != 0) {
+                        std::this_thread::yield();
+                        continue;
+                    }
+                    const auto depth = std::min(
+                        publishedCallStackDepth.load(std::memory_order_relaxed),
+                        stallDetectorOptions.maxDepth
+                    );
+                    snapshotStarts.resize(depth);
+                    snapshotPaths.resize(depth);
+                    snapshotMainThreads.resize(depth);
+                    for (size_t i = 0; i < depth; ++i) {
+                        snapshotStarts[i] = publishedCallStack[i].start.load(std::memory_order_relaxed);
+                        snapshotPaths[i] = publishedCallStack[i].path.load(std::memory_order_relaxed);
+                        snapshotMainThreads[i] = publishedCallStack[i].mainThread.load(std::memory_order_relaxed);
+                    }
+                    std::atomic_thread_fence(std::memory_order_acquire);
+                    if (publishedCallStackSequence.load(std::memory_order_relaxed) == sequenceBefore) {
+                        break;
+                    }
+                }
+
+                // Find the innermost call running for too long, and report
+                // it unless it was already reported.  The clock is shared
+                // with the thread running Lua, which is why it's documented
+                // as having to be thread-safe when the stall detector is used.
+                const auto now = clock->GetCurrentTime();
+                const auto depth = snapshotStarts.size();
+                reportedStarts.resize(depth, -1.0);
+                for (size_t i = depth; i > 0; --i) {
+                    const auto level = i - 1;
+                    if (now - snapshotStarts[level] < stallDetectorOptions.threshold) {
+                        continue;
+                    }
+                    if (reportedStarts[level] == snapshotStarts[level]) {
+                        break;
+                    }
+                    reportedStarts[level] = snapshotStarts[level];
+                    StallInformation stall;
+                    stall.path = *snapshotPaths[level];
+                    stall.callStack.reserve(i);
+                    for (size_t j = 0; j < i; ++j) {
+                        stall.callStack.push_back(*snapshotPaths[j]);
+                    }
+                    stall.start = snapshotStarts[level];
+                    stall.detected = now;
+                    if (
+                        stallDetectorOptions.abort
+                        && snapshotMainThreads[level]
+                    ) {
+                        stall.aborted = RequestStallAbort(level, snapshotStarts[level]);
+                    }
+                    if (stallDetectorOptions.onStall != nullptr) {
+                        stallDetectorOptions.onStall(stall);
+                    }
+                    std::lock_guard< decltype(stallsMutex) > stallsLock(stallsMutex);
+                    stalls.push_back(std::move(stall));
+                    break;
+                }
+                lock.lock();
+            }
+        }
+
+        /**
+         * Find the entry in the report for the function with the given
+         * path, adding one if there isn't one already.
+         *
+         * @param[in] path
+         *     This represents the path to the function for which to
+         *     find the entry in the report.
+         *
+         * @return
+         *     The entry in the report for the function with the given
+         *     path is returned.
+         */
+        std::map< Path, FunctionInformation >::iterator FindFunctionInfo(const Path& path) {
+            auto functionInfoEntry = report.functionInfo.lower_bound(path);
+            if (
+                (functionInfoEntry == report.functionInfo.end())
+                || (functionInfoEntry->first != path)
+            ) {
+                functionInfoEntry = report.functionInfo.emplace_hint(
+                    functionInfoEntry,
+                    path,
+                    FunctionInformation()
+                );
+            }
+            return functionInfoEntry;
+        }
+
+        /**
+         * Return the slow-call threshold which applies to the function
+         * with the given path.
+         *
+         * @param[in] path
+         *     This represents the path to the function for which to
+         *     look up the slow-call threshold.
+         *
+         * @return
+         *     The slow-call threshold, in seconds, which applies to the
+         *     function with the given path is returned.
+         */
+        double GetSlowCallThreshold(const Path& path) const {
+            if (!slowCallOptions.thresholds.empty()) {
+                const auto thresholdsEntry = slowCallOptions.thresholds.find(path);
+                if (thresholdsEntry != slowCallOptions.thresholds.end()) {
+                    return thresholdsEntry->second;
+                }
+            }
+            return slowCallOptions.threshold;
+        }
+
+        /**
+         * Add a slow call to the slow-call log in the report, discarding
+         * the oldest slow call if the log is full.
+         *
+         * @param[in,out] lua
+         *     This points to the Lua interpreter's state.
+         *
+         * @param[in] path
+         *     This represents the path to the function which was slow.
+         *
+         * @param[in] finish
+         *     This is the value sampled from the real-time clock
+         *     when the slow call returned.
+         *
+         * @param[in] total
+         *     This is the amount of time elapsed, in seconds,
+         *     during the call.
+         */
+        void CaptureSlowCall(
+            lua_State* lua,
+            const Path& path,
+            double finish,
+            double total
+        ) {
+            if (slowCallOptions.capacity == 0) {
+                ++report.numSlowCallsDropped;
                 return;
             }
-            this->lua = lua;
-            const auto beforeWrapper = (Instrument*)lua_newuserdata(lua.get(), sizeof(Instrument)); // -1 = beforeWrapper
-            *beforeWrapper = before;
-            const auto afterWrapper = (Instrument*)lua_newuserdata(lua.get(), sizeof(Instrument)); // -1 = afterWrapper, -2 = beforeWrapper
-            *afterWrapper = after;
-            const auto contextWrapper = (void**)lua_newuserdata(lua.get(), sizeof(void*)); // -1 = contextWrapper, -2 = afterWrapper, -3 = beforeWrapper
-            *contextWrapper = context;
-            const auto instrumentationFactory = [](lua_State* lua){
-                const auto closure = [](lua_State* lua){
-                    const auto before = *(Instrument*)lua_touserdata(lua, lua_upvalueindex(3));
-                    const auto after = *(Instrument*)lua_touserdata(lua, lua_upvalueindex(4));
-                    const auto context = *(void**)lua_touserdata(lua, lua_upvalueindex(5));
-                    const auto path = ReadLuaStringList(lua, lua_upvalueindex(1));
-                    before(lua, context, path);
-                    const auto numArgs = lua_gettop(lua);
-                    lua_pushvalue(lua, lua_upvalueindex(2));
-                    lua_insert(lua, 1);
-                    lua_call(lua, numArgs, LUA_MULTRET);
-                    after(lua, context, path);
-                    return lua_gettop(lua);
-                };
-                lua_pushvalue(lua, lua_upvalueindex(1));
-                lua_pushvalue(lua, lua_upvalueindex(2));
-                lua_pushvalue(lua, lua_upvalueindex(3));
-                lua_pushcclosure(lua, closure, 5);
-                return 1;
+            if (report.slowCalls.size() >= slowCallOptions.capacity) {
+                report.slowCalls.pop_front();
+                ++report.numSlowCallsDropped;
+            }
+            SlowCallInformation slowCall;
+            slowCall.path = path;
+            slowCall.callStack.reserve(callStack.size());
+            for (const auto& call: callStack) {
+                slowCall.callStack.push_back(*call.path);
+            }
+            slowCall.timestamp = finish;
+            slowCall.totalTime = total;
+            if (slowCallOptions.captureTraceback) {
+                luaL_traceback(lua, lua, NULL, 1); // -1 = traceback
+                slowCall.traceback = lua_tostring(lua, -1);
+                lua_pop(lua, 1); // (stack empty)
+            }
+            slowCall.arguments = callStack.back().arguments;
+            report.slowCalls.push_back(std::move(slowCall));
+        }
+
+        /**
+         * Find the node of the call tree for a call to the function with
+         * the given path from the function on top of the call stack,
+         * adding the node if it isn't already in the call tree.
+         *
+         * @param[in] path
+         *     This represents the path to the function called.
+         *
+         * @return
+         *     The index of the node in the call tree is returned.
+         */
+        size_t FindCallTreeNode(const Path& path) {
+            if (report.callTree.empty()) {
+                report.callTree.resize(1);
+            }
+            const auto parent = (
+                callStack.empty()
+                ? 0
+                : callStack.back().callTreeNode
+            );
+            auto& children = report.callTree[parent].children;
+            const auto child = children.find(path);
+            if (child != children.end()) {
+                return child->second;
+            }
+            const auto index = report.callTree.size();
+            children[path] = index;
+            CallTreeNode node;
+            node.path = path;
+            node.parent = parent;
+            report.callTree.push_back(std::move(node));
+            return index;
+        }
+
+        /**
+         * Publish the statistics of the given function
+         * in shared memory.
+         *
+         * @param[in] path
+         *     This represents the path to the function.
+         *
+         * @param[in] functionInfo
+         *     This holds the statistics of the function to publish.
+         */
+        void PublishStatistics(
+            const Path& path,
+            const FunctionInformation& functionInfo
+        ) {
+            auto entry = sharedStatisticsEntries.find(&functionInfo);
+            if (entry == sharedStatisticsEntries.end()) {
+                size_t index;
+                if (!sharedStatistics->FindEntry(StringExtensions::Join(path, "."), index)) {
+                    return;
+                }
+                entry = sharedStatisticsEntries.insert({&functionInfo, index}).first;
+            }
+            SharedFunctionStatistics statistics;
+            statistics.numCalls = functionInfo.numCalls;
+            statistics.totalTime = functionInfo.totalTime;
+            statistics.maxTime = functionInfo.maxTime;
+            statistics.numAllocations = functionInfo.numAllocations;
+            statistics.bytesAllocated = functionInfo.bytesAllocated;
+            statistics.numInstructions = functionInfo.numInstructions;
+            sharedStatistics->Publish(entry->second, statistics);
+        }
+
+        /**
+         * Add the given critical path through a top-level call
+         * to the report.
+         *
+         * @param[in] criticalPath
+         *     This is the critical path to add, innermost call first.
+         *
+         * @param[in] start
+         *     This is the value sampled from the real-time clock
+         *     when the top-level call was made.
+         */
+        void RecordCriticalPath(
+            const std::vector< CriticalPathLink >& criticalPath,
+            double start
+        ) {
+            CriticalPathInformation criticalPathInfo;
+            criticalPathInfo.start = start;
+            criticalPathInfo.steps.reserve(criticalPath.size());
+            std::set< const Path* > counted;
+            for (size_t i = criticalPath.size(); i > 0; --i) {
+                const auto& link = criticalPath[i - 1];
+                CriticalPathStep step;
+                step.path = *link.path;
+                step.totalTime = link.totalTime;
+                criticalPathInfo.steps.push_back(std::move(step));
+                const auto nextTime = ((i > 1) ? criticalPath[i - 2].totalTime : 0.0);
+                auto& functionInfo = report.criticalPathFunctions[*link.path];
+                functionInfo.selfTime += link.totalTime - nextTime;
+                if (counted.insert(link.path).second) {
+                    ++functionInfo.numOccurrences;
+                    functionInfo.totalTime += link.totalTime;
+                }
+            }
+            if (criticalPathCapacity == 0) {
+                ++report.numCriticalPathsDropped;
+                return;
+            }
+            if (report.criticalPaths.size() >= criticalPathCapacity) {
+                report.criticalPaths.pop_front();
+                ++report.numCriticalPathsDropped;
+            }
+            report.criticalPaths.push_back(std::move(criticalPathInfo));
+        }
+
+        /**
+         * Search the Lua global variables again for functions, comparing
+         * what is found with the functions already instrumented.  Wrap
+         * functions not found before, and remove the instrumentation from
+         * functions no longer found.  Functions found again keep their
+         * wrappers untouched.
+         */
+        void Rescan() {
+            if (!instrumenting) {
+                return;
+            }
+
+            // Index the wrappers currently installed by their identity.
+            std::unordered_map< const void*, size_t > idsByWrapper;
+            for (size_t id = 0; id < instrumentedFunctions.size(); ++id) {
+                const auto& instrumentedFunction = instrumentedFunctions[id];
+                if (instrumentedFunction.wrapperRef == LUA_NOREF) {
+                    continue;
+                }
+                lua_rawgeti(lua.get(), LUA_REGISTRYINDEX, instrumentedFunction.wrapperRef); // -1 = wrapper
+                idsByWrapper[lua_topointer(lua.get(), -1)] = id;
+                lua_pop(lua.get(), 1); // (stack empty)
+            }
+
+            // Walk the Lua global variables, marking wrappers found,
+            // and adding any other functions found.
+            const auto numOldIds = instrumentedFunctions.size();
+            std::vector< bool > found(numOldIds, false);
+            std::vector< size_t > newIds;
+            const auto onFunctionFound = [this, &idsByWrapper, &found, &newIds](lua_State* lua, int parentIndex, const Path& path){
+                const auto idsByWrapperEntry = idsByWrapper.find(lua_topointer(lua, -1));
+                if (idsByWrapperEntry == idsByWrapper.end()) {
+                    newIds.push_back(AddInstrumentedFunction(lua, parentIndex, path));
+                } else {
+                    found[idsByWrapperEntry->second] = true;
+                }
             };
-            lua_pushcclosure(lua.get(), instrumentationFactory, 3); // -1 = instrumentationFactory
-            lua_getglobal(lua.get(), "_G"); // -1 = _G, -2 = instrumentationFactory
-            FindFunctionsInComposite(lua.get(), -1); // -1 = functions, -2 = _G, -3 = instrumentationFactory
-            lua_remove(lua.get(), -2); // -1 = functions, -2 = instrumentationFactory
-            const auto numFunctions = lua_rawlen(lua.get(), -1);
-            for (size_t i = 0; i < numFunctions; ++i) {
-                // Look up the next function's information.
-                lua_pushinteger(lua.get(), i + 1); // -1 = i+1, -2 = functions, -3 = instrumentationFactory
-                lua_rawget(lua.get(), -2); // -1 = functions[i+1], -2 = functions, -3 = instrumentationFactory
-
-                // Get the path of the function and construct
-                // the instrumented wrapper for it.
-                lua_pushstring(lua.get(), "path"); // -1 = "path", -2 = functions[i+1], -3 = functions, -4 = instrumentationFactory
-                lua_rawget(lua.get(), -2); // -1 = functions[i+1].path, -2 = functions[i+1], -3 = functions, -4 = instrumentationFactory
-                lua_pushvalue(lua.get(), -4); // -1 = instrumentationFactory, -2 = functions[i+1].path, -3 = functions[i+1], -4 = functions, -5 = instrumentationFactory
-                lua_pushvalue(lua.get(), -2); // -1 = functions[i+1].path, -2 = instrumentationFactory, -3 = functions[i+1].path, -4 = functions[i+1], -5 = functions, -6 = instrumentationFactory
-                lua_pushstring(lua.get(), "fn"); // -1 = "fn", -2 = functions[i+1].path, -3 = instrumentationFactory, -4 = functions[i+1].path, -5 = functions[i+1], -6 = functions, -7 = instrumentationFactory
-                lua_rawget(lua.get(), -5); // -1 = functions[i+1].fn, -2 = functions[i+1].path, -3 = instrumentationFactory, -4 = functions[i+1].path, -5 = functions[i+1], -6 = functions, -7 = instrumentationFactory
-                lua_call(lua.get(), 2, 1); // -1 = instrumented_fn, -2 = functions[i+1].path, -3 = functions[i+1], -4 = functions, -5 = instrumentationFactory
-
-                // Find the table containing the function and replace
-                // the function with its instrumented wrapper.
-                lua_pushstring(lua.get(), "parent"); // -1 = "parent", -2 = instrumented_fn, -3 = functions[i+1].path, -4 = functions[i+1], -5 = functions, -6 = instrumentationFactory
-                lua_rawget(lua.get(), -4); // -1 = functions[i+1].table, -2 = instrumented_fn, -3 = functions[i+1].path, -4 = functions[i+1], -5 = functions, -6 = instrumentationFactory
-                lua_pushinteger(lua.get(), lua_rawlen(lua.get(), -3)); // -1 = #functions[i+1].path, -2 = functions[i+1].table, -3 = instrumented_fn, -4 = functions[i+1].path, -5 = functions[i+1], -6 = functions, -7 = instrumentationFactory
-                lua_rawget(lua.get(), -4); // -1 = functions[i+1].path[#functions[i+1].path], -2 = functions[i+1].table, -3 = instrumented_fn, -4 = functions[i+1].path, -5 = functions[i+1], -6 = functions, -7 = instrumentationFactory
-                lua_pushvalue(lua.get(), -3); // -1 = instrumented_fn, -2 = functions[i+1].path[#functions[i+1].path], -3 = functions[i+1].table, -4 = instrumented_fn, -5 = functions[i+1].path, -6 = functions[i+1], -7 = functions, -8 = instrumentationFactory
-                lua_settable(lua.get(), -3);// -1 = functions[i+1].table, -2 = instrumented_fn, -3 = functions[i+1].path, -4 = functions[i+1], -5 = functions, -6 = instrumentationFactory
-                lua_pop(lua.get(), 4); // -1 = functions, -2 = instrumentationFactory
-            }
-            luaRegistryIndex = luaL_ref(lua.get(), LUA_REGISTRYINDEX); // -1 = instrumentationFactory
+            lua_getglobal(lua.get(), "_G"); // -1 = _G
+            FindFunctions(lua.get(), -1, {}, onFunctionFound);
             lua_pop(lua.get(), 1); // (stack empty)
+            for (const auto& moduleRoot: moduleRoots) {
+                lua_rawgeti(lua.get(), LUA_REGISTRYINDEX, moduleRoot.ref); // -1 = module
+                FindFunctions(lua.get(), -1, moduleRoot.basePath, onFunctionFound);
+                lua_pop(lua.get(), 1); // (stack empty)
+            }
+
+            // Remove instrumentation from functions no longer found,
+            // freeing their IDs for reuse, and instrument the new ones.
+            // Functions given freed IDs don't have wrappers yet, so they
+            // aren't mistaken for functions no longer found.
+            for (size_t id = 0; id < numOldIds; ++id) {
+                auto& instrumentedFunction = instrumentedFunctions[id];
+                if (
+                    !found[id]
+                    && (instrumentedFunction.wrapperRef != LUA_NOREF)
+                ) {
+                    RemoveWrapper(instrumentedFunction);
+                    freeIdsByPath[instrumentedFunction.path].push_back(id);
+                }
+            }
+            for (const auto id: newIds) {
+                InstallWrapper(lua.get(), id);
+            }
+        }
+
+        /**
+         * This is the Lua C function set as the __newindex metamethod of the
+         * table of global variables while a chunk is loaded by LoadChunk.
+         * It assigns the global variable, and if its value is a function
+         * or composite, instruments the functions found in it.
+         *
+         * Its upvalues are:
+         * 1. light userdata pointing to the Impl instance, or nil once
+         *    the chunk is loaded
+         *
+         * @param[in,out] lua
+         *     This points to the Lua interpreter's state.
+         *
+         * @return
+         *     The number of values returned (none) is returned.
+         */
+        static int GlobalsNewIndex(lua_State* lua) {
+            // 1 = globals, 2 = key, 3 = value
+            lua_settop(lua, 3);
+            lua_pushvalue(lua, 2);
+            lua_pushvalue(lua, 3);
+            lua_rawset(lua, 1);
+            const auto self = (Impl*)lua_touserdata(lua, lua_upvalueindex(1));
+            if (
+                (self == nullptr)
+                || !self->instrumenting
+                || (lua_type(lua, 2) != LUA_TSTRING)
+            ) {
+                return 0;
+            }
+            const Path path{lua_tostring(lua, 2)};
+            std::vector< size_t > newIds;
+            const auto onFunctionFound = [self, &newIds](lua_State* lua, int parentIndex, const Path& path){
+                // Don't wrap functions which are already wrappers,
+                // such as when one global variable is assigned another.
+                if (lua_tocfunction(lua, -1) != InstrumentedCall) {
+                    newIds.push_back(self->AddInstrumentedFunction(lua, parentIndex, path));
+                }
+            };
+            if (lua_isfunction(lua, 3)) {
+                lua_pushvalue(lua, 2); // -1 = key
+                lua_pushvalue(lua, 3); // -1 = fn, -2 = key
+                onFunctionFound(lua, 1, path);
+                lua_pop(lua, 2); // (stack back to arguments)
+            } else if (
+                lua_istable(lua, 3)
+                || IsInstrumentableLuaMeta(lua, 3)
+            ) {
+                FindFunctions(lua, 3, path, onFunctionFound);
+            }
+            for (const auto id: newIds) {
+                self->InstallWrapper(lua, id);
+            }
+            return 0;
+        }
+
+        /**
+         * Compile the given chunk of Lua code and execute it, measuring
+         * the time taken to do each.
+         *
+         * @param[in] name
+         *     This is the name of the chunk, used in Lua error messages.
+         *
+         * @param[in] chunk
+         *     This is the Lua code (source or precompiled) to load.
+         *
+         * @return
+         *     Information about the loading of the chunk is returned.
+         */
+        ChunkLoadInformation LoadChunk(
+            const std::string& name,
+            const std::string& chunk
+        ) {
+            ChunkLoadInformation info;
+            info.name = name;
+            if (!instrumenting) {
+                info.errorMessage = "not instrumenting";
+                return info;
+            }
+            const auto L = lua.get();
+
+            // Intercept assignments of new global variables,
+            // if the table of global variables allows it.
+            int globalsMetatableRef = LUA_NOREF;
+            lua_pushglobaltable(L); // -1 = _G
+            if (lua_getmetatable(L, -1) == 0) {
+                lua_newtable(L); // -1 = mt, -2 = _G
+                lua_pushlightuserdata(L, this); // -1 = self, -2 = mt, -3 = _G
+                lua_pushcclosure(L, GlobalsNewIndex, 1); // -1 = __newindex, -2 = mt, -3 = _G
+                lua_setfield(L, -2, "__newindex"); // -1 = mt, -2 = _G
+                lua_pushvalue(L, -1); // -1 = mt, -2 = mt, -3 = _G
+                globalsMetatableRef = luaL_ref(L, LUA_REGISTRYINDEX); // -1 = mt, -2 = _G
+                (void)lua_setmetatable(L, -2); // -1 = _G
+            } else {
+                lua_pop(L, 1); // -1 = _G
+            }
+            lua_pop(L, 1); // (stack empty)
+
+            // Compile and execute the chunk.
+            const auto top = lua_gettop(L);
+            lua_pushcfunction(L, ChunkTraceback); // -1 = traceback
             if (clock != nullptr) {
-                startTime = clock->GetCurrentTime();
+                info.start = clock->GetCurrentTime();
             }
-            report.functionInfo.clear();
+            const auto loadResult = luaL_loadbufferx(
+                L,
+                chunk.data(),
+                chunk.length(),
+                ("=" + name).c_str(),
+                NULL
+            ); // -1 = chunk or error, -2 = traceback
+            double compileEnd = info.start;
+            if (clock != nullptr) {
+                compileEnd = clock->GetCurrentTime();
+                info.compileTime = compileEnd - info.start;
+            }
+            if (loadResult == LUA_OK) {
+                const auto callResult = lua_pcall(L, 0, 0, top + 1); // -1 = error (if any), -2 = traceback
+                if (clock != nullptr) {
+                    info.executionTime = clock->GetCurrentTime() - compileEnd;
+                }
+                if (callResult == LUA_OK) {
+                    info.succeeded = true;
+                } else if (lua_isstring(L, -1)) {
+                    info.errorMessage = lua_tostring(L, -1);
+                } else {
+                    info.errorMessage = "(no error message)";
+                }
+            } else if (lua_isstring(L, -1)) {
+                info.errorMessage = lua_tostring(L, -1);
+            } else {
+                info.errorMessage = StringExtensions::sprintf("(unexpected lua_load result: %d)", loadResult);
+            }
+            lua_settop(L, top);
+
+            // Stop intercepting assignments of new global variables,
+            // unless the chunk replaced the metatable we set.
+            if (globalsMetatableRef != LUA_NOREF) {
+                lua_rawgeti(L, LUA_REGISTRYINDEX, globalsMetatableRef); // -1 = mt
+                lua_getfield(L, -1, "__newindex"); // -1 = __newindex, -2 = mt
+                if (lua_tocfunction(L, -1) == GlobalsNewIndex) {
+                    lua_pushnil(L); // -1 = nil, -2 = __newindex, -3 = mt
+                    (void)lua_setupvalue(L, -2, 1); // -1 = __newindex, -2 = mt
+                }
+                lua_pop(L, 1); // -1 = mt
+                lua_pushglobaltable(L); // -1 = _G, -2 = mt
+                if (lua_getmetatable(L, -1) == 0) {
+                    lua_pushnil(L); // -1 = nil, -2 = _G, -3 = mt
+                } // -1 = _G's mt, -2 = _G, -3 = mt
+                if (lua_rawequal(L, -1, -3) == 1) {
+                    lua_pushnil(L); // -1 = nil, -2 = _G's mt, -3 = _G, -4 = mt
+                    (void)lua_setmetatable(L, -3); // -1 = _G's mt, -2 = _G, -3 = mt
+                }
+                lua_pop(L, 3); // (stack empty)
+                luaL_unref(L, LUA_REGISTRYINDEX, globalsMetatableRef);
+            }
+
+            // Pick up anything the metatable missed, such as functions
+            // added to tables after the tables were assigned.
+            Rescan();
+            report.chunkLoads.push_back(info);
+            return info;
         }
 
         /**
@@ -610,39 +3081,31 @@ namespace MoonClock {
          * function call.
          */
         void StopInstrumentation() {
-            if (luaRegistryIndex == 0) {
+            if (!instrumenting) {
                 return;
             }
+            StopStallDetector();
             if (clock != nullptr) {
                 const auto stopTime = clock->GetCurrentTime();
                 report.totalTime = stopTime - startTime;
             }
-            lua_rawgeti(lua.get(), LUA_REGISTRYINDEX, luaRegistryIndex); // -1 = functions
-            const auto numFunctions = lua_rawlen(lua.get(), -1);
-            for (size_t i = 0; i < numFunctions; ++i) {
-                // Look up the next function's information.
-                lua_pushinteger(lua.get(), i + 1); // -1 = i+1, -2 = functions
-                lua_rawget(lua.get(), -2); // -1 = functions[i+1], -2 = functions
-
-                // Get the path of the function to know its name.
-                lua_pushstring(lua.get(), "path"); // -1 = "path", -2 = functions[i+1], -3 = functions
-                lua_rawget(lua.get(), -2); // -1 = functions[i+1].path, -2 = functions[i+1], -3 = functions
-                lua_pushinteger(lua.get(), lua_rawlen(lua.get(), -1)); // -1 = #functions[i+1].path, -2 = functions[i+1].path, -3 = functions[i+1], -4 = functions
-                lua_rawget(lua.get(), -2); // -1 = functions[i+1].path[#functions[i+1].path], -2 = functions[i+1].path, -3 = functions[i+1], -4 = functions
-                lua_remove(lua.get(), -2); // -1 = functions[i+1].path[#functions[i+1].path], -2 = functions[i+1], -3 = functions
-
-                // Find the function and the table containing it, and reinstall
-                // the original function without its instrumented wrapper.
-                lua_pushstring(lua.get(), "fn"); // -1 = "fn", -2 = functions[i+1].path[#functions[i+1].path], -3 = functions[i+1], -4 = functions
-                lua_rawget(lua.get(), -3); // -1 = functions[i+1].fn, -2 = functions[i+1].path[#functions[i+1].path], -3 = functions[i+1], -4 = functions
-                lua_pushstring(lua.get(), "parent"); // -1 = "parent", -2 = functions[i+1].fn, -3 = functions[i+1].path[#functions[i+1].path], -4 = functions[i+1], -5 = functions
-                lua_rawget(lua.get(), -4); // -1 = functions[i+1].table, -2 = functions[i+1].fn, -3 = functions[i+1].path[#functions[i+1].path], -4 = functions[i+1], -5 = functions
-                lua_insert(lua.get(), -3); // -1 = functions[i+1].fn, -2 = functions[i+1].path[#functions[i+1].path], -3 = functions[i+1].table, -4 = functions[i+1], -5 = functions
-                lua_settable(lua.get(), -3); // -1 = functions[i+1].table, -2 = functions[i+1], -3 = functions
-                lua_pop(lua.get(), 2); // -1 = functions
-            }
-            luaL_unref(lua.get(), LUA_REGISTRYINDEX, luaRegistryIndex);
-            luaRegistryIndex = 0;
+            for (auto& instrumentedFunction: instrumentedFunctions) {
+                RemoveWrapper(instrumentedFunction);
+            }
+            instrumentedFunctions.clear();
+            freeIdsByPath.clear();
+            *wrapperAttachment = nullptr;
+            wrapperAttachment = nullptr;
+            luaL_unref(lua.get(), LUA_REGISTRYINDEX, wrapperAttachmentRef);
+            wrapperAttachmentRef = LUA_NOREF;
+            calledFunction = nullptr;
+            RestoreSearchers();
+            while (!moduleLoadStack.empty()) {
+                FinishModuleLoad(false);
+            }
+            StopMemoryTracking();
+            StopInstructionCounting();
+            instrumenting = false;
             lua.reset();
         }
     };
@@ -668,54 +3131,199 @@ namespace MoonClock {
 
     void MoonClock::DefaultBeforeInstrument(lua_State* lua, void* context, const Path& path) {
         const auto self = (MoonClock::Impl*)context;
+        const auto functionInfoEntry = self->FindFunctionInfo(path);
 
         // If not at the top of the call stack, record the fact that the
         // caller called this function.
         if (!self->callStack.empty()) {
-            const auto& callerCallStackEntry = self->callStack.top();
-            auto& callerFunctionInfo = self->report.functionInfo[callerCallStackEntry.path];
-            auto& calleeCallInfo = callerFunctionInfo.calls[path];
+            const auto& callerCallStackEntry = self->callStack.back();
+            auto& calleeCallInfo = callerCallStackEntry.functionInfo->calls[path];
             ++calleeCallInfo.numCalls;
         }
 
         // Increment the counter of calls to this function.
-        auto& functionInfo = self->report.functionInfo[path];
+        auto& functionInfo = functionInfoEntry->second;
         ++functionInfo.numCalls;
 
         // Sample the current real time and record it, along with the
         // function's path, on top of the call stack.
         Impl::CallStackLocation call;
+        call.path = &functionInfoEntry->first;
+        call.lua = lua;
+        call.functionInfo = &functionInfo;
+        if (
+            self->slowCallCaptureEnabled
+            && self->slowCallOptions.captureArguments
+        ) {
+            const auto numArgs = lua_gettop(lua);
+            call.arguments.reserve(numArgs);
+            for (int i = 1; i <= numArgs; ++i) {
+                call.arguments.push_back(SummarizeLuaValue(lua, i));
+            }
+        }
+        if (self->callTreeTrackingEnabled) {
+            call.callTreeNode = self->FindCallTreeNode(path);
+            ++self->report.callTree[call.callTreeNode].numCalls;
+        }
+        if (
+            (self->calledFunction != nullptr)
+            && (&self->calledFunction->path == &path)
+        ) {
+            call.latencyBudgets = &self->calledFunction->latencyBudgets;
+        }
+        call.startAllocations = self->report.memory.numAllocations;
+        call.startBytesAllocated = self->report.memory.bytesAllocated;
+        call.startInstructions = self->report.numInstructions;
         call.start = self->clock->GetCurrentTime();
-        call.path = path;
-        self->callStack.push(std::move(call));
+        self->callStack.push_back(std::move(call));
+        if (self->stallDetectorEnabled) {
+            self->PublishPush(lua);
+        }
     }
 
     void MoonClock::DefaultAfterInstrument(lua_State* lua, void* context, const Path& path) {
         const auto self = (MoonClock::Impl*)context;
 
-        // Record the current real time, and compare it to the time
-        // recorded on top of the call stack, to determine the total
-        // time elapsed during the call.
-        const auto& call = self->callStack.top();
+        // Record the current real time.
         const auto finish = self->clock->GetCurrentTime();
-        auto& functionInfo = self->report.functionInfo[path];
+
+        // Find the returning call, which is normally on top of the call
+        // stack.  Any calls above it were unwound by Lua errors, or made
+        // by coroutines which have since yielded, so discard them.  If the
+        // call isn't on the call stack at all, it was itself discarded
+        // that way (a coroutine which yielded has resumed and is now
+        // returning), so leave the call stack alone.
+        if (!self->DiscardCallsAbove(lua, path)) {
+            return;
+        }
+
+        // Compare the current real time to the time recorded on top of the
+        // call stack, to determine the total time elapsed during the call.
+        const auto& call = self->callStack.back();
+        auto& functionInfo = *call.functionInfo;
         const auto total = finish - call.start;
 
         // Update the minimum, total, and maximum call times for this function.
         functionInfo.minTime = std::min(functionInfo.minTime, total);
         functionInfo.totalTime += total;
         functionInfo.maxTime = std::max(functionInfo.maxTime, total);
+        if (self->latencyHistogramsEnabled) {
+            if (functionInfo.latencyHistogram.empty()) {
+                functionInfo.latencyHistogram.resize(NUM_LATENCY_HISTOGRAM_BUCKETS);
+            }
+            ++functionInfo.latencyHistogram[GetLatencyHistogramBucket(total)];
+        }
+
+        // Update the memory allocated and instructions executed
+        // by this function.
+        const auto numAllocations = self->report.memory.numAllocations - call.startAllocations;
+        const auto bytesAllocated = self->report.memory.bytesAllocated - call.startBytesAllocated;
+        const auto numInstructions = self->report.numInstructions - call.startInstructions;
+        functionInfo.numAllocations += numAllocations;
+        functionInfo.bytesAllocated += bytesAllocated;
+        functionInfo.numInstructions += numInstructions;
+        if (self->callTreeTrackingEnabled) {
+            auto& callTreeNode = self->report.callTree[call.callTreeNode];
+            callTreeNode.totalTime += total;
+            callTreeNode.numAllocations += numAllocations;
+            callTreeNode.bytesAllocated += bytesAllocated;
+            callTreeNode.numInstructions += numInstructions;
+        }
+
+        // Publish the function's statistics for other processes to watch.
+        if (self->sharedStatistics != nullptr) {
+            self->PublishStatistics(*call.path, functionInfo);
+        }
+
+        // Capture the call if it took longer than expected.
+        if (
+            self->slowCallCaptureEnabled
+            && (total > self->GetSlowCallThreshold(path))
+        ) {
+            self->CaptureSlowCall(lua, path, finish, total);
+        }
+
+        // Count the call against any latency budgets which apply to it.
+        if (!self->latencyBudgets.empty()) {
+            self->ApplyLatencyBudgets(
+                path,
+                (
+                    (call.latencyBudgets == nullptr)
+                    ? self->GetLatencyBudgets(path)
+                    : *call.latencyBudgets
+                ),
+                finish,
+                total
+            );
+        }
+
+        // Extend the critical path through the longest call made by
+        // this function with this call.
+        std::vector< Impl::CriticalPathLink > criticalPath;
+        if (self->criticalPathTrackingEnabled) {
+            criticalPath = std::move(self->callStack.back().criticalPath);
+            Impl::CriticalPathLink link;
+            link.path = call.path;
+            link.totalTime = total;
+            criticalPath.push_back(link);
+        }
 
         // Pop the call stack.  If it's not empty after popping it, update
         // the record at the top of the call stack to account for the time
         // elapsed making the call from that function to the function
-        // which just returned.
-        self->callStack.pop();
+        // which just returned.  Otherwise, this was a top-level call,
+        // so its critical path is complete.
+        self->callStack.pop_back();
+        if (self->stallDetectorEnabled) {
+            self->PublishPop();
+        }
         if (!self->callStack.empty()) {
-            const auto& callerCallStackEntry = self->callStack.top();
-            auto& callerFunctionInfo = self->report.functionInfo[callerCallStackEntry.path];
-            auto& calleeCallInfo = callerFunctionInfo.calls[path];
+            auto& callerCallStackEntry = self->callStack.back();
+            auto& calleeCallInfo = callerCallStackEntry.functionInfo->calls[path];
             calleeCallInfo.totalTime += total;
+            calleeCallInfo.numAllocations += numAllocations;
+            calleeCallInfo.bytesAllocated += bytesAllocated;
+            calleeCallInfo.numInstructions += numInstructions;
+            if (
+                self->criticalPathTrackingEnabled
+                && (total > callerCallStackEntry.longestCallTime)
+            ) {
+                callerCallStackEntry.longestCallTime = total;
+                callerCallStackEntry.criticalPath = std::move(criticalPath);
+            }
+        } else if (self->criticalPathTrackingEnabled) {
+            self->RecordCriticalPath(criticalPath, finish - total);
+        }
+    }
+
+    void MoonClock::CountingBeforeInstrument(lua_State* lua, void* context, const Path& path) {
+        const auto self = (MoonClock::Impl*)context;
+        const auto functionInfoEntry = self->FindFunctionInfo(path);
+
+        // If not at the top of the call stack, record the fact that the
+        // caller called this function.
+        if (!self->callStack.empty()) {
+            ++self->callStack.back().functionInfo->calls[path].numCalls;
+        }
+
+        // Increment the counter of calls to this function, and push it
+        // onto the call stack.
+        auto& functionInfo = functionInfoEntry->second;
+        ++functionInfo.numCalls;
+        Impl::CallStackLocation call;
+        call.path = &functionInfoEntry->first;
+        call.lua = lua;
+        call.functionInfo = &functionInfo;
+        self->callStack.push_back(std::move(call));
+    }
+
+    void MoonClock::CountingAfterInstrument(lua_State* lua, void* context, const Path& path) {
+        const auto self = (MoonClock::Impl*)context;
+
+        // Pop the call stack, along with any calls left on top of it by
+        // Lua errors or coroutines which yielded.
+        if (self->DiscardCallsAbove(lua, path)) {
+            self->callStack.pop_back();
         }
     }
 
@@ -725,6 +3333,91 @@ namespace MoonClock {
 
     void MoonClock::SetClock(std::shared_ptr< Timekeeping::Clock > clock) {
         impl_->clock = std::move(clock);
+        impl_->virtualClock = nullptr;
+    }
+
+    void MoonClock::UseVirtualClock(std::shared_ptr< VirtualClock > clock) {
+        impl_->clock = clock;
+        impl_->virtualClock = std::move(clock);
+        impl_->memoryTrackingEnabled = true;
+        if (impl_->instructionCountingGranularity == 0) {
+            impl_->instructionCountingGranularity = 1;
+        }
+    }
+
+    void MoonClock::SetSlowCallOptions(const SlowCallOptions& options) {
+        impl_->slowCallOptions = options;
+        impl_->slowCallCaptureEnabled = (
+            (options.threshold != std::numeric_limits< decltype(options.threshold) >::infinity())
+            || !options.thresholds.empty()
+        );
+    }
+
+    void MoonClock::SetCriticalPathTracking(bool enable, size_t capacity) {
+        impl_->criticalPathTrackingEnabled = enable;
+        impl_->criticalPathCapacity = capacity;
+    }
+
+    void MoonClock::SetCallTreeTracking(bool enable) {
+        impl_->callTreeTrackingEnabled = enable;
+    }
+
+    void MoonClock::SetLatencyHistograms(bool enable) {
+        impl_->latencyHistogramsEnabled = enable;
+    }
+
+    bool MoonClock::SetSharedStatistics(const std::string& name, size_t capacity) {
+        // Remove any segment created before first, in case it has the same
+        // name as the new one, which would otherwise be removed with it.
+        impl_->sharedStatisticsEntries.clear();
+        impl_->sharedStatistics = nullptr;
+        if (name.empty()) {
+            return true;
+        }
+        std::unique_ptr< SharedStatisticsWriter > sharedStatistics(new SharedStatisticsWriter());
+        if (!sharedStatistics->Create(name, capacity)) {
+            return false;
+        }
+        impl_->sharedStatistics = std::move(sharedStatistics);
+        return true;
+    }
+
+    void MoonClock::SetStallDetectorOptions(const StallDetectorOptions& options) {
+        impl_->stallDetectorOptions = options;
+    }
+
+    void MoonClock::SetModuleLoadProfiling(bool enable) {
+        impl_->moduleLoadProfilingEnabled = enable;
+    }
+
+    void MoonClock::SetMemoryTracking(bool enable) {
+        impl_->memoryTrackingEnabled = enable;
+    }
+
+    void MoonClock::SetInstructionCounting(size_t granularity) {
+        impl_->instructionCountingGranularity = granularity;
+    }
+
+    void MoonClock::AddLatencyBudget(const LatencyBudget& budget) {
+        impl_->latencyBudgets.push_back(budget);
+        impl_->UpdateLatencyBudgets();
+
+        // Budgets added while instrumenting are enforced from now on,
+        // so they need their information in the report right away.
+        if (impl_->instrumenting) {
+            impl_->AddLatencyBudgetInformation(
+                budget,
+                (impl_->clock == nullptr) ? 0.0 : impl_->clock->GetCurrentTime()
+            );
+        }
+    }
+
+    void MoonClock::ClearLatencyBudgets() {
+        impl_->latencyBudgets.clear();
+        impl_->UpdateLatencyBudgets();
+        if (impl_->instrumenting) {
+            impl_->report.latencyBudgets.clear();
+        }
     }
 
     void MoonClock::StartInstrumentation(
@@ -739,12 +3432,27 @@ namespace MoonClock {
         impl_->StartInstrumentation(lua, before, after, context);
     }
 
+    void MoonClock::Rescan() {
+        impl_->Rescan();
+    }
+
+    ChunkLoadInformation MoonClock::LoadChunk(
+        const std::string& name,
+        const std::string& chunk
+    ) {
+        return impl_->LoadChunk(name, chunk);
+    }
+
     void MoonClock::StopInstrumentation() {
         impl_->StopInstrumentation();
     }
 
     auto MoonClock::GenerateReport() const -> Report {
-        return impl_->report;
+        auto report = impl_->report;
+        IndexCallers(report);
+        std::lock_guard< decltype(impl_->stallsMutex) > lock(impl_->stallsMutex);
+        report.stalls = impl_->stalls;
+        return report;
     }
 
 }
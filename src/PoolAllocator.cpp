@@ -0,0 +1,316 @@
+/**
+ * @file PoolAllocator.cpp
+ *
+ * This module contains the implementation of the MoonClock::PoolAllocator
+ * class.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include <algorithm>
+#include <MoonClock/PoolAllocator.hpp>
+#include <new>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+extern "C" {
+#include <lua.h>
+}
+
+namespace {
+
+    /**
+     * This is the number of size classes served from pools.
+     */
+    constexpr size_t NUM_SIZE_CLASSES = (
+        MoonClock::PoolAllocator::MAX_POOLED_SIZE
+        / MoonClock::PoolAllocator::SIZE_CLASS_GRANULARITY
+    );
+
+    /**
+     * This is laid over each pooled block which is free, in order to
+     * link it into the free list of its size class.
+     */
+    struct FreeBlock {
+        /**
+         * This points to the next free block of the same size class,
+         * if any.
+         */
+        FreeBlock* next;
+    };
+
+    /**
+     * Determine whether or not blocks of the given size are served
+     * from pools.
+     *
+     * @param[in] size
+     *     This is the size of the block, in bytes.
+     *
+     * @return
+     *     An indication of whether or not blocks of the given size
+     *     are served from pools is returned.
+     */
+    bool IsPooled(size_t size) {
+        return (
+            (size > 0)
+            && (size <= MoonClock::PoolAllocator::MAX_POOLED_SIZE)
+        );
+    }
+
+    /**
+     * Return the index of the size class of blocks of the given size.
+     *
+     * @param[in] size
+     *     This is the size of the block, in bytes.  It must be one
+     *     served from pools.
+     *
+     * @return
+     *     The index of the size class of blocks of the given size
+     *     is returned.
+     */
+    size_t GetSizeClass(size_t size) {
+        return (size - 1) / MoonClock::PoolAllocator::SIZE_CLASS_GRANULARITY;
+    }
+
+}
+
+namespace MoonClock {
+
+    /**
+     * This contains the private properties of a PoolAllocator instance.
+     */
+    struct PoolAllocator::Impl {
+        // Properties
+
+        /**
+         * This holds the head of the free list of each size class.
+         */
+        FreeBlock* freeLists[NUM_SIZE_CLASSES] = {};
+
+        /**
+         * This points to the next unused byte of the slab currently
+         * being carved into blocks.
+         */
+        char* slabNext = nullptr;
+
+        /**
+         * This points just past the end of the slab currently
+         * being carved into blocks.
+         */
+        char* slabEnd = nullptr;
+
+        /**
+         * This holds all slabs obtained from the C library's allocator.
+         */
+        std::vector< void* > slabs;
+
+        /**
+         * This holds the counters kept by the allocator.
+         */
+        Statistics statistics;
+
+        // Lifecycle management
+
+        ~Impl() noexcept {
+            for (auto slab: slabs) {
+                free(slab);
+            }
+        }
+        Impl(const Impl&) = delete;
+        Impl(Impl&&) noexcept = delete;
+        Impl& operator=(const Impl&) = delete;
+        Impl& operator=(Impl&&) noexcept = delete;
+
+        // Methods
+
+        /**
+         * This is the default constructor for the structure.
+         */
+        Impl() = default;
+
+        /**
+         * Allocate a new block of memory.
+         *
+         * @param[in] size
+         *     This is the size of the block to allocate, in bytes.
+         *
+         * @return
+         *     A pointer to the new block is returned, or NULL if
+         *     the memory could not be allocated.
+         */
+        void* AllocateBlock(size_t size) {
+            if (!IsPooled(size)) {
+                const auto block = malloc(size);
+                if (block != NULL) {
+                    ++statistics.numLargeBlocks;
+                    statistics.bytesAllocated += size;
+                }
+                return block;
+            }
+            const auto sizeClass = GetSizeClass(size);
+            auto& freeList = freeLists[sizeClass];
+            void* block;
+            if (freeList == nullptr) {
+                const auto blockSize = (sizeClass + 1) * SIZE_CLASS_GRANULARITY;
+                if ((size_t)(slabEnd - slabNext) < blockSize) {
+                    // Whatever is left of the current slab is too small
+                    // for this block, and is abandoned.
+                    const auto slab = (char*)malloc(SLAB_SIZE);
+                    if (slab == NULL) {
+                        return NULL;
+                    }
+                    slabs.push_back(slab);
+                    statistics.bytesReserved += SLAB_SIZE;
+                    slabNext = slab;
+                    slabEnd = slab + SLAB_SIZE;
+                }
+                block = slabNext;
+                slabNext += blockSize;
+            } else {
+                block = freeList;
+                freeList = freeList->next;
+            }
+            ++statistics.numPooledBlocks;
+            statistics.bytesAllocated += size;
+            return block;
+        }
+
+        /**
+         * Free a block of memory.
+         *
+         * @param[in] block
+         *     This points to the block to free.
+         *
+         * @param[in] size
+         *     This is the size of the block, in bytes.
+         */
+        void ReleaseBlock(void* block, size_t size) {
+            if (block == NULL) {
+                return;
+            }
+            statistics.bytesAllocated -= size;
+            if (!IsPooled(size)) {
+                free(block);
+                --statistics.numLargeBlocks;
+                return;
+            }
+            auto& freeList = freeLists[GetSizeClass(size)];
+            const auto freeBlock = (FreeBlock*)block;
+            freeBlock->next = freeList;
+            freeList = freeBlock;
+            --statistics.numPooledBlocks;
+        }
+
+        /**
+         * Change the size of a block of memory, moving it if necessary.
+         *
+         * @param[in] block
+         *     This points to the block to resize.
+         *
+         * @param[in] oldSize
+         *     This is the current size of the block, in bytes.
+         *
+         * @param[in] newSize
+         *     This is the new size of the block, in bytes.
+         *
+         * @return
+         *     A pointer to the resized block is returned, or NULL if
+         *     the memory could not be allocated, in which case the
+         *     original block is left alone.  Shrinking a block never
+         *     fails, as Lua requires.
+         */
+        void* ReallocateBlock(void* block, size_t oldSize, size_t newSize) {
+            const auto oldIsPooled = IsPooled(oldSize);
+            const auto newIsPooled = IsPooled(newSize);
+            if (
+                oldIsPooled
+                && newIsPooled
+                && (GetSizeClass(oldSize) == GetSizeClass(newSize))
+            ) {
+                statistics.bytesAllocated += newSize;
+                statistics.bytesAllocated -= oldSize;
+                return block;
+            }
+            if (
+                !oldIsPooled
+                && !newIsPooled
+            ) {
+                const auto newBlock = realloc(block, newSize);
+                if (newBlock != NULL) {
+                    statistics.bytesAllocated += newSize;
+                    statistics.bytesAllocated -= oldSize;
+                }
+                return newBlock;
+            }
+            const auto shrinking = (newSize <= oldSize);
+            if (shrinking) {
+                // Make room to keep the block with the slabs, in case
+                // it has to stay where it is (see below).
+                try {
+                    slabs.reserve(slabs.size() + 1);
+                } catch (const std::bad_alloc&) {
+                }
+            }
+            const auto newBlock = AllocateBlock(newSize);
+            if (newBlock == NULL) {
+                // Lua requires that shrinking a block never fails, so a
+                // large block shrinking into the pooled sizes stays where
+                // it is if no pooled block can be had for it.  From then on
+                // it's treated as a pooled block, carved from a slab of
+                // its own, since its size will be given as a pooled size.
+                if (!shrinking) {
+                    return NULL;
+                }
+                try {
+                    slabs.push_back(block);
+                } catch (const std::bad_alloc&) {
+                    // The block can't be freed with the slabs,
+                    // so it will be leaked.
+                }
+                statistics.bytesReserved += oldSize;
+                --statistics.numLargeBlocks;
+                ++statistics.numPooledBlocks;
+                statistics.bytesAllocated += newSize;
+                statistics.bytesAllocated -= oldSize;
+                return block;
+            }
+            memcpy(newBlock, block, std::min(oldSize, newSize));
+            ReleaseBlock(block, oldSize);
+            return newBlock;
+        }
+    };
+
+    PoolAllocator::~PoolAllocator() noexcept = default;
+
+    PoolAllocator::PoolAllocator()
+        : impl_(new Impl())
+    {
+    }
+
+    void* PoolAllocator::Allocate(void* ud, void* ptr, size_t osize, size_t nsize) {
+        auto& impl = *((PoolAllocator*)ud)->impl_;
+        if (ptr == NULL) {
+            // When allocating a new block, Lua passes the type of object
+            // being allocated as osize, rather than a size.
+            if (nsize == 0) {
+                return NULL;
+            }
+            return impl.AllocateBlock(nsize);
+        }
+        if (nsize == 0) {
+            impl.ReleaseBlock(ptr, osize);
+            return NULL;
+        }
+        return impl.ReallocateBlock(ptr, osize, nsize);
+    }
+
+    lua_State* PoolAllocator::NewState() {
+        return lua_newstate(Allocate, this);
+    }
+
+    PoolAllocator::Statistics PoolAllocator::GetStatistics() const {
+        return impl_->statistics;
+    }
+
+}
@@ -0,0 +1,366 @@
+/**
+ * @file Pprof.cpp
+ *
+ * This module contains the implementation of the function which exports
+ * a MoonClock::Report as a profile in the format used by the pprof tools.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include <algorithm>
+#include <map>
+#include <MoonClock/Pprof.hpp>
+#include <MoonClock/Query.hpp>
+#include <stdint.h>
+#include <StringExtensions/StringExtensions.hpp>
+#include <vector>
+
+namespace {
+
+    /**
+     * These are the numbers of the fields of the
+     * perftools.profiles.Profile message which are written.
+     */
+    enum ProfileField {
+        PROFILE_SAMPLE_TYPE = 1,
+        PROFILE_SAMPLE = 2,
+        PROFILE_LOCATION = 4,
+        PROFILE_FUNCTION = 5,
+        PROFILE_STRING_TABLE = 6,
+        PROFILE_DURATION_NANOS = 10,
+        PROFILE_PERIOD_TYPE = 11,
+        PROFILE_PERIOD = 12,
+        PROFILE_DEFAULT_SAMPLE_TYPE = 14,
+    };
+
+    /**
+     * These are the numbers of the fields of the ValueType, Sample,
+     * Location, Line, and Function messages which are written.
+     */
+    enum MessageField {
+        VALUE_TYPE_TYPE = 1,
+        VALUE_TYPE_UNIT = 2,
+        SAMPLE_LOCATION_ID = 1,
+        SAMPLE_VALUE = 2,
+        LOCATION_ID = 1,
+        LOCATION_LINE = 4,
+        LINE_FUNCTION_ID = 1,
+        LINE_LINE = 2,
+        FUNCTION_ID = 1,
+        FUNCTION_NAME = 2,
+        FUNCTION_SYSTEM_NAME = 3,
+        FUNCTION_FILENAME = 4,
+        FUNCTION_START_LINE = 5,
+    };
+
+    /**
+     * These are the protocol buffer wire types used.
+     */
+    enum WireType {
+        WIRE_TYPE_VARINT = 0,
+        WIRE_TYPE_LENGTH_DELIMITED = 2,
+    };
+
+    /**
+     * This is used to write the fields of a protocol buffer message.
+     */
+    struct MessageWriter {
+        // Properties
+
+        /**
+         * This holds the encoded fields written so far.
+         */
+        std::string encoding;
+
+        // Methods
+
+        /**
+         * Write the given unsigned integer in base-128 varint form.
+         *
+         * @param[in] value
+         *     This is the value to write.
+         */
+        void WriteVarint(uint64_t value) {
+            while (value >= 0x80) {
+                encoding.push_back((char)((value & 0x7F) | 0x80));
+                value >>= 7;
+            }
+            encoding.push_back((char)value);
+        }
+
+        /**
+         * Write the key of a field.
+         *
+         * @param[in] field
+         *     This is the number of the field.
+         *
+         * @param[in] wireType
+         *     This is the wire type of the field.
+         */
+        void WriteKey(int field, WireType wireType) {
+            WriteVarint(((uint64_t)field << 3) | wireType);
+        }
+
+        /**
+         * Write a field holding an integer.  Zero values aren't written,
+         * since zero is the default value of every integer field.
+         *
+         * @param[in] field
+         *     This is the number of the field.
+         *
+         * @param[in] value
+         *     This is the value of the field.
+         */
+        void WriteInteger(int field, int64_t value) {
+            if (value == 0) {
+                return;
+            }
+            WriteKey(field, WIRE_TYPE_VARINT);
+            WriteVarint((uint64_t)value);
+        }
+
+        /**
+         * Write a field holding a string of bytes, such as a string
+         * or an embedded message.
+         *
+         * @param[in] field
+         *     This is the number of the field.
+         *
+         * @param[in] bytes
+         *     This is the value of the field.
+         */
+        void WriteBytes(int field, const std::string& bytes) {
+            WriteKey(field, WIRE_TYPE_LENGTH_DELIMITED);
+            WriteVarint(bytes.length());
+            encoding += bytes;
+        }
+
+        /**
+         * Write a repeated integer field in packed form.
+         *
+         * @param[in] field
+         *     This is the number of the field.
+         *
+         * @param[in] values
+         *     These are the values of the field.
+         */
+        void WritePacked(int field, const std::vector< int64_t >& values) {
+            MessageWriter packed;
+            for (const auto value: values) {
+                packed.WriteVarint((uint64_t)value);
+            }
+            WriteBytes(field, packed.encoding);
+        }
+    };
+
+    /**
+     * This holds the strings of a profile, each of which is referred to
+     * by its index in the table.
+     */
+    struct StringTable {
+        // Properties
+
+        /**
+         * This holds the strings in the table, in order.
+         * The first string is always the empty string.
+         */
+        std::vector< std::string > strings{""};
+
+        /**
+         * This holds the index of each string in the table.
+         */
+        std::map< std::string, int64_t > indices{{"", 0}};
+
+        // Methods
+
+        /**
+         * Return the index of the given string in the table,
+         * adding the string to the table if it isn't already in it.
+         *
+         * @param[in] s
+         *     This is the string to find.
+         *
+         * @return
+         *     The index of the given string in the table is returned.
+         */
+        int64_t Find(const std::string& s) {
+            const auto index = indices.find(s);
+            if (index != indices.end()) {
+                return index->second;
+            }
+            const auto newIndex = (int64_t)strings.size();
+            strings.push_back(s);
+            indices[s] = newIndex;
+            return newIndex;
+        }
+    };
+
+    /**
+     * This holds the values of one sample of the profile, in the order
+     * of the sample types of the profile.
+     */
+    struct SampleValues {
+        /**
+         * This is the number of calls.
+         */
+        int64_t calls = 0;
+
+        /**
+         * This is the time elapsed, in nanoseconds.
+         */
+        int64_t wall = 0;
+
+        /**
+         * This is the number of blocks of memory allocated.
+         */
+        int64_t allocObjects = 0;
+
+        /**
+         * This is the number of bytes allocated.
+         */
+        int64_t allocSpace = 0;
+
+        /**
+         * This is the number of Lua virtual machine instructions executed.
+         */
+        int64_t instructions = 0;
+    };
+
+    /**
+     * Return the sample values giving the given number of calls
+     * and self costs.
+     *
+     * @param[in] numCalls
+     *     This is the number of calls.
+     *
+     * @param[in] selfCosts
+     *     These are the self costs of the calls.
+     *
+     * @return
+     *     The sample values are returned.
+     */
+    SampleValues MakeSampleValues(size_t numCalls, const MoonClock::SelfCosts& selfCosts) {
+        SampleValues values;
+        values.calls = (int64_t)numCalls;
+        values.wall = (int64_t)MoonClock::ToNanoseconds(selfCosts.time);
+        values.allocObjects = (int64_t)selfCosts.numAllocations;
+        values.allocSpace = (int64_t)selfCosts.bytesAllocated;
+        values.instructions = (int64_t)selfCosts.numInstructions;
+        return values;
+    }
+
+}
+
+namespace MoonClock {
+
+    std::string EncodePprofProfile(const Report& report) {
+        MessageWriter profile;
+        StringTable strings;
+
+        // Describe the values of each sample.
+        const std::vector< std::pair< std::string, std::string > > sampleTypes{
+            {"calls", "count"},
+            {"wall", "nanoseconds"},
+            {"alloc_objects", "count"},
+            {"alloc_space", "bytes"},
+            {"instructions", "count"},
+        };
+        for (const auto& sampleType: sampleTypes) {
+            MessageWriter valueType;
+            valueType.WriteInteger(VALUE_TYPE_TYPE, strings.Find(sampleType.first));
+            valueType.WriteInteger(VALUE_TYPE_UNIT, strings.Find(sampleType.second));
+            profile.WriteBytes(PROFILE_SAMPLE_TYPE, valueType.encoding);
+        }
+
+        // Assign an ID to each function, which is also the ID of the
+        // single location used for the function.
+        std::map< Path, uint64_t > functionIds;
+        for (const auto& functionInfoEntry: report.functionInfo) {
+            (void)functionIds.insert({functionInfoEntry.first, functionIds.size() + 1});
+        }
+        for (size_t i = 1; i < report.callTree.size(); ++i) {
+            (void)functionIds.insert({report.callTree[i].path, functionIds.size() + 1});
+        }
+
+        // Write the samples.
+        const auto writeSample = [&profile](
+            const std::vector< int64_t >& locationIds,
+            const SampleValues& values
+        ){
+            MessageWriter sample;
+            sample.WritePacked(SAMPLE_LOCATION_ID, locationIds);
+            sample.WritePacked(
+                SAMPLE_VALUE,
+                {
+                    values.calls,
+                    values.wall,
+                    values.allocObjects,
+                    values.allocSpace,
+                    values.instructions,
+                }
+            );
+            profile.WriteBytes(PROFILE_SAMPLE, sample.encoding);
+        };
+        if (report.callTree.empty()) {
+            for (const auto& functionInfoEntry: report.functionInfo) {
+                const auto& functionInfo = functionInfoEntry.second;
+                const auto values = MakeSampleValues(functionInfo.numCalls, GetSelfCosts(functionInfo));
+                writeSample({(int64_t)functionIds[functionInfoEntry.first]}, values);
+            }
+        } else {
+            for (size_t i = 1; i < report.callTree.size(); ++i) {
+                const auto values = MakeSampleValues(report.callTree[i].numCalls, GetSelfCosts(report, i));
+
+                // The stack lists the innermost call first.
+                std::vector< int64_t > locationIds;
+                for (auto j = i; j != 0; j = report.callTree[j].parent) {
+                    locationIds.push_back((int64_t)functionIds[report.callTree[j].path]);
+                }
+                writeSample(locationIds, values);
+            }
+        }
+
+        // Write the locations and functions.
+        for (const auto& functionIdEntry: functionIds) {
+            const auto& path = functionIdEntry.first;
+            const auto id = functionIdEntry.second;
+            SourceInformation sourceInfo;
+            const auto sourceInfoEntry = report.sources.find(path);
+            if (sourceInfoEntry != report.sources.end()) {
+                sourceInfo = sourceInfoEntry->second;
+            }
+            MessageWriter line;
+            line.WriteInteger(LINE_FUNCTION_ID, (int64_t)id);
+            line.WriteInteger(LINE_LINE, sourceInfo.lineDefined);
+            MessageWriter location;
+            location.WriteInteger(LOCATION_ID, (int64_t)id);
+            location.WriteBytes(LOCATION_LINE, line.encoding);
+            profile.WriteBytes(PROFILE_LOCATION, location.encoding);
+            const auto name = strings.Find(StringExtensions::Join(path, "."));
+            MessageWriter function;
+            function.WriteInteger(FUNCTION_ID, (int64_t)id);
+            function.WriteInteger(FUNCTION_NAME, name);
+            function.WriteInteger(FUNCTION_SYSTEM_NAME, name);
+            function.WriteInteger(FUNCTION_FILENAME, strings.Find(sourceInfo.source));
+            function.WriteInteger(FUNCTION_START_LINE, sourceInfo.lineDefined);
+            profile.WriteBytes(PROFILE_FUNCTION, function.encoding);
+        }
+
+        // Write the string table, which must be complete by now,
+        // followed by the fields which refer to it.
+        const auto wallType = strings.Find("wall");
+        const auto nanosecondsUnit = strings.Find("nanoseconds");
+        for (const auto& s: strings.strings) {
+            profile.WriteBytes(PROFILE_STRING_TABLE, s);
+        }
+        profile.WriteInteger(PROFILE_DURATION_NANOS, (int64_t)ToNanoseconds(report.totalTime));
+        MessageWriter periodType;
+        periodType.WriteInteger(VALUE_TYPE_TYPE, wallType);
+        periodType.WriteInteger(VALUE_TYPE_UNIT, nanosecondsUnit);
+        profile.WriteBytes(PROFILE_PERIOD_TYPE, periodType.encoding);
+        profile.WriteInteger(PROFILE_PERIOD, 1);
+        profile.WriteInteger(PROFILE_DEFAULT_SAMPLE_TYPE, wallType);
+        return profile.encoding;
+    }
+
+}
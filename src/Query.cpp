@@ -0,0 +1,260 @@
+/**
+ * @file Query.cpp
+ *
+ * This module contains the implementation of the functions which answer
+ * common questions about a MoonClock::Report.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include <algorithm>
+#include <MoonClock/Query.hpp>
+#include <StringExtensions/StringExtensions.hpp>
+
+namespace {
+
+    /**
+     * Return the range of entries of the given map, keyed by path, whose
+     * paths start with the given prefix.
+     *
+     * Paths are compared key by key, and no string falls between a key
+     * and that key with a null character appended.  So the entries whose
+     * paths start with the prefix are exactly those from the prefix up to
+     * (but not including) the prefix with a null character appended to
+     * its last key.
+     *
+     * @param[in] map
+     *     This is the map whose entries to select.
+     *
+     * @param[in] prefix
+     *     This is the prefix of the paths of the entries to select.
+     *
+     * @return
+     *     The first selected entry, and the entry just past the last
+     *     selected entry, are returned.
+     */
+    template< typename T > std::pair<
+        typename std::map< MoonClock::Path, T >::const_iterator,
+        typename std::map< MoonClock::Path, T >::const_iterator
+    > GetPrefixRange(
+        const std::map< MoonClock::Path, T >& map,
+        const MoonClock::Path& prefix
+    ) {
+        if (prefix.empty()) {
+            return std::make_pair(map.begin(), map.end());
+        }
+        auto limit = prefix;
+        limit.back().push_back('\0');
+        return std::make_pair(
+            map.lower_bound(prefix),
+            map.lower_bound(limit)
+        );
+    }
+
+    /**
+     * Return the given count less the given amount, or zero
+     * if the amount is more than the count.
+     *
+     * @param[in] count
+     *     This is the count to reduce.
+     *
+     * @param[in] amount
+     *     This is the amount by which to reduce the count.
+     *
+     * @return
+     *     The reduced count is returned.
+     */
+    size_t Less(size_t count, size_t amount) {
+        return ((count > amount) ? (count - amount) : 0);
+    }
+
+}
+
+namespace MoonClock {
+
+    FunctionReference FunctionRange::begin() const {
+        return first;
+    }
+
+    FunctionReference FunctionRange::end() const {
+        return last;
+    }
+
+    bool FunctionRange::empty() const {
+        return (first == last);
+    }
+
+    double GetSelfTime(const FunctionInformation& functionInfo) {
+        auto selfTime = functionInfo.totalTime;
+        for (const auto& callsEntry: functionInfo.calls) {
+            selfTime -= callsEntry.second.totalTime;
+        }
+        return std::max(selfTime, 0.0);
+    }
+
+    SelfCosts GetSelfCosts(const FunctionInformation& functionInfo) {
+        SelfCosts selfCosts;
+        selfCosts.time = GetSelfTime(functionInfo);
+        size_t calleeAllocations = 0;
+        size_t calleeBytesAllocated = 0;
+        size_t calleeInstructions = 0;
+        for (const auto& callsEntry: functionInfo.calls) {
+            calleeAllocations += callsEntry.second.numAllocations;
+            calleeBytesAllocated += callsEntry.second.bytesAllocated;
+            calleeInstructions += callsEntry.second.numInstructions;
+        }
+        selfCosts.numAllocations = Less(functionInfo.numAllocations, calleeAllocations);
+        selfCosts.bytesAllocated = Less(functionInfo.bytesAllocated, calleeBytesAllocated);
+        selfCosts.numInstructions = Less(functionInfo.numInstructions, calleeInstructions);
+        return selfCosts;
+    }
+
+    SelfCosts GetSelfCosts(const Report& report, size_t node) {
+        const auto& callTreeNode = report.callTree[node];
+        auto selfTime = callTreeNode.totalTime;
+        size_t childAllocations = 0;
+        size_t childBytesAllocated = 0;
+        size_t childInstructions = 0;
+        for (const auto& child: callTreeNode.children) {
+            const auto& childNode = report.callTree[child.second];
+            selfTime -= childNode.totalTime;
+            childAllocations += childNode.numAllocations;
+            childBytesAllocated += childNode.bytesAllocated;
+            childInstructions += childNode.numInstructions;
+        }
+        SelfCosts selfCosts;
+        selfCosts.time = std::max(selfTime, 0.0);
+        selfCosts.numAllocations = Less(callTreeNode.numAllocations, childAllocations);
+        selfCosts.bytesAllocated = Less(callTreeNode.bytesAllocated, childBytesAllocated);
+        selfCosts.numInstructions = Less(callTreeNode.numInstructions, childInstructions);
+        return selfCosts;
+    }
+
+    uint64_t ToNanoseconds(double seconds) {
+        return (uint64_t)(std::max(seconds, 0.0) * 1e9 + 0.5);
+    }
+
+    double GetMetric(const FunctionInformation& functionInfo, Metric metric) {
+        switch (metric) {
+            case Metric::Calls: return (double)functionInfo.numCalls;
+            case Metric::TotalTime: return functionInfo.totalTime;
+            case Metric::SelfTime: return GetSelfTime(functionInfo);
+            case Metric::MaxTime: return functionInfo.maxTime;
+            case Metric::Allocations: return (double)functionInfo.numAllocations;
+            case Metric::BytesAllocated: return (double)functionInfo.bytesAllocated;
+            case Metric::Instructions: return (double)functionInfo.numInstructions;
+            default: return 0.0;
+        }
+    }
+
+    FunctionRange GetFunctionsWithPrefix(const Report& report, const Path& prefix) {
+        const auto range = GetPrefixRange(report.functionInfo, prefix);
+        FunctionRange functions;
+        functions.first = range.first;
+        functions.last = range.second;
+        return functions;
+    }
+
+    std::vector< FunctionReference > GetFunctionsMatching(
+        const Report& report,
+        const std::string& pattern
+    ) {
+        Path prefix;
+        for (const auto& key: StringExtensions::Split(pattern, '.')) {
+            if (key == "*") {
+                break;
+            }
+            prefix.push_back(key);
+        }
+        std::vector< FunctionReference > functions;
+        const auto range = GetFunctionsWithPrefix(report, prefix);
+        for (auto function = range.begin(); function != range.end(); ++function) {
+            if (PathMatchesPattern(function->first, pattern)) {
+                functions.push_back(function);
+            }
+        }
+        return functions;
+    }
+
+    std::vector< FunctionReference > FilterFunctions(
+        const Report& report,
+        std::function< bool(const Path& path, const FunctionInformation& functionInfo) > filter
+    ) {
+        std::vector< FunctionReference > functions;
+        for (auto function = report.functionInfo.begin(); function != report.functionInfo.end(); ++function) {
+            if (filter(function->first, function->second)) {
+                functions.push_back(function);
+            }
+        }
+        return functions;
+    }
+
+    std::vector< RankedFunction > GetTopFunctions(
+        const Report& report,
+        Metric metric,
+        size_t n,
+        const Path& prefix
+    ) {
+        const auto range = GetFunctionsWithPrefix(report, prefix);
+        std::vector< FunctionReference > functions;
+        for (auto function = range.begin(); function != range.end(); ++function) {
+            functions.push_back(function);
+        }
+        return GetTopFunctions(functions, metric, n);
+    }
+
+    std::vector< RankedFunction > GetTopFunctions(
+        const std::vector< FunctionReference >& functions,
+        Metric metric,
+        size_t n
+    ) {
+        std::vector< RankedFunction > ranking;
+        ranking.reserve(functions.size());
+        for (const auto& function: functions) {
+            RankedFunction rankedFunction;
+            rankedFunction.function = function;
+            rankedFunction.value = GetMetric(function->second, metric);
+            ranking.push_back(rankedFunction);
+        }
+        n = std::min(n, ranking.size());
+        std::partial_sort(
+            ranking.begin(),
+            ranking.begin() + n,
+            ranking.end(),
+            [](const RankedFunction& lhs, const RankedFunction& rhs){
+                if (lhs.value != rhs.value) {
+                    return (lhs.value > rhs.value);
+                }
+                return (lhs.function->first < rhs.function->first);
+            }
+        );
+        ranking.resize(n);
+        return ranking;
+    }
+
+    RollupInformation RollUp(const Report& report, const Path& prefix) {
+        RollupInformation rollup;
+        for (const auto& function: GetFunctionsWithPrefix(report, prefix)) {
+            const auto& functionInfo = function.second;
+            ++rollup.numFunctions;
+            rollup.numCalls += functionInfo.numCalls;
+            rollup.totalTime += functionInfo.totalTime;
+            rollup.selfTime += functionInfo.totalTime;
+            for (const auto& callsEntry: functionInfo.calls) {
+                rollup.selfTime -= callsEntry.second.totalTime;
+            }
+
+            // Calls made to other functions in the group were already counted
+            // in the total time of the caller, so they don't enter the group
+            // again.
+            const auto nestedCalls = GetPrefixRange(functionInfo.calls, prefix);
+            for (auto callsEntry = nestedCalls.first; callsEntry != nestedCalls.second; ++callsEntry) {
+                rollup.numCalls -= callsEntry->second.numCalls;
+                rollup.totalTime -= callsEntry->second.totalTime;
+            }
+        }
+        rollup.selfTime = std::max(rollup.selfTime, 0.0);
+        return rollup;
+    }
+
+}
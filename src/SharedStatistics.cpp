@@ -0,0 +1,488 @@
+/**
+ * @file SharedStatistics.cpp
+ *
+ * This module contains the implementation of the
+ * MoonClock::SharedStatisticsWriter and MoonClock::SharedStatisticsReader
+ * classes.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include <algorithm>
+#include <errno.h>
+#include <map>
+#include <MoonClock/Query.hpp>
+#include <MoonClock/SharedStatistics.hpp>
+#include <new>
+#include <string.h>
+#include <StringExtensions/StringExtensions.hpp>
+#include <thread>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif /* not _WIN32 */
+
+namespace {
+
+    static_assert(
+        (ATOMIC_INT_LOCK_FREE == 2) && (ATOMIC_LLONG_LOCK_FREE == 2),
+        "shared statistics require lock-free atomics to work across processes"
+    );
+
+    /**
+     * This is the largest number of times a reader tries to copy the
+     * statistics of a function before giving up on it.
+     */
+    constexpr size_t MAX_READ_ATTEMPTS = 100;
+
+    /**
+     * Return the name of the shared memory segment with the given name,
+     * in the form required by shm_open.
+     *
+     * @param[in] name
+     *     This is the name of the shared memory segment.
+     *
+     * @return
+     *     The name, with a slash at the front, is returned.
+     */
+    std::string GetSegmentName(const std::string& name) {
+        if (
+            !name.empty()
+            && (name[0] == '/')
+        ) {
+            return name;
+        }
+        return "/" + name;
+    }
+
+    /**
+     * Return the size of a shared memory segment with space
+     * for the given number of entries.
+     *
+     * @param[in] capacity
+     *     This is the number of entries for which there is space
+     *     in the segment.
+     *
+     * @return
+     *     The size of the segment, in bytes, is returned.
+     */
+    size_t GetSegmentSize(size_t capacity) {
+        return (
+            sizeof(MoonClock::SharedStatisticsHeader)
+            + capacity * sizeof(MoonClock::SharedStatisticsEntry)
+        );
+    }
+
+}
+
+namespace MoonClock {
+
+    /**
+     * This contains the private properties of a SharedStatisticsWriter
+     * instance.
+     */
+    struct SharedStatisticsWriter::Impl {
+        // Properties
+
+        /**
+         * This is the name of the shared memory segment, in the form
+         * used by shm_open.
+         */
+        std::string segmentName;
+
+        /**
+         * This is the size of the shared memory segment, in bytes.
+         */
+        size_t size = 0;
+
+        /**
+         * This points to the header at the start of the shared memory
+         * segment, or is nullptr if no segment is open.
+         */
+        SharedStatisticsHeader* header = nullptr;
+
+        /**
+         * This points to the entries in the shared memory segment,
+         * following the header.
+         */
+        SharedStatisticsEntry* entries = nullptr;
+
+        /**
+         * This holds the index of the entry of each function,
+         * keyed by the name of the function.
+         */
+        std::map< std::string, size_t > indices;
+
+        // Lifecycle management
+
+        ~Impl() noexcept {
+            Close();
+        }
+        Impl(const Impl&) = delete;
+        Impl(Impl&&) noexcept = delete;
+        Impl& operator=(const Impl&) = delete;
+        Impl& operator=(Impl&&) noexcept = delete;
+
+        // Methods
+
+        /**
+         * This is the default constructor for the structure.
+         */
+        Impl() = default;
+
+        /**
+         * Remove the shared memory segment, if one is open.
+         */
+        void Close() {
+#ifndef _WIN32
+            if (header != nullptr) {
+                (void)munmap(header, size);
+                (void)shm_unlink(segmentName.c_str());
+            }
+#endif /* not _WIN32 */
+            header = nullptr;
+            entries = nullptr;
+            size = 0;
+            indices.clear();
+        }
+    };
+
+    SharedStatisticsWriter::~SharedStatisticsWriter() noexcept = default;
+
+    SharedStatisticsWriter::SharedStatisticsWriter(SharedStatisticsWriter&& other) noexcept
+        : impl_(std::move(other.impl_))
+    {
+    }
+
+    SharedStatisticsWriter& SharedStatisticsWriter::operator=(SharedStatisticsWriter&& other) noexcept {
+        if (this != &other) {
+            impl_ = std::move(other.impl_);
+        }
+        return *this;
+    }
+
+    SharedStatisticsWriter::SharedStatisticsWriter()
+        : impl_(new Impl())
+    {
+    }
+
+    bool SharedStatisticsWriter::Create(const std::string& name, size_t capacity) {
+        impl_->Close();
+#ifdef _WIN32
+        return false;
+#else /* not _WIN32 */
+        const auto segmentName = GetSegmentName(name);
+        const auto size = GetSegmentSize(capacity);
+        const auto fd = shm_open(segmentName.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+        if (fd < 0) {
+            return false;
+        }
+        if (ftruncate(fd, (off_t)size) != 0) {
+            (void)close(fd);
+            (void)shm_unlink(segmentName.c_str());
+            return false;
+        }
+        const auto mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        (void)close(fd);
+        if (mapping == MAP_FAILED) {
+            (void)shm_unlink(segmentName.c_str());
+            return false;
+        }
+
+        // Set up the header and entries, leaving the magic number for last,
+        // so that readers don't accept the segment until it's ready.
+        const auto header = new(mapping) SharedStatisticsHeader();
+        const auto entries = (SharedStatisticsEntry*)((char*)mapping + sizeof(SharedStatisticsHeader));
+        for (size_t i = 0; i < capacity; ++i) {
+            (void)new(entries + i) SharedStatisticsEntry();
+        }
+        header->version = SHARED_STATISTICS_VERSION;
+        header->headerSize = (uint32_t)sizeof(SharedStatisticsHeader);
+        header->entrySize = (uint32_t)sizeof(SharedStatisticsEntry);
+        header->capacity = (uint32_t)capacity;
+        header->processId = (uint32_t)getpid();
+        header->numEntries.store(0, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        header->magic = SHARED_STATISTICS_MAGIC;
+        impl_->segmentName = segmentName;
+        impl_->size = size;
+        impl_->header = header;
+        impl_->entries = entries;
+        return true;
+#endif /* _WIN32 or not _WIN32 */
+    }
+
+    void SharedStatisticsWriter::Close() {
+        impl_->Close();
+    }
+
+    bool SharedStatisticsWriter::FindEntry(const std::string& name, size_t& index) {
+        const auto indicesEntry = impl_->indices.find(name);
+        if (indicesEntry != impl_->indices.end()) {
+            index = indicesEntry->second;
+            return true;
+        }
+        if (impl_->header == nullptr) {
+            return false;
+        }
+        const auto numEntries = impl_->header->numEntries.load(std::memory_order_relaxed);
+        if (numEntries >= impl_->header->capacity) {
+            return false;
+        }
+        auto& entry = impl_->entries[numEntries];
+        (void)strncpy(entry.name, name.c_str(), SHARED_STATISTICS_NAME_SIZE - 1);
+        entry.name[SHARED_STATISTICS_NAME_SIZE - 1] = '\0';
+        impl_->header->numEntries.store(numEntries + 1, std::memory_order_release);
+        index = numEntries;
+        impl_->indices[name] = index;
+        return true;
+    }
+
+    void SharedStatisticsWriter::Publish(size_t index, const SharedFunctionStatistics& statistics) {
+        if (
+            (impl_->header == nullptr)
+            || (index >= impl_->header->capacity)
+        ) {
+            return;
+        }
+        auto& entry = impl_->entries[index];
+        const auto sequence = entry.sequence.load(std::memory_order_relaxed);
+        entry.sequence.store(sequence + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        entry.numCalls.store(statistics.numCalls, std::memory_order_relaxed);
+        entry.totalNanoseconds.store(ToNanoseconds(statistics.totalTime), std::memory_order_relaxed);
+        entry.maxNanoseconds.store(ToNanoseconds(statistics.maxTime), std::memory_order_relaxed);
+        entry.numAllocations.store(statistics.numAllocations, std::memory_order_relaxed);
+        entry.bytesAllocated.store(statistics.bytesAllocated, std::memory_order_relaxed);
+        entry.numInstructions.store(statistics.numInstructions, std::memory_order_relaxed);
+        entry.sequence.store(sequence + 2, std::memory_order_release);
+    }
+
+    /**
+     * This contains the private properties of a SharedStatisticsReader
+     * instance.
+     */
+    struct SharedStatisticsReader::Impl {
+        // Properties
+
+        /**
+         * This is the size of the shared memory segment, in bytes.
+         */
+        size_t size = 0;
+
+        /**
+         * This points to the header at the start of the shared memory
+         * segment, or is nullptr if no segment is open.
+         */
+        const SharedStatisticsHeader* header = nullptr;
+
+        /**
+         * This points to the entries in the shared memory segment,
+         * following the header.
+         */
+        const SharedStatisticsEntry* entries = nullptr;
+
+        // Lifecycle management
+
+        ~Impl() noexcept {
+            Close();
+        }
+        Impl(const Impl&) = delete;
+        Impl(Impl&&) noexcept = delete;
+        Impl& operator=(const Impl&) = delete;
+        Impl& operator=(Impl&&) noexcept = delete;
+
+        // Methods
+
+        /**
+         * This is the default constructor for the structure.
+         */
+        Impl() = default;
+
+        /**
+         * Close the shared memory segment, if one is open.
+         */
+        void Close() {
+#ifndef _WIN32
+            if (header != nullptr) {
+                (void)munmap((void*)header, size);
+            }
+#endif /* not _WIN32 */
+            header = nullptr;
+            entries = nullptr;
+            size = 0;
+        }
+
+        /**
+         * Read a consistent copy of the statistics in the given entry.
+         *
+         * @param[in] entry
+         *     This is the entry to read.
+         *
+         * @param[out] statistics
+         *     This is where to store the copy of the statistics.
+         *
+         * @return
+         *     An indication of whether or not a consistent copy
+         *     could be read is returned.
+         */
+        static bool ReadEntry(
+            const SharedStatisticsEntry& entry,
+            SharedFunctionStatistics& statistics
+        ) {
+            for (size_t attempt = 0; attempt < MAX_READ_ATTEMPTS; ++attempt) {
+                const auto sequenceBefore = entry.sequence.load(std::memory_order_acquire);
+                if ((sequenceBefore & 1) != 0) {
+                    std::this_thread::yield();
+                    continue;
+                }
+                statistics.numCalls = entry.numCalls.load(std::memory_order_relaxed);
+                const auto totalNanoseconds = entry.totalNanoseconds.load(std::memory_order_relaxed);
+                const auto maxNanoseconds = entry.maxNanoseconds.load(std::memory_order_relaxed);
+                statistics.numAllocations = entry.numAllocations.load(std::memory_order_relaxed);
+                statistics.bytesAllocated = entry.bytesAllocated.load(std::memory_order_relaxed);
+                statistics.numInstructions = entry.numInstructions.load(std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (entry.sequence.load(std::memory_order_relaxed) == sequenceBefore) {
+                    statistics.totalTime = totalNanoseconds / 1e9;
+                    statistics.maxTime = maxNanoseconds / 1e9;
+                    return true;
+                }
+            }
+            return false;
+        }
+    };
+
+    SharedStatisticsReader::~SharedStatisticsReader() noexcept = default;
+
+    SharedStatisticsReader::SharedStatisticsReader(SharedStatisticsReader&& other) noexcept
+        : impl_(std::move(other.impl_))
+    {
+    }
+
+    SharedStatisticsReader& SharedStatisticsReader::operator=(SharedStatisticsReader&& other) noexcept {
+        if (this != &other) {
+            impl_ = std::move(other.impl_);
+        }
+        return *this;
+    }
+
+    SharedStatisticsReader::SharedStatisticsReader()
+        : impl_(new Impl())
+    {
+    }
+
+    bool SharedStatisticsReader::Open(const std::string& name, std::string& errorMessage) {
+        impl_->Close();
+#ifdef _WIN32
+        errorMessage = "shared statistics aren't supported on this system";
+        return false;
+#else /* not _WIN32 */
+        const auto segmentName = GetSegmentName(name);
+        const auto fd = shm_open(segmentName.c_str(), O_RDONLY, 0);
+        if (fd < 0) {
+            errorMessage = StringExtensions::sprintf(
+                "unable to open shared memory segment '%s': %s",
+                segmentName.c_str(),
+                strerror(errno)
+            );
+            return false;
+        }
+        struct stat status;
+        if (
+            (fstat(fd, &status) != 0)
+            || ((size_t)status.st_size < sizeof(SharedStatisticsHeader))
+        ) {
+            (void)close(fd);
+            errorMessage = StringExtensions::sprintf(
+                "shared memory segment '%s' is too small",
+                segmentName.c_str()
+            );
+            return false;
+        }
+        const auto size = (size_t)status.st_size;
+        const auto mapping = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+        (void)close(fd);
+        if (mapping == MAP_FAILED) {
+            errorMessage = StringExtensions::sprintf(
+                "unable to map shared memory segment '%s': %s",
+                segmentName.c_str(),
+                strerror(errno)
+            );
+            return false;
+        }
+        const auto header = (const SharedStatisticsHeader*)mapping;
+        const auto magic = header->magic;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (magic != SHARED_STATISTICS_MAGIC) {
+            errorMessage = StringExtensions::sprintf(
+                "shared memory segment '%s' doesn't hold MoonClock statistics",
+                segmentName.c_str()
+            );
+        } else if (header->version != SHARED_STATISTICS_VERSION) {
+            errorMessage = StringExtensions::sprintf(
+                "shared memory segment '%s' has layout version %u, but only version %u is supported",
+                segmentName.c_str(),
+                (unsigned int)header->version,
+                (unsigned int)SHARED_STATISTICS_VERSION
+            );
+        } else if (
+            (header->headerSize != sizeof(SharedStatisticsHeader))
+            || (header->entrySize != sizeof(SharedStatisticsEntry))
+            || (GetSegmentSize(header->capacity) > size)
+        ) {
+            errorMessage = StringExtensions::sprintf(
+                "shared memory segment '%s' has an unexpected layout",
+                segmentName.c_str()
+            );
+        } else {
+            impl_->size = size;
+            impl_->header = header;
+            impl_->entries = (const SharedStatisticsEntry*)((const char*)mapping + sizeof(SharedStatisticsHeader));
+            return true;
+        }
+        (void)munmap(mapping, size);
+        return false;
+#endif /* _WIN32 or not _WIN32 */
+    }
+
+    void SharedStatisticsReader::Close() {
+        impl_->Close();
+    }
+
+    unsigned int SharedStatisticsReader::GetProcessId() const {
+        if (impl_->header == nullptr) {
+            return 0;
+        }
+        return impl_->header->processId;
+    }
+
+    std::vector< SharedFunctionStatistics > SharedStatisticsReader::Read() const {
+        std::vector< SharedFunctionStatistics > functions;
+        if (impl_->header == nullptr) {
+            return functions;
+        }
+        const auto numEntries = std::min(
+            impl_->header->numEntries.load(std::memory_order_acquire),
+            impl_->header->capacity
+        );
+        functions.reserve(numEntries);
+        for (size_t i = 0; i < numEntries; ++i) {
+            const auto& entry = impl_->entries[i];
+            SharedFunctionStatistics statistics;
+            if (!Impl::ReadEntry(entry, statistics)) {
+                continue;
+            }
+            statistics.name.assign(
+                entry.name,
+                strnlen(entry.name, SHARED_STATISTICS_NAME_SIZE)
+            );
+            functions.push_back(std::move(statistics));
+        }
+        return functions;
+    }
+
+}
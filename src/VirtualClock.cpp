@@ -0,0 +1,93 @@
+/**
+ * @file VirtualClock.cpp
+ *
+ * This module contains the implementation of the MoonClock::VirtualClock
+ * class.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include <atomic>
+#include <MoonClock/VirtualClock.hpp>
+
+namespace MoonClock {
+
+    /**
+     * This contains the private properties of a VirtualClock instance.
+     */
+    struct VirtualClock::Impl {
+        // Properties
+
+        /**
+         * This is the amount by which to advance the clock
+         * for each Lua virtual machine instruction executed.
+         */
+        double secondsPerInstruction = 0.0;
+
+        /**
+         * This is the amount by which to advance the clock
+         * for each block of memory allocated.
+         */
+        double secondsPerAllocation = 0.0;
+
+        /**
+         * This is the number of Lua virtual machine instructions
+         * counted by the clock.
+         */
+        std::atomic< size_t > numInstructions{0};
+
+        /**
+         * This is the number of blocks of memory allocated
+         * counted by the clock.
+         */
+        std::atomic< size_t > numAllocations{0};
+    };
+
+    VirtualClock::~VirtualClock() noexcept = default;
+
+    VirtualClock::VirtualClock(VirtualClock&& other) noexcept
+        : impl_(std::move(other.impl_))
+    {
+    }
+
+    VirtualClock& VirtualClock::operator=(VirtualClock&& other) noexcept {
+        if (this != &other) {
+            impl_ = std::move(other.impl_);
+        }
+        return *this;
+    }
+
+    VirtualClock::VirtualClock(
+        double secondsPerInstruction,
+        double secondsPerAllocation
+    )
+        : impl_(new Impl())
+    {
+        impl_->secondsPerInstruction = secondsPerInstruction;
+        impl_->secondsPerAllocation = secondsPerAllocation;
+    }
+
+    void VirtualClock::CountInstructions(size_t numInstructions) {
+        impl_->numInstructions.fetch_add(numInstructions, std::memory_order_relaxed);
+    }
+
+    void VirtualClock::CountAllocations(size_t numAllocations) {
+        impl_->numAllocations.fetch_add(numAllocations, std::memory_order_relaxed);
+    }
+
+    size_t VirtualClock::GetInstructionCount() const {
+        return impl_->numInstructions.load(std::memory_order_relaxed);
+    }
+
+    size_t VirtualClock::GetAllocationCount() const {
+        return impl_->numAllocations.load(std::memory_order_relaxed);
+    }
+
+    double VirtualClock::GetCurrentTime() {
+        return (
+            GetInstructionCount() * impl_->secondsPerInstruction
+            + GetAllocationCount() * impl_->secondsPerAllocation
+        );
+    }
+
+}
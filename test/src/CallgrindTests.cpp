@@ -0,0 +1,81 @@
+/**
+ * @file CallgrindTests.cpp
+ *
+ * This module contains the unit tests of the function which exports
+ * a MoonClock::Report as a profile in the Callgrind format.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include <gtest/gtest.h>
+#include <MoonClock/Callgrind.hpp>
+#include <MoonClock/MoonClock.hpp>
+#include <string>
+#include <StringExtensions/StringExtensions.hpp>
+#include <vector>
+
+TEST(Callgrind_Tests, Format_Profile) {
+    MoonClock::Report report;
+    report.totalTime = 2.0;
+    report.numInstructions = 1000;
+    report.memory.numAllocations = 30;
+    report.memory.bytesAllocated = 3000;
+    auto& foo = report.functionInfo[{"foo"}];
+    foo.numCalls = 2;
+    foo.totalTime = 1.5;
+    foo.numInstructions = 800;
+    foo.numAllocations = 30;
+    foo.bytesAllocated = 3000;
+    auto& fooCallsBar = foo.calls[{"lib", "bar"}];
+    fooCallsBar.numCalls = 4;
+    fooCallsBar.totalTime = 0.5;
+    fooCallsBar.numInstructions = 300;
+    fooCallsBar.numAllocations = 10;
+    fooCallsBar.bytesAllocated = 1000;
+    auto& bar = report.functionInfo[{"lib", "bar"}];
+    bar.numCalls = 4;
+    bar.totalTime = 0.5;
+    bar.numInstructions = 300;
+    bar.numAllocations = 10;
+    bar.bytesAllocated = 1000;
+    (void)report.functionInfo[{"unused"}];
+    report.sources[{"foo"}].source = "script.lua";
+    report.sources[{"foo"}].lineDefined = 12;
+    report.sources[{"lib", "bar"}].source = "lib.lua";
+    report.sources[{"lib", "bar"}].lineDefined = 3;
+    const auto profile = MoonClock::FormatCallgrindProfile(report);
+    const auto lines = StringExtensions::Split(profile, '\n');
+    const std::vector< std::string > expectedLines{
+        "# callgrind format",
+        "version: 1",
+        "creator: MoonClock",
+        "positions: line",
+        "event: Time : Time (ns)",
+        "event: Ir : Lua Instructions",
+        "event: Allocs : Allocations",
+        "event: Bytes : Bytes Allocated",
+        "events: Time Ir Allocs Bytes",
+        "summary: 2000000000 1000 30 3000",
+        "",
+        "fl=(1) script.lua",
+        "fn=(1) foo",
+        "12 1000000000 500 20 2000",
+        "cfi=(2) lib.lua",
+        "cfn=(2) lib.bar",
+        "calls=4 3",
+        "12 500000000 300 10 1000",
+        "",
+        "fl=(2)",
+        "fn=(2)",
+        "3 500000000 300 10 1000",
+        "",
+    };
+    EXPECT_EQ(expectedLines, lines);
+}
+
+TEST(Callgrind_Tests, Unknown_Source) {
+    MoonClock::Report report;
+    report.functionInfo[{"foo"}].numCalls = 1;
+    const auto profile = MoonClock::FormatCallgrindProfile(report);
+    EXPECT_NE(std::string::npos, profile.find("\nfl=(1) ???\nfn=(1) foo\n0 0 0 0 0\n"));
+}
@@ -0,0 +1,57 @@
+/**
+ * @file DotTests.cpp
+ *
+ * This module contains the unit tests of the function which exports
+ * the call graph of a MoonClock::Report in the DOT language.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include "TestReport.hpp"
+
+#include <gtest/gtest.h>
+#include <MoonClock/Dot.hpp>
+#include <MoonClock/MoonClock.hpp>
+#include <string>
+
+TEST(Dot_Tests, Nodes_And_Edges) {
+    const auto report = MakeTestReport();
+    MoonClock::DotOptions options;
+    options.nodeThreshold = 0.0;
+    options.edgeThreshold = 0.0;
+    const auto graph = MoonClock::FormatDotGraph(report, options);
+    EXPECT_EQ(0, graph.find("digraph MoonClock {\n"));
+    EXPECT_NE(
+        std::string::npos,
+        graph.find("N4 [label=\"app.main\\nself 2500.000 ms (12.5%)\\ntotal 10000.000 ms (50.0%)\\n1 calls\"")
+    );
+    EXPECT_NE(std::string::npos, graph.find("N4 -> N2 [label=\"2 calls\\n6000.000 ms (30.0%)\", penwidth=2.50, weight=49];"));
+    EXPECT_NE(std::string::npos, graph.find("N4 -> N5 [label=\"3 calls\\n1500.000 ms (7.5%)\""));
+    EXPECT_NE(std::string::npos, graph.find("N2 -> N1 [label=\"2 calls\\n2000.000 ms (10.0%)\", penwidth=1.50, weight=39];"));
+
+    // The function with the most self time is filled with the darkest red.
+    EXPECT_NE(std::string::npos, graph.find("total 6000.000 ms (30.0%)\\n2 calls\", fontsize=32.0, fillcolor=\"#b20000\"];"));
+    EXPECT_EQ(std::string::npos, graph.find("not shown"));
+}
+
+TEST(Dot_Tests, Quoting) {
+    auto report = MakeTestReport();
+    auto& quoted = report.functionInfo[{"lib", "\"quoted\""}];
+    quoted.numCalls = 1;
+    quoted.totalTime = 1.0;
+    const auto graph = MoonClock::FormatDotGraph(report, MoonClock::DotOptions());
+    EXPECT_NE(std::string::npos, graph.find("[label=\"lib.\\\"quoted\\\"\\n"));
+}
+
+TEST(Dot_Tests, Pruning) {
+    const auto report = MakeTestReport();
+    MoonClock::DotOptions options;
+    options.nodeThreshold = 0.05;
+    options.edgeThreshold = 0.08;
+    const auto graph = MoonClock::FormatDotGraph(report, options);
+    EXPECT_EQ(std::string::npos, graph.find("\"app.dbx\\n"));
+    EXPECT_NE(std::string::npos, graph.find("N3 -> N2 ["));
+    EXPECT_EQ(std::string::npos, graph.find("N3 -> N4 ["));
+    EXPECT_EQ(std::string::npos, graph.find("N2 -> N4 ["));
+    EXPECT_NE(std::string::npos, graph.find("label=\"1 functions and 2 calls below thresholds not shown\";"));
+}
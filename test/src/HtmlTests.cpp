@@ -0,0 +1,112 @@
+/**
+ * @file HtmlTests.cpp
+ *
+ * This module contains the unit tests of the function which formats
+ * a MoonClock::Report as a self-contained, interactive HTML page.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include <gtest/gtest.h>
+#include <MoonClock/Html.hpp>
+#include <MoonClock/MoonClock.hpp>
+#include <string>
+
+namespace {
+
+    /**
+     * Return the report information embedded in the given page.
+     *
+     * @param[in] page
+     *     This is the page holding the report information.
+     *
+     * @return
+     *     The report information embedded in the page, as JSON,
+     *     is returned, or an empty string if it wasn't found.
+     */
+    std::string GetReportData(const std::string& page) {
+        const std::string start = "<script type=\"application/json\" id=\"report-data\">";
+        const auto dataStart = page.find(start);
+        if (dataStart == std::string::npos) {
+            return "";
+        }
+        const auto dataEnd = page.find("</script>", dataStart);
+        if (dataEnd == std::string::npos) {
+            return "";
+        }
+        return page.substr(dataStart + start.length(), dataEnd - dataStart - start.length());
+    }
+
+}
+
+TEST(Html_Tests, Title_Is_Escaped) {
+    MoonClock::Report report;
+    const auto page = MoonClock::FormatHtmlReport(report, "<Nightly> & \"More\"");
+    EXPECT_EQ(0, page.find("<!DOCTYPE html>"));
+    EXPECT_NE(
+        std::string::npos,
+        page.find("<title>&lt;Nightly&gt; &amp; &quot;More&quot;</title>")
+    );
+    EXPECT_NE(std::string::npos, page.find("</html>"));
+}
+
+TEST(Html_Tests, Report_Data) {
+    MoonClock::Report report;
+    report.totalTime = 2.0;
+    auto& foo = report.functionInfo[{"foo"}];
+    foo.numCalls = 2;
+    foo.minTime = 0.5;
+    foo.totalTime = 1.5;
+    foo.maxTime = 1.0;
+    foo.calls[{"lib", "</script>"}] = MoonClock::CallsInformation(4, 0.5);
+    foo.latencyHistogram.resize(MoonClock::NUM_LATENCY_HISTOGRAM_BUCKETS);
+    foo.latencyHistogram[19] = 1;
+    foo.latencyHistogram[20] = 1;
+    auto& bar = report.functionInfo[{"lib", "</script>"}];
+    bar.numCalls = 4;
+    bar.totalTime = 0.5;
+    (void)report.functionInfo[{"unused"}];
+    report.sources[{"foo"}].source = "script.lua";
+    report.sources[{"foo"}].lineDefined = 12;
+    const auto data = GetReportData(MoonClock::FormatHtmlReport(report));
+    EXPECT_EQ(
+        (
+            "{\"totalTime\":2,\"numInstructions\":0"
+            ",\"memory\":{\"tracked\":false,\"numAllocations\":0,\"bytesAllocated\":0,\"peakBytes\":0}"
+            ",\"histogramFirstLimit\":1e-06"
+            ",\"functions\":["
+            "{\"name\":\"foo\",\"source\":\"script.lua\",\"line\":12,\"calls\":2"
+            ",\"totalTime\":1.5,\"selfTime\":1,\"minTime\":0.5,\"maxTime\":1"
+            ",\"allocations\":0,\"bytes\":0,\"instructions\":0"
+            ",\"callees\":[[1,4,0.5]]"
+            ",\"histogram\":[0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,1,1,0,0,0,0,0,0,0,0,0,0,0]}"
+            ",{\"name\":\"lib.\\u003c/script\\u003e\",\"source\":\"\",\"line\":0,\"calls\":4"
+            ",\"totalTime\":0.5,\"selfTime\":0.5,\"minTime\":0,\"maxTime\":0"
+            ",\"allocations\":0,\"bytes\":0,\"instructions\":0"
+            ",\"callees\":[],\"histogram\":[]}"
+            "],\"tree\":[]}"
+        ),
+        data
+    );
+}
+
+TEST(Html_Tests, Call_Tree_Data) {
+    MoonClock::Report report;
+    report.functionInfo[{"foo"}].numCalls = 1;
+    report.functionInfo[{"bar"}].numCalls = 1;
+    report.callTree.resize(3);
+    report.callTree[0].children[{"foo"}] = 1;
+    report.callTree[1].path = {"foo"};
+    report.callTree[1].numCalls = 1;
+    report.callTree[1].totalTime = 0.75;
+    report.callTree[1].children[{"bar"}] = 2;
+    report.callTree[2].path = {"bar"};
+    report.callTree[2].parent = 1;
+    report.callTree[2].numCalls = 1;
+    report.callTree[2].totalTime = 0.25;
+    const auto data = GetReportData(MoonClock::FormatHtmlReport(report));
+    EXPECT_NE(
+        std::string::npos,
+        data.find(",\"tree\":[[0,0,0,0],[1,0,1,0.75],[0,1,1,0.25]]}")
+    );
+}
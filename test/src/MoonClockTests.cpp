@@ -7,14 +7,23 @@
  * © 2019 by Richard Walters
  */
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <gtest/gtest.h>
 #include <limits>
 #include <map>
 #include <MoonClock/MoonClock.hpp>
+#include <MoonClock/SharedStatistics.hpp>
+#include <mutex>
 #include <set>
 #include <string>
 #include <StringExtensions/StringExtensions.hpp>
 #include <Timekeeping/Clock.hpp>
+#include <tuple>
+#ifndef _WIN32
+#include <unistd.h>
+#endif /* not _WIN32 */
 #include <vector>
 
 extern "C" {
@@ -183,6 +192,30 @@ namespace {
         }
     };
 
+    struct SharedMockClock : public Timekeeping::Clock {
+        // Properties
+
+        std::atomic< double > time_{0.0};
+
+        // Methods
+
+        // Timekeeping::Clock
+        virtual double GetCurrentTime() override {
+            return time_;
+        }
+    };
+
+    struct SteadyClock : public Timekeeping::Clock {
+        // Methods
+
+        // Timekeeping::Clock
+        virtual double GetCurrentTime() override {
+            return std::chrono::duration< double >(
+                std::chrono::steady_clock::now().time_since_epoch()
+            ).count();
+        }
+    };
+
 }
 
 /**
@@ -584,6 +617,12 @@ TEST_F(Moon_Clock_Tests, Default_Instruments) {
         report.functionInfo
     );
     EXPECT_NEAR(1.2, report.totalTime, std::numeric_limits< decltype(report.totalTime) >::epsilon() * 2);
+    EXPECT_EQ(
+        (std::map< MoonClock::Path, std::map< MoonClock::Path, MoonClock::CallsInformation > >({
+            {{"bar"}, {{{"foo"}, {2, 0.15}}}},
+        })),
+        report.callers
+    );
 }
 
 TEST_F(Moon_Clock_Tests, Default_Instruments_Second_Run) {
@@ -833,3 +872,1599 @@ TEST_F(Moon_Clock_Tests, Instrument_Function_Found_In_Userdata) {
         lines
     );
 }
+
+TEST_F(Moon_Clock_Tests, Slow_Call_Capture) {
+    // Simulated test case:
+    // * We have two functions, "foo" and "bar".
+    // * "foo" calls "bar" twice.
+    // * Calls to "foo" are slow if they take more than 0.5.
+    // * Calls to "bar" are slow if they take more than 0.075.
+    //
+    // time   call             total time
+    //  1.0   -> foo
+    //  1.2            -> bar
+    //  1.3            <- bar  0.1 (slow)
+    //  1.45           -> bar
+    //  1.5            <- bar  0.05
+    //  1.6   <- foo           0.6 (slow)
+    MoonClock::MoonClock moonClock;
+    std::shared_ptr< lua_State > sharedLua(
+        lua,
+        [](lua_State*){}
+    );
+    const auto mockClock = std::make_shared< MockClock >();
+    moonClock.SetClock(mockClock);
+    MoonClock::SlowCallOptions slowCallOptions;
+    slowCallOptions.threshold = 0.5;
+    slowCallOptions.thresholds[{"bar"}] = 0.075;
+    slowCallOptions.captureArguments = true;
+    moonClock.SetSlowCallOptions(slowCallOptions);
+    moonClock.StartInstrumentation(sharedLua);
+    const auto context = moonClock.GetDefaultContext();
+    mockClock->time_ = 1.0;
+    MoonClock::MoonClock::DefaultBeforeInstrument(lua, context, {"foo"});
+    lua_pushinteger(lua, 42);
+    lua_pushstring(lua, "hello");
+    mockClock->time_ = 1.2;
+    MoonClock::MoonClock::DefaultBeforeInstrument(lua, context, {"bar"});
+    lua_settop(lua, 0);
+    mockClock->time_ = 1.3;
+    MoonClock::MoonClock::DefaultAfterInstrument(lua, context, {"bar"});
+    mockClock->time_ = 1.45;
+    MoonClock::MoonClock::DefaultBeforeInstrument(lua, context, {"bar"});
+    mockClock->time_ = 1.5;
+    MoonClock::MoonClock::DefaultAfterInstrument(lua, context, {"bar"});
+    mockClock->time_ = 1.6;
+    MoonClock::MoonClock::DefaultAfterInstrument(lua, context, {"foo"});
+    moonClock.StopInstrumentation();
+    const auto report = moonClock.GenerateReport();
+    ASSERT_EQ(2, report.slowCalls.size());
+    EXPECT_EQ(MoonClock::Path({"bar"}), report.slowCalls[0].path);
+    EXPECT_EQ(
+        std::vector< MoonClock::Path >({{"foo"}, {"bar"}}),
+        report.slowCalls[0].callStack
+    );
+    EXPECT_NEAR(1.3, report.slowCalls[0].timestamp, std::numeric_limits< double >::epsilon() * 2);
+    EXPECT_NEAR(0.1, report.slowCalls[0].totalTime, std::numeric_limits< double >::epsilon() * 2);
+    EXPECT_EQ(
+        std::vector< std::string >({"42", "\"hello\""}),
+        report.slowCalls[0].arguments
+    );
+    EXPECT_EQ(MoonClock::Path({"foo"}), report.slowCalls[1].path);
+    EXPECT_EQ(
+        std::vector< MoonClock::Path >({{"foo"}}),
+        report.slowCalls[1].callStack
+    );
+    EXPECT_NEAR(0.6, report.slowCalls[1].totalTime, std::numeric_limits< double >::epsilon() * 2);
+    EXPECT_EQ(0, report.numSlowCallsDropped);
+}
+
+TEST_F(Moon_Clock_Tests, Slow_Call_Capture_Traceback) {
+    const auto advance = [](lua_State* lua){
+        auto mockClock = (MockClock*)lua_touserdata(lua, lua_upvalueindex(1));
+        mockClock->time_ += lua_tonumber(lua, 1);
+        return 0;
+    };
+    ASSERT_EQ(
+        LUA_OK,
+        luaL_dostring(
+            lua,
+            "function foo()\n"
+            "    advance(1)\n"
+            "end\n"
+        )
+    );
+    for (const auto captureTraceback: {false, true}) {
+        MoonClock::MoonClock moonClock;
+        std::shared_ptr< lua_State > sharedLua(
+            lua,
+            [](lua_State*){}
+        );
+        const auto mockClock = std::make_shared< MockClock >();
+        moonClock.SetClock(mockClock);
+        MoonClock::SlowCallOptions slowCallOptions;
+        slowCallOptions.threshold = 0.5;
+        slowCallOptions.captureTraceback = captureTraceback;
+        moonClock.SetSlowCallOptions(slowCallOptions);
+        moonClock.StartInstrumentation(sharedLua);
+        lua_pushlightuserdata(lua, mockClock.get());
+        lua_pushcclosure(lua, advance, 1);
+        lua_setglobal(lua, "advance");
+        ASSERT_EQ(LUA_OK, luaL_dostring(lua, "foo()"));
+        moonClock.StopInstrumentation();
+        lua_pushnil(lua);
+        lua_setglobal(lua, "advance");
+        const auto report = moonClock.GenerateReport();
+        ASSERT_EQ(1, report.slowCalls.size());
+        EXPECT_EQ(MoonClock::Path({"foo"}), report.slowCalls[0].path);
+        if (captureTraceback) {
+            EXPECT_EQ(0, report.slowCalls[0].traceback.find("stack traceback:"));
+            EXPECT_NE(
+                std::string::npos,
+                report.slowCalls[0].traceback.find("[string \"foo()\"]:1: in main chunk")
+            );
+        } else {
+            EXPECT_TRUE(report.slowCalls[0].traceback.empty());
+        }
+    }
+}
+
+TEST_F(Moon_Clock_Tests, Slow_Call_Capture_Bounded) {
+    MoonClock::MoonClock moonClock;
+    std::shared_ptr< lua_State > sharedLua(
+        lua,
+        [](lua_State*){}
+    );
+    const auto mockClock = std::make_shared< MockClock >();
+    moonClock.SetClock(mockClock);
+    MoonClock::SlowCallOptions slowCallOptions;
+    slowCallOptions.threshold = 0.0;
+    slowCallOptions.capacity = 2;
+    moonClock.SetSlowCallOptions(slowCallOptions);
+    moonClock.StartInstrumentation(sharedLua);
+    const auto context = moonClock.GetDefaultContext();
+    for (size_t i = 0; i < 5; ++i) {
+        MoonClock::MoonClock::DefaultBeforeInstrument(lua, context, {"foo"});
+        mockClock->time_ += (double)(i + 1);
+        MoonClock::MoonClock::DefaultAfterInstrument(lua, context, {"foo"});
+    }
+    moonClock.StopInstrumentation();
+    const auto report = moonClock.GenerateReport();
+    ASSERT_EQ(2, report.slowCalls.size());
+    EXPECT_EQ(4.0, report.slowCalls[0].totalTime);
+    EXPECT_EQ(5.0, report.slowCalls[1].totalTime);
+    EXPECT_EQ(3, report.numSlowCallsDropped);
+}
+
+TEST_F(Moon_Clock_Tests, Path_Matches_Pattern) {
+    EXPECT_TRUE(MoonClock::PathMatchesPattern({"api", "get"}, "api.get"));
+    EXPECT_FALSE(MoonClock::PathMatchesPattern({"api", "put"}, "api.get"));
+    EXPECT_TRUE(MoonClock::PathMatchesPattern({"api", "get"}, "api.*"));
+    EXPECT_TRUE(MoonClock::PathMatchesPattern({"api", "db", "query"}, "api.*"));
+    EXPECT_FALSE(MoonClock::PathMatchesPattern({"api"}, "api.*"));
+    EXPECT_TRUE(MoonClock::PathMatchesPattern({"api", "db", "query"}, "*.db.query"));
+    EXPECT_FALSE(MoonClock::PathMatchesPattern({"api", "db", "query"}, "*.query"));
+    EXPECT_FALSE(MoonClock::PathMatchesPattern({"api", "get"}, "api"));
+}
+
+TEST_F(Moon_Clock_Tests, Latency_Budgets) {
+    MoonClock::MoonClock moonClock;
+    std::shared_ptr< lua_State > sharedLua(
+        lua,
+        [](lua_State*){}
+    );
+    const auto mockClock = std::make_shared< MockClock >();
+    moonClock.SetClock(mockClock);
+    std::vector< std::string > violations;
+    MoonClock::LatencyBudget latencyBudget;
+    latencyBudget.pattern = "api.*";
+    latencyBudget.budget = 0.2;
+    latencyBudget.objective = 0.5;
+    latencyBudget.window = 1.0;
+    latencyBudget.onViolation = [&violations](
+        const MoonClock::Path& path,
+        double totalTime,
+        const std::string& pattern,
+        double budget
+    ) {
+        violations.push_back(
+            StringExtensions::Join(path, ".")
+            + " > "
+            + pattern
+        );
+    };
+    moonClock.AddLatencyBudget(latencyBudget);
+    mockClock->time_ = 0.0;
+    moonClock.StartInstrumentation(sharedLua);
+    const auto context = moonClock.GetDefaultContext();
+    const auto call = [this, context, &mockClock](const MoonClock::Path& path, double duration) {
+        MoonClock::MoonClock::DefaultBeforeInstrument(lua, context, path);
+        mockClock->time_ += duration;
+        MoonClock::MoonClock::DefaultAfterInstrument(lua, context, path);
+    };
+    call({"api", "get"}, 0.1);
+    call({"api", "put"}, 0.3);
+    call({"other"}, 0.45);
+    call({"api", "get"}, 0.1);
+    call({"api", "db", "query"}, 0.4);
+    call({"api", "db", "query"}, 0.4);
+    moonClock.StopInstrumentation();
+    const auto report = moonClock.GenerateReport();
+    EXPECT_EQ(
+        std::vector< std::string >({
+            "api.put > api.*",
+            "api.db.query > api.*",
+            "api.db.query > api.*",
+        }),
+        violations
+    );
+    ASSERT_EQ(1, report.latencyBudgets.size());
+    const auto& latencyBudgetInfo = report.latencyBudgets[0];
+    EXPECT_EQ("api.*", latencyBudgetInfo.pattern);
+    EXPECT_EQ(5, latencyBudgetInfo.numCalls);
+    EXPECT_EQ(3, latencyBudgetInfo.numViolations);
+    ASSERT_EQ(2, latencyBudgetInfo.windows.size());
+    EXPECT_EQ(0.0, latencyBudgetInfo.windows[0].start);
+    EXPECT_EQ(3, latencyBudgetInfo.windows[0].numCalls);
+    EXPECT_EQ(1, latencyBudgetInfo.windows[0].numViolations);
+    EXPECT_NEAR(2.0 / 3.0, latencyBudgetInfo.windows[0].burnRate, 0.0001);
+    EXPECT_EQ(1.0, latencyBudgetInfo.windows[1].start);
+    EXPECT_EQ(2, latencyBudgetInfo.windows[1].numCalls);
+    EXPECT_EQ(2, latencyBudgetInfo.windows[1].numViolations);
+    EXPECT_NEAR(2.0, latencyBudgetInfo.windows[1].burnRate, 0.0001);
+}
+
+TEST_F(Moon_Clock_Tests, Latency_Budgets_Changed_While_Instrumenting) {
+    MoonClock::MoonClock moonClock;
+    std::shared_ptr< lua_State > sharedLua(
+        lua,
+        [](lua_State*){}
+    );
+    const auto mockClock = std::make_shared< MockClock >();
+    moonClock.SetClock(mockClock);
+    mockClock->time_ = 0.0;
+    moonClock.StartInstrumentation(sharedLua);
+    const auto context = moonClock.GetDefaultContext();
+    const auto call = [this, context, &mockClock](const MoonClock::Path& path, double duration) {
+        MoonClock::MoonClock::DefaultBeforeInstrument(lua, context, path);
+        mockClock->time_ += duration;
+        MoonClock::MoonClock::DefaultAfterInstrument(lua, context, path);
+    };
+    call({"api", "get"}, 0.3);
+    MoonClock::LatencyBudget latencyBudget;
+    latencyBudget.pattern = "api.*";
+    latencyBudget.budget = 0.2;
+    moonClock.AddLatencyBudget(latencyBudget);
+    call({"api", "get"}, 0.3);
+    call({"api", "get"}, 0.1);
+    moonClock.ClearLatencyBudgets();
+    latencyBudget.pattern = "other";
+    moonClock.AddLatencyBudget(latencyBudget);
+    call({"api", "get"}, 0.3);
+    call({"other"}, 0.3);
+    moonClock.StopInstrumentation();
+    const auto report = moonClock.GenerateReport();
+    ASSERT_EQ(1, report.latencyBudgets.size());
+    const auto& latencyBudgetInfo = report.latencyBudgets[0];
+    EXPECT_EQ("other", latencyBudgetInfo.pattern);
+    EXPECT_EQ(1, latencyBudgetInfo.numCalls);
+    EXPECT_EQ(1, latencyBudgetInfo.numViolations);
+    ASSERT_EQ(1, latencyBudgetInfo.windows.size());
+    EXPECT_NEAR(0.7, latencyBudgetInfo.windows[0].start, 0.0001);
+}
+
+TEST_F(Moon_Clock_Tests, Latency_Budgets_Of_Instrumented_Functions) {
+    MoonClock::MoonClock moonClock;
+    std::shared_ptr< lua_State > sharedLua(
+        lua,
+        [](lua_State*){}
+    );
+    lua_newtable(lua); // -1 = api
+    lua_pushcfunction(lua, [](lua_State* lua){ return 0; }); // -1 = get, -2 = api
+    lua_setfield(lua, -2, "get"); // -1 = api
+    lua_pushcfunction(lua, [](lua_State* lua){ return 0; }); // -1 = put, -2 = api
+    lua_setfield(lua, -2, "put"); // -1 = api
+    lua_setglobal(lua, "api"); // (stack empty)
+    const auto mockClock = std::make_shared< MockClock >();
+    moonClock.SetClock(mockClock);
+    MoonClock::LatencyBudget latencyBudget;
+    latencyBudget.pattern = "api.*";
+    moonClock.AddLatencyBudget(latencyBudget);
+    moonClock.StartInstrumentation(sharedLua);
+    ASSERT_EQ(LUA_OK, luaL_dostring(lua, "api.get() api.put()"));
+    latencyBudget.pattern = "api.get";
+    moonClock.AddLatencyBudget(latencyBudget);
+    ASSERT_EQ(LUA_OK, luaL_dostring(lua, "api.get() api.put() tostring(1)"));
+    moonClock.StopInstrumentation();
+    const auto report = moonClock.GenerateReport();
+    ASSERT_EQ(2, report.latencyBudgets.size());
+    EXPECT_EQ(4, report.latencyBudgets[0].numCalls);
+    EXPECT_EQ(1, report.latencyBudgets[1].numCalls);
+}
+
+TEST_F(Moon_Clock_Tests, Stall_Detector_Reports_Stalled_Call) {
+    MoonClock::MoonClock moonClock;
+    std::shared_ptr< lua_State > sharedLua(
+        lua,
+        [](lua_State*){}
+    );
+    const auto mockClock = std::make_shared< SharedMockClock >();
+    moonClock.SetClock(mockClock);
+    std::mutex mutex;
+    std::condition_variable stallDetected;
+    std::vector< MoonClock::Path > stalledPaths;
+    MoonClock::StallDetectorOptions stallDetectorOptions;
+    stallDetectorOptions.threshold = 1.0;
+    stallDetectorOptions.pollInterval = 0.001;
+    stallDetectorOptions.onStall = [&](const MoonClock::StallInformation& stall) {
+        std::lock_guard< decltype(mutex) > lock(mutex);
+        stalledPaths.push_back(stall.path);
+        stallDetected.notify_all();
+    };
+    moonClock.SetStallDetectorOptions(stallDetectorOptions);
+    moonClock.StartInstrumentation(sharedLua);
+    const auto context = moonClock.GetDefaultContext();
+    mockClock->time_ = 1.0;
+    MoonClock::MoonClock::DefaultBeforeInstrument(lua, context, {"foo"});
+    mockClock->time_ = 1.5;
+    MoonClock::MoonClock::DefaultBeforeInstrument(lua, context, {"bar"});
+    mockClock->time_ = 3.0;
+    {
+        std::unique_lock< decltype(mutex) > lock(mutex);
+        EXPECT_TRUE(
+            stallDetected.wait_for(
+                lock,
+                std::chrono::seconds(1),
+                [&stalledPaths]{ return !stalledPaths.empty(); }
+            )
+        );
+    }
+    MoonClock::MoonClock::DefaultAfterInstrument(lua, context, {"bar"});
+    MoonClock::MoonClock::DefaultAfterInstrument(lua, context, {"foo"});
+    moonClock.StopInstrumentation();
+    const auto report = moonClock.GenerateReport();
+    ASSERT_EQ(1, report.stalls.size());
+    EXPECT_EQ(MoonClock::Path({"bar"}), report.stalls[0].path);
+    EXPECT_EQ(
+        std::vector< MoonClock::Path >({{"foo"}, {"bar"}}),
+        report.stalls[0].callStack
+    );
+    EXPECT_EQ(1.5, report.stalls[0].start);
+    EXPECT_EQ(3.0, report.stalls[0].detected);
+    EXPECT_FALSE(report.stalls[0].aborted);
+    EXPECT_EQ(
+        std::vector< MoonClock::Path >({{"bar"}}),
+        stalledPaths
+    );
+}
+
+TEST_F(Moon_Clock_Tests, Stall_Detector_Aborts_Stalled_Call) {
+    MoonClock::MoonClock moonClock;
+    std::shared_ptr< lua_State > sharedLua(
+        lua,
+        [](lua_State*){}
+    );
+    moonClock.SetClock(std::make_shared< SteadyClock >());
+    MoonClock::StallDetectorOptions stallDetectorOptions;
+    stallDetectorOptions.threshold = 0.05;
+    stallDetectorOptions.pollInterval = 0.01;
+    stallDetectorOptions.abort = true;
+    moonClock.SetStallDetectorOptions(stallDetectorOptions);
+    ASSERT_EQ(LUA_OK, luaL_dostring(lua, "function spin() while true do end end"));
+    moonClock.StartInstrumentation(sharedLua);
+    lua_getglobal(lua, "spin");
+    ASSERT_EQ(LUA_ERRRUN, lua_pcall(lua, 0, 0, 0));
+    EXPECT_NE(std::string::npos, std::string(lua_tostring(lua, -1)).find("stall"));
+    lua_pop(lua, 1);
+    moonClock.StopInstrumentation();
+    const auto report = moonClock.GenerateReport();
+    ASSERT_EQ(1, report.stalls.size());
+    EXPECT_EQ(MoonClock::Path({"spin"}), report.stalls[0].path);
+    EXPECT_TRUE(report.stalls[0].aborted);
+}
+
+TEST_F(Moon_Clock_Tests, Stall_Detector_Abort_Keeps_Counting_Instructions) {
+    MoonClock::MoonClock moonClock;
+    std::shared_ptr< lua_State > sharedLua(
+        lua,
+        [](lua_State*){}
+    );
+    moonClock.SetClock(std::make_shared< SteadyClock >());
+    moonClock.SetInstructionCounting(10);
+    MoonClock::StallDetectorOptions stallDetectorOptions;
+    stallDetectorOptions.threshold = 0.05;
+    stallDetectorOptions.pollInterval = 0.01;
+    stallDetectorOptions.abort = true;
+    moonClock.SetStallDetectorOptions(stallDetectorOptions);
+    ASSERT_EQ(LUA_OK, luaL_dostring(lua, "function spin() while true do end end"));
+    moonClock.StartInstrumentation(sharedLua);
+    lua_getglobal(lua, "spin");
+    ASSERT_EQ(LUA_ERRRUN, lua_pcall(lua, 0, 0, 0));
+    lua_pop(lua, 1);
+    const auto numInstructionsAfterAbort = moonClock.GenerateReport().numInstructions;
+    ASSERT_EQ(LUA_OK, luaL_dostring(lua, "local n = 0 for i = 1, 1000 do n = n + i end"));
+    moonClock.StopInstrumentation();
+    const auto report = moonClock.GenerateReport();
+    ASSERT_EQ(1, report.stalls.size());
+    EXPECT_TRUE(report.stalls[0].aborted);
+    EXPECT_GT(report.numInstructions, numInstructionsAfterAbort + 1000);
+}
+
+TEST_F(Moon_Clock_Tests, Stall_Detector_Does_Not_Abort_Returned_Call) {
+    MoonClock::MoonClock moonClock;
+    std::shared_ptr< lua_State > sharedLua(
+        lua,
+        [](lua_State*){}
+    );
+    const auto mockClock = std::make_shared< SharedMockClock >();
+    moonClock.SetClock(mockClock);
+    std::mutex mutex;
+    std::condition_variable stallDetected;
+    bool detected = false;
+    MoonClock::StallDetectorOptions stallDetectorOptions;
+    stallDetectorOptions.threshold = 1.0;
+    stallDetectorOptions.pollInterval = 0.001;
+    stallDetectorOptions.abort = true;
+    stallDetectorOptions.onStall = [&](const MoonClock::StallInformation& stall) {
+        std::lock_guard< decltype(mutex) > lock(mutex);
+        detected = true;
+        stallDetected.notify_all();
+    };
+    moonClock.SetStallDetectorOptions(stallDetectorOptions);
+    moonClock.StartInstrumentation(sharedLua);
+    const auto context = moonClock.GetDefaultContext();
+    mockClock->time_ = 1.0;
+    MoonClock::MoonClock::DefaultBeforeInstrument(lua, context, {"foo"});
+    mockClock->time_ = 3.0;
+    {
+        std::unique_lock< decltype(mutex) > lock(mutex);
+        ASSERT_TRUE(
+            stallDetected.wait_for(
+                lock,
+                std::chrono::seconds(1),
+                [&detected]{ return detected; }
+            )
+        );
+    }
+
+    // The stalled call returns before any Lua code runs the abort hook,
+    // so the next Lua code run isn't aborted, and the hook goes away.
+    MoonClock::MoonClock::DefaultAfterInstrument(lua, context, {"foo"});
+    EXPECT_EQ(LUA_OK, luaL_dostring(lua, "local x = 1"));
+    EXPECT_TRUE(lua_gethook(lua) == NULL);
+    moonClock.StopInstrumentation();
+}
+
+TEST_F(Moon_Clock_Tests, Stall_Detector_Does_Not_Abort_Coroutine_Call) {
+    MoonClock::MoonClock moonClock;
+    std::shared_ptr< lua_State > sharedLua(
+        lua,
+        [](lua_State*){}
+    );
+    const auto mockClock = std::make_shared< SharedMockClock >();
+    moonClock.SetClock(mockClock);
+    std::mutex mutex;
+    std::condition_variable stallDetected;
+    bool detected = false;
+    MoonClock::StallDetectorOptions stallDetectorOptions;
+    stallDetectorOptions.threshold = 1.0;
+    stallDetectorOptions.pollInterval = 0.001;
+    stallDetectorOptions.abort = true;
+    stallDetectorOptions.onStall = [&](const MoonClock::StallInformation& stall) {
+        std::lock_guard< decltype(mutex) > lock(mutex);
+        detected = true;
+        stallDetected.notify_all();
+    };
+    moonClock.SetStallDetectorOptions(stallDetectorOptions);
+    moonClock.StartInstrumentation(sharedLua);
+    const auto coroutine = lua_newthread(lua); // -1 = coroutine
+    const auto context = moonClock.GetDefaultContext();
+    mockClock->time_ = 1.0;
+    MoonClock::MoonClock::DefaultBeforeInstrument(coroutine, context, {"foo"});
+    mockClock->time_ = 3.0;
+    {
+        std::unique_lock< decltype(mutex) > lock(mutex);
+        ASSERT_TRUE(
+            stallDetected.wait_for(
+                lock,
+                std::chrono::seconds(1),
+                [&detected]{ return detected; }
+            )
+        );
+    }
+
+    // No hook is set on either thread for a call made by a coroutine.
+    EXPECT_TRUE(lua_gethook(lua) == NULL);
+    EXPECT_TRUE(lua_gethook(coroutine) == NULL);
+    MoonClock::MoonClock::DefaultAfterInstrument(coroutine, context, {"foo"});
+    lua_pop(lua, 1); // (stack empty)
+    moonClock.StopInstrumentation();
+    const auto report = moonClock.GenerateReport();
+    ASSERT_EQ(1, report.stalls.size());
+    EXPECT_FALSE(report.stalls[0].aborted);
+}
+
+TEST_F(Moon_Clock_Tests, Stall_Detector_Stop_Restores_Replaced_Hook) {
+    MoonClock::MoonClock moonClock;
+    std::shared_ptr< lua_State > sharedLua(
+        lua,
+        [](lua_State*){}
+    );
+    const auto mockClock = std::make_shared< SharedMockClock >();
+    moonClock.SetClock(mockClock);
+    std::mutex mutex;
+    std::condition_variable stallDetected;
+    bool detected = false;
+    MoonClock::StallDetectorOptions stallDetectorOptions;
+    stallDetectorOptions.threshold = 1.0;
+    stallDetectorOptions.pollInterval = 0.001;
+    stallDetectorOptions.abort = true;
+    stallDetectorOptions.onStall = [&](const MoonClock::StallInformation& stall) {
+        std::lock_guard< decltype(mutex) > lock(mutex);
+        detected = true;
+        stallDetected.notify_all();
+    };
+    moonClock.SetStallDetectorOptions(stallDetectorOptions);
+    const auto UserHook = [](lua_State* lua, lua_Debug* ar){};
+    lua_sethook(lua, UserHook, LUA_MASKCOUNT, 1000);
+    moonClock.StartInstrumentation(sharedLua);
+    const auto context = moonClock.GetDefaultContext();
+    mockClock->time_ = 1.0;
+    MoonClock::MoonClock::DefaultBeforeInstrument(lua, context, {"foo"});
+    mockClock->time_ = 3.0;
+    {
+        std::unique_lock< decltype(mutex) > lock(mutex);
+        ASSERT_TRUE(
+            stallDetected.wait_for(
+                lock,
+                std::chrono::seconds(1),
+                [&detected]{ return detected; }
+            )
+        );
+    }
+
+    // The abort never happens, since no Lua code runs before the
+    // stall detector is stopped, so the hook it replaced is set back.
+    MoonClock::MoonClock::DefaultAfterInstrument(lua, context, {"foo"});
+    moonClock.StopInstrumentation();
+    EXPECT_TRUE(lua_gethook(lua) == (lua_Hook)UserHook);
+    EXPECT_EQ(LUA_MASKCOUNT, lua_gethookmask(lua));
+    EXPECT_EQ(1000, lua_gethookcount(lua));
+    lua_sethook(lua, NULL, 0, 0);
+}
+
+TEST_F(Moon_Clock_Tests, Counting_Instruments) {
+    MoonClock::MoonClock moonClock;
+    std::shared_ptr< lua_State > sharedLua(
+        lua,
+        [](lua_State*){}
+    );
+    moonClock.StartInstrumentation(
+        sharedLua,
+        MoonClock::MoonClock::CountingBeforeInstrument,
+        MoonClock::MoonClock::CountingAfterInstrument
+    );
+    const auto context = moonClock.GetDefaultContext();
+    MoonClock::MoonClock::CountingBeforeInstrument(lua, context, {"foo"});
+    MoonClock::MoonClock::CountingBeforeInstrument(lua, context, {"bar"});
+    MoonClock::MoonClock::CountingAfterInstrument(lua, context, {"bar"});
+    MoonClock::MoonClock::CountingBeforeInstrument(lua, context, {"bar"});
+    MoonClock::MoonClock::CountingAfterInstrument(lua, context, {"bar"});
+    MoonClock::MoonClock::CountingAfterInstrument(lua, context, {"foo"});
+    MoonClock::MoonClock::CountingBeforeInstrument(lua, context, {"bar"});
+    MoonClock::MoonClock::CountingAfterInstrument(lua, context, {"bar"});
+    moonClock.StopInstrumentation();
+    const auto report = moonClock.GenerateReport();
+    const auto noTime = std::numeric_limits< double >::max();
+    EXPECT_EQ(
+        (std::map< MoonClock::Path, MoonClock::FunctionInformation >({
+            {{"foo"}, {1, noTime, 0.0, 0.0, {{{"bar"}, {2, 0.0}}}}},
+            {{"bar"}, {3, noTime, 0.0, 0.0, {}}},
+        })),
+        report.functionInfo
+    );
+}
+
+TEST_F(Moon_Clock_Tests, Wrapper_Held_After_Stop_Calls_Original_Only) {
+    MoonClock::MoonClock moonClock;
+    std::shared_ptr< lua_State > sharedLua(
+        lua,
+        [](lua_State*){}
+    );
+    lua_pushcfunction(lua, [](lua_State* lua){
+        lua_pushinteger(lua, lua_tointeger(lua, -1) * 2);
+        return 1;
+    });
+    lua_setglobal(lua, "foo");
+    std::vector< std::string > lines;
+    const auto before = [](lua_State* lua, void* context, const MoonClock::Path& path) {
+        auto& lines = *(std::vector< std::string >*)context;
+        lines.push_back(
+            std::string("before: ")
+            + StringExtensions::Join(path, ".")
+        );
+    };
+    const auto after = [](lua_State* lua, void* context, const MoonClock::Path& path) {
+        auto& lines = *(std::vector< std::string >*)context;
+        lines.push_back(
+            std::string("after: ")
+            + StringExtensions::Join(path, ".")
+        );
+    };
+    moonClock.StartInstrumentation(sharedLua, before, after, &lines);
+    lua_getglobal(lua, "foo"); // -1 = wrapper
+    moonClock.StopInstrumentation();
+    lua_pushvalue(lua, -1); // -1 = wrapper, -2 = wrapper
+    lua_pushinteger(lua, 21); // -1 = 21, -2 = wrapper, -3 = wrapper
+    lua_call(lua, 1, 1); // -1 = 42, -2 = wrapper
+    EXPECT_EQ(42, lua_tointeger(lua, -1));
+    lua_pop(lua, 1); // -1 = wrapper
+    lua_getglobal(lua, "foo"); // -1 = foo, -2 = wrapper
+    EXPECT_EQ(0, lua_rawequal(lua, -1, -2));
+    lua_pop(lua, 2); // (stack empty)
+    EXPECT_TRUE(lines.empty());
+}
+
+TEST_F(Moon_Clock_Tests, Rescan) {
+    MoonClock::MoonClock moonClock;
+    std::shared_ptr< lua_State > sharedLua(
+        lua,
+        [](lua_State*){}
+    );
+    const auto Double = [](lua_State* lua){
+        lua_pushinteger(lua, lua_tointeger(lua, -1) * 2);
+        return 1;
+    };
+    const auto Triple = [](lua_State* lua){
+        lua_pushinteger(lua, lua_tointeger(lua, -1) * 3);
+        return 1;
+    };
+    lua_pushcfunction(lua, Double);
+    lua_setglobal(lua, "foo");
+    lua_newtable(lua);
+    lua_pushcfunction(lua, Double);
+    lua_setfield(lua, -2, "bar");
+    lua_setglobal(lua, "spam");
+    std::vector< std::string > lines;
+    const auto before = [](lua_State* lua, void* context, const MoonClock::Path& path) {
+        auto& lines = *(std::vector< std::string >*)context;
+        lines.push_back(
+            std::string("before: ")
+            + StringExtensions::Join(path, ".")
+        );
+    };
+    const auto after = [](lua_State* lua, void* context, const MoonClock::Path& path) {
+        auto& lines = *(std::vector< std::string >*)context;
+        lines.push_back(
+            std::string("after: ")
+            + StringExtensions::Join(path, ".")
+        );
+    };
+    moonClock.StartInstrumentation(sharedLua, before, after, &lines);
+
+    // Add a new function "baz", replace "foo", and remove "spam",
+    // holding onto it to check that its instrumentation is removed.
+    lua_pushcfunction(lua, Triple);
+    lua_setglobal(lua, "baz");
+    lua_pushcfunction(lua, Triple);
+    lua_setglobal(lua, "foo");
+    lua_getglobal(lua, "spam"); // -1 = spam
+    lua_pushnil(lua); // -1 = nil, -2 = spam
+    lua_setglobal(lua, "spam"); // -1 = spam
+    moonClock.Rescan();
+    for (const auto name: {"foo", "baz"}) {
+        lua_getglobal(lua, name); // -1 = fn, -2 = spam
+        lua_pushinteger(lua, 2); // -1 = 2, -2 = fn, -3 = spam
+        lua_call(lua, 1, 1); // -1 = 6, -2 = spam
+        EXPECT_EQ(6, lua_tointeger(lua, -1));
+        lua_pop(lua, 1); // -1 = spam
+    }
+    lua_getfield(lua, -1, "bar"); // -1 = spam.bar, -2 = spam
+    lua_pushinteger(lua, 2); // -1 = 2, -2 = spam.bar, -3 = spam
+    lua_call(lua, 1, 1); // -1 = 4, -2 = spam
+    EXPECT_EQ(4, lua_tointeger(lua, -1));
+    lua_pop(lua, 2); // (stack empty)
+    moonClock.StopInstrumentation();
+    EXPECT_EQ(
+        std::vector< std::string >({
+            "before: foo",
+            "after: foo",
+            "before: baz",
+            "after: baz",
+        }),
+        lines
+    );
+}
+
+TEST_F(Moon_Clock_Tests, Rescan_Finishes_Calls_In_Progress_Through_Removed_Wrappers) {
+    MoonClock::MoonClock moonClock;
+    std::shared_ptr< lua_State > sharedLua(
+        lua,
+        [](lua_State*){}
+    );
+    ASSERT_EQ(
+        LUA_OK,
+        luaL_dostring(
+            lua,
+            "function foo()\n"
+            "    coroutine.yield()\n"
+            "end\n"
+        )
+    );
+    std::vector< std::string > lines;
+    const auto before = [](lua_State* lua, void* context, const MoonClock::Path& path) {
+        auto& lines = *(std::vector< std::string >*)context;
+        lines.push_back(
+            std::string("before: ")
+            + StringExtensions::Join(path, ".")
+        );
+    };
+    const auto after = [](lua_State* lua, void* context, const MoonClock::Path& path) {
+        auto& lines = *(std::vector< std::string >*)context;
+        lines.push_back(
+            std::string("after: ")
+            + StringExtensions::Join(path, ".")
+        );
+    };
+    moonClock.StartInstrumentation(sharedLua, before, after, &lines);
+
+    // Suspend a coroutine in the middle of a call to "foo", then replace
+    // "foo" and rescan, which removes the wrapper of the old "foo".
+    const auto coroutine = lua_newthread(lua); // -1 = coroutine
+    lua_getglobal(coroutine, "foo");
+    ASSERT_EQ(LUA_YIELD, lua_resume(coroutine, lua, 0));
+    ASSERT_EQ(LUA_OK, luaL_dostring(lua, "function foo() end"));
+    moonClock.Rescan();
+
+    // The call to the old "foo" should still be finished when the
+    // coroutine is resumed, and the new "foo" should be instrumented.
+    ASSERT_EQ(LUA_OK, lua_resume(coroutine, lua, 0));
+    lua_pop(lua, 1); // (stack empty)
+    ASSERT_EQ(LUA_OK, luaL_dostring(lua, "foo()"));
+    moonClock.StopInstrumentation();
+    EXPECT_EQ(
+        std::vector< std::string >({
+            "before: foo",
+            "before: coroutine.yield",
+            "after: coroutine.yield",
+            "after: foo",
+            "before: foo",
+            "after: foo",
+        }),
+        lines
+    );
+}
+
+TEST_F(Moon_Clock_Tests, Coroutines_Yield_Through_Instrumented_Functions) {
+    MoonClock::MoonClock moonClock;
+    std::shared_ptr< lua_State > sharedLua(
+        lua,
+        [](lua_State*){}
+    );
+    const auto mockClock = std::make_shared< MockClock >();
+    moonClock.SetClock(mockClock);
+    ASSERT_EQ(
+        LUA_OK,
+        luaL_dostring(
+            lua,
+            "function gen()\n"
+            "    coroutine.yield(1)\n"
+            "    coroutine.yield(2)\n"
+            "    return 3\n"
+            "end\n"
+            "function outer()\n"
+            "    local co = coroutine.create(gen)\n"
+            "    local total = 0\n"
+            "    while coroutine.status(co) ~= 'dead' do\n"
+            "        local _, value = coroutine.resume(co)\n"
+            "        total = total + value\n"
+            "    end\n"
+            "    advance(1)\n"
+            "    return total\n"
+            "end\n"
+        )
+    );
+    moonClock.StartInstrumentation(sharedLua);
+    const auto Advance = [](lua_State* lua){
+        auto mockClock = (MockClock*)lua_touserdata(lua, lua_upvalueindex(1));
+        mockClock->time_ += lua_tonumber(lua, 1);
+        return 0;
+    };
+    lua_pushlightuserdata(lua, mockClock.get());
+    lua_pushcclosure(lua, Advance, 1);
+    lua_setglobal(lua, "advance");
+    ASSERT_EQ(LUA_OK, luaL_dostring(lua, "result = outer()"));
+    lua_getglobal(lua, "result"); // -1 = result
+    EXPECT_EQ(6, lua_tointeger(lua, -1));
+    lua_pop(lua, 1); // (stack empty)
+    moonClock.StopInstrumentation();
+    const auto report = moonClock.GenerateReport();
+    EXPECT_EQ(1, report.functionInfo.at({"gen"}).numCalls);
+    EXPECT_EQ(2, report.functionInfo.at({"coroutine", "yield"}).numCalls);
+    EXPECT_EQ(3, report.functionInfo.at({"coroutine", "resume"}).numCalls);
+
+    // Calls made by the coroutine before it yielded shouldn't disturb
+    // the timing of the calls which were still in progress.
+    const auto& outerInfo = report.functionInfo.at({"outer"});
+    EXPECT_EQ(1, outerInfo.numCalls);
+    EXPECT_EQ(1.0, outerInfo.totalTime);
+}
+
+TEST_F(Moon_Clock_Tests, Same_Function_In_Resumer_And_Coroutine) {
+    MoonClock::MoonClock moonClock;
+    std::shared_ptr< lua_State > sharedLua(
+        lua,
+        [](lua_State*){}
+    );
+    const auto mockClock = std::make_shared< MockClock >();
+    moonClock.SetClock(mockClock);
+    ASSERT_EQ(
+        LUA_OK,
+        luaL_dostring(
+            lua,
+            "function work(resume)\n"
+            "    if resume == nil then\n"
+            "        coroutine.yield(5)\n"
+            "        return 0\n"
+            "    end\n"
+            "    advance(1)\n"
+            "    local value = resume()\n"
+            "    advance(1)\n"
+            "    return value\n"
+            "end\n"
+            "function outer()\n"
+            "    return work(coroutine.wrap(work))\n"
+            "end\n"
+        )
+    );
+    moonClock.StartInstrumentation(sharedLua);
+    const auto Advance = [](lua_State* lua){
+        auto mockClock = (MockClock*)lua_touserdata(lua, lua_upvalueindex(1));
+        mockClock->time_ += lua_tonumber(lua, 1);
+        return 0;
+    };
+    lua_pushlightuserdata(lua, mockClock.get());
+    lua_pushcclosure(lua, Advance, 1);
+    lua_setglobal(lua, "advance");
+    ASSERT_EQ(LUA_OK, luaL_dostring(lua, "result = outer()"));
+    lua_getglobal(lua, "result"); // -1 = result
+    EXPECT_EQ(5, lua_tointeger(lua, -1));
+    lua_pop(lua, 1); // (stack empty)
+    moonClock.StopInstrumentation();
+    const auto report = moonClock.GenerateReport();
+
+    // The call to work made by outer is timed, even though the coroutine
+    // calling work (through the wrapper made by coroutine.wrap, which
+    // isn't instrumented) was suspended inside work when it returned.
+    const auto& workInfo = report.functionInfo.at({"work"});
+    EXPECT_EQ(2, workInfo.numCalls);
+    EXPECT_EQ(2.0, workInfo.totalTime);
+    EXPECT_EQ(2.0, workInfo.maxTime);
+    const auto& outerInfo = report.functionInfo.at({"outer"});
+    EXPECT_EQ(2.0, outerInfo.totalTime);
+    EXPECT_EQ(2.0, outerInfo.calls.at({"work"}).totalTime);
+}
+
+TEST_F(Moon_Clock_Tests, Module_Load_Profiling) {
+    MoonClock::MoonClock moonClock;
+    std::shared_ptr< lua_State > sharedLua(
+        lua,
+        [](lua_State*){}
+    );
+    const auto mockClock = std::make_shared< MockClock >();
+    moonClock.SetClock(mockClock);
+    moonClock.SetModuleLoadProfiling(true);
+    mockClock->time_ = 1.0;
+    moonClock.StartInstrumentation(sharedLua);
+    const auto Advance = [](lua_State* lua){
+        auto mockClock = (MockClock*)lua_touserdata(lua, lua_upvalueindex(1));
+        mockClock->time_ += lua_tonumber(lua, 1);
+        return 0;
+    };
+    lua_pushlightuserdata(lua, mockClock.get());
+    lua_pushcclosure(lua, Advance, 1);
+    lua_setglobal(lua, "advance");
+    ASSERT_EQ(
+        LUA_OK,
+        luaL_dostring(
+            lua,
+            "package.preload.inner = function()\n"
+            "    advance(0.25)\n"
+            "    return {fn = function() return 42 end}\n"
+            "end\n"
+            "package.preload.outer = function()\n"
+            "    advance(0.5)\n"
+            "    local inner = require('inner')\n"
+            "    advance(0.125)\n"
+            "    return function() return inner.fn() end\n"
+            "end\n"
+            "local outer = require('outer')\n"
+            "result = outer()\n"
+        )
+    );
+    lua_getglobal(lua, "result"); // -1 = result
+    EXPECT_EQ(42, lua_tointeger(lua, -1));
+    lua_pop(lua, 1); // (stack empty)
+    moonClock.StopInstrumentation();
+    const auto report = moonClock.GenerateReport();
+    ASSERT_EQ(1, report.moduleLoads.size());
+    const auto& outer = report.moduleLoads[0];
+    EXPECT_EQ("outer", outer.name);
+    EXPECT_TRUE(outer.completed);
+    EXPECT_EQ(1.0, outer.start);
+    EXPECT_EQ(0.875, outer.totalTime);
+    EXPECT_EQ(0.625, outer.selfTime);
+    ASSERT_EQ(1, outer.requiredModules.size());
+    const auto& inner = outer.requiredModules[0];
+    EXPECT_EQ("inner", inner.name);
+    EXPECT_TRUE(inner.completed);
+    EXPECT_EQ(1.5, inner.start);
+    EXPECT_EQ(0.25, inner.totalTime);
+    EXPECT_EQ(0.25, inner.selfTime);
+    EXPECT_TRUE(inner.requiredModules.empty());
+    EXPECT_EQ(1, report.functionInfo.count({"require:outer"}));
+    EXPECT_EQ(1, report.functionInfo.count({"require:inner", "fn"}));
+
+    // The searchers should be restored, so modules loaded now
+    // aren't profiled.
+    ASSERT_EQ(
+        LUA_OK,
+        luaL_dostring(
+            lua,
+            "package.preload.later = function() return {} end\n"
+            "require('later')\n"
+        )
+    );
+    EXPECT_EQ(1, moonClock.GenerateReport().moduleLoads.size());
+}
+
+TEST_F(Moon_Clock_Tests, Module_Re_Exporting_Instrumented_Functions) {
+    MoonClock::MoonClock moonClock;
+    std::shared_ptr< lua_State > sharedLua(
+        lua,
+        [](lua_State*){}
+    );
+    moonClock.SetClock(std::make_shared< MockClock >());
+    moonClock.SetModuleLoadProfiling(true);
+    moonClock.StartInstrumentation(sharedLua);
+    ASSERT_EQ(
+        LUA_OK,
+        luaL_dostring(
+            lua,
+            "package.preload.utils = function()\n"
+            "    return {insert = table.insert, own = function() end}\n"
+            "end\n"
+            "package.preload.concat = function()\n"
+            "    return table.concat\n"
+            "end\n"
+            "local utils = require('utils')\n"
+            "local concat = require('concat')\n"
+            "local t = {}\n"
+            "utils.insert(t, 'a')\n"
+            "utils.own()\n"
+            "concat(t)\n"
+        )
+    );
+    moonClock.StopInstrumentation();
+    const auto report = moonClock.GenerateReport();
+
+    // Functions re-exported by modules are counted once, under their
+    // original paths, and not as calls to themselves.
+    ASSERT_EQ(1, report.functionInfo.count({"table", "insert"}));
+    const auto& insert = report.functionInfo.at({"table", "insert"});
+    EXPECT_EQ(1, insert.numCalls);
+    EXPECT_TRUE(insert.calls.empty());
+    EXPECT_EQ(0, report.functionInfo.count({"require:utils", "insert"}));
+    EXPECT_EQ(1, report.functionInfo.count({"require:utils", "own"}));
+    ASSERT_EQ(1, report.functionInfo.count({"table", "concat"}));
+    EXPECT_EQ(1, report.functionInfo.at({"table", "concat"}).numCalls);
+    EXPECT_EQ(0, report.functionInfo.count({"require:concat"}));
+}
+
+TEST_F(Moon_Clock_Tests, Loader_Held_After_Destruction_Calls_Original_Only) {
+    {
+        MoonClock::MoonClock moonClock;
+        std::shared_ptr< lua_State > sharedLua(
+            lua,
+            [](lua_State*){}
+        );
+        moonClock.SetClock(std::make_shared< MockClock >());
+        moonClock.SetModuleLoadProfiling(true);
+        moonClock.StartInstrumentation(sharedLua);
+        ASSERT_EQ(
+            LUA_OK,
+            luaL_dostring(
+                lua,
+                "package.preload.held = function() return {answer = 42} end\n"
+                "loader = package.searchers[1]('held')\n"
+            )
+        );
+        moonClock.StopInstrumentation();
+    }
+    ASSERT_EQ(LUA_OK, luaL_dostring(lua, "result = loader('held').answer"));
+    lua_getglobal(lua, "result"); // -1 = result
+    EXPECT_EQ(42, lua_tointeger(lua, -1));
+    lua_pop(lua, 1); // (stack empty)
+}
+
+TEST_F(Moon_Clock_Tests, Load_Chunk) {
+    MoonClock::MoonClock moonClock;
+    std::shared_ptr< lua_State > sharedLua(
+        lua,
+        [](lua_State*){}
+    );
+    const auto mockClock = std::make_shared< MockClock >();
+    const auto Advance = [](lua_State* lua){
+        auto mockClock = (MockClock*)lua_touserdata(lua, lua_upvalueindex(1));
+        mockClock->time_ += lua_tonumber(lua, 1);
+        return 0;
+    };
+    lua_pushlightuserdata(lua, mockClock.get());
+    lua_pushcclosure(lua, Advance, 1);
+    lua_setglobal(lua, "advance");
+    moonClock.SetClock(mockClock);
+    mockClock->time_ = 1.0;
+    moonClock.StartInstrumentation(sharedLua);
+    const auto info = moonClock.LoadChunk(
+        "startup",
+        (
+            "function helper()\n"
+            "    advance(0.5)\n"
+            "end\n"
+            "helper()\n"
+            "spam = {}\n"
+            "function spam.bar() end\n"
+        )
+    );
+    EXPECT_TRUE(info.succeeded) << info.errorMessage;
+    EXPECT_EQ("startup", info.name);
+    EXPECT_EQ(1.0, info.start);
+    EXPECT_EQ(0.0, info.compileTime);
+    EXPECT_EQ(0.5, info.executionTime);
+    const auto badInfo = moonClock.LoadChunk("bad", "function(");
+    EXPECT_FALSE(badInfo.succeeded);
+    EXPECT_FALSE(badInfo.errorMessage.empty());
+
+    // The table of global variables should have no metatable left behind.
+    lua_pushglobaltable(lua); // -1 = _G
+    EXPECT_EQ(0, lua_getmetatable(lua, -1));
+    lua_pop(lua, 1); // (stack empty)
+
+    // Functions added to tables by the chunk should be picked up
+    // by the rescan after the chunk executed.
+    lua_getglobal(lua, "spam"); // -1 = spam
+    lua_getfield(lua, -1, "bar"); // -1 = spam.bar, -2 = spam
+    lua_call(lua, 0, 0); // -1 = spam
+    lua_pop(lua, 1); // (stack empty)
+    moonClock.StopInstrumentation();
+    const auto report = moonClock.GenerateReport();
+    ASSERT_EQ(2, report.chunkLoads.size());
+    EXPECT_EQ("startup", report.chunkLoads[0].name);
+    EXPECT_EQ("bad", report.chunkLoads[1].name);
+    ASSERT_EQ(1, report.functionInfo.count({"helper"}));
+    EXPECT_EQ(1, report.functionInfo.at({"helper"}).numCalls);
+    EXPECT_EQ(0.5, report.functionInfo.at({"helper"}).totalTime);
+    EXPECT_EQ(1, report.functionInfo.count({"spam", "bar"}));
+}
+
+TEST_F(Moon_Clock_Tests, Merge_Reports) {
+    MoonClock::Report first;
+    first.functionInfo = {
+        {{"foo"}, {1, 0.6, 0.6, 0.6, {{{"bar"}, {2, 0.15}}}}},
+        {{"bar"}, {2, 0.05, 0.15, 0.1, {}}},
+    };
+    first.totalTime = 1.2;
+    first.numSlowCallsDropped = 1;
+    MoonClock::Report second;
+    second.functionInfo = {
+        {{"foo"}, {2, 0.5, 1.2, 0.7, {{{"bar"}, {1, 0.2}}}}},
+        {{"spam"}, {1, 0.3, 0.3, 0.3, {}}},
+    };
+    second.totalTime = 1.5;
+    second.numSlowCallsDropped = 2;
+    const auto merged = MoonClock::MergeReports({first, second});
+    EXPECT_EQ(
+        (std::map< MoonClock::Path, MoonClock::FunctionInformation >({
+            {{"foo"}, {3, 0.5, 1.8, 0.7, {{{"bar"}, {3, 0.35}}}}},
+            {{"bar"}, {2, 0.05, 0.15, 0.1, {}}},
+            {{"spam"}, {1, 0.3, 0.3, 0.3, {}}},
+        })),
+        merged.functionInfo
+    );
+    EXPECT_NEAR(2.7, merged.totalTime, std::numeric_limits< decltype(merged.totalTime) >::epsilon() * 4);
+    EXPECT_EQ(3, merged.numSlowCallsDropped);
+    EXPECT_EQ(
+        (std::map< MoonClock::Path, std::map< MoonClock::Path, MoonClock::CallsInformation > >({
+            {{"bar"}, {{{"foo"}, {3, 0.35}}}},
+        })),
+        merged.callers
+    );
+}
+
+TEST_F(Moon_Clock_Tests, Callers_Index) {
+    MoonClock::Report report;
+    report.functionInfo = {
+        {{"app", "main"}, {1, 1.0, 1.0, 1.0, {{{"db", "query"}, {2, 0.5}}, {{"log"}, {1, 0.1}}}}},
+        {{"app", "worker"}, {3, 0.2, 0.9, 0.4, {{{"db", "query"}, {6, 0.6}}}}},
+        {{"db", "query"}, {8, 0.1, 1.1, 0.2, {{{"log"}, {8, 0.4}}}}},
+        {{"log"}, {9, 0.05, 0.5, 0.06, {}}},
+    };
+    report.callers[{"stale"}][{"entry"}] = {1, 1.0};
+    MoonClock::IndexCallers(report);
+    EXPECT_EQ(
+        (std::map< MoonClock::Path, std::map< MoonClock::Path, MoonClock::CallsInformation > >({
+            {{"db", "query"}, {
+                {{"app", "main"}, {2, 0.5}},
+                {{"app", "worker"}, {6, 0.6}},
+            }},
+            {{"log"}, {
+                {{"app", "main"}, {1, 0.1}},
+                {{"db", "query"}, {8, 0.4}},
+            }},
+        })),
+        report.callers
+    );
+}
+
+TEST_F(Moon_Clock_Tests, Memory_Tracking) {
+    MoonClock::MoonClock moonClock;
+    std::shared_ptr< lua_State > sharedLua(
+        lua,
+        [](lua_State*){}
+    );
+    moonClock.SetMemoryTracking(true);
+    moonClock.StartInstrumentation(sharedLua);
+    void* ud;
+    EXPECT_FALSE(lua_getallocf(lua, &ud) == LuaAllocator);
+    ASSERT_EQ(
+        LUA_OK,
+        luaL_dostring(
+            lua,
+            "local t = {}\n"
+            "for i = 1, 1000 do\n"
+            "    t[i] = {value = tostring(i)}\n"
+            "end\n"
+            "kept = t\n"
+        )
+    );
+    moonClock.StopInstrumentation();
+    EXPECT_TRUE(lua_getallocf(lua, &ud) == LuaAllocator);
+    const auto report = moonClock.GenerateReport();
+    EXPECT_TRUE(report.memory.tracked);
+    EXPECT_GE(report.memory.numAllocations, 2000);
+    EXPECT_GT(report.memory.bytesAllocated, 0);
+    EXPECT_GT(report.memory.endBytes, report.memory.startBytes);
+    EXPECT_GE(report.memory.peakBytes, report.memory.endBytes);
+    EXPECT_EQ(
+        (size_t)lua_gc(lua, LUA_GCCOUNT, 0) * 1024 + (size_t)lua_gc(lua, LUA_GCCOUNTB, 0),
+        report.memory.endBytes
+    );
+}
+
+TEST_F(Moon_Clock_Tests, Per_Function_Allocations_And_Instructions) {
+    MoonClock::MoonClock moonClock;
+    std::shared_ptr< lua_State > sharedLua(
+        lua,
+        [](lua_State*){}
+    );
+    ASSERT_EQ(
+        LUA_OK,
+        luaL_dostring(
+            lua,
+            "function busy()\n"
+            "    local sum = 0\n"
+            "    for i = 1, 1000 do\n"
+            "        sum = sum + i\n"
+            "    end\n"
+            "    return sum\n"
+            "end\n"
+            "function allocating()\n"
+            "    local t = {}\n"
+            "    for i = 1, 100 do\n"
+            "        t[i] = {}\n"
+            "    end\n"
+            "    return t\n"
+            "end\n"
+        )
+    );
+    moonClock.SetMemoryTracking(true);
+    moonClock.SetInstructionCounting(1);
+    moonClock.StartInstrumentation(sharedLua);
+    EXPECT_TRUE(lua_gethook(lua) != NULL);
+    ASSERT_EQ(
+        LUA_OK,
+        luaL_dostring(
+            lua,
+            "busy()\n"
+            "allocating()\n"
+        )
+    );
+    moonClock.StopInstrumentation();
+    EXPECT_TRUE(lua_gethook(lua) == NULL);
+    const auto report = moonClock.GenerateReport();
+    const auto& busy = report.functionInfo.at({"busy"});
+    const auto& allocating = report.functionInfo.at({"allocating"});
+    EXPECT_GE(busy.numInstructions, 1000);
+    EXPECT_LT(busy.numAllocations, 100);
+    EXPECT_GE(allocating.numAllocations, 100);
+    EXPECT_GT(allocating.bytesAllocated, 0);
+    EXPECT_GT(allocating.numInstructions, 0);
+    EXPECT_GE(report.numInstructions, busy.numInstructions + allocating.numInstructions);
+}
+
+TEST_F(Moon_Clock_Tests, Virtual_Clock_Is_Deterministic) {
+    const auto run = [](lua_State* lua){
+        EXPECT_EQ(
+            LUA_OK,
+            luaL_dostring(
+                lua,
+                "function inner(n)\n"
+                "    local t = {}\n"
+                "    for i = 1, n do\n"
+                "        t[i] = tostring(i)\n"
+                "    end\n"
+                "    return #t\n"
+                "end\n"
+                "function outer()\n"
+                "    return inner(10) + inner(100)\n"
+                "end\n"
+            )
+        );
+        MoonClock::MoonClock moonClock;
+        std::shared_ptr< lua_State > sharedLua(
+            lua,
+            [](lua_State*){}
+        );
+        const auto clock = std::make_shared< MoonClock::VirtualClock >(1.0, 10.0);
+        moonClock.UseVirtualClock(clock);
+        moonClock.StartInstrumentation(sharedLua);
+        EXPECT_EQ(LUA_OK, luaL_dostring(lua, "outer()"));
+        moonClock.StopInstrumentation();
+        EXPECT_GT(clock->GetInstructionCount(), 0);
+        EXPECT_GT(clock->GetAllocationCount(), 0);
+        return moonClock.GenerateReport();
+    };
+    const auto firstReport = run(lua);
+    const auto secondLua = lua_newstate(LuaAllocator, NULL);
+    luaL_openlibs(secondLua);
+    const auto secondReport = run(secondLua);
+    lua_close(secondLua);
+    const auto& outer = firstReport.functionInfo.at({"outer"});
+    const auto& inner = firstReport.functionInfo.at({"inner"});
+    EXPECT_GT(outer.totalTime, 0.0);
+    EXPECT_EQ(2, inner.numCalls);
+    EXPECT_LT(inner.minTime, inner.maxTime);
+    EXPECT_EQ(
+        outer.numInstructions + outer.numAllocations * 10.0,
+        outer.totalTime
+    );
+    EXPECT_EQ(firstReport.functionInfo, secondReport.functionInfo);
+}
+
+TEST_F(Moon_Clock_Tests, Critical_Paths) {
+    // Simulated test case:
+    // * "foo" is called twice at the top level.
+    // * The first time, it calls "bar" and then "spam", which calls "eggs".
+    // * The second time, it calls "bar" only.
+    //
+    // time   call                     total time
+    //  1.0   -> foo
+    //  1.1          -> bar
+    //  1.2          <-                0.1
+    //  1.3          -> spam
+    //  1.4                 -> eggs
+    //  1.6                 <-         0.2
+    //  1.7          <-                0.4
+    //  1.8   <-                       0.8
+    //  2.0   -> foo
+    //  2.1          -> bar
+    //  2.4          <-                0.3
+    //  2.5   <-                       0.5
+    //
+    MoonClock::MoonClock moonClock;
+    std::shared_ptr< lua_State > sharedLua(
+        lua,
+        [](lua_State*){}
+    );
+    const auto mockClock = std::make_shared< MockClock >();
+    moonClock.SetClock(mockClock);
+    moonClock.SetCriticalPathTracking(true, 1);
+    moonClock.StartInstrumentation(sharedLua);
+    const auto context = moonClock.GetDefaultContext();
+    struct Event {
+        double time;
+        bool call;
+        MoonClock::Path path;
+    };
+    const std::vector< Event > events{
+        {1.0, true, {"foo"}},
+        {1.1, true, {"bar"}},
+        {1.2, false, {"bar"}},
+        {1.3, true, {"spam"}},
+        {1.4, true, {"eggs"}},
+        {1.6, false, {"eggs"}},
+        {1.7, false, {"spam"}},
+        {1.8, false, {"foo"}},
+        {2.0, true, {"foo"}},
+        {2.1, true, {"bar"}},
+        {2.4, false, {"bar"}},
+        {2.5, false, {"foo"}},
+    };
+    for (const auto& event: events) {
+        mockClock->time_ = event.time;
+        if (event.call) {
+            MoonClock::MoonClock::DefaultBeforeInstrument(lua, context, event.path);
+        } else {
+            MoonClock::MoonClock::DefaultAfterInstrument(lua, context, event.path);
+        }
+    }
+    moonClock.StopInstrumentation();
+    const auto report = moonClock.GenerateReport();
+    const auto tolerance = 1e-9;
+
+    // Only the most recent critical path is kept.
+    EXPECT_EQ(1, report.numCriticalPathsDropped);
+    ASSERT_EQ(1, report.criticalPaths.size());
+    const auto& criticalPath = report.criticalPaths[0];
+    EXPECT_NEAR(2.0, criticalPath.start, tolerance);
+    ASSERT_EQ(2, criticalPath.steps.size());
+    EXPECT_EQ((MoonClock::Path{"foo"}), criticalPath.steps[0].path);
+    EXPECT_NEAR(0.5, criticalPath.steps[0].totalTime, tolerance);
+    EXPECT_EQ((MoonClock::Path{"bar"}), criticalPath.steps[1].path);
+    EXPECT_NEAR(0.3, criticalPath.steps[1].totalTime, tolerance);
+
+    // Functions on all critical paths are counted.
+    const std::map< MoonClock::Path, std::tuple< size_t, double, double > > expectedFunctions{
+        {{"foo"}, std::make_tuple(2, 1.3, 0.6)},
+        {{"bar"}, std::make_tuple(1, 0.3, 0.3)},
+        {{"spam"}, std::make_tuple(1, 0.4, 0.2)},
+        {{"eggs"}, std::make_tuple(1, 0.2, 0.2)},
+    };
+    ASSERT_EQ(expectedFunctions.size(), report.criticalPathFunctions.size());
+    for (const auto& expectedFunction: expectedFunctions) {
+        const auto& functionInfo = report.criticalPathFunctions.at(expectedFunction.first);
+        EXPECT_EQ(std::get< 0 >(expectedFunction.second), functionInfo.numOccurrences);
+        EXPECT_NEAR(std::get< 1 >(expectedFunction.second), functionInfo.totalTime, tolerance);
+        EXPECT_NEAR(std::get< 2 >(expectedFunction.second), functionInfo.selfTime, tolerance);
+    }
+}
+
+TEST_F(Moon_Clock_Tests, Call_Tree) {
+    // Simulated test case:
+    // * "foo" calls "spam", and "bar" calls "spam".
+    // * "foo" is called twice, and "bar" once.
+    //
+    // time   call                     total time
+    //  1.0   -> foo
+    //  1.1          -> spam
+    //  1.2          <-                0.1
+    //  1.3   <-                       0.3
+    //  2.0   -> bar
+    //  2.1          -> spam
+    //  2.4          <-                0.3
+    //  2.5   <-                       0.5
+    //  3.0   -> foo
+    //  3.1          -> spam
+    //  3.3          <-                0.2
+    //  3.4   <-                       0.4
+    //
+    MoonClock::MoonClock moonClock;
+    std::shared_ptr< lua_State > sharedLua(
+        lua,
+        [](lua_State*){}
+    );
+    const auto mockClock = std::make_shared< MockClock >();
+    moonClock.SetClock(mockClock);
+    moonClock.SetCallTreeTracking(true);
+    moonClock.StartInstrumentation(sharedLua);
+    const auto context = moonClock.GetDefaultContext();
+    struct Event {
+        double time;
+        bool call;
+        MoonClock::Path path;
+    };
+    const std::vector< Event > events{
+        {1.0, true, {"foo"}},
+        {1.1, true, {"spam"}},
+        {1.2, false, {"spam"}},
+        {1.3, false, {"foo"}},
+        {2.0, true, {"bar"}},
+        {2.1, true, {"spam"}},
+        {2.4, false, {"spam"}},
+        {2.5, false, {"bar"}},
+        {3.0, true, {"foo"}},
+        {3.1, true, {"spam"}},
+        {3.3, false, {"spam"}},
+        {3.4, false, {"foo"}},
+    };
+    for (const auto& event: events) {
+        mockClock->time_ = event.time;
+        if (event.call) {
+            MoonClock::MoonClock::DefaultBeforeInstrument(lua, context, event.path);
+        } else {
+            MoonClock::MoonClock::DefaultAfterInstrument(lua, context, event.path);
+        }
+    }
+    moonClock.StopInstrumentation();
+    const auto report = moonClock.GenerateReport();
+    const auto tolerance = 1e-9;
+    ASSERT_EQ(5, report.callTree.size());
+    const auto& root = report.callTree[0];
+    EXPECT_TRUE(root.path.empty());
+    ASSERT_EQ(2, root.children.size());
+    const auto& foo = report.callTree[root.children.at({"foo"})];
+    EXPECT_EQ(2, foo.numCalls);
+    EXPECT_NEAR(0.7, foo.totalTime, tolerance);
+    ASSERT_EQ(1, foo.children.size());
+    const auto& fooSpam = report.callTree[foo.children.at({"spam"})];
+    EXPECT_EQ((MoonClock::Path{"spam"}), fooSpam.path);
+    EXPECT_EQ(root.children.at({"foo"}), fooSpam.parent);
+    EXPECT_EQ(2, fooSpam.numCalls);
+    EXPECT_NEAR(0.3, fooSpam.totalTime, tolerance);
+    const auto& bar = report.callTree[root.children.at({"bar"})];
+    EXPECT_EQ(1, bar.numCalls);
+    EXPECT_NEAR(0.5, bar.totalTime, tolerance);
+    const auto& barSpam = report.callTree[bar.children.at({"spam"})];
+    EXPECT_EQ(1, barSpam.numCalls);
+    EXPECT_NEAR(0.3, barSpam.totalTime, tolerance);
+
+    // Call trees of merged reports are merged node by node.
+    const auto merged = MoonClock::MergeReports({report, report});
+    ASSERT_EQ(5, merged.callTree.size());
+    const auto& mergedFoo = merged.callTree[merged.callTree[0].children.at({"foo"})];
+    EXPECT_EQ(4, mergedFoo.numCalls);
+    EXPECT_EQ(4, merged.callTree[mergedFoo.children.at({"spam"})].numCalls);
+}
+
+TEST_F(Moon_Clock_Tests, Function_Sources) {
+    MoonClock::MoonClock moonClock;
+    std::shared_ptr< lua_State > sharedLua(
+        lua,
+        [](lua_State*){}
+    );
+    const std::string script = (
+        "-- first line\n"
+        "function foo()\n"
+        "end\n"
+        "lib = {\n"
+        "    bar = function()\n"
+        "        return 42\n"
+        "    end\n"
+        "}\n"
+    );
+    ASSERT_EQ(
+        LUA_OK,
+        luaL_loadbuffer(lua, script.data(), script.length(), "@script.lua")
+    );
+    ASSERT_EQ(LUA_OK, lua_pcall(lua, 0, 0, 0));
+    moonClock.StartInstrumentation(sharedLua);
+    moonClock.StopInstrumentation();
+    const auto report = moonClock.GenerateReport();
+    const auto& foo = report.sources.at({"foo"});
+    EXPECT_EQ("script.lua", foo.source);
+    EXPECT_EQ(2, foo.lineDefined);
+    EXPECT_EQ(3, foo.lastLineDefined);
+    const auto& bar = report.sources.at({"lib", "bar"});
+    EXPECT_EQ("script.lua", bar.source);
+    EXPECT_EQ(5, bar.lineDefined);
+    EXPECT_EQ(7, bar.lastLineDefined);
+    const auto& print = report.sources.at({"print"});
+    EXPECT_EQ("[C]", print.source);
+    EXPECT_EQ(0, print.lineDefined);
+}
+
+TEST_F(Moon_Clock_Tests, Call_Costs) {
+    MoonClock::MoonClock moonClock;
+    std::shared_ptr< lua_State > sharedLua(
+        lua,
+        [](lua_State*){}
+    );
+    ASSERT_EQ(
+        LUA_OK,
+        luaL_dostring(
+            lua,
+            "function inner()\n"
+            "    local t = {}\n"
+            "    for i = 1, 100 do\n"
+            "        t[i] = {}\n"
+            "    end\n"
+            "    return t\n"
+            "end\n"
+            "function outer()\n"
+            "    inner()\n"
+            "    inner()\n"
+            "end\n"
+        )
+    );
+    moonClock.SetMemoryTracking(true);
+    moonClock.SetInstructionCounting(1);
+    moonClock.StartInstrumentation(sharedLua);
+    ASSERT_EQ(LUA_OK, luaL_dostring(lua, "outer()"));
+    moonClock.StopInstrumentation();
+    const auto report = moonClock.GenerateReport();
+    const auto& inner = report.functionInfo.at({"inner"});
+    const auto& outer = report.functionInfo.at({"outer"});
+    const auto& outerCallsInner = outer.calls.at({"inner"});
+    EXPECT_EQ(2, outerCallsInner.numCalls);
+    EXPECT_EQ(inner.numAllocations, outerCallsInner.numAllocations);
+    EXPECT_EQ(inner.bytesAllocated, outerCallsInner.bytesAllocated);
+    EXPECT_EQ(inner.numInstructions, outerCallsInner.numInstructions);
+    EXPECT_GE(outerCallsInner.numAllocations, 200);
+    EXPECT_LE(outerCallsInner.numAllocations, outer.numAllocations);
+    EXPECT_LE(outerCallsInner.numInstructions, outer.numInstructions);
+}
+
+TEST_F(Moon_Clock_Tests, Latency_Histogram_Buckets) {
+    EXPECT_EQ(0, MoonClock::GetLatencyHistogramBucket(0.0));
+    EXPECT_EQ(0, MoonClock::GetLatencyHistogramBucket(0.5e-6));
+    EXPECT_EQ(1, MoonClock::GetLatencyHistogramBucket(1e-6));
+    EXPECT_EQ(1, MoonClock::GetLatencyHistogramBucket(1.9e-6));
+    EXPECT_EQ(2, MoonClock::GetLatencyHistogramBucket(2e-6));
+    EXPECT_EQ(11, MoonClock::GetLatencyHistogramBucket(1.5e-3));
+    EXPECT_EQ(
+        MoonClock::NUM_LATENCY_HISTOGRAM_BUCKETS - 1,
+        MoonClock::GetLatencyHistogramBucket(1e9)
+    );
+}
+
+TEST_F(Moon_Clock_Tests, Latency_Histograms) {
+    MoonClock::MoonClock moonClock;
+    std::shared_ptr< lua_State > sharedLua(
+        lua,
+        [](lua_State*){}
+    );
+    const auto mockClock = std::make_shared< MockClock >();
+    moonClock.SetClock(mockClock);
+    moonClock.SetLatencyHistograms(true);
+    moonClock.StartInstrumentation(sharedLua);
+    const auto context = moonClock.GetDefaultContext();
+    const std::vector< double > callTimes{1.5e-6, 1.7e-6, 3e-6, 1.5e-3};
+    for (const auto callTime: callTimes) {
+        mockClock->time_ = 1.0;
+        MoonClock::MoonClock::DefaultBeforeInstrument(lua, context, {"foo"});
+        mockClock->time_ = 1.0 + callTime;
+        MoonClock::MoonClock::DefaultAfterInstrument(lua, context, {"foo"});
+    }
+    moonClock.StopInstrumentation();
+    const auto report = moonClock.GenerateReport();
+    std::vector< size_t > expectedHistogram(MoonClock::NUM_LATENCY_HISTOGRAM_BUCKETS);
+    expectedHistogram[1] = 2;
+    expectedHistogram[2] = 1;
+    expectedHistogram[11] = 1;
+    const auto& foo = report.functionInfo.at({"foo"});
+    EXPECT_EQ(expectedHistogram, foo.latencyHistogram);
+    EXPECT_TRUE(report.functionInfo.at({"print"}).latencyHistogram.empty());
+
+    // Histograms of merged reports are added bucket by bucket.
+    const auto merged = MoonClock::MergeReports({report, report});
+    EXPECT_EQ(4, merged.functionInfo.at({"foo"}).latencyHistogram[1]);
+}
+
+#ifndef _WIN32
+TEST_F(Moon_Clock_Tests, Shared_Statistics) {
+    MoonClock::MoonClock moonClock;
+    std::shared_ptr< lua_State > sharedLua(
+        lua,
+        [](lua_State*){}
+    );
+    const auto mockClock = std::make_shared< MockClock >();
+    moonClock.SetClock(mockClock);
+    const auto name = StringExtensions::sprintf(
+        "MoonClockTests-%u-Shared_Statistics",
+        (unsigned int)getpid()
+    );
+    ASSERT_TRUE(moonClock.SetSharedStatistics(name));
+    moonClock.StartInstrumentation(sharedLua);
+    const auto context = moonClock.GetDefaultContext();
+    mockClock->time_ = 1.0;
+    MoonClock::MoonClock::DefaultBeforeInstrument(lua, context, {"lib", "foo"});
+    mockClock->time_ = 1.25;
+    MoonClock::MoonClock::DefaultAfterInstrument(lua, context, {"lib", "foo"});
+
+    // Statistics are published while instrumentation is still running.
+    MoonClock::SharedStatisticsReader reader;
+    std::string errorMessage;
+    ASSERT_TRUE(reader.Open(name, errorMessage)) << errorMessage;
+    auto functions = reader.Read();
+    ASSERT_EQ(1, functions.size());
+    EXPECT_EQ("lib.foo", functions[0].name);
+    EXPECT_EQ(1, functions[0].numCalls);
+    EXPECT_DOUBLE_EQ(0.25, functions[0].totalTime);
+    EXPECT_DOUBLE_EQ(0.25, functions[0].maxTime);
+    mockClock->time_ = 2.0;
+    MoonClock::MoonClock::DefaultBeforeInstrument(lua, context, {"lib", "foo"});
+    mockClock->time_ = 2.5;
+    MoonClock::MoonClock::DefaultAfterInstrument(lua, context, {"lib", "foo"});
+    functions = reader.Read();
+    ASSERT_EQ(1, functions.size());
+    EXPECT_EQ(2, functions[0].numCalls);
+    EXPECT_DOUBLE_EQ(0.75, functions[0].totalTime);
+    EXPECT_DOUBLE_EQ(0.5, functions[0].maxTime);
+    moonClock.StopInstrumentation();
+
+    // Publishing stops, and the segment is removed, when the name is empty.
+    EXPECT_TRUE(moonClock.SetSharedStatistics(""));
+    MoonClock::SharedStatisticsReader lateReader;
+    EXPECT_FALSE(lateReader.Open(name, errorMessage));
+}
+#endif /* not _WIN32 */
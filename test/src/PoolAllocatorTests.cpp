@@ -0,0 +1,132 @@
+/**
+ * @file PoolAllocatorTests.cpp
+ *
+ * This module contains the unit tests of the
+ * MoonClock::PoolAllocator class.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include <gtest/gtest.h>
+#include <MoonClock/PoolAllocator.hpp>
+#include <set>
+#include <stdint.h>
+#include <string.h>
+#include <type_traits>
+#include <vector>
+
+extern "C" {
+#include <lua.h>
+#include <lualib.h>
+#include <lauxlib.h>
+}
+
+TEST(Pool_Allocator_Tests, Allocate_And_Free_Small_Blocks) {
+    MoonClock::PoolAllocator allocator;
+    std::vector< void* > blocks;
+    for (size_t size = 1; size <= MoonClock::PoolAllocator::MAX_POOLED_SIZE; ++size) {
+        const auto block = MoonClock::PoolAllocator::Allocate(&allocator, NULL, LUA_TSTRING, size);
+        ASSERT_FALSE(block == NULL);
+        EXPECT_EQ(0, (uintptr_t)block % MoonClock::PoolAllocator::SIZE_CLASS_GRANULARITY);
+        memset(block, (int)size, size);
+        blocks.push_back(block);
+    }
+    auto statistics = allocator.GetStatistics();
+    EXPECT_EQ(MoonClock::PoolAllocator::MAX_POOLED_SIZE, statistics.numPooledBlocks);
+    EXPECT_EQ(0, statistics.numLargeBlocks);
+    EXPECT_EQ(
+        MoonClock::PoolAllocator::MAX_POOLED_SIZE * (MoonClock::PoolAllocator::MAX_POOLED_SIZE + 1) / 2,
+        statistics.bytesAllocated
+    );
+    EXPECT_EQ(MoonClock::PoolAllocator::SLAB_SIZE, statistics.bytesReserved);
+    EXPECT_EQ(blocks.size(), std::set< void* >(blocks.begin(), blocks.end()).size());
+    for (size_t size = 1; size <= MoonClock::PoolAllocator::MAX_POOLED_SIZE; ++size) {
+        const auto block = (const uint8_t*)blocks[size - 1];
+        for (size_t i = 0; i < size; ++i) {
+            ASSERT_EQ((uint8_t)size, block[i]);
+        }
+        EXPECT_TRUE(MoonClock::PoolAllocator::Allocate(&allocator, blocks[size - 1], size, 0) == NULL);
+    }
+    statistics = allocator.GetStatistics();
+    EXPECT_EQ(0, statistics.numPooledBlocks);
+    EXPECT_EQ(0, statistics.bytesAllocated);
+}
+
+TEST(Pool_Allocator_Tests, Freed_Blocks_Are_Reused) {
+    MoonClock::PoolAllocator allocator;
+    const auto first = MoonClock::PoolAllocator::Allocate(&allocator, NULL, 0, 40);
+    MoonClock::PoolAllocator::Allocate(&allocator, first, 40, 0);
+    const auto second = MoonClock::PoolAllocator::Allocate(&allocator, NULL, 0, 33);
+    EXPECT_EQ(first, second);
+    MoonClock::PoolAllocator::Allocate(&allocator, second, 33, 0);
+}
+
+TEST(Pool_Allocator_Tests, Reallocate_Across_Size_Classes) {
+    MoonClock::PoolAllocator allocator;
+    auto block = (char*)MoonClock::PoolAllocator::Allocate(&allocator, NULL, 0, 10);
+    memcpy(block, "0123456789", 10);
+
+    // Growing within the same size class leaves the block in place.
+    EXPECT_EQ(block, MoonClock::PoolAllocator::Allocate(&allocator, block, 10, 16));
+
+    // Growing into another size class, and then beyond the pools,
+    // moves the block and keeps its contents.
+    block = (char*)MoonClock::PoolAllocator::Allocate(&allocator, block, 16, 100);
+    ASSERT_FALSE(block == NULL);
+    EXPECT_EQ(0, memcmp(block, "0123456789", 10));
+    block = (char*)MoonClock::PoolAllocator::Allocate(&allocator, block, 100, 1000);
+    ASSERT_FALSE(block == NULL);
+    EXPECT_EQ(0, memcmp(block, "0123456789", 10));
+    auto statistics = allocator.GetStatistics();
+    EXPECT_EQ(0, statistics.numPooledBlocks);
+    EXPECT_EQ(1, statistics.numLargeBlocks);
+    EXPECT_EQ(1000, statistics.bytesAllocated);
+
+    // Shrinking back into the pools works too.
+    block = (char*)MoonClock::PoolAllocator::Allocate(&allocator, block, 1000, 20);
+    ASSERT_FALSE(block == NULL);
+    EXPECT_EQ(0, memcmp(block, "0123456789", 10));
+    statistics = allocator.GetStatistics();
+    EXPECT_EQ(1, statistics.numPooledBlocks);
+    EXPECT_EQ(0, statistics.numLargeBlocks);
+    EXPECT_EQ(20, statistics.bytesAllocated);
+    MoonClock::PoolAllocator::Allocate(&allocator, block, 20, 0);
+}
+
+TEST(Pool_Allocator_Tests, Not_Movable) {
+    // Lua interpreters hold a pointer to the allocator they use,
+    // so moving the allocator would leave them with a stale pointer.
+    EXPECT_FALSE(std::is_move_constructible< MoonClock::PoolAllocator >::value);
+    EXPECT_FALSE(std::is_move_assignable< MoonClock::PoolAllocator >::value);
+}
+
+TEST(Pool_Allocator_Tests, Run_Lua_Interpreter) {
+    MoonClock::PoolAllocator allocator;
+    const auto lua = allocator.NewState();
+    ASSERT_FALSE(lua == nullptr);
+    luaL_openlibs(lua);
+    ASSERT_EQ(
+        LUA_OK,
+        luaL_dostring(
+            lua,
+            "local t = {}\n"
+            "for i = 1, 10000 do\n"
+            "    t[i] = {value = tostring(i)}\n"
+            "end\n"
+            "local sum = 0\n"
+            "for i = 1, #t do\n"
+            "    sum = sum + tonumber(t[i].value)\n"
+            "end\n"
+            "result = sum\n"
+        )
+    );
+    lua_getglobal(lua, "result");
+    EXPECT_EQ(50005000, lua_tointeger(lua, -1));
+    lua_pop(lua, 1);
+    EXPECT_GT(allocator.GetStatistics().numPooledBlocks, 0);
+    lua_close(lua);
+    const auto statistics = allocator.GetStatistics();
+    EXPECT_EQ(0, statistics.numPooledBlocks);
+    EXPECT_EQ(0, statistics.numLargeBlocks);
+    EXPECT_EQ(0, statistics.bytesAllocated);
+}
@@ -0,0 +1,228 @@
+/**
+ * @file PprofTests.cpp
+ *
+ * This module contains the unit tests of the function which exports
+ * a MoonClock::Report as a profile in the format used by the pprof tools.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include <gtest/gtest.h>
+#include <map>
+#include <MoonClock/MoonClock.hpp>
+#include <MoonClock/Pprof.hpp>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace {
+
+    /**
+     * This holds one field decoded from a protocol buffer message.
+     */
+    struct Field {
+        /**
+         * This is the value of the field, if it holds an integer.
+         */
+        uint64_t integer = 0;
+
+        /**
+         * This is the value of the field, if it holds a string of bytes,
+         * such as a string or an embedded message.
+         */
+        std::string bytes;
+    };
+
+    /**
+     * Decode a base-128 varint from the given encoding.
+     *
+     * @param[in] encoding
+     *     This is the encoding from which to decode the varint.
+     *
+     * @param[in,out] offset
+     *     This is the position in the encoding of the varint,
+     *     which is moved past the varint.
+     *
+     * @return
+     *     The decoded value is returned.
+     */
+    uint64_t DecodeVarint(const std::string& encoding, size_t& offset) {
+        uint64_t value = 0;
+        int shift = 0;
+        while (offset < encoding.length()) {
+            const auto byte = (uint8_t)encoding[offset++];
+            value |= (uint64_t)(byte & 0x7F) << shift;
+            if ((byte & 0x80) == 0) {
+                break;
+            }
+            shift += 7;
+        }
+        return value;
+    }
+
+    /**
+     * Decode the fields of the given protocol buffer message.  Only the
+     * varint and length-delimited wire types are supported.
+     *
+     * @param[in] encoding
+     *     This is the encoded message.
+     *
+     * @return
+     *     The fields of the message, keyed by field number,
+     *     are returned.
+     */
+    std::map< int, std::vector< Field > > DecodeMessage(const std::string& encoding) {
+        std::map< int, std::vector< Field > > fields;
+        size_t offset = 0;
+        while (offset < encoding.length()) {
+            const auto key = DecodeVarint(encoding, offset);
+            Field field;
+            if ((key & 7) == 0) {
+                field.integer = DecodeVarint(encoding, offset);
+            } else {
+                const auto length = (size_t)DecodeVarint(encoding, offset);
+                field.bytes = encoding.substr(offset, length);
+                offset += length;
+            }
+            fields[(int)(key >> 3)].push_back(field);
+        }
+        return fields;
+    }
+
+    /**
+     * Decode the given packed repeated integer field.
+     *
+     * @param[in] encoding
+     *     This is the encoded field.
+     *
+     * @return
+     *     The values of the field are returned.
+     */
+    std::vector< uint64_t > DecodePacked(const std::string& encoding) {
+        std::vector< uint64_t > values;
+        size_t offset = 0;
+        while (offset < encoding.length()) {
+            values.push_back(DecodeVarint(encoding, offset));
+        }
+        return values;
+    }
+
+    /**
+     * This holds the parts of a decoded profile checked by the tests.
+     */
+    struct DecodedProfile {
+        /**
+         * This holds the string table of the profile.
+         */
+        std::vector< std::string > strings;
+
+        /**
+         * This holds the name of each function, keyed by function ID.
+         */
+        std::map< uint64_t, std::string > functionNames;
+
+        /**
+         * This holds the start line of each function, keyed by function ID.
+         */
+        std::map< uint64_t, uint64_t > functionLines;
+
+        /**
+         * This holds the stack of each sample, as the names of the
+         * functions in it, innermost first, mapped to the values
+         * of the sample.
+         */
+        std::map< std::vector< std::string >, std::vector< uint64_t > > samples;
+    };
+
+    /**
+     * Decode the given profile.  Each location is expected to refer to
+     * the function with the same ID, as EncodePprofProfile does.
+     *
+     * @param[in] encoding
+     *     This is the encoded profile.
+     *
+     * @return
+     *     The decoded profile is returned.
+     */
+    DecodedProfile DecodeProfile(const std::string& encoding) {
+        DecodedProfile profile;
+        auto fields = DecodeMessage(encoding);
+        for (const auto& field: fields[6]) {
+            profile.strings.push_back(field.bytes);
+        }
+        for (const auto& field: fields[5]) {
+            auto function = DecodeMessage(field.bytes);
+            const auto id = function[1].at(0).integer;
+            profile.functionNames[id] = profile.strings.at((size_t)function[2].at(0).integer);
+            profile.functionLines[id] = (function[5].empty() ? 0 : function[5][0].integer);
+        }
+        for (const auto& field: fields[2]) {
+            auto sample = DecodeMessage(field.bytes);
+            std::vector< std::string > stack;
+            for (const auto locationId: DecodePacked(sample[1].at(0).bytes)) {
+                stack.push_back(profile.functionNames.at(locationId));
+            }
+            profile.samples[stack] = DecodePacked(sample[2].at(0).bytes);
+        }
+        return profile;
+    }
+
+}
+
+TEST(Pprof_Tests, Flat_Profile_Without_Call_Tree) {
+    MoonClock::Report report;
+    report.totalTime = 2.0;
+    auto& foo = report.functionInfo[{"foo"}];
+    foo.numCalls = 2;
+    foo.totalTime = 1.5;
+    foo.calls[{"lib", "bar"}].numCalls = 4;
+    foo.calls[{"lib", "bar"}].totalTime = 0.5;
+    auto& bar = report.functionInfo[{"lib", "bar"}];
+    bar.numCalls = 4;
+    bar.totalTime = 0.5;
+    report.sources[{"foo"}].source = "script.lua";
+    report.sources[{"foo"}].lineDefined = 12;
+    const auto profile = DecodeProfile(MoonClock::EncodePprofProfile(report));
+    ASSERT_FALSE(profile.strings.empty());
+    EXPECT_EQ("", profile.strings[0]);
+    EXPECT_EQ(2, profile.functionNames.size());
+    for (const auto& functionName: profile.functionNames) {
+        if (functionName.second == "foo") {
+            EXPECT_EQ(12, profile.functionLines.at(functionName.first));
+        }
+    }
+    ASSERT_EQ(2, profile.samples.size());
+    const auto& fooValues = profile.samples.at({"foo"});
+    ASSERT_EQ(5, fooValues.size());
+    EXPECT_EQ(2, fooValues[0]);
+    EXPECT_EQ(1000000000, fooValues[1]);
+    const auto& barValues = profile.samples.at({"lib.bar"});
+    EXPECT_EQ(4, barValues[0]);
+    EXPECT_EQ(500000000, barValues[1]);
+}
+
+TEST(Pprof_Tests, Stacks_From_Call_Tree) {
+    MoonClock::Report report;
+    report.functionInfo[{"foo"}].numCalls = 1;
+    report.functionInfo[{"bar"}].numCalls = 1;
+    report.callTree.resize(3);
+    report.callTree[0].children[{"foo"}] = 1;
+    report.callTree[1].path = {"foo"};
+    report.callTree[1].numCalls = 1;
+    report.callTree[1].totalTime = 0.75;
+    report.callTree[1].numInstructions = 300;
+    report.callTree[1].children[{"bar"}] = 2;
+    report.callTree[2].path = {"bar"};
+    report.callTree[2].parent = 1;
+    report.callTree[2].numCalls = 1;
+    report.callTree[2].totalTime = 0.25;
+    report.callTree[2].numInstructions = 100;
+    const auto profile = DecodeProfile(MoonClock::EncodePprofProfile(report));
+    ASSERT_EQ(2, profile.samples.size());
+    const auto& fooValues = profile.samples.at({"foo"});
+    EXPECT_EQ(500000000, fooValues[1]);
+    EXPECT_EQ(200, fooValues[4]);
+    const auto& barValues = profile.samples.at({"bar", "foo"});
+    EXPECT_EQ(250000000, barValues[1]);
+    EXPECT_EQ(100, barValues[4]);
+}
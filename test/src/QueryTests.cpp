@@ -0,0 +1,195 @@
+/**
+ * @file QueryTests.cpp
+ *
+ * This module contains the unit tests of the functions which answer
+ * common questions about a MoonClock::Report.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include "TestReport.hpp"
+
+#include <gtest/gtest.h>
+#include <MoonClock/MoonClock.hpp>
+#include <MoonClock/Query.hpp>
+#include <string>
+#include <vector>
+
+namespace {
+
+    /**
+     * Return the names of the functions in the given ranking, in order,
+     * with the keys of each path joined by periods.
+     *
+     * @param[in] ranking
+     *     This is the ranking of functions whose names to return.
+     *
+     * @return
+     *     The names of the functions in the ranking are returned.
+     */
+    std::vector< std::string > Names(const std::vector< MoonClock::RankedFunction >& ranking) {
+        std::vector< std::string > names;
+        for (const auto& rankedFunction: ranking) {
+            std::string name;
+            for (const auto& key: rankedFunction.function->first) {
+                if (!name.empty()) {
+                    name += ".";
+                }
+                name += key;
+            }
+            names.push_back(name);
+        }
+        return names;
+    }
+
+}
+
+TEST(Query_Tests, Self_Time) {
+    const auto report = MakeTestReport();
+    EXPECT_EQ(2.5, MoonClock::GetSelfTime(report.functionInfo.at({"app", "main"})));
+    EXPECT_EQ(3.0, MoonClock::GetSelfTime(report.functionInfo.at({"app", "db", "query"})));
+    EXPECT_EQ(2.0, MoonClock::GetSelfTime(report.functionInfo.at({"app", "db", "connect"})));
+}
+
+TEST(Query_Tests, Self_Costs) {
+    auto report = MakeTestReport();
+    auto& main = report.functionInfo.at({"app", "main"});
+    main.bytesAllocated = 4096;
+    main.numInstructions = 1000;
+    auto& queryCalls = main.calls.at({"app", "db", "query"});
+    queryCalls.numAllocations = 40;
+    queryCalls.bytesAllocated = 1024;
+    queryCalls.numInstructions = 1200;
+    const auto selfCosts = MoonClock::GetSelfCosts(main);
+    EXPECT_EQ(2.5, selfCosts.time);
+    EXPECT_EQ(60, selfCosts.numAllocations);
+    EXPECT_EQ(3072, selfCosts.bytesAllocated);
+    EXPECT_EQ(0, selfCosts.numInstructions);
+}
+
+TEST(Query_Tests, Self_Costs_Of_Call_Tree_Node) {
+    MoonClock::Report report;
+    report.callTree.resize(3);
+    auto& main = report.callTree[1];
+    main.path = {"app", "main"};
+    main.children[{"app", "db", "query"}] = 2;
+    main.numCalls = 1;
+    main.totalTime = 10.0;
+    main.numAllocations = 100;
+    main.bytesAllocated = 4096;
+    main.numInstructions = 1000;
+    report.callTree[0].children[main.path] = 1;
+    auto& query = report.callTree[2];
+    query.path = {"app", "db", "query"};
+    query.parent = 1;
+    query.numCalls = 2;
+    query.totalTime = 6.0;
+    query.numAllocations = 40;
+    query.bytesAllocated = 1024;
+    query.numInstructions = 1200;
+    auto selfCosts = MoonClock::GetSelfCosts(report, 1);
+    EXPECT_EQ(4.0, selfCosts.time);
+    EXPECT_EQ(60, selfCosts.numAllocations);
+    EXPECT_EQ(3072, selfCosts.bytesAllocated);
+    EXPECT_EQ(0, selfCosts.numInstructions);
+    selfCosts = MoonClock::GetSelfCosts(report, 2);
+    EXPECT_EQ(6.0, selfCosts.time);
+    EXPECT_EQ(40, selfCosts.numAllocations);
+}
+
+TEST(Query_Tests, To_Nanoseconds) {
+    EXPECT_EQ(2000000000, MoonClock::ToNanoseconds(2.0));
+    EXPECT_EQ(2, MoonClock::ToNanoseconds(1.6e-9));
+    EXPECT_EQ(0, MoonClock::ToNanoseconds(-1.0));
+}
+
+TEST(Query_Tests, Top_Functions) {
+    const auto report = MakeTestReport();
+    EXPECT_EQ(
+        (std::vector< std::string >{"app.main", "app.db.query"}),
+        Names(MoonClock::GetTopFunctions(report, MoonClock::Metric::TotalTime, 2))
+    );
+    EXPECT_EQ(
+        (std::vector< std::string >{"app.db.query", "app.main", "string.format"}),
+        Names(MoonClock::GetTopFunctions(report, MoonClock::Metric::SelfTime, 3))
+    );
+    EXPECT_EQ(
+        (std::vector< std::string >{"app.dbx", "string.format", "app.db.connect", "app.db.query", "app.main"}),
+        Names(MoonClock::GetTopFunctions(report, MoonClock::Metric::Calls, 100))
+    );
+    EXPECT_EQ(
+        (std::vector< std::string >{"app.main", "string.format"}),
+        Names(MoonClock::GetTopFunctions(report, MoonClock::Metric::Allocations, 2))
+    );
+    EXPECT_EQ(
+        (std::vector< std::string >{"app.db.query"}),
+        Names(MoonClock::GetTopFunctions(report, MoonClock::Metric::TotalTime, 1, {"app", "db"}))
+    );
+    EXPECT_TRUE(MoonClock::GetTopFunctions(report, MoonClock::Metric::TotalTime, 0).empty());
+}
+
+TEST(Query_Tests, Functions_With_Prefix) {
+    const auto report = MakeTestReport();
+    std::vector< MoonClock::Path > paths;
+    for (const auto& function: MoonClock::GetFunctionsWithPrefix(report, {"app", "db"})) {
+        paths.push_back(function.first);
+    }
+    EXPECT_EQ(
+        (std::vector< MoonClock::Path >{
+            {"app", "db", "connect"},
+            {"app", "db", "query"},
+        }),
+        paths
+    );
+    EXPECT_TRUE(MoonClock::GetFunctionsWithPrefix(report, {"math"}).empty());
+    size_t numFunctions = 0;
+    for (const auto& function: MoonClock::GetFunctionsWithPrefix(report, {})) {
+        (void)function;
+        ++numFunctions;
+    }
+    EXPECT_EQ(report.functionInfo.size(), numFunctions);
+}
+
+TEST(Query_Tests, Functions_Matching_And_Filtered) {
+    const auto report = MakeTestReport();
+    const auto matching = MoonClock::GetFunctionsMatching(report, "app.*.query");
+    ASSERT_EQ(1, matching.size());
+    EXPECT_EQ((MoonClock::Path{"app", "db", "query"}), matching[0]->first);
+    const auto filtered = MoonClock::FilterFunctions(
+        report,
+        [](const MoonClock::Path& path, const MoonClock::FunctionInformation& functionInfo){
+            return (functionInfo.numCalls >= 5);
+        }
+    );
+    ASSERT_EQ(2, filtered.size());
+    EXPECT_EQ((MoonClock::Path{"app", "dbx"}), filtered[0]->first);
+    EXPECT_EQ((MoonClock::Path{"string", "format"}), filtered[1]->first);
+    EXPECT_EQ(
+        (std::vector< std::string >{"string.format"}),
+        Names(MoonClock::GetTopFunctions(filtered, MoonClock::Metric::TotalTime, 1))
+    );
+}
+
+TEST(Query_Tests, Roll_Up) {
+    const auto report = MakeTestReport();
+
+    // "app.db.connect" is only called from "app.db.query", so the group is
+    // entered twice, and its time is the time of "app.db.query".
+    auto rollup = MoonClock::RollUp(report, {"app", "db"});
+    EXPECT_EQ(2, rollup.numFunctions);
+    EXPECT_EQ(2, rollup.numCalls);
+    EXPECT_EQ(6.0, rollup.totalTime);
+    EXPECT_EQ(5.0, rollup.selfTime);
+
+    // Everything under "app" is entered once, through "app.main".
+    rollup = MoonClock::RollUp(report, {"app"});
+    EXPECT_EQ(4, rollup.numFunctions);
+    EXPECT_EQ(1 + 7, rollup.numCalls);
+    EXPECT_EQ(10.0 + 0.5, rollup.totalTime);
+    EXPECT_EQ(7.5 + 0.5, rollup.selfTime);
+
+    rollup = MoonClock::RollUp(report, {"string"});
+    EXPECT_EQ(1, rollup.numFunctions);
+    EXPECT_EQ(5, rollup.numCalls);
+    EXPECT_EQ(2.5, rollup.totalTime);
+}
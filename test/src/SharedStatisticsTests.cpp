@@ -0,0 +1,153 @@
+/**
+ * @file SharedStatisticsTests.cpp
+ *
+ * This module contains the unit tests of the
+ * MoonClock::SharedStatisticsWriter and MoonClock::SharedStatisticsReader
+ * classes.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#ifndef _WIN32
+
+#include <gtest/gtest.h>
+#include <MoonClock/SharedStatistics.hpp>
+#include <string>
+#include <StringExtensions/StringExtensions.hpp>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+    /**
+     * Return a name for a shared memory segment which no other
+     * process running the tests will use at the same time.
+     *
+     * @param[in] name
+     *     This distinguishes the segment from others used
+     *     by the same process.
+     *
+     * @return
+     *     The name of the segment is returned.
+     */
+    std::string GetTestSegmentName(const std::string& name) {
+        return StringExtensions::sprintf(
+            "MoonClockTests-%u-%s",
+            (unsigned int)getpid(),
+            name.c_str()
+        );
+    }
+
+}
+
+TEST(Shared_Statistics_Tests, Publish_And_Read) {
+    const auto name = GetTestSegmentName("Publish_And_Read");
+    MoonClock::SharedStatisticsWriter writer;
+    ASSERT_TRUE(writer.Create(name, 4));
+    size_t fooIndex = 99, barIndex = 99, fooIndexAgain = 99;
+    ASSERT_TRUE(writer.FindEntry("foo", fooIndex));
+    ASSERT_TRUE(writer.FindEntry("lib.bar", barIndex));
+    ASSERT_TRUE(writer.FindEntry("foo", fooIndexAgain));
+    EXPECT_EQ(0, fooIndex);
+    EXPECT_EQ(1, barIndex);
+    EXPECT_EQ(fooIndex, fooIndexAgain);
+    MoonClock::SharedFunctionStatistics foo;
+    foo.numCalls = 3;
+    foo.totalTime = 0.5;
+    foo.maxTime = 0.25;
+    foo.numAllocations = 7;
+    foo.bytesAllocated = 1024;
+    foo.numInstructions = 100000;
+    writer.Publish(fooIndex, foo);
+
+    MoonClock::SharedStatisticsReader reader;
+    std::string errorMessage;
+    ASSERT_TRUE(reader.Open(name, errorMessage)) << errorMessage;
+    EXPECT_EQ((unsigned int)getpid(), reader.GetProcessId());
+    auto functions = reader.Read();
+    ASSERT_EQ(2, functions.size());
+    EXPECT_EQ("foo", functions[0].name);
+    EXPECT_EQ(3, functions[0].numCalls);
+    EXPECT_DOUBLE_EQ(0.5, functions[0].totalTime);
+    EXPECT_DOUBLE_EQ(0.25, functions[0].maxTime);
+    EXPECT_EQ(7, functions[0].numAllocations);
+    EXPECT_EQ(1024, functions[0].bytesAllocated);
+    EXPECT_EQ(100000, functions[0].numInstructions);
+    EXPECT_EQ("lib.bar", functions[1].name);
+    EXPECT_EQ(0, functions[1].numCalls);
+
+    // The reader sees statistics published after it opened the segment.
+    foo.numCalls = 4;
+    writer.Publish(fooIndex, foo);
+    functions = reader.Read();
+    ASSERT_EQ(2, functions.size());
+    EXPECT_EQ(4, functions[0].numCalls);
+
+    // The reader can keep reading the segment after the writer removes it,
+    // but the segment can no longer be opened.
+    writer.Close();
+    EXPECT_EQ(2, reader.Read().size());
+    MoonClock::SharedStatisticsReader lateReader;
+    EXPECT_FALSE(lateReader.Open(name, errorMessage));
+}
+
+TEST(Shared_Statistics_Tests, Open_Missing_Segment) {
+    MoonClock::SharedStatisticsReader reader;
+    std::string errorMessage;
+    EXPECT_FALSE(reader.Open(GetTestSegmentName("Missing"), errorMessage));
+    EXPECT_FALSE(errorMessage.empty());
+    EXPECT_EQ(0, reader.GetProcessId());
+    EXPECT_TRUE(reader.Read().empty());
+}
+
+TEST(Shared_Statistics_Tests, Existing_Segment_Not_Replaced) {
+    const auto name = GetTestSegmentName("Existing_Segment_Not_Replaced");
+    MoonClock::SharedStatisticsWriter first;
+    ASSERT_TRUE(first.Create(name, 2));
+    size_t index = 99;
+    ASSERT_TRUE(first.FindEntry("foo", index));
+    MoonClock::SharedStatisticsWriter second;
+    EXPECT_FALSE(second.Create(name, 2));
+
+    // The first writer's segment is still the one readers see.
+    MoonClock::SharedStatisticsReader reader;
+    std::string errorMessage;
+    ASSERT_TRUE(reader.Open(name, errorMessage)) << errorMessage;
+    const auto functions = reader.Read();
+    ASSERT_EQ(1, functions.size());
+    EXPECT_EQ("foo", functions[0].name);
+
+    // Once the first writer removes its segment, the name can be reused.
+    first.Close();
+    EXPECT_TRUE(second.Create(name, 2));
+}
+
+TEST(Shared_Statistics_Tests, Capacity_And_Long_Names) {
+    const auto name = GetTestSegmentName("Capacity_And_Long_Names");
+    MoonClock::SharedStatisticsWriter writer;
+    ASSERT_TRUE(writer.Create("/" + name, 2));
+    const std::string longName(MoonClock::SHARED_STATISTICS_NAME_SIZE * 2, 'x');
+    size_t index;
+    EXPECT_TRUE(writer.FindEntry(longName, index));
+    EXPECT_TRUE(writer.FindEntry("foo", index));
+    EXPECT_FALSE(writer.FindEntry("bar", index));
+    MoonClock::SharedStatisticsReader reader;
+    std::string errorMessage;
+    ASSERT_TRUE(reader.Open(name, errorMessage)) << errorMessage;
+    const auto functions = reader.Read();
+    ASSERT_EQ(2, functions.size());
+    EXPECT_EQ(
+        longName.substr(0, MoonClock::SHARED_STATISTICS_NAME_SIZE - 1),
+        functions[0].name
+    );
+    EXPECT_EQ("foo", functions[1].name);
+}
+
+TEST(Shared_Statistics_Tests, Writer_Without_Segment) {
+    MoonClock::SharedStatisticsWriter writer;
+    size_t index;
+    EXPECT_FALSE(writer.FindEntry("foo", index));
+    writer.Publish(0, MoonClock::SharedFunctionStatistics());
+}
+
+#endif /* not _WIN32 */
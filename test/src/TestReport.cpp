@@ -0,0 +1,48 @@
+/**
+ * @file TestReport.cpp
+ *
+ * This module contains the implementation of the function which makes
+ * the MoonClock::Report shared by the unit tests of the modules which
+ * consume reports.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include "TestReport.hpp"
+
+MoonClock::Report MakeTestReport() {
+    MoonClock::Report report;
+    report.totalTime = 20.0;
+    report.memory.tracked = true;
+    report.numInstructions = 1100;
+    auto& main = report.functionInfo[{"app", "main"}];
+    main.numCalls = 1;
+    main.totalTime = 10.0;
+    main.calls[{"app", "db", "query"}] = MoonClock::CallsInformation(2, 6.0);
+    main.calls[{"string", "format"}] = MoonClock::CallsInformation(3, 1.5);
+    main.numAllocations = 100;
+    main.numInstructions = 1000;
+    auto& query = report.functionInfo[{"app", "db", "query"}];
+    query.numCalls = 2;
+    query.totalTime = 6.0;
+    query.maxTime = 4.0;
+    query.calls[{"app", "db", "connect"}] = MoonClock::CallsInformation(2, 2.0);
+    query.calls[{"string", "format"}] = MoonClock::CallsInformation(2, 1.0);
+    query.numAllocations = 40;
+    query.numInstructions = 500;
+    auto& connect = report.functionInfo[{"app", "db", "connect"}];
+    connect.numCalls = 2;
+    connect.totalTime = 2.0;
+    connect.numAllocations = 10;
+    connect.numInstructions = 100;
+    auto& format = report.functionInfo[{"string", "format"}];
+    format.numCalls = 5;
+    format.totalTime = 2.5;
+    format.numAllocations = 50;
+    format.numInstructions = 250;
+    auto& similar = report.functionInfo[{"app", "dbx"}];
+    similar.numCalls = 7;
+    similar.totalTime = 0.5;
+    similar.numInstructions = 100;
+    return report;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+/**
+ * @file TestReport.hpp
+ *
+ * This module declares the function which makes the MoonClock::Report
+ * shared by the unit tests of the modules which consume reports.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include <MoonClock/MoonClock.hpp>
+
+/**
+ * Make a report for the tests to consume.  The program ran for
+ * 20 seconds, with memory tracked and instructions counted.  In it,
+ * "app.main" calls "app.db.query" twice, which calls "app.db.connect"
+ * once each time, and "string.format" once.  "app.main" also calls
+ * "string.format" three times itself.  "app.dbx" is called seven times
+ * on its own, and makes no allocations.
+ *
+ * @return
+ *     The report made is returned.
+ */
+MoonClock::Report MakeTestReport();
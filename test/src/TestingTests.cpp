@@ -0,0 +1,174 @@
+/**
+ * @file TestingTests.cpp
+ *
+ * This module contains the unit tests of the helpers for Google Test
+ * in the MoonClock::Testing namespace.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include "TestReport.hpp"
+
+#include <gtest/gtest.h>
+#include <MoonClock/MoonClock.hpp>
+#include <MoonClock/Testing.hpp>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+
+namespace {
+
+    /**
+     * This is the path of the baseline file used by the tests.
+     */
+    const std::string BASELINE_PATH = "MoonClockTestingBaseline.txt";
+
+    /**
+     * Set or clear the environment variable which causes MatchesBaseline
+     * to write baseline files.
+     *
+     * @param[in] set
+     *     This indicates whether to set or clear the variable.
+     */
+    void SetUpdateBaselinesVariable(bool set) {
+#ifdef _WIN32
+        (void)_putenv_s(MoonClock::Testing::UPDATE_BASELINES_VARIABLE, set ? "1" : "");
+#else /* not _WIN32 */
+        if (set) {
+            (void)setenv(MoonClock::Testing::UPDATE_BASELINES_VARIABLE, "1", 1);
+        } else {
+            (void)unsetenv(MoonClock::Testing::UPDATE_BASELINES_VARIABLE);
+        }
+#endif /* _WIN32 or not _WIN32 */
+    }
+
+}
+
+/**
+ * This is the common fixture for all tests in this module.
+ */
+struct Testing_Tests
+    : public ::testing::Test
+{
+    // ::testing::Test
+
+    virtual void SetUp() override {
+        SetUpdateBaselinesVariable(false);
+        (void)remove(BASELINE_PATH.c_str());
+    }
+
+    virtual void TearDown() override {
+        (void)remove(BASELINE_PATH.c_str());
+    }
+};
+
+TEST_F(Testing_Tests, Calls_At_Most) {
+    const auto report = MakeTestReport();
+    EXPECT_CALLS_AT_MOST(report, "string.format", 5);
+    EXPECT_CALLS_AT_MOST(report, "app.*", 12);
+    EXPECT_FALSE(MoonClock::Testing::CallsAtMost("", "", "", report, "string.format", 4));
+    EXPECT_FALSE(MoonClock::Testing::CallsAtMost("", "", "", report, "app.*", 11));
+    EXPECT_FALSE(MoonClock::Testing::CallsAtMost("", "", "", report, "app.baz", 100));
+}
+
+TEST_F(Testing_Tests, Allocs_Per_Call_At_Most) {
+    auto report = MakeTestReport();
+    EXPECT_ALLOCS_PER_CALL_AT_MOST(report, "string.format", 10.0);
+    EXPECT_ALLOCS_PER_CALL_AT_MOST(report, "app.dbx", 0.0);
+    EXPECT_FALSE(MoonClock::Testing::AllocsPerCallAtMost("", "", "", report, "string.format", 9.5));
+    report.memory.tracked = false;
+    EXPECT_FALSE(MoonClock::Testing::AllocsPerCallAtMost("", "", "", report, "app.dbx", 100.0));
+}
+
+TEST_F(Testing_Tests, Missing_Baseline_Fails) {
+    const auto report = MakeTestReport();
+    MoonClock::Testing::Tolerance tolerance;
+    EXPECT_FALSE(MoonClock::Testing::MatchesBaseline("", "", "", report, BASELINE_PATH, tolerance));
+    FILE* file = fopen(BASELINE_PATH.c_str(), "r");
+    EXPECT_TRUE(file == NULL);
+    if (file != NULL) {
+        (void)fclose(file);
+    }
+}
+
+TEST_F(Testing_Tests, Update_Baselines_Variable_Writes_Baseline) {
+    const auto report = MakeTestReport();
+    MoonClock::Testing::Tolerance tolerance;
+    SetUpdateBaselinesVariable(true);
+    EXPECT_MATCHES_BASELINE(report, BASELINE_PATH, tolerance);
+    SetUpdateBaselinesVariable(false);
+    FILE* file = fopen(BASELINE_PATH.c_str(), "r");
+    ASSERT_FALSE(file == NULL);
+    (void)fclose(file);
+    EXPECT_MATCHES_BASELINE(report, BASELINE_PATH, tolerance);
+}
+
+TEST_F(Testing_Tests, Baseline_Within_Tolerance) {
+    auto report = MakeTestReport();
+    ASSERT_TRUE(MoonClock::Testing::WriteBaseline(report, BASELINE_PATH));
+    MoonClock::Testing::Tolerance tolerance;
+    tolerance.time = 0.5;
+    tolerance.instructions = 0.1;
+    report.functionInfo[{"string", "format"}].totalTime = 3.5;
+    report.functionInfo[{"string", "format"}].numInstructions = 270;
+    report.functionInfo[{"app", "dbx"}].totalTime = 0.2;
+    EXPECT_MATCHES_BASELINE(report, BASELINE_PATH, tolerance);
+}
+
+TEST_F(Testing_Tests, Baseline_Time_Regression) {
+    auto report = MakeTestReport();
+    ASSERT_TRUE(MoonClock::Testing::WriteBaseline(report, BASELINE_PATH));
+    MoonClock::Testing::Tolerance tolerance;
+    tolerance.time = 0.5;
+    report.functionInfo[{"app", "dbx"}].totalTime = 0.875;
+    EXPECT_FALSE(MoonClock::Testing::MatchesBaseline("", "", "", report, BASELINE_PATH, tolerance));
+}
+
+TEST_F(Testing_Tests, Baseline_Instruction_Regression) {
+    auto report = MakeTestReport();
+    ASSERT_TRUE(MoonClock::Testing::WriteBaseline(report, BASELINE_PATH));
+    MoonClock::Testing::Tolerance tolerance;
+    tolerance.instructions = 0.1;
+    report.functionInfo[{"string", "format"}].numInstructions = 300;
+    EXPECT_FALSE(MoonClock::Testing::MatchesBaseline("", "", "", report, BASELINE_PATH, tolerance));
+
+    // Instruction counts are ignored if instructions weren't counted.
+    report.numInstructions = 0;
+    report.functionInfo[{"string", "format"}].numInstructions = 0;
+    EXPECT_TRUE(MoonClock::Testing::MatchesBaseline("", "", "", report, BASELINE_PATH, tolerance));
+}
+
+TEST_F(Testing_Tests, Baseline_Allocation_Regression) {
+    auto report = MakeTestReport();
+    ASSERT_TRUE(MoonClock::Testing::WriteBaseline(report, BASELINE_PATH));
+    MoonClock::Testing::Tolerance tolerance;
+    tolerance.allocations = 0.1;
+    report.functionInfo[{"string", "format"}].numAllocations = 54;
+    EXPECT_TRUE(MoonClock::Testing::MatchesBaseline("", "", "", report, BASELINE_PATH, tolerance));
+    report.functionInfo[{"string", "format"}].numAllocations = 60;
+    EXPECT_FALSE(MoonClock::Testing::MatchesBaseline("", "", "", report, BASELINE_PATH, tolerance));
+
+    // With a baseline of zero, any allocation is a regression.
+    report.functionInfo[{"string", "format"}].numAllocations = 50;
+    report.functionInfo[{"app", "dbx"}].numAllocations = 1;
+    EXPECT_FALSE(MoonClock::Testing::MatchesBaseline("", "", "", report, BASELINE_PATH, tolerance));
+
+    // Allocations are ignored if memory wasn't tracked.
+    report.memory.tracked = false;
+    EXPECT_TRUE(MoonClock::Testing::MatchesBaseline("", "", "", report, BASELINE_PATH, tolerance));
+}
+
+TEST_F(Testing_Tests, Baseline_Without_Measurements) {
+    auto report = MakeTestReport();
+    report.memory.tracked = false;
+    report.numInstructions = 0;
+    ASSERT_TRUE(MoonClock::Testing::WriteBaseline(report, BASELINE_PATH));
+
+    // Instructions and allocations measured now aren't compared against
+    // a baseline which didn't measure them.
+    report = MakeTestReport();
+    report.functionInfo[{"app", "dbx"}].numAllocations = 100;
+    report.functionInfo[{"app", "dbx"}].numInstructions = 10000;
+    MoonClock::Testing::Tolerance tolerance;
+    EXPECT_TRUE(MoonClock::Testing::MatchesBaseline("", "", "", report, BASELINE_PATH, tolerance));
+}
@@ -0,0 +1,22 @@
+/**
+ * @file VirtualClockTests.cpp
+ *
+ * This module contains the unit tests of the
+ * MoonClock::VirtualClock class.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include <gtest/gtest.h>
+#include <MoonClock/VirtualClock.hpp>
+
+TEST(Virtual_Clock_Tests, Advances_By_Instructions_And_Allocations) {
+    MoonClock::VirtualClock clock(0.5, 2.0);
+    EXPECT_EQ(0.0, clock.GetCurrentTime());
+    clock.CountInstructions(10);
+    EXPECT_EQ(5.0, clock.GetCurrentTime());
+    clock.CountAllocations(3);
+    EXPECT_EQ(11.0, clock.GetCurrentTime());
+    EXPECT_EQ(10, clock.GetInstructionCount());
+    EXPECT_EQ(3, clock.GetAllocationCount());
+}
@@ -0,0 +1,246 @@
+#pragma once
+
+/**
+ * @file Testing.hpp
+ *
+ * This module declares helpers for Google Test which make assertions about
+ * the performance of Lua code, based on MoonClock::Report.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include <gtest/gtest.h>
+#include <MoonClock/MoonClock.hpp>
+#include <stddef.h>
+#include <string>
+
+/**
+ * Expect that the functions matching the given path pattern
+ * (see MoonClock::PathMatchesPattern) were called no more than
+ * the given number of times, in total, in the given report.
+ */
+#define EXPECT_CALLS_AT_MOST(report, pattern, max) \
+    EXPECT_PRED_FORMAT3(::MoonClock::Testing::CallsAtMost, report, pattern, max)
+
+/**
+ * Assert that the functions matching the given path pattern
+ * (see MoonClock::PathMatchesPattern) were called no more than
+ * the given number of times, in total, in the given report.
+ */
+#define ASSERT_CALLS_AT_MOST(report, pattern, max) \
+    ASSERT_PRED_FORMAT3(::MoonClock::Testing::CallsAtMost, report, pattern, max)
+
+/**
+ * Expect that the functions matching the given path pattern
+ * (see MoonClock::PathMatchesPattern) allocated no more than the given
+ * number of blocks of memory per call, on average, in the given report.
+ * Memory tracking must have been enabled when the report was made.
+ */
+#define EXPECT_ALLOCS_PER_CALL_AT_MOST(report, pattern, max) \
+    EXPECT_PRED_FORMAT3(::MoonClock::Testing::AllocsPerCallAtMost, report, pattern, max)
+
+/**
+ * Assert that the functions matching the given path pattern
+ * (see MoonClock::PathMatchesPattern) allocated no more than the given
+ * number of blocks of memory per call, on average, in the given report.
+ * Memory tracking must have been enabled when the report was made.
+ */
+#define ASSERT_ALLOCS_PER_CALL_AT_MOST(report, pattern, max) \
+    ASSERT_PRED_FORMAT3(::MoonClock::Testing::AllocsPerCallAtMost, report, pattern, max)
+
+/**
+ * Expect that no function in the given report performs worse than it did
+ * in the baseline file at the given path, beyond the given tolerance.
+ */
+#define EXPECT_MATCHES_BASELINE(report, baselinePath, tolerance) \
+    EXPECT_PRED_FORMAT3(::MoonClock::Testing::MatchesBaseline, report, baselinePath, tolerance)
+
+/**
+ * Assert that no function in the given report performs worse than it did
+ * in the baseline file at the given path, beyond the given tolerance.
+ */
+#define ASSERT_MATCHES_BASELINE(report, baselinePath, tolerance) \
+    ASSERT_PRED_FORMAT3(::MoonClock::Testing::MatchesBaseline, report, baselinePath, tolerance)
+
+namespace MoonClock {
+
+    namespace Testing {
+
+        /**
+         * This holds how much worse than its baseline a function may
+         * perform before a comparison against the baseline fails.  Each
+         * value is a fraction of the baseline value; for example, 0.1
+         * allows a function to take up to 10% longer than its baseline.
+         * Performing better than the baseline never fails.
+         */
+        struct Tolerance {
+            /**
+             * This is the tolerance for the time per call.
+             */
+            double time = 0.5;
+
+            /**
+             * This is the tolerance for the number of Lua virtual machine
+             * instructions executed per call.
+             */
+            double instructions = 0.05;
+
+            /**
+             * This is the tolerance for the number of blocks of memory
+             * allocated per call.
+             */
+            double allocations = 0.05;
+        };
+
+        /**
+         * This is the name of the environment variable which, if set,
+         * causes MatchesBaseline to write baseline files from the
+         * reports given to it, rather than comparing them.  It's the only
+         * way MatchesBaseline writes baseline files.
+         */
+        constexpr const char* UPDATE_BASELINES_VARIABLE = "MOONCLOCK_UPDATE_BASELINES";
+
+        /**
+         * This is the predicate formatter used by EXPECT_CALLS_AT_MOST
+         * and ASSERT_CALLS_AT_MOST.
+         *
+         * @param[in] reportExpression
+         *     This is the source text of the report argument.
+         *
+         * @param[in] patternExpression
+         *     This is the source text of the pattern argument.
+         *
+         * @param[in] maxExpression
+         *     This is the source text of the max argument.
+         *
+         * @param[in] report
+         *     This is the report to check.
+         *
+         * @param[in] pattern
+         *     This is the pattern matching the paths of the functions
+         *     whose calls are counted.
+         *
+         * @param[in] max
+         *     This is the largest number of calls allowed.
+         *
+         * @return
+         *     The result of the assertion is returned.
+         */
+        ::testing::AssertionResult CallsAtMost(
+            const char* reportExpression,
+            const char* patternExpression,
+            const char* maxExpression,
+            const Report& report,
+            const std::string& pattern,
+            size_t max
+        );
+
+        /**
+         * This is the predicate formatter used by
+         * EXPECT_ALLOCS_PER_CALL_AT_MOST and ASSERT_ALLOCS_PER_CALL_AT_MOST.
+         *
+         * @param[in] reportExpression
+         *     This is the source text of the report argument.
+         *
+         * @param[in] patternExpression
+         *     This is the source text of the pattern argument.
+         *
+         * @param[in] maxExpression
+         *     This is the source text of the max argument.
+         *
+         * @param[in] report
+         *     This is the report to check.
+         *
+         * @param[in] pattern
+         *     This is the pattern matching the paths of the functions
+         *     whose allocations are counted.
+         *
+         * @param[in] max
+         *     This is the largest average number of allocations per call
+         *     allowed.
+         *
+         * @return
+         *     The result of the assertion is returned.
+         */
+        ::testing::AssertionResult AllocsPerCallAtMost(
+            const char* reportExpression,
+            const char* patternExpression,
+            const char* maxExpression,
+            const Report& report,
+            const std::string& pattern,
+            double max
+        );
+
+        /**
+         * Write a baseline file from the given report.  The file is text,
+         * with one line per function, holding the path of the function,
+         * the number of calls, and the average time, number of instructions,
+         * and number of allocations per call, separated by tabs.  A dash
+         * takes the place of the instructions if they weren't counted,
+         * and of the allocations if memory wasn't tracked.
+         *
+         * @param[in] report
+         *     This is the report from which to make the baseline.
+         *
+         * @param[in] baselinePath
+         *     This is the path of the baseline file to write.
+         *
+         * @return
+         *     An indication of whether or not the baseline file
+         *     was written successfully is returned.
+         */
+        bool WriteBaseline(
+            const Report& report,
+            const std::string& baselinePath
+        );
+
+        /**
+         * This is the predicate formatter used by EXPECT_MATCHES_BASELINE
+         * and ASSERT_MATCHES_BASELINE.
+         *
+         * Each function in the baseline file which is also in the report
+         * is compared by its average time per call, by its average number
+         * of instructions per call if instructions were counted for both,
+         * and by its average number of allocations per call if memory was
+         * tracked for both.  A function whose baseline value is zero
+         * regresses if its value is above zero at all.
+         *
+         * If the environment variable named by UPDATE_BASELINES_VARIABLE
+         * is set, the baseline file is written from the report instead,
+         * and the assertion passes.  Otherwise, the assertion fails if
+         * the baseline file can't be read.
+         *
+         * @param[in] reportExpression
+         *     This is the source text of the report argument.
+         *
+         * @param[in] baselinePathExpression
+         *     This is the source text of the baselinePath argument.
+         *
+         * @param[in] toleranceExpression
+         *     This is the source text of the tolerance argument.
+         *
+         * @param[in] report
+         *     This is the report to check.
+         *
+         * @param[in] baselinePath
+         *     This is the path of the baseline file.
+         *
+         * @param[in] tolerance
+         *     This holds how much worse than its baseline a function may
+         *     perform before the assertion fails.
+         *
+         * @return
+         *     The result of the assertion is returned.
+         */
+        ::testing::AssertionResult MatchesBaseline(
+            const char* reportExpression,
+            const char* baselinePathExpression,
+            const char* toleranceExpression,
+            const Report& report,
+            const std::string& baselinePath,
+            const Tolerance& tolerance
+        );
+
+    }
+
+}
@@ -0,0 +1,387 @@
+/**
+ * @file Testing.cpp
+ *
+ * This module contains the implementation of the helpers for Google Test
+ * which make assertions about the performance of Lua code.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <MoonClock/Testing.hpp>
+#include <sstream>
+#include <stdlib.h>
+#include <StringExtensions/StringExtensions.hpp>
+
+namespace {
+
+    /**
+     * This holds the totals of the information collected about
+     * all the functions matching a path pattern.
+     */
+    struct MatchTotals {
+        /**
+         * This is the number of functions matching the pattern.
+         */
+        size_t numFunctions = 0;
+
+        /**
+         * This is the total number of calls to the matching functions.
+         */
+        size_t numCalls = 0;
+
+        /**
+         * This is the total number of blocks of memory allocated
+         * by the matching functions.
+         */
+        size_t numAllocations = 0;
+    };
+
+    /**
+     * Add up the information collected about all the functions in the
+     * given report matching the given path pattern.
+     *
+     * @param[in] report
+     *     This is the report holding the information to add up.
+     *
+     * @param[in] pattern
+     *     This is the pattern matching the paths of the functions
+     *     whose information is added up.
+     *
+     * @return
+     *     The totals of the information collected about the matching
+     *     functions are returned.
+     */
+    MatchTotals AddUpMatches(
+        const MoonClock::Report& report,
+        const std::string& pattern
+    ) {
+        MatchTotals totals;
+        for (const auto& functionInfoEntry: report.functionInfo) {
+            if (!MoonClock::PathMatchesPattern(functionInfoEntry.first, pattern)) {
+                continue;
+            }
+            const auto& functionInfo = functionInfoEntry.second;
+            ++totals.numFunctions;
+            totals.numCalls += functionInfo.numCalls;
+            totals.numAllocations += functionInfo.numAllocations;
+        }
+        return totals;
+    }
+
+    /**
+     * This holds the information about one function read from
+     * a baseline file.
+     */
+    struct BaselineEntry {
+        /**
+         * This is the number of calls to the function.
+         */
+        size_t numCalls = 0;
+
+        /**
+         * This is the average time, in seconds, per call.
+         */
+        double timePerCall = 0.0;
+
+        /**
+         * This is the average number of Lua virtual machine
+         * instructions executed per call, or a negative number
+         * if instructions weren't counted.
+         */
+        double instructionsPerCall = -1.0;
+
+        /**
+         * This is the average number of blocks of memory
+         * allocated per call, or a negative number if memory
+         * wasn't tracked.
+         */
+        double allocationsPerCall = -1.0;
+    };
+
+    /**
+     * This is written in a baseline file in place of a value
+     * which wasn't measured.
+     */
+    const std::string NOT_MEASURED = "-";
+
+    /**
+     * Parse a value read from a baseline file.
+     *
+     * @param[in] field
+     *     This is the field of the baseline file holding the value.
+     *
+     * @return
+     *     The value is returned, or a negative number is returned
+     *     if the value wasn't measured.
+     */
+    double ParseBaselineValue(const std::string& field) {
+        if (field == NOT_MEASURED) {
+            return -1.0;
+        }
+        return strtod(field.c_str(), NULL);
+    }
+
+    /**
+     * Read the baseline file at the given path.
+     *
+     * @param[in] baselinePath
+     *     This is the path of the baseline file to read.
+     *
+     * @param[out] baseline
+     *     This is where to store the information read from the
+     *     baseline file, keyed by the path of each function.
+     *
+     * @return
+     *     An indication of whether or not the baseline file
+     *     could be opened is returned.
+     */
+    bool ReadBaseline(
+        const std::string& baselinePath,
+        std::map< MoonClock::Path, BaselineEntry >& baseline
+    ) {
+        std::ifstream file(baselinePath);
+        if (!file) {
+            return false;
+        }
+        std::string line;
+        while (std::getline(file, line)) {
+            if (
+                line.empty()
+                || (line[0] == '#')
+            ) {
+                continue;
+            }
+            const auto fields = StringExtensions::Split(line, '\t');
+            if (fields.size() < 5) {
+                continue;
+            }
+            BaselineEntry entry;
+            entry.numCalls = (size_t)strtoull(fields[1].c_str(), NULL, 10);
+            entry.timePerCall = strtod(fields[2].c_str(), NULL);
+            entry.instructionsPerCall = ParseBaselineValue(fields[3]);
+            entry.allocationsPerCall = ParseBaselineValue(fields[4]);
+            baseline[StringExtensions::Split(fields[0], '.')] = entry;
+        }
+        return true;
+    }
+
+    /**
+     * Determine whether or not the given value is worse than the given
+     * baseline value, beyond the given tolerance.
+     *
+     * @param[in] value
+     *     This is the value to check.
+     *
+     * @param[in] baselineValue
+     *     This is the baseline value to compare against.
+     *
+     * @param[in] tolerance
+     *     This is the fraction of the baseline value by which the value
+     *     may exceed the baseline value.
+     *
+     * @return
+     *     An indication of whether or not the given value is worse than
+     *     the given baseline value, beyond the given tolerance,
+     *     is returned.  If the baseline value is zero, no tolerance
+     *     can be scaled from it, so any value above zero is worse.
+     */
+    bool IsRegression(
+        double value,
+        double baselineValue,
+        double tolerance
+    ) {
+        if (baselineValue <= 0.0) {
+            return (value > 0.0);
+        }
+        return (value > baselineValue * (1.0 + tolerance));
+    }
+
+}
+
+namespace MoonClock {
+
+    namespace Testing {
+
+        ::testing::AssertionResult CallsAtMost(
+            const char* reportExpression,
+            const char* patternExpression,
+            const char* maxExpression,
+            const Report& report,
+            const std::string& pattern,
+            size_t max
+        ) {
+            const auto totals = AddUpMatches(report, pattern);
+            if (totals.numFunctions == 0) {
+                return ::testing::AssertionFailure()
+                    << "No function in " << reportExpression
+                    << " matches " << patternExpression
+                    << " (\"" << pattern << "\")";
+            }
+            if (totals.numCalls > max) {
+                return ::testing::AssertionFailure()
+                    << "Functions in " << reportExpression
+                    << " matching \"" << pattern << "\" were called "
+                    << totals.numCalls << " times, but at most "
+                    << maxExpression << " (" << max << ") calls are allowed";
+            }
+            return ::testing::AssertionSuccess();
+        }
+
+        ::testing::AssertionResult AllocsPerCallAtMost(
+            const char* reportExpression,
+            const char* patternExpression,
+            const char* maxExpression,
+            const Report& report,
+            const std::string& pattern,
+            double max
+        ) {
+            if (!report.memory.tracked) {
+                return ::testing::AssertionFailure()
+                    << "Memory was not tracked in " << reportExpression;
+            }
+            const auto totals = AddUpMatches(report, pattern);
+            if (totals.numFunctions == 0) {
+                return ::testing::AssertionFailure()
+                    << "No function in " << reportExpression
+                    << " matches " << patternExpression
+                    << " (\"" << pattern << "\")";
+            }
+            if (totals.numCalls == 0) {
+                return ::testing::AssertionSuccess();
+            }
+            const auto allocsPerCall = (double)totals.numAllocations / totals.numCalls;
+            if (allocsPerCall > max) {
+                return ::testing::AssertionFailure()
+                    << "Functions in " << reportExpression
+                    << " matching \"" << pattern << "\" allocated "
+                    << allocsPerCall << " blocks per call ("
+                    << totals.numAllocations << " in "
+                    << totals.numCalls << " calls), but at most "
+                    << maxExpression << " (" << max << ") are allowed";
+            }
+            return ::testing::AssertionSuccess();
+        }
+
+        bool WriteBaseline(
+            const Report& report,
+            const std::string& baselinePath
+        ) {
+            std::ofstream file(baselinePath, std::ios::trunc);
+            if (!file) {
+                return false;
+            }
+            file << "# path\tcalls\ttime/call\tinstructions/call\tallocations/call\n";
+            file << std::setprecision(9);
+            for (const auto& functionInfoEntry: report.functionInfo) {
+                const auto& functionInfo = functionInfoEntry.second;
+                if (functionInfo.numCalls == 0) {
+                    continue;
+                }
+                const auto numCalls = (double)functionInfo.numCalls;
+                file
+                    << StringExtensions::Join(functionInfoEntry.first, ".")
+                    << '\t' << functionInfo.numCalls
+                    << '\t' << (functionInfo.totalTime / numCalls)
+                    << '\t';
+                if (report.numInstructions > 0) {
+                    file << (functionInfo.numInstructions / numCalls);
+                } else {
+                    file << NOT_MEASURED;
+                }
+                file << '\t';
+                if (report.memory.tracked) {
+                    file << (functionInfo.numAllocations / numCalls);
+                } else {
+                    file << NOT_MEASURED;
+                }
+                file << '\n';
+            }
+            return (bool)file;
+        }
+
+        ::testing::AssertionResult MatchesBaseline(
+            const char* reportExpression,
+            const char* baselinePathExpression,
+            const char* toleranceExpression,
+            const Report& report,
+            const std::string& baselinePath,
+            const Tolerance& tolerance
+        ) {
+            if (getenv(UPDATE_BASELINES_VARIABLE) != NULL) {
+                if (!WriteBaseline(report, baselinePath)) {
+                    return ::testing::AssertionFailure()
+                        << "Unable to write baseline file " << baselinePathExpression
+                        << " (\"" << baselinePath << "\")";
+                }
+                return ::testing::AssertionSuccess();
+            }
+            std::map< Path, BaselineEntry > baseline;
+            if (!ReadBaseline(baselinePath, baseline)) {
+                return ::testing::AssertionFailure()
+                    << "Unable to read baseline file " << baselinePathExpression
+                    << " (\"" << baselinePath << "\"); set "
+                    << UPDATE_BASELINES_VARIABLE << " to write it";
+            }
+            std::ostringstream regressions;
+            size_t numRegressions = 0;
+            for (const auto& baselineEntry: baseline) {
+                const auto functionInfoEntry = report.functionInfo.find(baselineEntry.first);
+                if (
+                    (functionInfoEntry == report.functionInfo.end())
+                    || (functionInfoEntry->second.numCalls == 0)
+                ) {
+                    continue;
+                }
+                const auto& functionInfo = functionInfoEntry->second;
+                const auto& expected = baselineEntry.second;
+                const auto numCalls = (double)functionInfo.numCalls;
+                const auto name = StringExtensions::Join(baselineEntry.first, ".");
+                const auto timePerCall = functionInfo.totalTime / numCalls;
+                if (IsRegression(timePerCall, expected.timePerCall, tolerance.time)) {
+                    ++numRegressions;
+                    regressions
+                        << "\n  " << name << ": " << timePerCall
+                        << " seconds per call, baseline " << expected.timePerCall;
+                }
+                const auto instructionsPerCall = functionInfo.numInstructions / numCalls;
+                if (
+                    (report.numInstructions > 0)
+                    && (expected.instructionsPerCall >= 0.0)
+                    && IsRegression(instructionsPerCall, expected.instructionsPerCall, tolerance.instructions)
+                ) {
+                    ++numRegressions;
+                    regressions
+                        << "\n  " << name << ": " << instructionsPerCall
+                        << " instructions per call, baseline " << expected.instructionsPerCall;
+                }
+                const auto allocationsPerCall = functionInfo.numAllocations / numCalls;
+                if (
+                    report.memory.tracked
+                    && (expected.allocationsPerCall >= 0.0)
+                    && IsRegression(allocationsPerCall, expected.allocationsPerCall, tolerance.allocations)
+                ) {
+                    ++numRegressions;
+                    regressions
+                        << "\n  " << name << ": " << allocationsPerCall
+                        << " allocations per call, baseline " << expected.allocationsPerCall;
+                }
+            }
+            if (numRegressions > 0) {
+                return ::testing::AssertionFailure()
+                    << reportExpression << " regressed from baseline "
+                    << baselinePathExpression << " (\"" << baselinePath << "\")"
+                    << " beyond tolerance " << toleranceExpression
+                    << " (time " << tolerance.time
+                    << ", instructions " << tolerance.instructions
+                    << ", allocations " << tolerance.allocations << "):"
+                    << regressions.str();
+            }
+            return ::testing::AssertionSuccess();
+        }
+
+    }
+
+}
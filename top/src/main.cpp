@@ -0,0 +1,645 @@
+/**
+ * @file main.cpp
+ *
+ * This module holds the main() function, which is the entrypoint
+ * to the program.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <errno.h>
+#include <map>
+#include <MoonClock/SharedStatistics.hpp>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <StringExtensions/StringExtensions.hpp>
+#include <sys/ioctl.h>
+#include <sys/select.h>
+#include <termios.h>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+    /**
+     * This is the smallest width of the column of function names.
+     */
+    constexpr size_t MIN_NAME_WIDTH = 16;
+
+    /**
+     * This is the total width of the columns other than the
+     * column of function names, including the spaces between them.
+     */
+    constexpr size_t STATISTICS_WIDTH = 7 * 13;
+
+    /**
+     * This is the number of lines drawn above the table of functions.
+     */
+    constexpr size_t NUM_HEADER_LINES = 4;
+
+    /**
+     * This is set by the signal handler when the program is asked
+     * to stop, such as by the user pressing Ctrl+C.
+     */
+    volatile sig_atomic_t stopRequested = 0;
+
+    /**
+     * These are the statistics by which the functions can be sorted.
+     */
+    enum class SortKey {
+        Name,
+        Calls,
+        CallRate,
+        TotalTime,
+        AverageTime,
+        MaxTime,
+        Allocations,
+        Instructions,
+    };
+
+    /**
+     * This holds the statistics of one function as shown by the program.
+     */
+    struct FunctionRow {
+        /**
+         * These are the statistics read from the shared memory segment.
+         */
+        MoonClock::SharedFunctionStatistics statistics;
+
+        /**
+         * This is the number of calls per second made to the function
+         * since the previous refresh.
+         */
+        double callRate = 0.0;
+    };
+
+    /**
+     * This function prints to the standard error stream information
+     * about how to use this program.
+     */
+    void PrintUsageInformation() {
+        fprintf(
+            stderr,
+            (
+                "Usage: moonclock-top [--interval SECONDS] [--sort KEY] NAME\n"
+                "\n"
+                "Watch the live statistics published by MoonClock in the\n"
+                "POSIX shared memory segment NAME (see the --publish option\n"
+                "of MoonClockTest, or MoonClock::SetSharedStatistics), and\n"
+                "show the functions called, refreshing periodically.\n"
+                "\n"
+                "NAME       Name of the shared memory segment to watch.\n"
+                "\n"
+                "--interval SECONDS\n"
+                "           Refresh every SECONDS seconds (1 by default).\n"
+                "\n"
+                "--sort KEY Sort the functions by KEY, which is one of:\n"
+                "           name, calls, rate, total (the default),\n"
+                "           average, max, allocs, or instructions.\n"
+                "\n"
+                "While running, press one of these keys to sort the functions\n"
+                "by a different statistic: n (name), c (calls), r (rate),\n"
+                "t (total), a (average), m (max), l (allocs), or\n"
+                "i (instructions).  Press q to quit.\n"
+            )
+        );
+    }
+
+    /**
+     * This contains variables set through the operating system environment
+     * or the command-line arguments.
+     */
+    struct Environment {
+        /**
+         * This is the name of the shared memory segment to watch.
+         */
+        std::string segmentName;
+
+        /**
+         * This is the time, in seconds, between refreshes.
+         */
+        double interval = 1.0;
+
+        /**
+         * This is the statistic by which to sort the functions.
+         */
+        SortKey sortKey = SortKey::TotalTime;
+    };
+
+    /**
+     * This maps the name of each statistic given to the --sort option
+     * to the statistic.
+     */
+    const std::map< std::string, SortKey > SORT_KEYS_BY_NAME{
+        {"name", SortKey::Name},
+        {"calls", SortKey::Calls},
+        {"rate", SortKey::CallRate},
+        {"total", SortKey::TotalTime},
+        {"average", SortKey::AverageTime},
+        {"max", SortKey::MaxTime},
+        {"allocs", SortKey::Allocations},
+        {"instructions", SortKey::Instructions},
+    };
+
+    /**
+     * This maps each key which can be pressed to select a statistic
+     * by which to sort the functions to the statistic.
+     */
+    const std::map< char, SortKey > SORT_KEYS_BY_KEY{
+        {'n', SortKey::Name},
+        {'c', SortKey::Calls},
+        {'r', SortKey::CallRate},
+        {'t', SortKey::TotalTime},
+        {'a', SortKey::AverageTime},
+        {'m', SortKey::MaxTime},
+        {'l', SortKey::Allocations},
+        {'i', SortKey::Instructions},
+    };
+
+    /**
+     * This function updates the program environment to incorporate
+     * any applicable command-line arguments.
+     *
+     * @param[in] argc
+     *     This is the number of command-line arguments given to the program.
+     *
+     * @param[in] argv
+     *     This is the array of command-line arguments given to the program.
+     *
+     * @param[in,out] environment
+     *     This is the environment to update.
+     *
+     * @return
+     *     An indication of whether or not the function succeeded is returned.
+     */
+    bool ProcessCommandLineArguments(
+        int argc,
+        char* argv[],
+        Environment& environment
+    ) {
+        std::vector< std::string > positionalArgs;
+        for (int i = 1; i < argc; ++i) {
+            const std::string arg(argv[i]);
+            if (arg == "--interval") {
+                char* end = nullptr;
+                if (++i < argc) {
+                    environment.interval = strtod(argv[i], &end);
+                }
+                if (
+                    (end == nullptr)
+                    || (end == argv[i])
+                    || (*end != '\0')
+                    || !(environment.interval > 0.0)
+                ) {
+                    fprintf(
+                        stderr,
+                        "no number SECONDS > 0 given for --interval\n"
+                    );
+                    return false;
+                }
+                continue;
+            }
+            if (arg == "--sort") {
+                if (++i >= argc) {
+                    fprintf(
+                        stderr,
+                        "no value given for --sort\n"
+                    );
+                    return false;
+                }
+                const auto sortKey = SORT_KEYS_BY_NAME.find(argv[i]);
+                if (sortKey == SORT_KEYS_BY_NAME.end()) {
+                    fprintf(
+                        stderr,
+                        "unknown statistic '%s' given for --sort\n",
+                        argv[i]
+                    );
+                    return false;
+                }
+                environment.sortKey = sortKey->second;
+                continue;
+            }
+            positionalArgs.push_back(arg);
+        }
+        if (positionalArgs.empty()) {
+            fprintf(
+                stderr,
+                "no NAME given\n"
+            );
+            return false;
+        }
+        if (positionalArgs.size() > 1) {
+            fprintf(
+                stderr,
+                "extra arguments given\n"
+            );
+            return false;
+        }
+        environment.segmentName = positionalArgs[0];
+        return true;
+    }
+
+    /**
+     * This function is called when the program is asked to stop.
+     *
+     * @param[in] signalNumber
+     *     This identifies the signal received.
+     */
+    void OnStopSignal(int signalNumber) {
+        (void)signalNumber;
+        stopRequested = 1;
+    }
+
+    /**
+     * This puts the terminal into a mode where each key pressed is given
+     * to the program immediately, without being shown, for as long as the
+     * instance exists, and restores the terminal when the instance is
+     * destroyed.  If the standard input stream isn't a terminal,
+     * it does nothing.
+     */
+    struct TerminalMode {
+        /**
+         * This indicates whether or not the terminal mode was changed.
+         */
+        bool changed = false;
+
+        /**
+         * This holds the terminal mode to restore.
+         */
+        struct termios original;
+
+        /**
+         * This is the constructor of the structure.
+         */
+        TerminalMode() {
+            if (
+                !isatty(STDIN_FILENO)
+                || (tcgetattr(STDIN_FILENO, &original) != 0)
+            ) {
+                return;
+            }
+            auto mode = original;
+            mode.c_lflag &= ~(ICANON | ECHO);
+            mode.c_cc[VMIN] = 0;
+            mode.c_cc[VTIME] = 0;
+            changed = (tcsetattr(STDIN_FILENO, TCSANOW, &mode) == 0);
+        }
+
+        /**
+         * This is the destructor of the structure.
+         */
+        ~TerminalMode() {
+            if (changed) {
+                (void)tcsetattr(STDIN_FILENO, TCSANOW, &original);
+            }
+        }
+    };
+
+    /**
+     * Return the size of the terminal, in characters.
+     *
+     * @param[out] columns
+     *     This is where to store the width of the terminal.
+     *
+     * @param[out] rows
+     *     This is where to store the height of the terminal.
+     */
+    void GetTerminalSize(size_t& columns, size_t& rows) {
+        struct winsize size;
+        if (
+            (ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) == 0)
+            && (size.ws_col > 0)
+            && (size.ws_row > 0)
+        ) {
+            columns = size.ws_col;
+            rows = size.ws_row;
+        } else {
+            columns = 80;
+            rows = 24;
+        }
+    }
+
+    /**
+     * Format the given amount of time for display in a column,
+     * choosing the unit which keeps the number short.
+     *
+     * @param[in] seconds
+     *     This is the amount of time to format, in seconds.
+     *
+     * @return
+     *     The formatted amount of time is returned.
+     */
+    std::string FormatTime(double seconds) {
+        if (seconds >= 1.0) {
+            return StringExtensions::sprintf("%.3f s", seconds);
+        } else if (seconds >= 1e-3) {
+            return StringExtensions::sprintf("%.3f ms", seconds * 1e3);
+        } else if (seconds >= 1e-6) {
+            return StringExtensions::sprintf("%.3f us", seconds * 1e6);
+        } else {
+            return StringExtensions::sprintf("%.0f ns", seconds * 1e9);
+        }
+    }
+
+    /**
+     * Return the average amount of time elapsed during each call
+     * to the function with the given statistics.
+     *
+     * @param[in] statistics
+     *     These are the statistics of the function.
+     *
+     * @return
+     *     The average time per call, in seconds, is returned.
+     */
+    double GetAverageTime(const MoonClock::SharedFunctionStatistics& statistics) {
+        if (statistics.numCalls == 0) {
+            return 0.0;
+        }
+        return statistics.totalTime / statistics.numCalls;
+    }
+
+    /**
+     * Return the value of the given statistic of the given function,
+     * for sorting the functions.
+     *
+     * @param[in] row
+     *     This holds the statistics of the function.
+     *
+     * @param[in] sortKey
+     *     This is the statistic to return.
+     *
+     * @return
+     *     The value of the statistic is returned.
+     */
+    double GetSortValue(const FunctionRow& row, SortKey sortKey) {
+        const auto& statistics = row.statistics;
+        switch (sortKey) {
+            case SortKey::Calls: return (double)statistics.numCalls;
+            case SortKey::CallRate: return row.callRate;
+            case SortKey::TotalTime: return statistics.totalTime;
+            case SortKey::AverageTime: return GetAverageTime(statistics);
+            case SortKey::MaxTime: return statistics.maxTime;
+            case SortKey::Allocations: return (double)statistics.numAllocations;
+            case SortKey::Instructions: return (double)statistics.numInstructions;
+            default: return 0.0;
+        }
+    }
+
+    /**
+     * Sort the given functions by the given statistic, largest first,
+     * or by name if the statistic is the name.
+     *
+     * @param[in,out] rows
+     *     These are the functions to sort.
+     *
+     * @param[in] sortKey
+     *     This is the statistic by which to sort the functions.
+     */
+    void SortRows(std::vector< FunctionRow >& rows, SortKey sortKey) {
+        std::stable_sort(
+            rows.begin(),
+            rows.end(),
+            [sortKey](const FunctionRow& lhs, const FunctionRow& rhs){
+                if (sortKey != SortKey::Name) {
+                    const auto lhsValue = GetSortValue(lhs, sortKey);
+                    const auto rhsValue = GetSortValue(rhs, sortKey);
+                    if (lhsValue != rhsValue) {
+                        return (lhsValue > rhsValue);
+                    }
+                }
+                return (lhs.statistics.name < rhs.statistics.name);
+            }
+        );
+    }
+
+    /**
+     * Return the name of the given statistic, as given to the
+     * --sort option.
+     *
+     * @param[in] sortKey
+     *     This is the statistic whose name to return.
+     *
+     * @return
+     *     The name of the statistic is returned.
+     */
+    std::string GetSortKeyName(SortKey sortKey) {
+        for (const auto& sortKeyEntry: SORT_KEYS_BY_NAME) {
+            if (sortKeyEntry.second == sortKey) {
+                return sortKeyEntry.first;
+            }
+        }
+        return "";
+    }
+
+    /**
+     * Clear the terminal and draw the given functions on it.
+     *
+     * @param[in] environment
+     *     This holds the name of the segment and the sort order.
+     *
+     * @param[in] processId
+     *     This identifies the process publishing the statistics.
+     *
+     * @param[in] rows
+     *     These are the functions to draw, already sorted.
+     */
+    void Draw(
+        const Environment& environment,
+        unsigned int processId,
+        const std::vector< FunctionRow >& rows
+    ) {
+        size_t terminalColumns, terminalRows;
+        GetTerminalSize(terminalColumns, terminalRows);
+        const auto nameWidth = std::max(
+            MIN_NAME_WIDTH,
+            (terminalColumns > STATISTICS_WIDTH + 1)
+            ? terminalColumns - STATISTICS_WIDTH - 1
+            : 0
+        );
+        const auto processRunning = (
+            (kill((pid_t)processId, 0) == 0)
+            || (errno != ESRCH)
+        );
+        std::string screen = "\x1b[H\x1b[2J";
+        screen += StringExtensions::sprintf(
+            "moonclock-top: %s  process %u%s  %zu functions  sorted by %s\n",
+            environment.segmentName.c_str(),
+            processId,
+            processRunning ? "" : " (process exited)",
+            rows.size(),
+            GetSortKeyName(environment.sortKey).c_str()
+        );
+        screen += "keys: n c r t a m l i to sort, q to quit\n\n";
+        screen += StringExtensions::sprintf(
+            "%-*s %12s %12s %12s %12s %12s %12s %12s\n",
+            (int)nameWidth,
+            "Function",
+            "Calls",
+            "Calls/s",
+            "Total",
+            "Average",
+            "Max",
+            "Allocs",
+            "Instructions"
+        );
+        const auto maxRows = (
+            (terminalRows > NUM_HEADER_LINES + 1)
+            ? terminalRows - NUM_HEADER_LINES - 1
+            : 1
+        );
+        for (size_t i = 0; (i < rows.size()) && (i < maxRows); ++i) {
+            const auto& statistics = rows[i].statistics;
+            auto name = statistics.name;
+            if (name.length() > nameWidth) {
+                name = "..." + name.substr(name.length() - nameWidth + 3);
+            }
+            screen += StringExtensions::sprintf(
+                "%-*s %12llu %12.1f %12s %12s %12s %12llu %12llu\n",
+                (int)nameWidth,
+                name.c_str(),
+                (unsigned long long)statistics.numCalls,
+                rows[i].callRate,
+                FormatTime(statistics.totalTime).c_str(),
+                FormatTime(GetAverageTime(statistics)).c_str(),
+                FormatTime(statistics.maxTime).c_str(),
+                (unsigned long long)statistics.numAllocations,
+                (unsigned long long)statistics.numInstructions
+            );
+        }
+        (void)fwrite(screen.data(), 1, screen.length(), stdout);
+        (void)fflush(stdout);
+    }
+
+    /**
+     * Wait for the given amount of time, or until a key is pressed
+     * or the program is asked to stop, and handle any keys pressed.
+     *
+     * @param[in] seconds
+     *     This is the longest time to wait, in seconds.
+     *
+     * @param[in,out] environment
+     *     This holds the sort order, which is changed if a key
+     *     selecting a different statistic is pressed.
+     *
+     * @return
+     *     An indication of whether or not to keep running is returned.
+     */
+    bool WaitForInput(double seconds, Environment& environment) {
+        fd_set readSet;
+        FD_ZERO(&readSet);
+        FD_SET(STDIN_FILENO, &readSet);
+        struct timeval timeout;
+        timeout.tv_sec = (time_t)seconds;
+        timeout.tv_usec = (suseconds_t)((seconds - timeout.tv_sec) * 1e6);
+        const auto result = select(STDIN_FILENO + 1, &readSet, NULL, NULL, &timeout);
+        if (stopRequested) {
+            return false;
+        }
+        if (result <= 0) {
+            return true;
+        }
+        char keys[16];
+        const auto numKeys = read(STDIN_FILENO, keys, sizeof(keys));
+        if (numKeys <= 0) {
+            // The standard input stream was closed or can't be read,
+            // so just wait until the next refresh.
+            FD_ZERO(&readSet);
+            (void)select(0, NULL, NULL, NULL, &timeout);
+            return !stopRequested;
+        }
+        for (ssize_t i = 0; i < numKeys; ++i) {
+            if (keys[i] == 'q') {
+                return false;
+            }
+            const auto sortKey = SORT_KEYS_BY_KEY.find(keys[i]);
+            if (sortKey != SORT_KEYS_BY_KEY.end()) {
+                environment.sortKey = sortKey->second;
+            }
+        }
+        return true;
+    }
+
+}
+
+/**
+ * This function is the entrypoint of the program.
+ * It opens the shared memory segment in which MoonClock publishes
+ * live statistics, and shows them until asked to stop.
+ *
+ * @param[in] argc
+ *     This is the number of command-line arguments given to the program.
+ *
+ * @param[in] argv
+ *     This is the array of command-line arguments given to the program.
+ */
+int main(int argc, char* argv[]) {
+    Environment environment;
+    if (!ProcessCommandLineArguments(argc, argv, environment)) {
+        PrintUsageInformation();
+        return EXIT_FAILURE;
+    }
+    MoonClock::SharedStatisticsReader reader;
+    std::string errorMessage;
+    if (!reader.Open(environment.segmentName, errorMessage)) {
+        fprintf(stderr, "%s\n", errorMessage.c_str());
+        return EXIT_FAILURE;
+    }
+    (void)signal(SIGINT, OnStopSignal);
+    (void)signal(SIGTERM, OnStopSignal);
+    TerminalMode terminalMode;
+    std::map< std::string, uint64_t > lastNumCalls;
+    auto lastRefresh = std::chrono::steady_clock::now();
+    bool firstRefresh = true;
+    std::vector< FunctionRow > rows;
+    for (;;) {
+        // Read the statistics again, working out how many calls were
+        // made to each function per second since the last time.
+        const auto now = std::chrono::steady_clock::now();
+        const auto elapsed = std::chrono::duration< double >(now - lastRefresh).count();
+        lastRefresh = now;
+        rows.clear();
+        for (auto& statistics: reader.Read()) {
+            FunctionRow row;
+            auto& numCalls = lastNumCalls[statistics.name];
+            if (
+                !firstRefresh
+                && (elapsed > 0.0)
+                && (statistics.numCalls >= numCalls)
+            ) {
+                row.callRate = (statistics.numCalls - numCalls) / elapsed;
+            }
+            numCalls = statistics.numCalls;
+            row.statistics = std::move(statistics);
+            rows.push_back(std::move(row));
+        }
+        firstRefresh = false;
+
+        // Show the statistics, and wait until it's time to refresh them,
+        // redrawing right away if the sort order is changed.
+        auto sortKey = environment.sortKey;
+        SortRows(rows, sortKey);
+        Draw(environment, reader.GetProcessId(), rows);
+        const auto deadline = now + std::chrono::duration< double >(environment.interval);
+        for (;;) {
+            const auto remaining = std::chrono::duration< double >(
+                deadline - std::chrono::steady_clock::now()
+            ).count();
+            if (remaining <= 0.0) {
+                break;
+            }
+            if (!WaitForInput(remaining, environment)) {
+                printf("\n");
+                return EXIT_SUCCESS;
+            }
+            if (environment.sortKey != sortKey) {
+                sortKey = environment.sortKey;
+                SortRows(rows, sortKey);
+                Draw(environment, reader.GetProcessId(), rows);
+            }
+        }
+    }
+}